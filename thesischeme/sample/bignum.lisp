@@ -0,0 +1,27 @@
+; bignum benchmark
+;   factorials and binomial coefficients. results that do not fit in a
+;   fixnum become bignums and come back to fixnums when they fit again.
+(set! fact
+ (lambda (n acc)
+   (cond ((< n 1) acc)
+	 (else (fact (- n 1) (* acc n))))))
+
+(set! choose
+ (lambda (n k)
+   (let loop ((i 1) (acc 1))
+     (cond ((< k i) acc)
+	   (else (loop (+ i 1) (/ (* acc (+ (- n i) 1)) i)))))))
+
+(set! repeat
+ (lambda (n)
+   (cond ((< n 1) 0)
+	 (else (fact 1000 1) (repeat (- n 1))))))
+
+(fact 30 1)
+(choose 100 50)
+(/ (fact 100 1) (fact 98 1))
+(repeat 100)
+
+; Karatsuba法で掛けて割り戻す
+(set! big (fact 5000 1))
+(= (/ (* big big) big) big)
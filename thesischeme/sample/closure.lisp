@@ -0,0 +1,29 @@
+; flat closure benchmark
+;   make-handlers returns a list of callbacks. each callback refers to
+;   one variable, so a flat closure keeps just that value instead of
+;   the whole frame (which also holds acc, the rest of the list).
+;   count is assigned by the callbacks, so each callback shares the
+;   binding with its frame through a box.
+(set! make-handlers
+ (lambda (n count acc)
+   (cond ((< n 1) (cons (lambda () count) acc))
+	 (else (make-handlers (- n 1) count
+			      (cons (lambda (x) (set! count (+ count x)) count) acc))))))
+
+; 先頭は最後に作ったcountを読むcallback
+(set! call-all
+ (lambda (hs)
+   (cond ((atom? hs) 0)
+	 (else ((car hs) 1) (call-all (cdr hs))))))
+
+(set! run
+ (lambda (hs)
+   (call-all (cdr hs))
+   ((car hs))))
+
+(set! repeat
+ (lambda (n result)
+   (cond ((< n 1) result)
+	 (else (repeat (- n 1) (run (make-handlers 2000 0 '())))))))
+
+(repeat 100 0)
@@ -0,0 +1,34 @@
+; call/cc benchmark: early exit
+;   product of a list, leaving a deep non-tail recursion at the first 0.
+;   call/ec only remembers the stack depth, call/cc seals the stack.
+(set! product-loop
+ (lambda (lst break)
+   (cond ((atom? lst) 1)
+	 ((< (car lst) 1) (break 0))
+	 (else (* (car lst) (product-loop (cdr lst) break))))))
+
+(set! product/ec
+ (lambda (lst)
+   (call/ec (lambda (break) (product-loop lst break)))))
+
+(set! product/cc
+ (lambda (lst)
+   (call/cc (lambda (break) (product-loop lst break)))))
+
+(set! ones
+ (lambda (n acc)
+   (cond ((< n 1) acc)
+	 (else (ones (- n 1) (cons 1 acc))))))
+
+(set! data (ones 2000 '(0)))
+
+(set! repeat
+ (lambda (n thunk)
+   (cond ((< n 1) #t)
+	 (else (thunk) (repeat (- n 1) thunk)))))
+
+(repeat 500 (lambda () (product/ec data)))
+(repeat 500 (lambda () (product/cc data)))
+(product/ec data)
+(product/cc data)
+(exit 0)
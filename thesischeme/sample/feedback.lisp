@@ -0,0 +1,23 @@
+; type feedback
+;   the call sites inside a lambda record which procedures they called and
+;   the types of the operands of arithmetic. (+ a b) runs the integer-only
+;   binary version until a non-integer turns up, then falls back to the
+;   generic one for good.
+(set! sum
+ (lambda (lst acc)
+   (cond ((atom? lst) acc)
+	 (else (sum (cdr lst) (+ acc (car lst)))))))
+
+(set! apply-all
+ (lambda (f lst)
+   (cond ((atom? lst) '())
+	 (else (cons (f (car lst)) (apply-all f (cdr lst)))))))
+
+(sum '(1 2 3 4 5) 0)
+(apply-all (lambda (x) (* x x)) '(1 2 3))
+
+; 整数以外を渡すとerrorになり、以後の(+ acc (car lst))は汎用の+を呼ぶ
+(sum '(1 a 3) 0)
+(sum '(10 20) 0)
+
+(type-feedback)
@@ -0,0 +1,28 @@
+; flonum benchmark
+;   numerical integration and Newton's method. most results are
+;   immediate and do not allocate a cell.
+(set! integrate
+ (lambda (f a b n)
+   (let ((h (/ (- b a) n)))
+     (let loop ((i 0) (x a) (sum 0.0))
+       (cond ((= i n) (* sum h))
+	     (else (loop (+ i 1) (+ x h) (+ sum (f (+ x (* h 0.5)))))))))))
+
+(set! square-root
+ (lambda (a)
+   (let loop ((x a) (i 0))
+     (cond ((= i 30) x)
+	   (else (loop (* 0.5 (+ x (/ a x))) (+ i 1)))))))
+
+(integrate (lambda (x) (* x x)) 0.0 1.0 100000)
+(square-root 2.0)
+(square-root 1e10)
+(* 4.0 (integrate (lambda (x) (/ 1.0 (+ 1.0 (* x x)))) 0.0 1.0 100000))
+
+; 読み戻すと同じ値になる最短の桁で表示する
+(+ 0.1 0.2)
+1e21
+(exact->inexact (/ (* 1000000000000 1000000000000) 3))
+(inexact->exact 1e20)
+(- 0.0)
+(type-feedback)
@@ -0,0 +1,46 @@
+; call/cc benchmark: generator
+;   a generator walks a list and returns one element per call.
+;   every element costs two captures and two re-entries.
+(set! walk
+ (lambda (f lst)
+   (cond ((atom? lst) #t)
+	 (else (f (car lst))
+	       (walk f (cdr lst))))))
+
+(set! make-generator
+ (lambda (lst)
+   ((lambda (return resume)
+      (set! resume
+	    (lambda (dummy)
+	      (walk (lambda (x)
+		      (call/cc (lambda (k)
+				 (set! resume k)
+				 (return x))))
+		    lst)
+	      (return 'done)))
+      (lambda ()
+	(call/cc (lambda (k)
+		   (set! return k)
+		   (resume #f)))))
+    #f #f)))
+
+(set! iota
+ (lambda (n acc)
+   (cond ((< n 1) acc)
+	 (else (iota (- n 1) (cons n acc))))))
+
+(set! sum-generator
+ (lambda (g acc)
+   ((lambda (x)
+      (cond ((eq? x 'done) acc)
+	    (else (sum-generator g (+ acc x)))))
+    (g))))
+
+(set! repeat
+ (lambda (n thunk)
+   (cond ((< n 1) #t)
+	 (else (thunk) (repeat (- n 1) thunk)))))
+
+(repeat 20 (lambda () (sum-generator (make-generator (iota 10000 '())) 0)))
+(sum-generator (make-generator (iota 10000 '())) 0)
+(exit 0)
@@ -0,0 +1,40 @@
+; persistent maps and sets (hash array mapped trie)
+;   updates return a new map that shares everything but the changed
+;   path with the old one. keys are compared with equal?.
+(set! v1 (pmap 'apple 1 'banana 2))
+(set! v2 (pmap-set v1 'cherry 3))
+(set! v3 (pmap-delete v2 'apple))
+(pmap-ref v1 'cherry 'none)
+(pmap-ref v2 'cherry)
+(pmap-contains? v3 'apple)
+(pmap-size v1)
+(pmap-size v2)
+(pmap-size v3)
+(pmap-ref (pmap-update v2 'apple (lambda (n) (+ n 10)) 0) 'apple)
+(pmap-ref (pmap '(1 2) "one-two") (cons 1 (cons 2 '())))
+
+; 一度に沢山入れるときはtransientにすると、作ったnodeをその場で書き換える
+(set! t (pmap-transient v1))
+(let loop ((i 0))
+  (cond ((< i 10000)
+         (pmap-set! t i (* i i))
+         (loop (+ i 1)))))
+(set! big (pmap-persistent! t))
+(pmap-size big)
+(pmap-ref big 9999)
+(pmap-size v1)
+
+; 古い版はそのまま残る
+(set! smaller
+ (let loop ((i 0) (m big))
+   (cond ((< i 5000) (loop (+ i 1) (pmap-delete m i)))
+         (else m))))
+(pmap-size smaller)
+(pmap-contains? smaller 10)
+(pmap-contains? big 10)
+
+(set! s (pset 'a 'b 'c))
+(pset-contains? (pset-add s 'd) 'd)
+(pset-contains? s 'd)
+(pset-size (pset-remove s 'a))
+(pset-size (list->pset '(1 2 2 3 3 3)))
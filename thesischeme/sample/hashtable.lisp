@@ -0,0 +1,35 @@
+; hash tables (SRFI-69)
+;   open addressing in C. keys are compared with eq?, eqv?, equal?
+;   or string=?, and the table doubles when it gets 3/4 full.
+(set! h (make-hash-table eq?))
+(hash-table-set! h 'apple 1)
+(hash-table-set! h 'banana 2)
+(hash-table-ref h 'apple)
+(hash-table-ref/default h 'cherry 0)
+(hash-table-update!/default h 'cherry (lambda (n) (+ n 1)) 0)
+(hash-table-ref h 'cherry)
+(hash-table-delete! h 'banana)
+(hash-table-exists? h 'banana)
+(hash-table-size h)
+
+; equal?の表はlistや文字列の中身で引ける
+(set! e (make-hash-table equal?))
+(hash-table-set! e '(1 2) "one-two")
+(hash-table-set! e "key" 'string-key)
+(hash-table-ref e (cons 1 (cons 2 '())))
+(hash-table-ref e (string-append "k" "ey"))
+
+; メモ化
+(set! memo (make-hash-table eqv?))
+(set! fib
+ (lambda (n)
+   (if (< n 2)
+       n
+       (let ((v (hash-table-ref/default memo n #f)))
+	 (if v
+	     v
+	     (let ((r (+ (fib (- n 1)) (fib (- n 2)))))
+	       (hash-table-set! memo n r)
+	       r))))))
+(fib 100)
+(hash-table-size memo)
@@ -0,0 +1,32 @@
+; inlining benchmark
+;   a point is (x . y). the accessors are small global procedures which
+;   the optimizer inlines into sum-points; redefining point-x afterwards
+;   puts the original call back.
+(set! point-x (lambda (p) (car p)))
+(set! point-y (lambda (p) (cdr p)))
+(set! make-point (lambda (x y) (cons x y)))
+(set! add-point
+ (lambda (a b)
+   (make-point (+ (point-x a) (point-x b)) (+ (point-y a) (point-y b)))))
+
+(set! points
+ (lambda (n acc)
+   (cond ((< n 1) acc)
+	 (else (points (- n 1) (cons (make-point n 1) acc))))))
+
+(set! sum-points
+ (lambda (lst acc)
+   (cond ((atom? lst) acc)
+	 (else (sum-points (cdr lst) (add-point acc (car lst)))))))
+
+(set! repeat
+ (lambda (n lst result)
+   (cond ((< n 1) result)
+	 (else (repeat (- n 1) lst (sum-points lst (make-point 0 0)))))))
+
+(set! data (points 1000 '()))
+(repeat 200 data '())
+
+; 以後の呼び出しはpoint-xを呼ぶ
+(set! point-x (lambda (p) (cdr p)))
+(repeat 1 data '())
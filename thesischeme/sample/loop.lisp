@@ -0,0 +1,17 @@
+; let, let*, letrec, named let, do
+;   named letとdoの末尾の自己呼び出しはenv stack上の同じ場所に
+;   frameを作り直すだけで、整数もimmediateなので繰り返しの度にheapを使わない
+(let ((x 1) (y 2)) (+ x y))
+(let* ((x 1) (y (+ x 1))) (* x y))
+(letrec ((even? (lambda (n) (cond ((< n 1) #t) (else (odd? (- n 1))))))
+	 (odd? (lambda (n) (cond ((< n 1) #f) (else (even? (- n 1)))))))
+  (even? 1000))
+
+(set! sum
+ (lambda (n)
+   (let loop ((i 0) (s 0))
+     (cond ((< i n) (loop (+ i 1) (+ s i)))
+	   (else s)))))
+(sum 10000)
+
+(do ((i 0 (+ i 1))) ((< 9999999 i) i))
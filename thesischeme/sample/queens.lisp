@@ -0,0 +1,31 @@
+; N-Queens benchmark
+;   columns and diagonals already taken are kept in vectors,
+;   so each check is a constant time vector-ref.
+(set! queens
+ (lambda (n)
+   (let ((col (make-vector n #f))
+	 (up (make-vector (* 2 n) #f))
+	 (down (make-vector (* 2 n) #f)))
+     (let place ((r 0))
+       (if (= r n)
+	   1
+	   (let loop ((c 0) (count 0))
+	     (cond ((= c n) count)
+		   ((or (vector-ref col c)
+			(vector-ref up (+ r c))
+			(vector-ref down (+ (- r c) n)))
+		    (loop (+ c 1) count))
+		   (else
+		    (vector-set! col c #t)
+		    (vector-set! up (+ r c) #t)
+		    (vector-set! down (+ (- r c) n) #t)
+		    (let ((k (place (+ r 1))))
+		      (vector-set! col c #f)
+		      (vector-set! up (+ r c) #f)
+		      (vector-set! down (+ (- r c) n) #f)
+		      (loop (+ c 1) (+ count k)))))))))))
+
+(queens 6)
+(queens 8)
+(queens 9)
+#(1 #(2 3) (4 . 5))
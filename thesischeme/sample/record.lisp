@@ -0,0 +1,35 @@
+; records (define-record-type)
+;   a record is a cell with contiguous slots. calls of the accessors
+;   and modifiers are a type check and a slot access in the evaluator
+;   and in compiled code, so they cost about as much as car.
+(define-record-type <point> (make-point x y) point?
+  (x point-x set-point-x!)
+  (y point-y))
+(set! p (make-point 3 4))
+p
+(point? p)
+(point? (cons 3 4))
+(point-x p)
+(set-point-x! p 10)
+(point-x p)
+
+; 構造をalistで表すとfieldを読む度にassqで探す
+(set! add-point
+ (lambda (a b)
+   (make-point (+ (point-x a) (point-x b)) (+ (point-y a) (point-y b)))))
+(set! sum-points
+ (lambda (n acc)
+   (cond ((< n 1) acc)
+	 (else (sum-points (- n 1) (add-point acc (make-point n 1)))))))
+(sum-points 100000 (make-point 0 0))
+
+; constructorが取らないfieldは#f
+(define-record-type node (make-node value) node?
+  (value node-value)
+  (next node-next set-node-next!))
+(set! n (make-node 'a))
+(node-next n)
+(set-node-next! n (make-node 'b))
+(node-value (node-next n))
+(map point-y (cons (make-point 1 2) (cons (make-point 3 4) '())))
+(node-value p)
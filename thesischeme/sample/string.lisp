@@ -0,0 +1,42 @@
+; strings and characters
+;   strings are length-prefixed UTF-8. string-append builds ropes and
+;   substring returns views, so neither copies long strings.
+(set! s "héllo, λ world")
+(string-length s)
+(string-ref s 7)
+(substring s 7 14)
+(string->list "aλ日")
+(list->string (string->list "abc"))
+
+; 繰り返し連結してもropeなので毎回は写さない
+(set! repeat
+ (lambda (str n)
+   (let loop ((i 0) (acc ""))
+     (cond ((= i n) acc)
+	   (else (loop (+ i 1) (string-append acc str)))))))
+(set! long (repeat "0123456789" 1000))
+(string-length long)
+(string-ref long 9999)
+(string-length (substring long 100 9000))
+
+; 共有している中身は書き換える前に写す
+(set! base (make-string 100 #\a))
+(set! joined (string-append base base))
+(string-set! base 0 #\λ)
+(string-ref base 0)
+(string-ref joined 0)
+; 表示で潰す前のropeでも同じ
+(let ((rope (string-append base base)))
+  (string-set! base 1 #\b)
+  (string-ref rope 1))
+
+(eq? (string->symbol (symbol->string 'foo)) 'foo)
+(string->symbol "with space")
+(string->number "1.5e3")
+(number->string 12345678901234567890)
+(string<? "apple" "banana")
+(char->integer #\λ)
+(write "tab\tquote\"nul\x0;")
+(newline)
+(display "done")
+(newline)
@@ -0,0 +1,20 @@
+; tail calls: if, and, or, cond =>, apply, eval
+;   a state machine of mutually recursive procedures. every call is in
+;   tail position, so it runs in constant control stack.
+(set! state-a
+ (lambda (n)
+   (if (< n 1)
+       'a
+       (state-b (- n 1)))))
+(set! state-b
+ (lambda (n)
+   (and (< -1 n)
+	(or (< n 0)
+	    (cond ((< n 1) 'b)
+		  (else (apply state-c (cons (- n 1) '()))))))))
+(set! state-c
+ (lambda (n)
+   (cond (n => state-a))))
+(state-a 1000000)
+
+(map (lambda (n) (state-a n)) '(0 1 2 3 4 5))
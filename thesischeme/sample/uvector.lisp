@@ -0,0 +1,29 @@
+; homogeneous numeric vectors (SRFI-4)
+;   elements are raw C arrays. whole-vector operations run in
+;   vectorised kernels (simd.c) instead of one call per element.
+(simd-level)
+
+(set! a (f64vector 0.5 1.5 2.5))
+(set! b (list->f64vector '(1 2 3)))
+(uvector-dot a b)
+(uvector-sum (uvector-mul b b))
+(uvector-max b)
+
+; 中点の列をまとめて作ってから二乗の平均を取る
+(set! midpoints
+ (lambda (n)
+   (let ((xs (make-f64vector n)))
+     (let loop ((i 0))
+       (cond ((= i n) xs)
+	     (else (f64vector-set! xs i (/ (+ i 0.5) n))
+		   (loop (+ i 1))))))))
+(set! mean-square
+ (lambda (xs)
+   (/ (uvector-dot xs xs) (f64vector-length xs))))
+(mean-square (midpoints 10000))
+
+; 整数の和は溢れない. 要素ごとの和は型の幅で回る
+(uvector-sum (make-u8vector 100000 255))
+(uvector-dot #s32(2147483647 -2147483648) #s32(2147483647 -2147483648))
+(uvector-sum #s64(9223372036854775807 1))
+(uvector-add #u8(250 10) #u8(10 10))
@@ -6,6 +6,9 @@
 
 #include <stdint.h>
 #include <setjmp.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
 
 #include "scheme.h"
 
@@ -13,42 +16,69 @@
   File Local Utility Macro Definitions
 ==================================================*/
 /* cell constructor */
+/* free cellとpageの管理用のcellはobject.consの2 wordを使う */
+#define CELL_CAR(obj) ((obj)->object.cons.car)
+#define CELL_CDR(obj) ((obj)->object.cons.cdr)
+
 #define FREE_CELL_CONSTRUCT(obj, kar, kdr)  \
   do {                                      \
     HEADER_TYPE(obj) = CELL_TYPE_FREE;      \
-    CAR(obj) = kar;                         \
-    CDR(obj) = kdr;                         \
+    CELL_CAR(obj) = kar;                    \
+    CELL_CDR(obj) = kdr;                    \
+  } while (0)
+
+#define BIGNUM_CONSTRUCT(obj, digits, length, negative)          \
+  do {                                                          \
+    HEADER_TYPE(obj) = CELL_TYPE_BIGNUM;                        \
+    HEADER_FLAG(obj) = (negative) ? BIGNUM_FLAG_NEGATIVE : 0;   \
+    BIGNUM_DIGITS(obj) = digits;                                \
+    BIGNUM_LENGTH(obj) = length;                                \
+  } while (0)
+
+#define FLONUM_CONSTRUCT(obj, value)     \
+  do {                                   \
+    HEADER_TYPE(obj) = CELL_TYPE_FLONUM; \
+    HEAP_FLONUM_VALUE(obj) = value;      \
   } while (0)
 
-#define CONS_CONSTRUCT(obj, kar, kdr)  \
-  do {                                 \
-    HEADER_TYPE(obj) = CELL_TYPE_CONS; \
-    CAR(obj) = kar;                    \
-    CDR(obj) = kdr;                    \
+#define VECTOR_CONSTRUCT(obj, elements, length) \
+  do {                                          \
+    HEADER_TYPE(obj) = CELL_TYPE_VECTOR;        \
+    VECTOR_ELEMENTS(obj) = elements;            \
+    VECTOR_LENGTH(obj) = length;                \
   } while (0)
 
-#define INTEGER_CONSTRUCT(obj, value)     \
-  do {                                    \
-    HEADER_TYPE(obj) = CELL_TYPE_INTEGER; \
-    INTEGER_VALUE(obj) = value;           \
+#define UVECTOR_CONSTRUCT(obj, type, elements, length) \
+  do {                                                 \
+    HEADER_TYPE(obj) = CELL_TYPE_UVECTOR;              \
+    HEADER_FLAG(obj) = type;                           \
+    UVECTOR_ELEMENTS(obj) = elements;                  \
+    UVECTOR_LENGTH(obj) = length;                      \
   } while (0)
 
 #define SYMBOL_CONSTRUCT(obj, name, value) \
   do {                                     \
     HEADER_TYPE(obj) = CELL_TYPE_SYMBOL;   \
-    SYMBOL_NAME(obj) = strdup(pname);      \
+    SYMBOL_NAME(obj) = name;               \
+    SYMBOL_LENGTH(obj) = 0;                \
+    SYMBOL_HASH(obj) = 0;                  \
     SYMBOL_VCELL(obj) = value;             \
   } while (0)
 
-#define STRING_CONSTRUCT(obj, str)       \
-  do {                                   \
-    HEADER_TYPE(obj) = CELL_TYPE_STRING; \
-    STRING_VALUE(obj) = strdup(str);     \
+#define STRING_CONSTRUCT(obj, flag, str, length, count) \
+  do {                                                  \
+    HEADER_TYPE(obj) = CELL_TYPE_STRING;                \
+    HEADER_FLAG(obj) = flag;                            \
+    STRING_VALUE(obj) = str;                            \
+    STRING_LENGTH(obj) = length;                        \
+    STRING_COUNT(obj) = count;                          \
+    STRING_PAYLOAD(obj) = NULL;                         \
   } while (0)
 
 #define CLOSURE_CONSTRUCT(obj, args, body ,env) \
   do {                                          \
     HEADER_TYPE(obj) = CELL_TYPE_CLOSURE;       \
+    HEADER_FLAG(obj) = FALSE;                   \
     CLOSURE_ARGS(obj) = args;                   \
     CLOSURE_BODY(obj) = body;                   \
     CLOSURE_ENV(obj) = env;                     \
@@ -58,6 +88,31 @@
   do {                                  \
     HEADER_TYPE(obj) = CELL_TYPE_MACRO; \
     MACRO_CLOSURE(obj) = closure;       \
+    MACRO_RULES(obj) = SCM_NULL;        \
+  } while (0)
+
+#define BOX_CONSTRUCT(obj, value)     \
+  do {                                \
+    HEADER_TYPE(obj) = CELL_TYPE_BOX; \
+    BOX_VALUE(obj) = value;           \
+  } while (0)
+
+#define CALL_SITE_CONSTRUCT(obj, target)    \
+  do {                                      \
+    HEADER_TYPE(obj) = CELL_TYPE_CALL_SITE; \
+    HEADER_FLAG(obj) = 0;                   \
+    CALL_SITE_TARGET(obj) = target;         \
+    CALL_SITE_CALLEE(obj) = SCM_UNBOUND;    \
+    CALL_SITE_CALLS(obj) = 0;               \
+    CALL_SITE_TYPES(obj)[0] = 0;            \
+    CALL_SITE_TYPES(obj)[1] = 0;            \
+  } while (0)
+
+#define CONTINUATION_CONSTRUCT(obj, segment, depth)  \
+  do {                                               \
+    HEADER_TYPE(obj) = CELL_TYPE_CONTINUATION;       \
+    CONTINUATION_SEGMENT(obj) = segment;             \
+    CONTINUATION_DEPTH(obj) = depth;                 \
   } while (0)
 
 /*==================================================
@@ -68,11 +123,26 @@ static SCM page_list = NULL;
 static SCM current_search_page = NULL;
 /* free cell list */
 static int free_cell_total_size;
+static int heap_page_count = 0;
+/* number of garbage collections */
+static int gc_count = 0;
 
 /* stakc pointer */
 static void *stack_start;
 static void *stack_end;
 
+/* registered root area */
+struct RootArea {
+    SCM *start;
+    int count;
+};
+static struct RootArea *root_areas = NULL;
+static int root_area_count = 0;
+
+/* registered weak hooks: called after marking, before sweeping */
+static void (**weak_hooks)(void) = NULL;
+static int weak_hook_count = 0;
+
 /*===========================================================================
   GC support
 ===========================================================================*/
@@ -158,12 +228,12 @@ void *xrealloc(void *ptr, size_t size)
  */
 
 /* Page List Accesser */
-#define NEXT_PAGE CDR
-#define PAGES_FREE_CELL_LIST CAR
+#define NEXT_PAGE CELL_CDR
+#define PAGES_FREE_CELL_LIST CELL_CAR
 
 /* Free Cell List Accesser */
-#define NEXT_FREE_CELL CDR
-#define FREE_CELL_INDEX CAR
+#define NEXT_FREE_CELL CELL_CDR
+#define FREE_CELL_INDEX CELL_CAR
 
 /* heap size */
 #define ALLOCATE_HEAP_PAGE_OBJECT_SIZE 5001
@@ -178,6 +248,26 @@ static void add_heap(void);
 /* cell finalizer */
 static void cell_finalize(SCM obj);
 
+/* cons allocator */
+static struct _Cons *allocate_cons_slow(void);
+static int is_heap_cons(SCM obj);
+static int cons_sweep(void);
+static void cons_space_finalize(void);
+
+/* cdr-coded list */
+static void cdr_coded_initialize(void);
+static void cdr_coded_finalize(void);
+static int is_cdr_coded(SCM obj);
+static int cdr_coded_flag_p(SCM obj);
+static void cdr_coded_set_flag(SCM obj);
+static int gc_mark_cdr_coded(SCM obj);
+static void cdr_coded_sweep(void);
+
+/* data space */
+static void mark_payload(SCM cell);
+static void data_sweep(void);
+static void data_space_finalize(void);
+
 /* garbage collection */
 static void scheme_gc(void);
 
@@ -196,6 +286,7 @@ void allocator_initialize(void)
     page_list = NULL;
     current_search_page = page_list;
     free_cell_total_size = 0;
+    cdr_coded_initialize();
 }
 
 void allocator_finalize(void)
@@ -213,6 +304,9 @@ void allocator_finalize(void)
         next_page = NEXT_PAGE(current_page);
         free(current_page);
     }
+    cons_space_finalize();
+    cdr_coded_finalize();
+    data_space_finalize();
 }
 
 /**
@@ -281,12 +375,13 @@ static void add_heap(void)
          curr_cell++, cell_index++) {
         FREE_CELL_CONSTRUCT(curr_cell, AS_SCM(cell_index), (curr_cell + 1));
     }
-    CDR(last_cell) = NULL;
+    CELL_CDR(last_cell) = NULL;
 
 #if DEBUG
     dump_page_list();
 #endif
     free_cell_total_size += (ALLOCATE_HEAP_PAGE_OBJECT_SIZE - 1);
+    heap_page_count++;
 #if DEBUG
     printf("free_cell_total_size %d\n", free_cell_total_size);
 #endif
@@ -299,9 +394,9 @@ static int is_heap_object(SCM obj)
 {
     SCM page;
 
-    if (AS_UINT(obj) & 0x03) return (0 != 0); /* false */
+    if (! SCM_POINTER_P(obj)) return (0 != 0); /* false */
 
-    for (page = page_list; page != NULL; page = CDR(page)) {
+    for (page = page_list; page != NULL; page = NEXT_PAGE(page)) {
         if (is_this_pages_object(page, obj)) {
             return (0 == 0); /* true */
         }
@@ -340,18 +435,761 @@ static void dump_page_list(void)
     int page_index = 0;
     printf("page_list\n");
     while (curr_page != NULL) {
-        SCM curr = CAR(curr_page);
+        SCM curr = PAGES_FREE_CELL_LIST(curr_page);
         int i = 0;
         printf("free_list[%d] = %p\n", page_index, curr_page);
         while(curr != NULL) {
             printf("[%d] = %p\n",i++,curr);
-            curr = CDR(curr);
+            curr = NEXT_FREE_CELL(curr);
         }
-        curr_page = CDR(curr_page);
+        curr_page = NEXT_PAGE(curr_page);
         page_index++;
     }
 }
 
+/*==================================================
+  Cons Allocator
+==================================================*/
+/* == Cons Page Design ==
+ *
+ * consは2 word (struct _Cons) だけで、headerを持たない。
+ * cellとは別の、consだけを置くpageから切り出す。
+ *
+ * |- ConsPage -|-- slot --|-- slot --| .... |-- slot --|
+ *   next
+ *   mark[]    : slotごとのmark bit
+ *   flag[]    : slotごとの印 (LAMBDA_STACK_FRAME_P)
+ *
+ * pageはCONS_PAGE_SIZE境界に置くので、consのアドレスの下位bitを
+ * 落とすとpageの先頭になる。SCMにはSCM_CONS_TAGを足して持つ。
+ * 空きslotはcarをSCM_FREE_CONSにし、cdrで次の空きslotをつなぐ。
+ */
+#define CONS_PAGE_SIZE (64 * 1024)
+/* これだけのpageまではGCせずに足す (GCの度にcellのheapもsweepするので) */
+#define CONS_PAGE_MIN_COUNT 16
+#define CONS_PAGE_BITMAP_WORDS (CONS_PAGE_SIZE / sizeof(struct _Cons) / 64)
+
+struct ConsPage {
+    struct ConsPage *next;
+    uint64_t mark[CONS_PAGE_BITMAP_WORDS];
+    uint64_t flag[CONS_PAGE_BITMAP_WORDS];
+    struct _Cons slots[];
+};
+
+#define CONS_PAGE_SLOTS \
+  ((CONS_PAGE_SIZE - offsetof(struct ConsPage, slots)) / sizeof(struct _Cons))
+#define CONS_PAGE_OF(cons) \
+  ((struct ConsPage *) (AS_UINT(cons) & ~(uintptr_t) (CONS_PAGE_SIZE - 1)))
+#define CONS_SLOT_INDEX(page, cons) ((int) ((cons) - (page)->slots))
+#define BIT_P(bitmap, i)     (((bitmap)[(i) >> 6] >> ((i) & 63)) & 1)
+#define BIT_SET(bitmap, i)   ((bitmap)[(i) >> 6] |= (uint64_t) 1 << ((i) & 63))
+#define BIT_CLEAR(bitmap, i) ((bitmap)[(i) >> 6] &= ~((uint64_t) 1 << ((i) & 63)))
+
+/* 空きslotのcar. 値としては現れないアドレスを使う */
+static struct _Cell free_cons_marker;
+#define SCM_FREE_CONS (&free_cons_marker)
+
+static struct ConsPage *cons_pages = NULL;
+static struct _Cons *cons_free_list = NULL;
+static int cons_page_count = 0;
+static int cons_free_count = 0;
+
+static void add_cons_page(void)
+{
+    struct ConsPage *page;
+    int i;
+    if (posix_memalign((void **) &page, CONS_PAGE_SIZE, CONS_PAGE_SIZE) != 0)
+        error(1,0,"out of memory\n");
+    memset(page->mark, 0, sizeof(page->mark));
+    memset(page->flag, 0, sizeof(page->flag));
+    page->next = cons_pages;
+    cons_pages = page;
+    cons_page_count++;
+    for (i = CONS_PAGE_SLOTS - 1; i >= 0; i--) {
+        page->slots[i].car = SCM_FREE_CONS;
+        page->slots[i].cdr = (SCM) cons_free_list;
+        cons_free_list = &page->slots[i];
+    }
+    cons_free_count += CONS_PAGE_SLOTS;
+}
+
+/* free listが空: GCし、空きが少なければpageを足す */
+static struct _Cons *allocate_cons_slow(void)
+{
+    if (cons_page_count < CONS_PAGE_MIN_COUNT) {
+        add_cons_page();
+        return cons_free_list;
+    }
+    scheme_gc();
+    while (cons_free_count < cons_page_count * (int) CONS_PAGE_SLOTS / 2) {
+        add_cons_page();
+    }
+    if (cons_free_list == NULL) {
+        add_cons_page();
+    }
+    return cons_free_list;
+}
+
+/* heapのcons pageにあるconsか (保守的GC用) */
+static int is_heap_cons(SCM obj)
+{
+    struct ConsPage *page;
+    struct _Cons *cons;
+    size_t offset;
+
+    if (! SCM_CONS_P(obj)) return (0 != 0); /* false */
+    cons = SCM_TO_CONS(obj);
+    for (page = cons_pages; page != NULL; page = page->next) {
+        if (page == CONS_PAGE_OF(cons)) {
+            offset = (char *) cons - (char *) page->slots;
+            return (char *) cons >= (char *) page->slots &&
+                offset < CONS_PAGE_SLOTS * sizeof(struct _Cons) &&
+                offset % sizeof(struct _Cons) == 0;
+        }
+    }
+    return (0 != 0); /* false */
+}
+
+/* env stackのconsは印を持たない. CDR-coded listの要素はそちらのbitmap */
+int cons_flag_p(SCM obj)
+{
+    struct _Cons *cons = SCM_TO_CONS(obj);
+    struct ConsPage *page;
+    if (ENV_STACK_P(obj)) return FALSE;
+    if (CDR_CODED_P(obj)) return cdr_coded_flag_p(obj);
+    page = CONS_PAGE_OF(cons);
+    return BIT_P(page->flag, CONS_SLOT_INDEX(page, cons)) != 0;
+}
+
+void cons_set_flag(SCM obj)
+{
+    struct _Cons *cons = SCM_TO_CONS(obj);
+    struct ConsPage *page = CONS_PAGE_OF(cons);
+    if (CDR_CODED_P(obj)) {
+        cdr_coded_set_flag(obj);
+        return;
+    }
+    BIT_SET(page->flag, CONS_SLOT_INDEX(page, cons));
+}
+
+/**
+ * markの無いslotを空きに戻してfree listを作り直す。
+ * 回収したconsの数を返す
+ */
+static int cons_sweep(void)
+{
+    struct ConsPage *page;
+    int collect = 0;
+    int i, w;
+
+    cons_free_list = NULL;
+    cons_free_count = 0;
+    for (page = cons_pages; page != NULL; page = page->next) {
+        for (i = CONS_PAGE_SLOTS - 1; i >= 0; i--) {
+            struct _Cons *cons = &page->slots[i];
+            if (BIT_P(page->mark, i))
+                continue;
+            if (cons->car != SCM_FREE_CONS) {
+                cons->car = SCM_FREE_CONS;
+                collect++;
+            }
+            cons->cdr = (SCM) cons_free_list;
+            cons_free_list = cons;
+            cons_free_count++;
+        }
+        for (w = 0; w < CONS_PAGE_BITMAP_WORDS; w++) {
+            page->flag[w] &= page->mark[w];
+            page->mark[w] = 0;
+        }
+    }
+    return collect;
+}
+
+static void cons_space_finalize(void)
+{
+    while (cons_pages != NULL) {
+        struct ConsPage *next = cons_pages->next;
+        free(cons_pages);
+        cons_pages = next;
+    }
+    cons_free_list = NULL;
+}
+
+/*==================================================
+  CDR-coded List
+==================================================*/
+/* == CDR-coded List Design ==
+ *
+ * 書き換えられることの少ないlist (read_list, mapの結果など) は要素を
+ * 連続したwordに並べる。n要素のlistは最後のcdrを含めてn + 1 word.
+ *
+ *   | e0 | e1 | e2 | tail |        (e0 e1 e2 . tail)
+ *
+ * 要素のwordをconsと同じtag (SCM_CONS_TAG) で指すので、CARとCONS_Pは
+ * consと変わらない。wordごとに次のbitを持つ:
+ *   next     : cdrは次のword (最後の要素以外)
+ *   override : cdrはoverride[]にある (SET_CDRで分けた要素)
+ *   mark     : GC
+ *   flag     : LAMBDA_STACK_FRAME_P
+ * nextもoverrideも無い要素のcdrは次のwordの値で、consのcdrと同じ場所。
+ *
+ * 要素のcdrを書き換える時は、その要素のcdrをoverride[]に移して
+ * nextを落とす (要素の場所は変わらないので、指しているものはそのまま)。
+ *
+ * 領域はCDR_CODED_SPACE_START (scheme.h) にまとめて予約し (触ったpageだけが
+ * 使われる)、回収したwordの隙間から切り出す。入らなければ普通のconsで作る。
+ * -DSCHEME_CDR_CODINGが無ければ何も予約せず、listは全て普通のconsになる。
+ */
+#define CDR_CODED_WORDS (CDR_CODED_SPACE_SIZE / sizeof(SCM))
+#define CDR_CODED_BITMAP_SIZE (CDR_CODED_WORDS / 8)
+/* 前のGCから切り出したword数がこれを越えたらGCする */
+#define CDR_CODED_GC_THRESHOLD (1024 * 1024)
+/* これより短いlistはconsのままにする */
+#define CDR_CODED_MIN_LENGTH 2
+
+static int cdr_coded_enabled = FALSE;
+static SCM *cdr_coded_words = NULL;
+static SCM *cdr_coded_override = NULL;
+static uint64_t *cdr_coded_next = NULL;
+static uint64_t *cdr_coded_overridden = NULL;
+static uint64_t *cdr_coded_mark = NULL;
+static uint64_t *cdr_coded_flag = NULL;
+
+/* 一度でも使ったwordの上限 */
+static size_t cdr_coded_top = 0;
+/* 切り出し中の隙間 [free, limit) */
+static size_t cdr_coded_free = 0;
+static size_t cdr_coded_limit = 0;
+/* 前のGCで見つけた隙間 */
+struct CdrCodedHole {
+    size_t start;
+    size_t end;
+};
+static struct CdrCodedHole *cdr_coded_holes = NULL;
+static int cdr_coded_hole_count = 0;
+static int cdr_coded_hole_capacity = 0;
+static int cdr_coded_next_hole = 0;
+static size_t cdr_coded_allocated = 0;
+
+/* 要素のwordの添字 */
+#define CDR_CODED_INDEX(obj) ((size_t) CDR_CODED_WORD_INDEX(obj))
+
+#ifdef SCHEME_CDR_CODING
+/**
+ * addressを決めて予約する。他のものが居てそこに取れなければ、
+ * CDR_CODED_Pがその領域のobjectを取り違えるので続けられない
+ */
+static void *map_reserved(uintptr_t address, size_t size)
+{
+    void *p = mmap((void *) address, size, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED)
+        error(1, 0, "out of memory\n");
+    if (address != 0 && AS_UINT(p) != address)
+        error(1, 0, "cannot reserve cdr-coded space at %p\n", (void *) address);
+    return p;
+}
+#endif
+
+static void cdr_coded_initialize(void)
+{
+#ifdef SCHEME_CDR_CODING
+    /* 要素の領域と次のbitmapは続けて置く (CDR_CODED_NEXT_BITMAP) */
+    cdr_coded_words = map_reserved(CDR_CODED_SPACE_START,
+                                   CDR_CODED_SPACE_SIZE + CDR_CODED_BITMAP_SIZE);
+    cdr_coded_next = CDR_CODED_NEXT_BITMAP;
+    cdr_coded_override = map_reserved(0, CDR_CODED_SPACE_SIZE);
+    cdr_coded_overridden = map_reserved(0, CDR_CODED_BITMAP_SIZE);
+    cdr_coded_mark = map_reserved(0, CDR_CODED_BITMAP_SIZE);
+    cdr_coded_flag = map_reserved(0, CDR_CODED_BITMAP_SIZE);
+    cdr_coded_enabled = TRUE;
+#endif
+}
+
+static void cdr_coded_finalize(void)
+{
+    if (! cdr_coded_enabled) return;
+    munmap(cdr_coded_words, CDR_CODED_SPACE_SIZE + CDR_CODED_BITMAP_SIZE);
+    munmap(cdr_coded_override, CDR_CODED_SPACE_SIZE);
+    munmap(cdr_coded_overridden, CDR_CODED_BITMAP_SIZE);
+    munmap(cdr_coded_mark, CDR_CODED_BITMAP_SIZE);
+    munmap(cdr_coded_flag, CDR_CODED_BITMAP_SIZE);
+    cdr_coded_words = cdr_coded_override = NULL;
+    cdr_coded_next = cdr_coded_overridden = cdr_coded_mark = cdr_coded_flag = NULL;
+    free(cdr_coded_holes);
+    cdr_coded_holes = NULL;
+    cdr_coded_enabled = FALSE;
+}
+
+SCM cdr_coded_cdr(SCM obj)
+{
+    size_t i = CDR_CODED_INDEX(obj);
+    if (BIT_P(cdr_coded_next, i))
+        return AS_SCM(AS_UINT(obj) + sizeof(SCM));
+    if (BIT_P(cdr_coded_overridden, i))
+        return cdr_coded_override[i];
+    return cdr_coded_words[i + 1];
+}
+
+/* cdrの場所. 次のwordがcdrの要素はここでoverride[]に分ける */
+SCM *cdr_coded_cdr_ref(SCM obj)
+{
+    size_t i = CDR_CODED_INDEX(obj);
+    if (BIT_P(cdr_coded_next, i)) {
+        cdr_coded_override[i] = AS_SCM(AS_UINT(obj) + sizeof(SCM));
+        BIT_CLEAR(cdr_coded_next, i);
+        BIT_SET(cdr_coded_overridden, i);
+    }
+    if (BIT_P(cdr_coded_overridden, i))
+        return &cdr_coded_override[i];
+    return &cdr_coded_words[i + 1];
+}
+
+/**
+ * n wordを切り出す。空きが無ければNULL.
+ * GCが起きることがある
+ */
+static SCM *cdr_coded_allocate(size_t n)
+{
+    SCM *words;
+    if (! cdr_coded_enabled) return NULL;
+    if (cdr_coded_allocated > CDR_CODED_GC_THRESHOLD) {
+        scheme_gc();
+    }
+    while (cdr_coded_free + n > cdr_coded_limit) {
+        if (cdr_coded_next_hole < cdr_coded_hole_count) {
+            cdr_coded_free = cdr_coded_holes[cdr_coded_next_hole].start;
+            cdr_coded_limit = cdr_coded_holes[cdr_coded_next_hole].end;
+            cdr_coded_next_hole++;
+        } else if (cdr_coded_limit != CDR_CODED_WORDS) {
+            /* 隙間を使い切ったら未使用の部分から */
+            cdr_coded_free = cdr_coded_top;
+            cdr_coded_limit = CDR_CODED_WORDS;
+        } else {
+            return NULL;
+        }
+    }
+    words = &cdr_coded_words[cdr_coded_free];
+    cdr_coded_free += n;
+    if (cdr_coded_free > cdr_coded_top) {
+        cdr_coded_top = cdr_coded_free;
+    }
+    cdr_coded_allocated += n;
+    return words;
+}
+
+/* words[0..length-1]を要素にする. 要素とtailは呼び出し側が埋める */
+static SCM cdr_coded_construct(SCM *words, size_t length)
+{
+    size_t start = words - cdr_coded_words;
+    size_t i;
+    for (i = start; i <= start + length; i++) {
+        if (i < start + length - 1) {
+            BIT_SET(cdr_coded_next, i);
+        } else {
+            BIT_CLEAR(cdr_coded_next, i);
+        }
+        BIT_CLEAR(cdr_coded_overridden, i);
+        BIT_CLEAR(cdr_coded_flag, i);
+    }
+    return CONS_TO_SCM(words);
+}
+
+/**
+ * lstと同じ要素のCDR-coded listを作る (lstの背骨はcopyする)。
+ * 短いlistや入りきらない時はlstをそのまま返す
+ */
+SCM list_to_cdr_coded(SCM lst)
+{
+    SCM p;
+    SCM *words;
+    size_t length = 0, i;
+
+    for (p = lst; CONS_P(p); p = CDR(p)) {
+        length++;
+    }
+    if (length < CDR_CODED_MIN_LENGTH)
+        return lst;
+    words = cdr_coded_allocate(length + 1);
+    if (words == NULL)
+        return lst;
+    for (p = lst, i = 0; i < length; p = CDR(p), i++) {
+        words[i] = CAR(p);
+    }
+    words[length] = p;
+    return cdr_coded_construct(words, length);
+}
+
+/* list_reverseと同じ. 結果をCDR-coded listで作る */
+SCM cdr_coded_reverse(SCM lst)
+{
+    SCM p;
+    SCM *words;
+    size_t length = 0, i;
+
+    for (p = lst; CONS_P(p); p = CDR(p)) {
+        length++;
+    }
+    if (length < CDR_CODED_MIN_LENGTH)
+        return list_reverse(lst);
+    words = cdr_coded_allocate(length + 1);
+    if (words == NULL)
+        return list_reverse(lst);
+    for (p = lst, i = length; i > 0; p = CDR(p), i--) {
+        words[i - 1] = CAR(p);
+    }
+    words[length] = SCM_NULL;
+    return cdr_coded_construct(words, length);
+}
+
+static int cdr_coded_flag_p(SCM obj)
+{
+    return BIT_P(cdr_coded_flag, CDR_CODED_INDEX(obj)) != 0;
+}
+
+static void cdr_coded_set_flag(SCM obj)
+{
+    BIT_SET(cdr_coded_flag, CDR_CODED_INDEX(obj));
+}
+
+/* 保守的GC用: 使ったことのある要素のwordか */
+static int is_cdr_coded(SCM obj)
+{
+    return CONS_P(obj) && CDR_CODED_P(obj) && CDR_CODED_INDEX(obj) + 1 < cdr_coded_top;
+}
+
+/**
+ * 要素にmarkを付ける。子を辿る必要があればtrue.
+ * cdrが次のwordの値なら、そのwordも使っている
+ */
+static int gc_mark_cdr_coded(SCM obj)
+{
+    size_t i = CDR_CODED_INDEX(obj);
+    if (BIT_P(cdr_coded_mark, i)) return (0 != 0); /* already marked. */
+    BIT_SET(cdr_coded_mark, i);
+    if (! BIT_P(cdr_coded_next, i) && ! BIT_P(cdr_coded_overridden, i)) {
+        BIT_SET(cdr_coded_mark, i + 1);
+    }
+    return (0 == 0); /* true */
+}
+
+/**
+ * 回収したwordを空にする。保守的GCが古いwordを指しても
+ * 昔の要素やoverride[]を辿らないように
+ */
+static void cdr_coded_clear(size_t start, size_t end)
+{
+    size_t i;
+    for (i = start; i < end; i++) {
+        cdr_coded_words[i] = SCM_NULL;
+        BIT_CLEAR(cdr_coded_next, i);
+        BIT_CLEAR(cdr_coded_overridden, i);
+    }
+}
+
+static void cdr_coded_add_hole(size_t start, size_t end)
+{
+    cdr_coded_clear(start, end);
+    if (end - start < CDR_CODED_MIN_LENGTH + 1)
+        return;
+    if (cdr_coded_hole_count == cdr_coded_hole_capacity) {
+        cdr_coded_hole_capacity = cdr_coded_hole_capacity ? cdr_coded_hole_capacity * 2 : 64;
+        cdr_coded_holes = xrealloc(cdr_coded_holes,
+                                   sizeof(struct CdrCodedHole) * cdr_coded_hole_capacity);
+    }
+    cdr_coded_holes[cdr_coded_hole_count].start = start;
+    cdr_coded_holes[cdr_coded_hole_count].end = end;
+    cdr_coded_hole_count++;
+}
+
+/**
+ * markの無いwordの並びを隙間として集め直す。
+ * 最後の隙間はtopを下げて未使用の部分に戻す
+ */
+static void cdr_coded_sweep(void)
+{
+    size_t i = 0, start;
+    size_t top = cdr_coded_top;
+
+    if (! cdr_coded_enabled) return; /* markのbitmapも無い */
+    cdr_coded_hole_count = 0;
+    cdr_coded_next_hole = 0;
+    cdr_coded_free = cdr_coded_limit = 0;
+    cdr_coded_allocated = 0;
+    while (i < top) {
+        /* 生きているwordを飛ばす */
+        while (i < top && (i & 63) == 0 && cdr_coded_mark[i >> 6] == ~(uint64_t) 0)
+            i += 64;
+        while (i < top && BIT_P(cdr_coded_mark, i))
+            i++;
+        if (i >= top)
+            break;
+        start = i;
+        while (i < top && (i & 63) == 0 && cdr_coded_mark[i >> 6] == 0)
+            i += 64;
+        while (i < top && ! BIT_P(cdr_coded_mark, i)) {
+            i++;
+            if ((i & 63) == 0 && i < top && cdr_coded_mark[i >> 6] == 0)
+                i += 64;
+        }
+        if (i >= top) {
+            cdr_coded_clear(start, top);
+            cdr_coded_top = start;
+            break;
+        }
+        cdr_coded_add_hole(start, i);
+    }
+    memset(cdr_coded_mark, 0, ((top + 63) >> 6) * sizeof(uint64_t));
+}
+
+/*==================================================
+  Data Space
+==================================================*/
+/* == Data Space Design ==
+ *
+ * cellは固定長なので、長さの決まらない中身 (symbolの名前, string,
+ * bignumのdigit列, vectorの要素) はcellの外のdata spaceに置く。
+ * cellはその領域を指すhandleで、領域もGCが回収する。
+ *
+ * = block
+ *
+ * |- DataHeader -|------- payload -------|
+ *                ^ cellが指すアドレス
+ *
+ * = small block (DATA_SMALL_MAX以下)
+ *
+ * 16, 32, ... , 32768 byteのsize classに分け、classごとのpage
+ * (DATA_PAGE_SIZE) から切り出す。空きblockはclassごとのfree listに
+ * つなぐ (payloadの先頭にnextを置く)。
+ *
+ * = large object
+ *
+ * DATA_SMALL_MAXを越えるものはpage単位でmmapし、回収したらmunmapする。
+ *
+ * 回収はcellのsweepの後:
+ *   gc_sweepで生き残ったcellの中身にmarkを付け (mark_payload),
+ *   data_sweepでmarkの無いblockを空きに戻す。
+ */
+struct DataHeader {
+    unsigned int size;            /* block size (headerを含む) */
+    unsigned char used;
+    unsigned char mark;
+};
+
+struct DataPage {
+    struct DataPage *next;
+    int size_class;
+    int used;                     /* 使用中のblock数 */
+};
+
+struct LargeObject {
+    struct LargeObject *next;
+    size_t mapped;                /* mmapした大きさ */
+    struct DataHeader header;     /* 直後がpayload */
+};
+
+#define DATA_HEADER(payload) ((struct DataHeader *) (payload) - 1)
+#define DATA_FREE_NEXT(payload) (*(void **) (payload))
+
+#define DATA_SIZE_CLASSES 12
+#define DATA_SMALL_MIN 16
+#define DATA_SMALL_MAX (DATA_SMALL_MIN << (DATA_SIZE_CLASSES - 1))
+#define DATA_PAGE_SIZE (256 * 1024)
+/* blockが16 byte境界に並ぶようにpageの管理部分を丸める */
+#define DATA_PAGE_HEADER_SIZE ((sizeof(struct DataPage) + 15) & ~(size_t) 15)
+#define DATA_PAGE_FIRST_BLOCK(page) ((char *) (page) + DATA_PAGE_HEADER_SIZE)
+#define DATA_CLASS_SIZE(size_class) (DATA_SMALL_MIN << (size_class))
+
+/* 前のGCからdata spaceに確保した量がこれと前のGCで生き残った量を
+ * 共に越えたら、cellが余っていてもGCする */
+#define DATA_GC_THRESHOLD (8 * 1024 * 1024)
+
+static struct DataPage *data_pages = NULL;
+static struct LargeObject *large_objects = NULL;
+static void *data_free_list[DATA_SIZE_CLASSES];
+/* 前のGCから確保した量 */
+static size_t data_allocated = 0;
+/* 前のGCで生き残った量 (blockの大きさの合計) */
+static size_t data_live = 0;
+
+static int data_size_class(size_t block_size)
+{
+    int size_class = 0;
+    while (DATA_CLASS_SIZE(size_class) < block_size) {
+        size_class++;
+    }
+    return size_class;
+}
+
+/**
+ * size classのpageを足してblockをfree listにつなぐ
+ */
+static void data_add_page(int size_class)
+{
+    struct DataPage *page = xmalloc(DATA_PAGE_SIZE);
+    size_t block_size = DATA_CLASS_SIZE(size_class);
+    char *block = DATA_PAGE_FIRST_BLOCK(page);
+    char *end = (char *) page + DATA_PAGE_SIZE;
+
+    page->next = data_pages;
+    page->size_class = size_class;
+    page->used = 0;
+    data_pages = page;
+
+    for (; block + block_size <= end; block += block_size) {
+        struct DataHeader *header = (struct DataHeader *) block;
+        header->size = block_size;
+        header->used = FALSE;
+        header->mark = FALSE;
+        DATA_FREE_NEXT(header + 1) = data_free_list[size_class];
+        data_free_list[size_class] = header + 1;
+    }
+}
+
+static void *data_allocate_large(size_t size)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    size_t mapped = (sizeof(struct LargeObject) + size + page_size - 1) & ~(size_t) (page_size - 1);
+    struct LargeObject *large = mmap(NULL, mapped, PROT_READ | PROT_WRITE,
+                                     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (large == MAP_FAILED) error(1,0,"out of memory\n");
+    large->next = large_objects;
+    large->mapped = mapped;
+    large->header.size = 0;       /* sizeはsmall blockのみ. mappedを見ること */
+    large->header.used = TRUE;
+    large->header.mark = FALSE;
+    large_objects = large;
+    data_allocated += mapped;
+    return &large->header + 1;
+}
+
+/**
+ * data spaceからsize byteの領域を確保する (中身は不定)。
+ * GCが起きることがあるので、持ち主のcellを先に作ってから呼ぶこと
+ */
+void *data_allocate(size_t size)
+{
+    size_t block_size = sizeof(struct DataHeader) + size;
+    int size_class;
+    void *payload;
+
+    if (data_allocated > DATA_GC_THRESHOLD && data_allocated > data_live) {
+        scheme_gc();
+    }
+    if (block_size > DATA_SMALL_MAX) {
+        return data_allocate_large(size);
+    }
+    size_class = data_size_class(block_size);
+    if (data_free_list[size_class] == NULL) {
+        data_add_page(size_class);
+    }
+    payload = data_free_list[size_class];
+    data_free_list[size_class] = DATA_FREE_NEXT(payload);
+    DATA_HEADER(payload)->used = TRUE;
+    data_allocated += DATA_CLASS_SIZE(size_class);
+    return payload;
+}
+
+/* 生き残ったcellが指す領域に印を付ける */
+static void mark_payload(SCM cell)
+{
+    void *payload = NULL;
+    if (SYMBOL_P(cell)) {
+        payload = SYMBOL_NAME(cell);
+    } else if (STRING_P(cell)) {
+        /* ropeとsymbolの名前を指すものはcellを辿って印を付ける */
+        if (! STRING_ROPE_P(cell) && ! STRING_SYMBOL_P(cell))
+            payload = STRING_PAYLOAD(cell);
+    } else if (BIGNUM_P(cell)) {
+        payload = BIGNUM_DIGITS(cell);
+    } else if (VECTOR_P(cell)) {
+        payload = VECTOR_ELEMENTS(cell);
+    } else if (UVECTOR_P(cell)) {
+        payload = UVECTOR_ELEMENTS(cell);
+    } else if (HASH_TABLE_P(cell)) {
+        payload = HASH_TABLE_ENTRIES(cell);
+    } else if (HAMT_NODE_P(cell)) {
+        payload = HAMT_NODE_ENTRIES(cell);
+    } else if (RECORD_P(cell)) {
+        payload = RECORD_SLOTS(cell);
+    }
+    if (payload != NULL) {
+        DATA_HEADER(payload)->mark = TRUE;
+    }
+}
+
+/**
+ * 印の無いblockを空きに戻してfree listを作り直す。
+ * 全て空いたpageとlarge objectはOSに返す
+ */
+static void data_sweep(void)
+{
+    struct DataPage **page_link = &data_pages;
+    struct LargeObject **large_link = &large_objects;
+    int i;
+
+    data_live = 0;
+    for (i = 0; i < DATA_SIZE_CLASSES; i++) {
+        data_free_list[i] = NULL;
+    }
+
+    while (*page_link != NULL) {
+        struct DataPage *page = *page_link;
+        size_t block_size = DATA_CLASS_SIZE(page->size_class);
+        char *block = DATA_PAGE_FIRST_BLOCK(page);
+        char *end = (char *) page + DATA_PAGE_SIZE;
+        void *free_list = data_free_list[page->size_class];
+
+        page->used = 0;
+        for (; block + block_size <= end; block += block_size) {
+            struct DataHeader *header = (struct DataHeader *) block;
+            if (header->used && header->mark) {
+                header->mark = FALSE;
+                page->used++;
+            } else {
+                header->used = FALSE;
+                DATA_FREE_NEXT(header + 1) = free_list;
+                free_list = header + 1;
+            }
+        }
+        if (page->used == 0) {
+            *page_link = page->next;
+            free(page);
+        } else {
+            data_free_list[page->size_class] = free_list;
+            data_live += block_size * page->used;
+            page_link = &page->next;
+        }
+    }
+
+    while (*large_link != NULL) {
+        struct LargeObject *large = *large_link;
+        if (large->header.mark) {
+            large->header.mark = FALSE;
+            data_live += large->mapped;
+            large_link = &large->next;
+        } else {
+            *large_link = large->next;
+            munmap(large, large->mapped);
+        }
+    }
+    data_allocated = 0;
+}
+
+static void data_space_finalize(void)
+{
+    while (data_pages != NULL) {
+        struct DataPage *next = data_pages->next;
+        free(data_pages);
+        data_pages = next;
+    }
+    while (large_objects != NULL) {
+        struct LargeObject *next = large_objects->next;
+        munmap(large_objects, large_objects->mapped);
+        large_objects = next;
+    }
+}
+
 /*==================================================
   GC
 ==================================================*/
@@ -359,10 +1197,12 @@ static void dump_page_list(void)
 /* root maker */
 static void gc_mark_stack(void);
 static void gc_mark_symbol_table(void);
+static void gc_mark_root_areas(void);
 
 static void gc_mark_memory(void *start, void *end, int offset);
 static void gc_mark_maybe_object(SCM obj);
 static void gc_mark_object(SCM obj);
+static int gc_mark_cons(SCM obj);
 
 /* sweeper */
 static int gc_sweep(void);
@@ -376,12 +1216,42 @@ void scm_gc_protect(SCM obj)
     GC_FOREVER_MARK(obj);
 }
 
+/**
+ * C側で保持するSCMの配列をrootとして登録する
+ * (GC_FOREVER_MARKは子をマークしないのでリストには使えない)
+ */
+void scm_gc_register_roots(SCM *start, int count)
+{
+    root_areas = xrealloc(root_areas, sizeof(struct RootArea) * (root_area_count + 1));
+    root_areas[root_area_count].start = start;
+    root_areas[root_area_count].count = count;
+    root_area_count++;
+}
+
+/**
+ * 弱い参照を持つ表の掃除を登録する. hookはmarkの後、sweepの前に呼ばれ、
+ * scm_gc_marked_pで生き残ったものを調べて、残すものはscm_gc_markする
+ */
+void scm_gc_register_weak_hook(void (*hook)(void))
+{
+    weak_hooks = xrealloc(weak_hooks, sizeof(weak_hooks[0]) * (weak_hook_count + 1));
+    weak_hooks[weak_hook_count++] = hook;
+}
+
 static void scheme_gc(void)
 {
     int collect_cells;
+    int i;
 
+    gc_count++;
     gc_mark_stack();
     gc_mark_symbol_table();
+    gc_mark_root_areas();
+    control_stack_mark();
+    env_stack_mark();
+    for (i = 0; i < weak_hook_count; i++) {
+        weak_hooks[i]();
+    }
 
 #if DEBUG
     dump_page_list();
@@ -389,12 +1259,20 @@ static void scheme_gc(void)
     printf("free_cell_total_size %d\n", free_cell_total_size);
 #endif
     collect_cells = gc_sweep();
+    cons_sweep();
+    cdr_coded_sweep();
+    data_sweep();
 #if DEBUG
     printf("free_cell_total_size %d\n", free_cell_total_size);
 #endif
+    /* consと同じく半分は空いているようにする. 生きているcellが多いと
+     * 少ししか回収できないGCを繰り返すことになる */
     if (collect_cells < 600) {
         add_heap();
     }
+    while (free_cell_total_size < heap_page_count * (ALLOCATE_HEAP_PAGE_OBJECT_SIZE - 1) / 2) {
+        add_heap();
+    }
     current_search_page = page_list;
 }
 
@@ -443,7 +1321,7 @@ static void gc_mark_symbol_table()
         SCM symbol_list = *start;
         SCM symbol;
         FOR_EACH(symbol_list, symbol) {
-            GC_MARK(symbol_list);
+            gc_mark_cons(symbol_list);
             if (! UNBOUND_P(SYMBOL_VCELL(symbol))) {
                 GC_MARK(symbol);
                 gc_mark_object(SYMBOL_VCELL(symbol));
@@ -457,6 +1335,54 @@ static void gc_mark_symbol_table()
 }
 
 
+/* precise marking from other modules (control stack etc.)
+ */
+void scm_gc_mark(SCM obj)
+{
+    gc_mark_object(obj);
+}
+
+/* markの途中で、objが既にmarkされているか (weak hook用) */
+int scm_gc_marked_p(SCM obj)
+{
+    if (CONS_P(obj)) {
+        struct _Cons *cons;
+        struct ConsPage *page;
+        if (ENV_STACK_P(obj)) return (0 == 0);
+        if (CDR_CODED_P(obj)) return BIT_P(cdr_coded_mark, CDR_CODED_INDEX(obj)) != 0;
+        cons = SCM_TO_CONS(obj);
+        page = CONS_PAGE_OF(cons);
+        return BIT_P(page->mark, CONS_SLOT_INDEX(page, cons)) != 0;
+    }
+    if (! SCM_POINTER_P(obj) || ! is_heap_object(obj)) return (0 == 0);
+    return GC_MARK_P(obj);
+}
+
+/* 現在のGCの通し番号 */
+int scm_gc_count(void)
+{
+    return gc_count;
+}
+
+/* cellを動かすGCを入れたら、動かす度に増やすこと.
+ * addressでhashする表はこれが変わっていたら入れ直す (hashtable.c) */
+unsigned int scm_gc_move_epoch(void)
+{
+    return 0;
+}
+
+/* mark of registered root areas
+ */
+static void gc_mark_root_areas(void)
+{
+    int i, j;
+    for (i = 0; i < root_area_count; i++) {
+        for (j = 0; j < root_areas[i].count; j++) {
+            gc_mark_object(root_areas[i].start[j]);
+        }
+    }
+}
+
 /* 指定されたアドレスの範囲をマーク */
 static void gc_mark_memory(void *start, void *end, int offset)
 {
@@ -471,7 +1397,7 @@ static void gc_mark_memory(void *start, void *end, int offset)
 /* オブジェクトらしいものをマーク */
 static void gc_mark_maybe_object(SCM obj)
 {
-    if (is_heap_object(obj)) {
+    if (is_heap_object(obj) || is_heap_cons(obj) || is_cdr_coded(obj)) {
         gc_mark_object(obj);
     }
 }
@@ -483,20 +1409,68 @@ static void gc_mark_object(SCM obj)
 {
  loop:
     if (obj == NULL) return;
-    if (SCM_CONSTANT_P(obj)) return ; /* scm constant is not marking */
-    if (FREE_CELL_P(obj)) return ; /* free cell is not marking */
-    if (GC_MARK_P(obj)) return ; /* already marked. */
-    
-    GC_MARK(obj);
     if (CONS_P(obj)) {
+        if (CDR_CODED_P(obj)) {
+            if (! gc_mark_cdr_coded(obj)) return ;
+        } else if (! gc_mark_cons(obj)) return ;
         gc_mark_object(CAR(obj));
         obj = CDR(obj);
         goto loop;
-    } else if (INTEGER_P(obj)) {
+    }
+    if (! SCM_POINTER_P(obj)) return ; /* scm constant and fixnum are not marking */
+    if (FREE_CELL_P(obj)) return ; /* free cell is not marking */
+    if (GC_MARK_P(obj)) return ; /* already marked. */
+    
+    GC_MARK(obj);
+    if (BIGNUM_P(obj) || HEAP_FLONUM_P(obj) || UVECTOR_P(obj)) {
         return ;
+    } else if (VECTOR_P(obj)) {
+        int i;
+        if (VECTOR_LENGTH(obj) == 0)
+            return ;
+        for (i = 0; i < VECTOR_LENGTH(obj) - 1; i++) {
+            gc_mark_object(VECTOR_REF(obj, i));
+        }
+        obj = VECTOR_REF(obj, i);
+        goto loop;
+    } else if (HASH_TABLE_P(obj)) {
+        int i;
+        for (i = 0; i < HASH_TABLE_CAPACITY(obj) * 2; i++) {
+            gc_mark_object(HASH_TABLE_ENTRIES(obj)[i]);
+        }
+    } else if (HAMT_P(obj)) {
+        obj = HAMT_ROOT(obj);
+        goto loop;
+    } else if (HAMT_NODE_P(obj)) {
+        int i;
+        /* 深さは高々8段 */
+        for (i = 0; i < HAMT_NODE_LENGTH(obj) * 2; i++) {
+            gc_mark_object(HAMT_NODE_ENTRIES(obj)[i]);
+        }
+    } else if (RECORD_P(obj)) {
+        int i;
+        gc_mark_object(RECORD_DESCRIPTOR(obj));
+        if (RECORD_SLOTS(obj) == NULL)
+            return ;
+        for (i = 0; i < RECORD_TYPE_COUNT(RECORD_DESCRIPTOR(obj)); i++) {
+            gc_mark_object(RECORD_REF(obj, i));
+        }
+    } else if (RECORD_TYPE_P(obj)) {
+        gc_mark_object(RECORD_TYPE_NAME(obj));
+        obj = RECORD_TYPE_FIELDS(obj);
+        goto loop;
+    } else if (RECORD_PROCEDURE_P(obj)) {
+        gc_mark_object(RECORD_PROCEDURE_DESCRIPTOR(obj));
+        gc_mark_object(RECORD_PROCEDURE_NAME(obj));
+        obj = RECORD_PROCEDURE_SLOTS(obj);
+        goto loop;
     } else if (SYMBOL_P(obj)) {
         gc_mark_object(SYMBOL_VCELL(obj));
     } else if (STRING_P(obj)) {
+        if (STRING_ROPE_P(obj) || STRING_SYMBOL_P(obj)) {
+            obj = STRING_BASE(obj);
+            goto loop;
+        }
         return ;
     } else if (PRIMITIVE_P(obj)) {
         return ;
@@ -506,15 +1480,46 @@ static void gc_mark_object(SCM obj)
         obj = CLOSURE_ENV(obj);
         goto loop;
     } else if (MACRO_P(obj)) {
+        gc_mark_object(MACRO_RULES(obj));
         obj = MACRO_CLOSURE(obj);
         goto loop;
+    } else if (CONTINUATION_P(obj)) {
+        control_stack_mark_segment(CONTINUATION_SEGMENT(obj));
+    } else if (BOX_P(obj)) {
+        obj = BOX_VALUE(obj);
+        goto loop;
+    } else if (CALL_SITE_P(obj)) {
+        gc_mark_object(CALL_SITE_CALLEE(obj));
+        obj = CALL_SITE_TARGET(obj);
+        goto loop;
     }
 }
 
+/**
+ * consにmarkを付ける。子を辿る必要があればtrue.
+ * env stackのconsはenv_stack_markが辿るのでここでは止める
+ */
+static int gc_mark_cons(SCM obj)
+{
+    struct _Cons *cons = SCM_TO_CONS(obj);
+    struct ConsPage *page;
+    int i;
+
+    if (ENV_STACK_P(obj)) return (0 != 0); /* false */
+    if (cons->car == SCM_FREE_CONS) return (0 != 0); /* free slot */
+    page = CONS_PAGE_OF(cons);
+    i = CONS_SLOT_INDEX(page, cons);
+    if (BIT_P(page->mark, i)) return (0 != 0); /* already marked. */
+    BIT_SET(page->mark, i);
+    return (0 == 0); /* true */
+}
+
 static void cell_finalize(SCM cell)
 {
-    if (SYMBOL_P(cell)) {
-        free(SYMBOL_NAME(cell));
+    /* symbolの名前などcellの中身はdata_sweepで回収する */
+    if (CONTINUATION_P(cell)) {
+        control_stack_release(CONTINUATION_SEGMENT(cell));
+        CONTINUATION_SEGMENT(cell) = NULL;
     }
 }
 
@@ -540,6 +1545,7 @@ static int gc_sweep(void)
                 if (! GC_FOREVER_MARK_P(cell)) {
                     GC_UNMARK(cell);
                 }
+                mark_payload(cell);
             } else { /* unmarked */
 
                 cell_finalize(cell);
@@ -586,7 +1592,7 @@ static void gc_sweep_symbol_table_free_cell_remove(void)
         while (! NULL_P(symbol_list)) {
             if (! NULL_P(CDR(symbol_list)) &&
                 ! GC_MARK_P(CAR(CDR(symbol_list)))) {
-                CDR(symbol_list) = CDDR(symbol_list);
+                SET_CDR(symbol_list, CDDR(symbol_list));
             } else {
                 symbol_list = CDR(symbol_list);
             }
@@ -622,37 +1628,250 @@ static void dump_cell(void)
   object allocator
 ==================================================*/
 SCM new_cons(SCM kar, SCM kdr)
+{
+    struct _Cons *cons = cons_free_list;
+    if (cons == NULL) {
+        cons = allocate_cons_slow();
+    }
+    cons_free_list = (struct _Cons *) cons->cdr;
+    cons_free_count--;
+    cons->car = kar;
+    cons->cdr = kdr;
+    return CONS_TO_SCM(cons);
+}
+
+/**
+ * digitsは作業領域 (xmalloc). data spaceに写してfreeする
+ * 値がfixnumに収まらないことは呼び出し側で確かめてあること
+ */
+SCM new_bignum(BignumDigit *digits, int length, int negative)
+{
+    SCM obj = allocate_cell();
+    BIGNUM_CONSTRUCT(obj, NULL, 0, negative);
+    BIGNUM_DIGITS(obj) = data_allocate(sizeof(BignumDigit) * length);
+    memcpy(BIGNUM_DIGITS(obj), digits, sizeof(BignumDigit) * length);
+    BIGNUM_LENGTH(obj) = length;
+    free(digits);
+    return obj;
+}
+
+/* 即値にできないflonum (new_flonum) */
+SCM new_heap_flonum(double value)
+{
+    SCM obj = allocate_cell();
+    FLONUM_CONSTRUCT(obj, value);
+    return obj;
+}
+
+/* 要素は全てfillで埋める */
+SCM new_vector(int length, SCM fill)
+{
+    SCM obj = allocate_cell();
+    SCM *elements;
+    int i;
+    VECTOR_CONSTRUCT(obj, NULL, 0);
+    if (length > 0) {
+        elements = data_allocate(sizeof(SCM) * length);
+        for (i = 0; i < length; i++) {
+            elements[i] = fill;
+        }
+        VECTOR_ELEMENTS(obj) = elements;
+        VECTOR_LENGTH(obj) = length;
+    }
+    return obj;
+}
+
+/* 要素は0で埋める */
+SCM new_uvector(enum UvectorType type, int length)
+{
+    SCM obj = allocate_cell();
+    size_t size = (size_t) UVECTOR_ELEMENT_SIZE(type) * length;
+    UVECTOR_CONSTRUCT(obj, type, NULL, 0);
+    if (length > 0) {
+        UVECTOR_ELEMENTS(obj) = data_allocate(size);
+        memset(UVECTOR_ELEMENTS(obj), 0, size);
+        UVECTOR_LENGTH(obj) = length;
+    }
+    return obj;
+}
+
+/* 空きのkeyはSCM_UNBOUND */
+SCM new_hash_table(enum HashTableKind kind, int capacity)
+{
+    SCM obj = allocate_cell();
+    int i;
+    HEADER_TYPE(obj) = CELL_TYPE_HASH_TABLE;
+    HEADER_FLAG(obj) = kind;
+    HASH_TABLE_ENTRIES(obj) = NULL;
+    HASH_TABLE_CAPACITY(obj) = 0;
+    HASH_TABLE_COUNT(obj) = 0;
+    HASH_TABLE_DELETED(obj) = 0;
+    HASH_TABLE_EPOCH(obj) = scm_gc_move_epoch();
+    HASH_TABLE_ENTRIES(obj) = data_allocate(sizeof(SCM) * 2 * capacity);
+    for (i = 0; i < capacity * 2; i++) {
+        HASH_TABLE_ENTRIES(obj)[i] = SCM_UNBOUND;
+    }
+    HASH_TABLE_CAPACITY(obj) = capacity;
+    return obj;
+}
+
+SCM new_hamt(int flag, SCM root, int count, unsigned int edit)
+{
+    SCM obj = allocate_cell();
+    HEADER_TYPE(obj) = CELL_TYPE_HAMT;
+    HEADER_FLAG(obj) = flag;
+    HAMT_ROOT(obj) = root;
+    HAMT_COUNT(obj) = count;
+    HAMT_EDIT(obj) = edit;
+    return obj;
+}
+
+/* 組はSCM_UNBOUNDで埋めておく */
+SCM new_hamt_node(int flag, unsigned int bitmap, int length, unsigned int edit)
+{
+    SCM obj = allocate_cell();
+    int i;
+    HEADER_TYPE(obj) = CELL_TYPE_HAMT_NODE;
+    HEADER_FLAG(obj) = flag;
+    HAMT_NODE_ENTRIES(obj) = NULL;
+    HAMT_NODE_BITMAP(obj) = bitmap;
+    HAMT_NODE_LENGTH(obj) = 0;
+    HAMT_NODE_EDIT(obj) = edit;
+    HAMT_NODE_ENTRIES(obj) = data_allocate(sizeof(SCM) * 2 * length);
+    for (i = 0; i < length * 2; i++) {
+        HAMT_NODE_ENTRIES(obj)[i] = SCM_UNBOUND;
+    }
+    HAMT_NODE_LENGTH(obj) = length;
+    return obj;
+}
+
+SCM new_record_type(SCM name, SCM fields, int count)
+{
+    SCM obj = allocate_cell();
+    HEADER_TYPE(obj) = CELL_TYPE_RECORD_TYPE;
+    HEADER_FLAG(obj) = 0;
+    RECORD_TYPE_NAME(obj) = name;
+    RECORD_TYPE_FIELDS(obj) = fields;
+    RECORD_TYPE_COUNT(obj) = count;
+    return obj;
+}
+
+/* slotは#fで埋めておく */
+SCM new_record(SCM descriptor)
 {
     SCM obj = allocate_cell();
-    CONS_CONSTRUCT(obj, kar, kdr);
+    int count = RECORD_TYPE_COUNT(descriptor);
+    SCM *slots;
+    int i;
+    HEADER_TYPE(obj) = CELL_TYPE_RECORD;
+    HEADER_FLAG(obj) = 0;
+    RECORD_DESCRIPTOR(obj) = descriptor;
+    RECORD_SLOTS(obj) = NULL;
+    if (count > 0) {
+        slots = data_allocate(sizeof(SCM) * count);
+        for (i = 0; i < count; i++) {
+            slots[i] = SCM_FALSE;
+        }
+        RECORD_SLOTS(obj) = slots;
+    }
     return obj;
 }
 
-SCM new_integer(int value)
+SCM new_record_procedure(enum RecordProcedureKind kind, SCM descriptor, SCM name, int index, SCM slots)
 {
     SCM obj = allocate_cell();
-    INTEGER_CONSTRUCT(obj, value);
+    HEADER_TYPE(obj) = CELL_TYPE_RECORD_PROCEDURE;
+    HEADER_FLAG(obj) = (index << 2) | kind;
+    RECORD_PROCEDURE_DESCRIPTOR(obj) = descriptor;
+    RECORD_PROCEDURE_NAME(obj) = name;
+    RECORD_PROCEDURE_SLOTS(obj) = slots;
     return obj;
 }
 
+/* 名前はdata spaceに写す */
 SCM new_symbol(char *pname, SCM value)
+{
+    return new_symbol_bytes(pname, strlen(pname), value);
+}
+
+SCM new_symbol_bytes(char *name, int length, SCM value)
 {
     SCM obj = allocate_cell();
-    SYMBOL_CONSTRUCT(obj, strdup(pname), value);
+    SYMBOL_CONSTRUCT(obj, NULL, value);
+    SYMBOL_NAME(obj) = data_allocate(length + 1);
+    memcpy(SYMBOL_NAME(obj), name, length);
+    SYMBOL_NAME(obj)[length] = '\0';
+    SYMBOL_LENGTH(obj) = length;
+    SYMBOL_HASH(obj) = symbol_hash(name, length);
     return obj;
 }
 
 SCM new_string(char *string)
+{
+    int length = strlen(string);
+    return new_string_bytes(string, length, utf8_count(string, length));
+}
+
+/* bytesがNULLなら中身は呼び出し側で埋める */
+SCM new_string_bytes(char *bytes, int length, int count)
 {
     SCM obj = allocate_cell();
-    STRING_CONSTRUCT(obj, strdup(string));
+    STRING_CONSTRUCT(obj, 0, NULL, 0, 0);
+    STRING_VALUE(obj) = STRING_PAYLOAD(obj) = data_allocate(length + 1);
+    if (bytes != NULL)
+        memcpy(STRING_VALUE(obj), bytes, length);
+    STRING_VALUE(obj)[length] = '\0';
+    STRING_LENGTH(obj) = length;
+    STRING_COUNT(obj) = count;
     return obj;
 }
 
-SCM new_closure(SCM sexp, SCM env)
+SCM new_rope_string(SCM left, SCM right, int depth)
+{
+    SCM base = new_cons(left, right);
+    SCM obj = allocate_cell();
+    STRING_CONSTRUCT(obj, STRING_FLAG_ROPE | (depth << STRING_FLAG_DEPTH_SHIFT), NULL,
+                     STRING_LENGTH(left) + STRING_LENGTH(right),
+                     STRING_COUNT(left) + STRING_COUNT(right));
+    STRING_BASE(obj) = base;
+    return obj;
+}
+
+/* payloadはvalueを含むdata spaceの領域の先頭 */
+SCM new_string_view(char *value, int length, int count, void *payload)
 {
     SCM obj = allocate_cell();
+    STRING_CONSTRUCT(obj, STRING_FLAG_VIEW, value, length, count);
+    STRING_PAYLOAD(obj) = payload;
+    return obj;
+}
+
+SCM new_symbol_string(SCM symbol, int count)
+{
+    SCM obj = allocate_cell();
+    STRING_CONSTRUCT(obj, STRING_FLAG_SYMBOL, SYMBOL_NAME(symbol), SYMBOL_LENGTH(symbol), count);
+    STRING_BASE(obj) = symbol;
+    return obj;
+}
+
+/**
+ * sexpは(params . body). 呼び出しの度にparamsを数えないように
+ * arityとstack frameの印をheaderに持たせる
+ */
+SCM new_closure(SCM sexp, SCM env)
+{
+    SCM obj;
+    SCM p;
+    int required = 0;
+    for (p = CAR(sexp); CONS_P(p); p = CDR(p)) {
+        required++;
+    }
+    if (required > CLOSURE_ARITY_MAX) {
+        scheme_error("too many parameters");
+    }
+    obj = allocate_cell();
     CLOSURE_CONSTRUCT(obj, CAR(sexp), CDR(sexp), env);
+    HEADER_FLAG(obj) = CLOSURE_FLAGS(required, SYMBOL_P(p), LAMBDA_STACK_FRAME_P(sexp));
     return obj;
 }
 
@@ -663,6 +1882,27 @@ SCM new_macro(SCM closure, SCM env)
     return obj;
 }
 
+SCM new_continuation(struct StackSegment *segment, int depth)
+{
+    SCM obj = allocate_cell();
+    CONTINUATION_CONSTRUCT(obj, segment, depth);
+    return obj;
+}
+
+SCM new_box(SCM value)
+{
+    SCM obj = allocate_cell();
+    BOX_CONSTRUCT(obj, value);
+    return obj;
+}
+
+SCM new_call_site(SCM target)
+{
+    SCM obj = allocate_cell();
+    CALL_SITE_CONSTRUCT(obj, target);
+    return obj;
+}
+
 SCM new_port(FILE *file)
 {
     SCM obj = allocate_cell();
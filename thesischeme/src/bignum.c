@@ -0,0 +1,617 @@
+/*===========================================================================
+ * bignum.c - exact integer arithmetic
+ *
+ * $Id$
+===========================================================================*/
+
+#include "scheme.h"
+
+/* 整数はfixnum (即値) かbignum.
+ *
+ * bignumは絶対値のdigit列 (下位から, 32bitずつ) と符号を持つ。
+ * fixnumに収まる値は必ずfixnumにする (make_integer) ので、bignumの
+ * 値は常にfixnumの範囲外にある。
+ *
+ * 計算はxmallocした作業用のdigit列の上で行い、結果をcellに写す。
+ * 計算中にcellを確保しないので、途中でGCが起きて引数のdigit列が
+ * 解放されることはない。
+ */
+
+/*==================================================
+  File Local Definitions
+==================================================*/
+#define DIGIT_BASE ((BignumDoubleDigit) 1 << BIGNUM_DIGIT_BITS)
+#define DIGIT_MASK (DIGIT_BASE - 1)
+
+/* これより短い数の積は筆算で求める */
+#define KARATSUBA_THRESHOLD 32
+
+/* 文字列との変換に使う10進の桁 */
+#define DECIMAL_BASE 1000000000
+#define DECIMAL_DIGITS 9
+
+/* 整数の符号と絶対値. fixnumの絶対値はbufに置く */
+struct Magnitude {
+    BignumDigit *digits;
+    int length;
+    int negative;
+    BignumDigit buf[2];
+};
+
+static BignumDigit *new_digits(int length)
+{
+    return xmalloc(sizeof(BignumDigit) * (length > 0 ? length : 1));
+}
+
+static int normalize_length(BignumDigit *digits, int length)
+{
+    while (length > 0 && digits[length - 1] == 0) {
+        length--;
+    }
+    return length;
+}
+
+static void magnitude_of(SCM x, struct Magnitude *m)
+{
+    if (FIXNUM_P(x)) {
+        intptr_t value = FIXNUM_VALUE(x);
+        uint64_t u = value < 0 ? - (uint64_t) value : (uint64_t) value;
+        m->buf[0] = (BignumDigit) (u & DIGIT_MASK);
+        m->buf[1] = (BignumDigit) (u >> BIGNUM_DIGIT_BITS);
+        m->digits = m->buf;
+        m->length = normalize_length(m->buf, 2);
+        m->negative = value < 0;
+    } else {
+        m->digits = BIGNUM_DIGITS(x);
+        m->length = BIGNUM_LENGTH(x);
+        m->negative = BIGNUM_NEGATIVE_P(x) ? TRUE : FALSE;
+    }
+}
+
+/**
+ * digit列から整数を作る。fixnumに収まればdigitsは解放する
+ */
+static SCM make_integer(BignumDigit *digits, int length, int negative)
+{
+    length = normalize_length(digits, length);
+    if (length <= 2) {
+        uint64_t u = 0;
+        if (length > 0)
+            u = digits[0];
+        if (length > 1)
+            u |= (uint64_t) digits[1] << BIGNUM_DIGIT_BITS;
+        if (u <= (uint64_t) FIXNUM_MAX) {
+            free(digits);
+            return MAKE_FIXNUM(negative ? - (intptr_t) u : (intptr_t) u);
+        }
+        if (negative && u == (uint64_t) FIXNUM_MAX + 1) {
+            free(digits);
+            return MAKE_FIXNUM(FIXNUM_MIN);
+        }
+    }
+    return new_bignum(digits, length, negative);
+}
+
+SCM new_integer(intptr_t value)
+{
+    BignumDigit *digits;
+    uint64_t u;
+    if (FIXNUM_RANGE_P(value)) {
+        return MAKE_FIXNUM(value);
+    }
+    u = value < 0 ? - (uint64_t) value : (uint64_t) value;
+    digits = new_digits(2);
+    digits[0] = (BignumDigit) (u & DIGIT_MASK);
+    digits[1] = (BignumDigit) (u >> BIGNUM_DIGIT_BITS);
+    return make_integer(digits, 2, value < 0);
+}
+
+/*==================================================
+  Digit Arithmetic
+==================================================*/
+static int compare_digits(BignumDigit *a, int an, BignumDigit *b, int bn)
+{
+    int i;
+    if (an != bn)
+        return an < bn ? -1 : 1;
+    for (i = an - 1; i >= 0; i--) {
+        if (a[i] != b[i])
+            return a[i] < b[i] ? -1 : 1;
+    }
+    return 0;
+}
+
+/* r = a + b (an >= bn). rはan + 1桁 */
+static int add_digits(BignumDigit *r, BignumDigit *a, int an, BignumDigit *b, int bn)
+{
+    BignumDoubleDigit carry = 0;
+    int i;
+    for (i = 0; i < an; i++) {
+        carry += a[i];
+        if (i < bn)
+            carry += b[i];
+        r[i] = (BignumDigit) (carry & DIGIT_MASK);
+        carry >>= BIGNUM_DIGIT_BITS;
+    }
+    r[an] = (BignumDigit) carry;
+    return normalize_length(r, an + 1);
+}
+
+/* r = a - b (a >= b). rはan桁 */
+static int sub_digits(BignumDigit *r, BignumDigit *a, int an, BignumDigit *b, int bn)
+{
+    BignumDoubleDigit borrow = 0;
+    int i;
+    for (i = 0; i < an; i++) {
+        BignumDoubleDigit t = (BignumDoubleDigit) a[i] - borrow - (i < bn ? b[i] : 0);
+        r[i] = (BignumDigit) (t & DIGIT_MASK);
+        borrow = (t >> BIGNUM_DIGIT_BITS) ? 1 : 0;
+    }
+    return normalize_length(r, an);
+}
+
+/* r[0, rn) += t[0, tn). 繰り上がりはrの中で止まること */
+static void add_into(BignumDigit *r, int rn, BignumDigit *t, int tn)
+{
+    BignumDoubleDigit carry = 0;
+    int i;
+    for (i = 0; i < rn && (i < tn || carry); i++) {
+        carry += r[i];
+        if (i < tn)
+            carry += t[i];
+        r[i] = (BignumDigit) (carry & DIGIT_MASK);
+        carry >>= BIGNUM_DIGIT_BITS;
+    }
+}
+
+/* r[0, rn) -= t[0, tn). 結果は負にならないこと */
+static void sub_into(BignumDigit *r, int rn, BignumDigit *t, int tn)
+{
+    BignumDoubleDigit borrow = 0;
+    int i;
+    for (i = 0; i < rn && (i < tn || borrow); i++) {
+        BignumDoubleDigit x = (BignumDoubleDigit) r[i] - borrow - (i < tn ? t[i] : 0);
+        r[i] = (BignumDigit) (x & DIGIT_MASK);
+        borrow = (x >> BIGNUM_DIGIT_BITS) ? 1 : 0;
+    }
+}
+
+/* 筆算. rはan + bn桁 */
+static void schoolbook_mul(BignumDigit *r, BignumDigit *a, int an, BignumDigit *b, int bn)
+{
+    int i, j;
+    memset(r, 0, sizeof(BignumDigit) * (an + bn));
+    for (j = 0; j < bn; j++) {
+        BignumDoubleDigit carry = 0;
+        if (b[j] == 0)
+            continue;
+        for (i = 0; i < an; i++) {
+            carry += (BignumDoubleDigit) a[i] * b[j] + r[i + j];
+            r[i + j] = (BignumDigit) (carry & DIGIT_MASK);
+            carry >>= BIGNUM_DIGIT_BITS;
+        }
+        r[an + j] = (BignumDigit) carry;
+    }
+}
+
+/**
+ * r = a * b. rはan + bn桁で、a, bと重ならないこと
+ * 短い方がKARATSUBA_THRESHOLD桁以上ならKaratsuba法で求める:
+ *   a = a1 B^m + a0, b = b1 B^m + b0 として
+ *   ab = z2 B^2m + (z1 - z2 - z0) B^m + z0
+ *   z0 = a0 b0, z2 = a1 b1, z1 = (a0 + a1)(b0 + b1)
+ */
+static void mul_digits(BignumDigit *r, BignumDigit *a, int an, BignumDigit *b, int bn)
+{
+    BignumDigit *t, *sa, *sb, *z1;
+    int m, i, san, sbn;
+
+    if (an < bn) {
+        BignumDigit *p = a; int n = an;
+        a = b; an = bn;
+        b = p; bn = n;
+    }
+    if (bn < KARATSUBA_THRESHOLD) {
+        schoolbook_mul(r, a, an, b, bn);
+        return;
+    }
+    if (an >= 2 * bn) {
+        /* 長さが違いすぎる: aをbn桁ずつに区切って掛ける */
+        t = new_digits(2 * bn);
+        memset(r, 0, sizeof(BignumDigit) * (an + bn));
+        for (i = 0; i < an; i += bn) {
+            int n = an - i < bn ? an - i : bn;
+            mul_digits(t, a + i, n, b, bn);
+            add_into(r + i, an + bn - i, t, n + bn);
+        }
+        free(t);
+        return;
+    }
+
+    /* an < 2bn なので m <= bn */
+    m = (an + 1) / 2;
+    sa = new_digits(m + 1);
+    sb = new_digits(m + 1);
+    z1 = new_digits(2 * m + 2);
+
+    san = add_digits(sa, a, m, a + m, an - m);
+    if (bn > m) {
+        sbn = add_digits(sb, b, m, b + m, bn - m);
+    } else {
+        memcpy(sb, b, sizeof(BignumDigit) * m);
+        sbn = normalize_length(sb, m);
+    }
+    memset(z1, 0, sizeof(BignumDigit) * (2 * m + 2));
+    mul_digits(z1, sa, san, sb, sbn);
+
+    mul_digits(r, a, m, b, m);                          /* z0 */
+    mul_digits(r + 2 * m, a + m, an - m, b + m, bn - m); /* z2 */
+    sub_into(z1, 2 * m + 2, r, 2 * m);
+    sub_into(z1, 2 * m + 2, r + 2 * m, an + bn - 2 * m);
+    add_into(r + m, an + bn - m, z1, normalize_length(z1, 2 * m + 2));
+
+    free(sa);
+    free(sb);
+    free(z1);
+}
+
+/* a /= d. 余りを返す */
+static BignumDigit short_div(BignumDigit *a, int an, BignumDigit d)
+{
+    BignumDoubleDigit rem = 0;
+    int i;
+    for (i = an - 1; i >= 0; i--) {
+        rem = (rem << BIGNUM_DIGIT_BITS) | a[i];
+        a[i] = (BignumDigit) (rem / d);
+        rem %= d;
+    }
+    return (BignumDigit) rem;
+}
+
+static int leading_zeros(BignumDigit d)
+{
+    int n = 0;
+    while (! (d & ((BignumDigit) 1 << (BIGNUM_DIGIT_BITS - 1)))) {
+        d <<= 1;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * q = a / b (Knuth, Algorithm D). an >= bn >= 2. qはan - bn + 1桁
+ * bの最上位digitの最上位bitが立つようにずらしてから、商を1桁ずつ
+ * 見積もって引く
+ */
+static void div_digits(BignumDigit *q, BignumDigit *a, int an, BignumDigit *b, int bn)
+{
+    BignumDigit *u = new_digits(an + 1);
+    BignumDigit *v = new_digits(bn);
+    int s = leading_zeros(b[bn - 1]);
+    int i, j;
+
+    for (i = bn - 1; i > 0; i--)
+        v[i] = (b[i] << s) | (s ? (BignumDigit) ((BignumDoubleDigit) b[i - 1] >> (BIGNUM_DIGIT_BITS - s)) : 0);
+    v[0] = b[0] << s;
+    u[an] = s ? (BignumDigit) ((BignumDoubleDigit) a[an - 1] >> (BIGNUM_DIGIT_BITS - s)) : 0;
+    for (i = an - 1; i > 0; i--)
+        u[i] = (a[i] << s) | (s ? (BignumDigit) ((BignumDoubleDigit) a[i - 1] >> (BIGNUM_DIGIT_BITS - s)) : 0);
+    u[0] = a[0] << s;
+
+    for (j = an - bn; j >= 0; j--) {
+        BignumDoubleDigit top = ((BignumDoubleDigit) u[j + bn] << BIGNUM_DIGIT_BITS) | u[j + bn - 1];
+        BignumDoubleDigit qhat = top / v[bn - 1];
+        BignumDoubleDigit rhat = top % v[bn - 1];
+        int64_t borrow, t;
+
+        while (qhat >= DIGIT_BASE ||
+               qhat * v[bn - 2] > ((rhat << BIGNUM_DIGIT_BITS) | u[j + bn - 2])) {
+            qhat--;
+            rhat += v[bn - 1];
+            if (rhat >= DIGIT_BASE)
+                break;
+        }
+        /* u[j, j + bn] -= qhat * v */
+        borrow = 0;
+        for (i = 0; i < bn; i++) {
+            BignumDoubleDigit p = qhat * v[i];
+            t = (int64_t) u[i + j] - borrow - (int64_t) (p & DIGIT_MASK);
+            u[i + j] = (BignumDigit) t;
+            borrow = (int64_t) (p >> BIGNUM_DIGIT_BITS) - (t >> BIGNUM_DIGIT_BITS);
+        }
+        t = (int64_t) u[j + bn] - borrow;
+        u[j + bn] = (BignumDigit) t;
+        if (t < 0) {
+            /* 見積もりが1大きかった: 足し戻す */
+            BignumDoubleDigit carry = 0;
+            qhat--;
+            for (i = 0; i < bn; i++) {
+                carry += (BignumDoubleDigit) u[i + j] + v[i];
+                u[i + j] = (BignumDigit) (carry & DIGIT_MASK);
+                carry >>= BIGNUM_DIGIT_BITS;
+            }
+            u[j + bn] += (BignumDigit) carry;
+        }
+        q[j] = (BignumDigit) qhat;
+    }
+    free(u);
+    free(v);
+}
+
+/*==================================================
+  Integer Operation
+==================================================*/
+/* x + y. negateが真ならx - y */
+static SCM add_magnitudes(struct Magnitude *x, struct Magnitude *y, int negate)
+{
+    int y_negative = negate ? ! y->negative : y->negative;
+    BignumDigit *r;
+    int length;
+
+    if (x->negative == y_negative) {
+        if (x->length < y->length) {
+            struct Magnitude *t = x; x = y; y = t;
+        }
+        r = new_digits(x->length + 1);
+        length = add_digits(r, x->digits, x->length, y->digits, y->length);
+        return make_integer(r, length, y_negative);
+    }
+    /* 符号が違う: 絶対値の大きい方から引く */
+    if (compare_digits(x->digits, x->length, y->digits, y->length) >= 0) {
+        r = new_digits(x->length);
+        length = sub_digits(r, x->digits, x->length, y->digits, y->length);
+        return make_integer(r, length, x->negative);
+    }
+    r = new_digits(y->length);
+    length = sub_digits(r, y->digits, y->length, x->digits, x->length);
+    return make_integer(r, length, y_negative);
+}
+
+SCM integer_add(SCM x, SCM y)
+{
+    struct Magnitude mx, my;
+    if (FIXNUM_P(x) && FIXNUM_P(y)) {
+        return new_integer(FIXNUM_VALUE(x) + FIXNUM_VALUE(y));
+    }
+    magnitude_of(x, &mx);
+    magnitude_of(y, &my);
+    return add_magnitudes(&mx, &my, FALSE);
+}
+
+SCM integer_sub(SCM x, SCM y)
+{
+    struct Magnitude mx, my;
+    if (FIXNUM_P(x) && FIXNUM_P(y)) {
+        return new_integer(FIXNUM_VALUE(x) - FIXNUM_VALUE(y));
+    }
+    magnitude_of(x, &mx);
+    magnitude_of(y, &my);
+    return add_magnitudes(&mx, &my, TRUE);
+}
+
+SCM integer_mul(SCM x, SCM y)
+{
+    struct Magnitude mx, my;
+    BignumDigit *r;
+    intptr_t value;
+
+    if (FIXNUM_P(x) && FIXNUM_P(y) &&
+        ! __builtin_mul_overflow(FIXNUM_VALUE(x), FIXNUM_VALUE(y), &value)) {
+        return new_integer(value);
+    }
+    magnitude_of(x, &mx);
+    magnitude_of(y, &my);
+    if (mx.length == 0 || my.length == 0) {
+        return MAKE_FIXNUM(0);
+    }
+    r = new_digits(mx.length + my.length);
+    mul_digits(r, mx.digits, mx.length, my.digits, my.length);
+    return make_integer(r, mx.length + my.length, mx.negative != my.negative);
+}
+
+/* 0に向かって丸めた商. yは0でないこと */
+SCM integer_quotient(SCM x, SCM y)
+{
+    struct Magnitude mx, my;
+    BignumDigit *q;
+    int length;
+
+    if (FIXNUM_P(x) && FIXNUM_P(y)) {
+        return new_integer(FIXNUM_VALUE(x) / FIXNUM_VALUE(y));
+    }
+    magnitude_of(x, &mx);
+    magnitude_of(y, &my);
+    if (compare_digits(mx.digits, mx.length, my.digits, my.length) < 0) {
+        return MAKE_FIXNUM(0);
+    }
+    length = mx.length - my.length + 1;
+    q = new_digits(mx.length);
+    if (my.length == 1) {
+        memcpy(q, mx.digits, sizeof(BignumDigit) * mx.length);
+        short_div(q, mx.length, my.digits[0]);
+        length = mx.length;
+    } else {
+        div_digits(q, mx.digits, mx.length, my.digits, my.length);
+    }
+    return make_integer(q, length, mx.negative != my.negative);
+}
+
+/* x < yなら負, x = yなら0, x > yなら正 */
+int integer_compare(SCM x, SCM y)
+{
+    struct Magnitude mx, my;
+    int c;
+    if (FIXNUM_P(x) && FIXNUM_P(y)) {
+        intptr_t a = FIXNUM_VALUE(x), b = FIXNUM_VALUE(y);
+        return a < b ? -1 : a > b;
+    }
+    magnitude_of(x, &mx);
+    magnitude_of(y, &my);
+    if (mx.negative != my.negative) {
+        return mx.negative ? -1 : 1;
+    }
+    c = compare_digits(mx.digits, mx.length, my.digits, my.length);
+    return mx.negative ? -c : c;
+}
+
+/*==================================================
+  Conversion
+==================================================*/
+/**
+ * 符号と10進の数字だけからなる文字列を整数にする
+ * (文字の確認はreaderがしてある)。9桁ずつ掛けて足す
+ */
+SCM c_string_to_integer(char *str)
+{
+    int negative = FALSE;
+    BignumDigit *digits;
+    int length = 0, capacity, n;
+
+    if (*str == '+' || *str == '-') {
+        negative = *str == '-';
+        str++;
+    }
+    n = strlen(str);
+    if (n <= 18) {
+        intptr_t value = (intptr_t) strtoll(str, NULL, 10);
+        return new_integer(negative ? -value : value);
+    }
+    /* 10^9 < 2^30 なので1桁につき2^30倍より小さくなる */
+    capacity = n / DECIMAL_DIGITS + 2;
+    digits = new_digits(capacity);
+    while (*str) {
+        BignumDoubleDigit carry = 0;
+        BignumDoubleDigit scale = 1;
+        int chunk = 0, i;
+        for (i = 0; i < DECIMAL_DIGITS && *str; i++, str++) {
+            chunk = chunk * 10 + (*str - '0');
+            scale *= 10;
+        }
+        carry = chunk;
+        for (i = 0; i < length; i++) {
+            carry += digits[i] * scale;
+            digits[i] = (BignumDigit) (carry & DIGIT_MASK);
+            carry >>= BIGNUM_DIGIT_BITS;
+        }
+        if (carry) {
+            digits[length++] = (BignumDigit) carry;
+        }
+    }
+    return make_integer(digits, length, negative);
+}
+
+/* int64_tに収まれば*valueに置いてTRUE */
+int integer_to_int64(SCM x, int64_t *value)
+{
+    struct Magnitude m;
+    uint64_t magnitude = 0;
+    int i;
+    if (FIXNUM_P(x)) {
+        *value = FIXNUM_VALUE(x);
+        return TRUE;
+    }
+    magnitude_of(x, &m);
+    if (m.length > 2)
+        return FALSE;
+    for (i = m.length - 1; i >= 0; i--) {
+        magnitude = (magnitude << BIGNUM_DIGIT_BITS) | m.digits[i];
+    }
+    if (m.negative) {
+        if (magnitude > (uint64_t) INT64_MAX + 1)
+            return FALSE;
+        *value = (int64_t) (0 - magnitude);
+    } else {
+        if (magnitude > (uint64_t) INT64_MAX)
+            return FALSE;
+        *value = (int64_t) magnitude;
+    }
+    return TRUE;
+}
+
+/* 上の桁から足していく. 大きすぎればinfになる */
+double integer_to_double(SCM x)
+{
+    double value = 0.0;
+    int i;
+    if (FIXNUM_P(x)) {
+        return (double) FIXNUM_VALUE(x);
+    }
+    for (i = BIGNUM_LENGTH(x) - 1; i >= 0; i--) {
+        value = value * (double) DIGIT_BASE + BIGNUM_DIGITS(x)[i];
+    }
+    return BIGNUM_NEGATIVE_P(x) ? -value : value;
+}
+
+/**
+ * 整数値の有限なdoubleを整数にする
+ * 2^62以上の値は仮数 (53bit) を指数の分だけずらしてdigit列に置く
+ */
+SCM double_to_integer(double value)
+{
+    union FlonumBits u;
+    BignumDigit *digits;
+    uint64_t mantissa, low, high;
+    int shift, word, bit, i;
+
+    if (-4e18 < value && value < 4e18) {
+        return new_integer((intptr_t) value);
+    }
+    u.value = value;
+    mantissa = (u.bits & (((uint64_t) 1 << 52) - 1)) | ((uint64_t) 1 << 52);
+    shift = (int) ((u.bits >> 52) & 0x7FF) - 1075;
+    word = shift / BIGNUM_DIGIT_BITS;
+    bit = shift % BIGNUM_DIGIT_BITS;
+    low = mantissa << bit;
+    high = bit ? mantissa >> (64 - bit) : 0;
+    digits = new_digits(word + 3);
+    for (i = 0; i < word; i++) {
+        digits[i] = 0;
+    }
+    digits[word] = (BignumDigit) (low & DIGIT_MASK);
+    digits[word + 1] = (BignumDigit) (low >> BIGNUM_DIGIT_BITS);
+    digits[word + 2] = (BignumDigit) high;
+    return make_integer(digits, word + 3, value < 0);
+}
+
+/* a /= 10^9. 定数で割るのでコンパイラが掛け算に直せる */
+static BignumDigit short_div_decimal(BignumDigit *a, int an)
+{
+    BignumDoubleDigit rem = 0;
+    int i;
+    for (i = an - 1; i >= 0; i--) {
+        rem = (rem << BIGNUM_DIGIT_BITS) | a[i];
+        a[i] = (BignumDigit) (rem / DECIMAL_BASE);
+        rem %= DECIMAL_BASE;
+    }
+    return (BignumDigit) rem;
+}
+
+/* 10^9で割った余りを下から集めて表示する */
+void print_integer(SCM x, FILE *file)
+{
+    BignumDigit *work, *chunks;
+    int length, count = 0;
+
+    if (FIXNUM_P(x)) {
+        fprintf(file, "%ld", (long) FIXNUM_VALUE(x));
+        return;
+    }
+    length = BIGNUM_LENGTH(x);
+    work = new_digits(length);
+    memcpy(work, BIGNUM_DIGITS(x), sizeof(BignumDigit) * length);
+    /* 2^32 < 10^(9 * 1.07) */
+    chunks = new_digits(length * 32 / 29 + 2);
+    while (length > 0) {
+        chunks[count++] = short_div_decimal(work, length);
+        length = normalize_length(work, length);
+    }
+    if (BIGNUM_NEGATIVE_P(x)) {
+        fputc('-', file);
+    }
+    fprintf(file, "%u", chunks[--count]);
+    while (count > 0) {
+        fprintf(file, "%0*u", DECIMAL_DIGITS, chunks[--count]);
+    }
+    free(work);
+    free(chunks);
+}
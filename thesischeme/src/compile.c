@@ -0,0 +1,1381 @@
+/*===========================================================================
+ * compile.c - scheme to c compiler
+ *
+ * $Id$
+===========================================================================*/
+#include <stdarg.h>
+
+#include "scheme.h"
+
+/* == Compiled Code Design ==
+ *
+ * A source file is translated into one C file. The C file includes
+ * scheme.h and is linked against the runtime library (every object
+ * except main.o), so compiled code shares cells, symbols, the GC and
+ * the printer with the interpreter.
+ *
+ * = Top-level procedure
+ *
+ *   (set! tak (lambda (x y z) ...))
+ *
+ * becomes three C functions
+ *
+ *   static SCM scmc_proc_0(SCM v0, SCM v1, SCM v2);  body
+ *   static SCM scmc_entry_0(SCM args);               primitive entry
+ *   static SCM scmc_bounce_0(SCM *args);             trampoline entry
+ *
+ * and the global tak is bound to a LIST_EXPR primitive cell, so that
+ * interpreted code, map and apply can call it like any other procedure.
+ * A procedure is compiled this way (a "known procedure") when the file
+ * assigns its global exactly once.
+ *
+ * = Call
+ *
+ *   known procedure   : direct C call
+ *   builtin primitive : call through its C function pointer
+ *   other             : scmc_apply() (interpreter)
+ *
+ * = Tail Call
+ *
+ *   self tail call    : parameter update and goto
+ *   known tail call   : arguments are stored in scmc_bounce_arguments,
+ *                       scmc_bounce is set and SCM_TAIL_CALL is returned.
+ *                       scmc_trampoline() at the nearest non-tail call
+ *                       site bounces until a real value comes back.
+ *   other tail call   : the procedure and the argument list are bounced
+ *                       to scmc_bounce_apply(). A compiled procedure (and
+ *                       apply of one) continues in the same trampoline.
+ *
+ * = Record
+ *
+ *   (define-record-type point (make-point x y) point? (x point-x) ...)
+ *
+ * is evaluated at compile time too, and calls of its procedures become
+ * a type check and a slot access in C
+ *
+ *   (point-x p)  =>  if (! RECORD_INSTANCE_P(p, scmc_record_type[0])) error
+ *                    RECORD_REF(p, 0)
+ *
+ * scmc_record_type[0] is set when the form is evaluated at run time.
+ *
+ * = Inner lambda
+ *
+ * An inner lambda stays interpreted. The closure is made at run time by
+ * eval with a frame holding the captured parameters. A procedure that
+ * assigns a captured parameter is left to the interpreter, because the
+ * closure would see a copy.
+ *
+ * = call/cc
+ *
+ * A call to the interpreter from compiled code runs a nested eval under
+ * a C frame. A continuation captured there can't be re-entered after
+ * the C frame returns, so in a file which uses call/cc a procedure is
+ * compiled only when it never calls the interpreter.
+ */
+
+/*==================================================
+  Runtime Support
+==================================================*/
+scmc_bounce_proc scmc_bounce = NULL;
+SCM scmc_bounce_arguments[SCMC_MAX_ARGUMENTS];
+
+/**
+ * SCM_TAIL_CALLが返る間、登録された手続きを呼び続ける
+ */
+SCM scmc_trampoline(SCM result)
+{
+    SCM args[SCMC_MAX_ARGUMENTS];
+    while (EQ_P(result, SCM_TAIL_CALL)) {
+        memcpy(args, scmc_bounce_arguments, sizeof(args));
+        result = scmc_bounce(args);
+    }
+    return result;
+}
+
+SCM scmc_apply(SCM subr, SCM args)
+{
+    return apply_procedure(subr, args);
+}
+
+/* compileされた手続き. primitive cellのflagが番号+1 */
+struct ScmcProcedure {
+    scmc_bounce_proc bounce;
+    int arity;
+};
+static struct ScmcProcedure *scmc_procedures = NULL;
+static int scmc_procedure_count = 0;
+
+/**
+ * 末尾位置での未知の手続きの呼び出し. a[0]が手続き, a[1]が引数のlist.
+ * compileされた手続きはそのbounceに渡し、Cのstackを積まずに呼ぶ
+ */
+SCM scmc_bounce_apply(SCM *a)
+{
+    SCM subr = a[0];
+    SCM args = a[1];
+    struct EvalState state;
+
+    while (EQ_P(subr, &Scheme_data_p_apply)) {
+        Scheme_apply(args, &state);
+        subr = state.subr;
+        args = state.args;
+    }
+    if (PRIMITIVE_P(subr) && HEADER_FLAG(subr) > 0) {
+        struct ScmcProcedure *proc = &scmc_procedures[HEADER_FLAG(subr) - 1];
+        scmc_arguments(args, scmc_bounce_arguments, proc->arity);
+        scmc_bounce = proc->bounce;
+        return SCM_TAIL_CALL;
+    }
+    return apply_procedure(subr, args);
+}
+
+SCM scmc_list(int count, ...)
+{
+    SCM args[SCMC_MAX_ARGUMENTS];
+    SCM result = SCM_NULL;
+    va_list ap;
+    int i;
+
+    va_start(ap, count);
+    for (i = 0; i < count; i++) {
+        args[i] = va_arg(ap, SCM);
+    }
+    va_end(ap);
+    for (i = count - 1; i >= 0; i--) {
+        result = new_cons(args[i], result);
+    }
+    return result;
+}
+
+SCM scmc_global(SCM symbol)
+{
+    SCM value = SYMBOL_VCELL(symbol);
+    if (UNBOUND_P(value)) {
+        set_current_sexp(symbol);
+        scheme_error("invalid reference");
+    }
+    return value;
+}
+
+/**
+ * 引数リストを配列に展開する
+ */
+void scmc_arguments(SCM args, SCM *vector, int count)
+{
+    int i;
+    for (i = 0; i < count; i++) {
+        if (! CONS_P(args)) {
+            scheme_error("argument error");
+        }
+        vector[i] = CAR(args);
+        args = CDR(args);
+    }
+    if (! NULL_P(args)) {
+        scheme_error("argument error");
+    }
+}
+
+SCM scmc_read_constant(char *text)
+{
+    SCM datum;
+    FILE *in = fmemopen(text, strlen(text), "r");
+    if (in == NULL) {
+        error(1, 0, "can't read constant %s\n", text);
+    }
+    datum = Scheme_read(in);
+    fclose(in);
+    return datum;
+}
+
+/* define-record-typeを評価する前なら型は#f */
+SCM scmc_new_record(SCM descriptor, SCM name)
+{
+    if (! RECORD_TYPE_P(descriptor)) {
+        record_type_error(name, descriptor);
+    }
+    return new_record(descriptor);
+}
+
+void scmc_define_procedure(struct _Cell *cell, char *name, SCM (*entry)(SCM),
+                           scmc_bounce_proc bounce, int arity)
+{
+    if (scmc_procedure_count >= 0xFFFF) {
+        error(1, 0, "too many compiled procedures\n");
+    }
+    scmc_procedures = xrealloc(scmc_procedures,
+                               sizeof(struct ScmcProcedure) * (scmc_procedure_count + 1));
+    scmc_procedures[scmc_procedure_count].bounce = bounce;
+    scmc_procedures[scmc_procedure_count].arity = arity;
+    HEADER_TYPE(cell) = CELL_TYPE_PRIMITIVE;
+    HEADER_GC_FLAG(cell) = 0;
+    HEADER_FLAG(cell) = ++scmc_procedure_count;
+    PRIMITIVE_TYPE(cell) = PRIMITIVE_TYPE_LIST_EXPR;
+    PRIMITIVE_NAME(cell) = name;
+    PRIMITIVE_PROC(cell) = entry;
+    SYMBOL_VCELL(intern(name)) = cell;
+}
+
+
+/*==================================================
+  Compiler
+==================================================*/
+/* size of C operand text */
+#define OPERAND_SIZE 64
+
+struct KnownProcedure {
+    SCM name;
+    SCM parameters;
+    SCM body;
+    int arity;
+    int compilable;
+};
+
+struct CompileContext {
+    FILE *out;
+    struct KnownProcedure *procedure; /* NULL on toplevel */
+    int temporary;
+    int indent;
+};
+
+/* compiler state. SCM objects are kept in compiler_roots. */
+enum CompilerRoot {
+    COMPILER_ROOT_FORMS,
+    COMPILER_ROOT_CONSTANTS,
+    COMPILER_ROOT_ASSIGNED,
+    COMPILER_ROOT_PRIMITIVES,
+    COMPILER_ROOT_RECORD_TYPES,
+    COMPILER_ROOT_ALIASES,
+    COMPILER_ROOT_SIZE
+};
+static SCM compiler_roots[COMPILER_ROOT_SIZE];
+static int compiler_roots_registered = FALSE;
+#define FORMS      (compiler_roots[COMPILER_ROOT_FORMS])
+#define CONSTANTS  (compiler_roots[COMPILER_ROOT_CONSTANTS])
+#define ASSIGNED   (compiler_roots[COMPILER_ROOT_ASSIGNED])
+#define PRIMITIVES (compiler_roots[COMPILER_ROOT_PRIMITIVES])
+#define RECORD_TYPES (compiler_roots[COMPILER_ROOT_RECORD_TYPES])
+#define ALIASES    (compiler_roots[COMPILER_ROOT_ALIASES])
+
+static struct KnownProcedure *known_procedures = NULL;
+static int known_procedure_count = 0;
+static int constant_count = 0;
+static int primitive_count = 0;
+static int record_type_count = 0;
+static int record_type_defined = 0;
+static int alias_count = 0;
+static int interpreter_call_count = 0;
+
+static SCM symbol_quote, symbol_setq, symbol_cond, symbol_lambda;
+static SCM symbol_macro, symbol_define_syntax, symbol_begin;
+static SCM symbol_if, symbol_and, symbol_or;
+static SCM symbol_define_record_type;
+
+static void compile_expression(struct CompileContext *ctx, SCM sexp, int tail, char *result);
+static void compile_sequence(struct CompileContext *ctx, SCM body, int tail, char *result);
+static void compile_known_call(struct CompileContext *ctx, struct KnownProcedure *proc,
+                               char (*operands)[OPERAND_SIZE], int tail, char *result);
+static void compile_unknown_call(struct CompileContext *ctx, char *subr,
+                                 char (*operands)[OPERAND_SIZE], int count, int tail, char *result);
+
+/*==================================================
+  Compiler Utility
+==================================================*/
+static int memq_count(SCM obj, SCM lst)
+{
+    int count = 0;
+    SCM kar;
+    FOR_EACH(lst, kar) {
+        if (EQ_P(kar, obj)) count++;
+    }
+    return count;
+}
+
+static void emit(struct CompileContext *ctx, char *format, ...)
+{
+    va_list ap;
+    int i;
+    for (i = 0; i < ctx->indent; i++) {
+        fputs("    ", ctx->out);
+    }
+    va_start(ap, format);
+    vfprintf(ctx->out, format, ap);
+    va_end(ap);
+    fputc('\n', ctx->out);
+}
+
+static void new_temporary(struct CompileContext *ctx, char *name)
+{
+    snprintf(name, OPERAND_SIZE, "t%d", ctx->temporary++);
+}
+
+/*
+ * constants are read back from their printed text, so an uninterned
+ * symbol (a variable renamed by syntax-rules, the loop of do) is replaced
+ * by an interned alias of its own, e.g. tmp => tmp.1
+ */
+static SCM alias_symbols(SCM datum)
+{
+    SCM kar, kdr;
+    if (CONS_P(datum)) {
+        kar = alias_symbols(CAR(datum));
+        kdr = alias_symbols(CDR(datum));
+        if (EQ_P(kar, CAR(datum)) && EQ_P(kdr, CDR(datum))) {
+            return datum;
+        }
+        return new_cons(kar, kdr);
+    }
+    if (SYMBOL_P(datum) && ! EQ_P(intern_bytes(SYMBOL_NAME(datum), SYMBOL_LENGTH(datum)), datum)) {
+        char name[OPERAND_SIZE];
+        SCM lst = ALIASES;
+        SCM alias;
+        FOR_EACH(lst, kar) {
+            if (EQ_P(CAR(kar), datum)) return CDR(kar);
+        }
+        snprintf(name, sizeof(name), "%.*s.%d", OPERAND_SIZE / 2, SYMBOL_NAME(datum), ++alias_count);
+        alias = intern(name);
+        ALIASES = new_cons(new_cons(datum, alias), ALIASES);
+        return alias;
+    }
+    return datum;
+}
+
+/* index of constant table. the same symbol or number shares an entry. */
+static int constant_index(SCM datum)
+{
+    int index = constant_count - 1;
+    SCM lst = CONSTANTS;
+    SCM kar;
+
+    datum = alias_symbols(datum);
+    FOR_EACH(lst, kar) {
+        if (EQ_P(kar, datum) ||
+            (BIGNUM_P(kar) && BIGNUM_P(datum) && integer_compare(kar, datum) == 0) ||
+            (HEAP_FLONUM_P(kar) && HEAP_FLONUM_P(datum) &&
+             HEAP_FLONUM_VALUE(kar) == HEAP_FLONUM_VALUE(datum))) {
+            return index;
+        }
+        index--;
+    }
+    CONSTANTS = new_cons(datum, CONSTANTS);
+    return constant_count++;
+}
+
+static void constant_operand(SCM datum, char *result)
+{
+    if (NULL_P(datum)) {
+        snprintf(result, OPERAND_SIZE, "SCM_NULL");
+    } else if (FALSE_P(datum)) {
+        snprintf(result, OPERAND_SIZE, "SCM_FALSE");
+    } else if (TRUE_P(datum)) {
+        snprintf(result, OPERAND_SIZE, "SCM_TRUE");
+    } else if (UNDEFINED_P(datum)) {
+        snprintf(result, OPERAND_SIZE, "SCM_UNDEFINED");
+    } else {
+        snprintf(result, OPERAND_SIZE, "scmc_const[%d]", constant_index(datum));
+    }
+}
+
+/* index of builtin primitive table */
+static int primitive_index(SCM symbol)
+{
+    int index = primitive_count - 1;
+    SCM lst = PRIMITIVES;
+    SCM kar;
+    FOR_EACH(lst, kar) {
+        if (EQ_P(kar, symbol)) return index;
+        index--;
+    }
+    PRIMITIVES = new_cons(symbol, PRIMITIVES);
+    return primitive_count++;
+}
+
+/* index of record type table. -1 if the type is not defined on toplevel */
+static int record_type_index(SCM descriptor)
+{
+    int index = record_type_count - 1;
+    SCM lst = RECORD_TYPES;
+    SCM kar;
+    FOR_EACH(lst, kar) {
+        if (EQ_P(kar, descriptor)) return index;
+        index--;
+    }
+    return -1;
+}
+
+static int lexical_index(struct CompileContext *ctx, SCM symbol)
+{
+    int index = 0;
+    SCM params;
+    SCM kar;
+    if (ctx->procedure == NULL) return -1;
+    params = ctx->procedure->parameters;
+    FOR_EACH(params, kar) {
+        if (EQ_P(kar, symbol)) return index;
+        index++;
+    }
+    return -1;
+}
+
+static struct KnownProcedure *known_procedure(SCM symbol)
+{
+    int i;
+    for (i = 0; i < known_procedure_count; i++) {
+        if (EQ_P(known_procedures[i].name, symbol) &&
+            known_procedures[i].compilable) {
+            return &known_procedures[i];
+        }
+    }
+    return NULL;
+}
+
+/* special form or global which is never assigned in this file */
+static int global_p(struct CompileContext *ctx, SCM symbol, SCM name)
+{
+    return EQ_P(symbol, name) &&
+        lexical_index(ctx, symbol) < 0 &&
+        memq_count(symbol, ASSIGNED) == 0;
+}
+
+static int atomic_p(SCM sexp)
+{
+    return ! CONS_P(sexp) || EQ_P(CAR(sexp), symbol_quote);
+}
+
+/*==================================================
+  Source Analysis
+==================================================*/
+/* collect all assigned symbols */
+static void scan_assignments(SCM sexp)
+{
+    while (CONS_P(sexp)) {
+        if (EQ_P(CAR(sexp), symbol_quote)) return;
+        if (EQ_P(CAR(sexp), symbol_setq) &&
+            CONS_P(CDR(sexp)) && SYMBOL_P(CADR(sexp))) {
+            ASSIGNED = new_cons(CADR(sexp), ASSIGNED);
+        }
+        scan_assignments(CAR(sexp));
+        sexp = CDR(sexp);
+    }
+}
+
+static int occurs_p(SCM symbol, SCM sexp)
+{
+    while (CONS_P(sexp)) {
+        if (occurs_p(symbol, CAR(sexp))) return TRUE;
+        sexp = CDR(sexp);
+    }
+    return EQ_P(symbol, sexp);
+}
+
+static int assigned_in_p(SCM symbol, SCM sexp)
+{
+    while (CONS_P(sexp)) {
+        if (EQ_P(CAR(sexp), symbol_quote)) return FALSE;
+        if (EQ_P(CAR(sexp), symbol_setq) &&
+            CONS_P(CDR(sexp)) && EQ_P(CADR(sexp), symbol)) {
+            return TRUE;
+        }
+        if (assigned_in_p(symbol, CAR(sexp))) return TRUE;
+        sexp = CDR(sexp);
+    }
+    return FALSE;
+}
+
+/* is symbol referred from an inner lambda? */
+static int captured_p(SCM symbol, SCM sexp)
+{
+    while (CONS_P(sexp)) {
+        if (EQ_P(CAR(sexp), symbol_quote)) return FALSE;
+        if (EQ_P(CAR(sexp), symbol_lambda)) return occurs_p(symbol, sexp);
+        if (captured_p(symbol, CAR(sexp))) return TRUE;
+        sexp = CDR(sexp);
+    }
+    return FALSE;
+}
+
+static int compilable_p(SCM params, SCM body)
+{
+    SCM kar;
+    if (occurs_p(symbol_macro, body)) return FALSE;
+    if (occurs_p(symbol_define_syntax, body)) return FALSE;
+    if (occurs_p(symbol_define_record_type, body)) return FALSE;
+    FOR_EACH(params, kar) {
+        if (! SYMBOL_P(kar)) return FALSE;
+        if (assigned_in_p(kar, body) && captured_p(kar, body)) return FALSE;
+    }
+    return TRUE;
+}
+
+/* (set! name (lambda (params ...) body ...)) */
+static void scan_known_procedure(SCM form)
+{
+    SCM name, lambda;
+    int arity;
+    struct KnownProcedure *proc;
+
+    if (! (LIST_3_P(form) && EQ_P(CAR(form), symbol_setq))) return;
+    name = CADR(form);
+    lambda = CADDR(form);
+    if (! SYMBOL_P(name) || memq_count(name, ASSIGNED) != 1) return;
+    if (! (CONS_P(lambda) && EQ_P(CAR(lambda), symbol_lambda) && CONS_P(CDR(lambda)))) return;
+    arity = list_length(CADR(lambda));
+    if (arity < 0 || arity > SCMC_MAX_ARGUMENTS) return;
+
+    known_procedures = xrealloc(known_procedures,
+                                sizeof(struct KnownProcedure) * (known_procedure_count + 1));
+    proc = &known_procedures[known_procedure_count++];
+    proc->name = name;
+    proc->parameters = CADR(lambda);
+    proc->body = CDDR(lambda);
+    proc->arity = arity;
+    proc->compilable = compilable_p(proc->parameters, proc->body);
+}
+
+/* macro and define-syntax on toplevel: define them now to expand calls in procedures */
+static void scan_macro(SCM form)
+{
+    if (CONS_P(form) && (EQ_P(CAR(form), symbol_macro) || EQ_P(CAR(form), symbol_define_syntax))) {
+        eval(form, TOPLEVEL_ENVIRONMENT);
+    }
+}
+
+/* (define-record-type ...) on toplevel: define it now to know its procedures */
+static void scan_record_type(SCM form)
+{
+    if (! (CONS_P(form) && EQ_P(CAR(form), symbol_define_record_type))) return;
+    eval(form, TOPLEVEL_ENVIRONMENT);
+    RECORD_TYPES = new_cons(SYMBOL_VCELL(CADR(form)), RECORD_TYPES);
+    record_type_count++;
+}
+
+/*==================================================
+  Expression Compiler
+==================================================*/
+/* evaluate operands from left to right */
+static void compile_operands(struct CompileContext *ctx, SCM operands, char (*result)[OPERAND_SIZE])
+{
+    int i = 0;
+    SCM rest;
+    for (; CONS_P(operands); operands = CDR(operands), i++) {
+        int later_side_effect = FALSE;
+        for (rest = CDR(operands); CONS_P(rest); rest = CDR(rest)) {
+            if (! atomic_p(CAR(rest))) later_side_effect = TRUE;
+        }
+        compile_expression(ctx, CAR(operands), FALSE, result[i]);
+        if (later_side_effect && SYMBOL_P(CAR(operands))) {
+            char tmp[OPERAND_SIZE];
+            new_temporary(ctx, tmp);
+            emit(ctx, "SCM %s = %s;", tmp, result[i]);
+            strcpy(result[i], tmp);
+        }
+    }
+}
+
+static void operand_list(char *buf, size_t size, char (*operands)[OPERAND_SIZE], int count)
+{
+    int i;
+    buf[0] = '\0';
+    for (i = 0; i < count; i++) {
+        if (i > 0) strncat(buf, ", ", size - strlen(buf) - 1);
+        strncat(buf, operands[i], size - strlen(buf) - 1);
+    }
+}
+
+/* tail position returns, others store to result */
+static void compile_value(struct CompileContext *ctx, char *value, int tail, char *result)
+{
+    if (tail) {
+        emit(ctx, "return %s;", value);
+    } else {
+        new_temporary(ctx, result);
+        emit(ctx, "SCM %s = %s;", result, value);
+    }
+}
+
+static void compile_symbol(struct CompileContext *ctx, SCM sexp, int tail, char *result)
+{
+    char value[OPERAND_SIZE];
+    int index = lexical_index(ctx, sexp);
+    if (index >= 0) {
+        snprintf(value, OPERAND_SIZE, "v%d", index);
+    } else {
+        snprintf(value, OPERAND_SIZE, "scmc_global(scmc_const[%d])", constant_index(sexp));
+    }
+    if (tail) {
+        emit(ctx, "return %s;", value);
+    } else {
+        strcpy(result, value);
+    }
+}
+
+static void compile_constant(struct CompileContext *ctx, SCM datum, int tail, char *result)
+{
+    char value[OPERAND_SIZE];
+    constant_operand(datum, value);
+    if (tail) {
+        emit(ctx, "return %s;", value);
+    } else {
+        strcpy(result, value);
+    }
+}
+
+static void compile_setq(struct CompileContext *ctx, SCM sexp, int tail, char *result)
+{
+    char value[OPERAND_SIZE];
+    SCM var = CADR(sexp);
+    int index = lexical_index(ctx, var);
+
+    compile_expression(ctx, CADDR(sexp), FALSE, value);
+    if (index >= 0) {
+        emit(ctx, "v%d = %s;", index, value);
+        snprintf(value, OPERAND_SIZE, "v%d", index);
+    } else {
+        emit(ctx, "SYMBOL_VCELL(scmc_const[%d]) = %s;", constant_index(var), value);
+    }
+    if (tail) {
+        emit(ctx, "return %s;", value);
+    } else {
+        compile_value(ctx, value, FALSE, result);
+    }
+}
+
+/*
+ * SCM r = SCM_UNDEFINED;
+ * do {
+ *     <test> if (! FALSE_P(test)) { <body> r = ...; break; }
+ *     ...
+ * } while (0);
+ */
+static void compile_cond(struct CompileContext *ctx, SCM clauses, int tail, char *result)
+{
+    char test[OPERAND_SIZE];
+    char value[OPERAND_SIZE];
+    SCM clause;
+
+    if (! tail) {
+        new_temporary(ctx, result);
+        emit(ctx, "SCM %s = SCM_UNDEFINED;", result);
+    }
+    emit(ctx, "do {");
+    ctx->indent++;
+    FOR_EACH(clauses, clause) {
+        SCM body = CDR(clause);
+        if (EQ_P(CAR(clause), SCM_SYMBOL_ELSE)) {
+            emit(ctx, "{");
+            strcpy(test, "SCM_TRUE");
+        } else {
+            compile_expression(ctx, CAR(clause), FALSE, test);
+            emit(ctx, "if (! FALSE_P(%s)) {", test);
+        }
+        ctx->indent++;
+        if (LIST_2_P(body) && EQ_P(CAR(body), SCM_SYMBOL_DOUBLE_ARROW)) {
+            /* (<test> => <receiver>) */
+            SCM receiver = CADR(body);
+            struct KnownProcedure *proc = NULL;
+            char operands[1][OPERAND_SIZE];
+            char subr[OPERAND_SIZE];
+            strcpy(operands[0], test);
+            if (SYMBOL_P(receiver) && lexical_index(ctx, receiver) < 0) {
+                proc = known_procedure(receiver);
+            }
+            if (proc != NULL && proc->arity == 1) {
+                compile_known_call(ctx, proc, operands, tail, value);
+            } else {
+                compile_expression(ctx, receiver, FALSE, subr);
+                compile_unknown_call(ctx, subr, operands, 1, tail, value);
+            }
+            if (! tail) {
+                emit(ctx, "%s = %s;", result, value);
+            }
+        } else if (NULL_P(body)) {
+            /* (<test>) の値はtestの値 */
+            compile_value(ctx, test, tail, value);
+            if (! tail) {
+                emit(ctx, "%s = %s;", result, value);
+            }
+        } else {
+            compile_sequence(ctx, body, tail, value);
+            if (! tail) {
+                emit(ctx, "%s = %s;", result, value);
+            }
+        }
+        if (! tail) {
+            emit(ctx, "break;");
+        }
+        ctx->indent--;
+        emit(ctx, "}");
+    }
+    ctx->indent--;
+    emit(ctx, "} while (0);");
+    if (tail) {
+        emit(ctx, "return SCM_UNDEFINED;");
+    }
+}
+
+/* (if t c a) is compiled as (cond (t c) (else a)) */
+static void compile_if(struct CompileContext *ctx, SCM operands, int tail, char *result)
+{
+    SCM clauses;
+    if (! (LIST_2_P(operands) || LIST_3_P(operands))) {
+        scheme_error("compile error: if");
+    }
+    clauses = NULL_P(CDDR(operands)) ? SCM_NULL
+        : new_cons(new_cons(SCM_SYMBOL_ELSE, CDDR(operands)), SCM_NULL);
+    clauses = new_cons(new_cons(CAR(operands), new_cons(CADR(operands), SCM_NULL)), clauses);
+    compile_cond(ctx, clauses, tail, result);
+}
+
+/*
+ * SCM r = SCM_TRUE;
+ * do {
+ *     r = <e1>; if (FALSE_P(r)) break;     (and)
+ *     r = <e1>; if (! FALSE_P(r)) break;   (or)
+ *     ...
+ *     r = <en>;
+ * } while (0);
+ */
+static void compile_logical(struct CompileContext *ctx, SCM operands, int and_p,
+                            int tail, char *result)
+{
+    char value[OPERAND_SIZE];
+
+    if (NULL_P(operands)) {
+        compile_constant(ctx, and_p ? SCM_TRUE : SCM_FALSE, tail, result);
+        return;
+    }
+    if (! tail) {
+        new_temporary(ctx, result);
+        emit(ctx, "SCM %s = SCM_UNDEFINED;", result);
+    }
+    emit(ctx, "do {");
+    ctx->indent++;
+    for (; CONS_P(CDR(operands)); operands = CDR(operands)) {
+        compile_expression(ctx, CAR(operands), FALSE, value);
+        if (tail) {
+            emit(ctx, "if (%sFALSE_P(%s)) return %s;", and_p ? "" : "! ", value, value);
+        } else {
+            emit(ctx, "%s = %s;", result, value);
+            emit(ctx, "if (%sFALSE_P(%s)) break;", and_p ? "" : "! ", value);
+        }
+    }
+    compile_expression(ctx, CAR(operands), tail, value);
+    if (! tail) {
+        emit(ctx, "%s = %s;", result, value);
+    }
+    ctx->indent--;
+    emit(ctx, "} while (0);");
+}
+
+/* inner lambda is made by the interpreter */
+static void compile_lambda(struct CompileContext *ctx, SCM sexp, int tail, char *result)
+{
+    char value[OPERAND_SIZE * 4];
+    char args[OPERAND_SIZE * 2];
+    SCM captured = SCM_NULL;
+    int count = 0;
+
+    if (ctx->procedure != NULL) {
+        SCM params = ctx->procedure->parameters;
+        SCM kar;
+        FOR_EACH(params, kar) {
+            if (occurs_p(kar, sexp)) {
+                captured = new_cons(kar, captured);
+                count++;
+            }
+        }
+    }
+    if (count == 0) {
+        snprintf(value, sizeof(value), "eval(scmc_const[%d], TOPLEVEL_ENVIRONMENT)",
+                 constant_index(sexp));
+    } else {
+        SCM kar;
+        SCM lst = captured;
+        args[0] = '\0';
+        FOR_EACH(lst, kar) {
+            char var[OPERAND_SIZE];
+            snprintf(var, OPERAND_SIZE, ", v%d", lexical_index(ctx, kar));
+            strncat(args, var, sizeof(args) - strlen(args) - 1);
+        }
+        snprintf(value, sizeof(value),
+                 "eval(scmc_const[%d], extend_environment(scmc_const[%d], scmc_list(%d%s), TOPLEVEL_ENVIRONMENT))",
+                 constant_index(sexp), constant_index(captured), count, args);
+    }
+    compile_value(ctx, value, tail, result);
+}
+
+static void compile_known_call(struct CompileContext *ctx, struct KnownProcedure *proc,
+                               char (*operands)[OPERAND_SIZE], int tail, char *result)
+{
+    char args[OPERAND_SIZE * SCMC_MAX_ARGUMENTS];
+    int index = proc - known_procedures;
+    int i;
+
+    if (tail && ctx->procedure == proc) {
+        /* self tail call */
+        char tmp[SCMC_MAX_ARGUMENTS][OPERAND_SIZE];
+        for (i = 0; i < proc->arity; i++) {
+            new_temporary(ctx, tmp[i]);
+            emit(ctx, "SCM %s = %s;", tmp[i], operands[i]);
+        }
+        for (i = 0; i < proc->arity; i++) {
+            emit(ctx, "v%d = %s;", i, tmp[i]);
+        }
+        emit(ctx, "goto entry;");
+    } else if (tail && ctx->procedure != NULL) {
+        for (i = 0; i < proc->arity; i++) {
+            emit(ctx, "scmc_bounce_arguments[%d] = %s;", i, operands[i]);
+        }
+        emit(ctx, "scmc_bounce = scmc_bounce_%d;", index);
+        emit(ctx, "return SCM_TAIL_CALL;");
+    } else {
+        char value[OPERAND_SIZE * (SCMC_MAX_ARGUMENTS + 1)];
+        operand_list(args, sizeof(args), operands, proc->arity);
+        snprintf(value, sizeof(value), "scmc_trampoline(scmc_proc_%d(%s))", index, args);
+        compile_value(ctx, value, tail, result);
+    }
+}
+
+/* the interpreter applies it. a tail call is bounced to the trampoline */
+static void compile_unknown_call(struct CompileContext *ctx, char *subr,
+                                 char (*operands)[OPERAND_SIZE], int count, int tail, char *result)
+{
+    char args[OPERAND_SIZE * SCMC_MAX_ARGUMENTS];
+    char list[OPERAND_SIZE * (SCMC_MAX_ARGUMENTS + 1)];
+    char value[OPERAND_SIZE * (SCMC_MAX_ARGUMENTS + 2)];
+
+    interpreter_call_count++;
+    operand_list(args, sizeof(args), operands, count);
+    snprintf(list, sizeof(list), "scmc_list(%d%s%s)", count, count > 0 ? ", " : "", args);
+    if (tail && ctx->procedure != NULL) {
+        emit(ctx, "scmc_bounce_arguments[0] = %s;", subr);
+        emit(ctx, "scmc_bounce_arguments[1] = %s;", list);
+        emit(ctx, "scmc_bounce = scmc_bounce_apply;");
+        emit(ctx, "return SCM_TAIL_CALL;");
+    } else {
+        snprintf(value, sizeof(value), "scmc_apply(%s, %s)", subr, list);
+        compile_value(ctx, value, tail, result);
+    }
+}
+
+static void compile_primitive_call(struct CompileContext *ctx, SCM subr, SCM symbol,
+                                   char (*operands)[OPERAND_SIZE], int count, int tail, char *result)
+{
+    char args[OPERAND_SIZE * SCMC_MAX_ARGUMENTS];
+    char value[OPERAND_SIZE * (SCMC_MAX_ARGUMENTS + 1)];
+    int index = primitive_index(symbol);
+
+    operand_list(args, sizeof(args), operands, count);
+    if (LIST_EXPR_P(subr)) {
+        snprintf(value, sizeof(value), "scmc_primitive[%d](scmc_list(%d%s%s))",
+                 index, count, count > 0 ? ", " : "", args);
+    } else {
+        snprintf(value, sizeof(value), "scmc_primitive[%d](%s)", index, args);
+    }
+    compile_value(ctx, value, tail, result);
+}
+
+/* type check and slot access in place */
+static void compile_record_call(struct CompileContext *ctx, SCM proc,
+                                char (*operands)[OPERAND_SIZE], int tail, char *result)
+{
+    char value[OPERAND_SIZE * 2];
+    char obj[OPERAND_SIZE];
+    int type = record_type_index(RECORD_PROCEDURE_DESCRIPTOR(proc));
+    int name = constant_index(RECORD_PROCEDURE_NAME(proc));
+    int index = RECORD_PROCEDURE_INDEX(proc);
+    SCM slots;
+    int i;
+
+    switch (RECORD_PROCEDURE_KIND(proc)) {
+    case RECORD_CONSTRUCTOR:
+        new_temporary(ctx, obj);
+        emit(ctx, "SCM %s = scmc_new_record(scmc_record_type[%d], scmc_const[%d]);", obj, type, name);
+        slots = RECORD_PROCEDURE_SLOTS(proc);
+        for (i = 0; CONS_P(slots); slots = CDR(slots), i++) {
+            emit(ctx, "RECORD_REF(%s, %d) = %s;", obj, (int) FIXNUM_VALUE(CAR(slots)), operands[i]);
+        }
+        compile_value(ctx, obj, tail, result);
+        return;
+    case RECORD_PREDICATE:
+        snprintf(value, sizeof(value), "C_TO_SCM_BOOLEAN(RECORD_INSTANCE_P(%s, scmc_record_type[%d]))",
+                 operands[0], type);
+        compile_value(ctx, value, tail, result);
+        return;
+    case RECORD_ACCESSOR:
+    case RECORD_MODIFIER:
+        new_temporary(ctx, obj);
+        emit(ctx, "SCM %s = %s;", obj, operands[0]);
+        emit(ctx, "if (! RECORD_INSTANCE_P(%s, scmc_record_type[%d])) record_type_error(scmc_const[%d], scmc_record_type[%d]);",
+             obj, type, name, type);
+        if (RECORD_PROCEDURE_KIND(proc) == RECORD_ACCESSOR) {
+            snprintf(value, sizeof(value), "RECORD_REF(%s, %d)", obj, index);
+        } else {
+            emit(ctx, "RECORD_REF(%s, %d) = %s;", obj, index, operands[1]);
+            snprintf(value, sizeof(value), "SCM_UNDEFINED");
+        }
+        compile_value(ctx, value, tail, result);
+        return;
+    }
+}
+
+static int record_procedure_arity(SCM proc)
+{
+    switch (RECORD_PROCEDURE_KIND(proc)) {
+    case RECORD_CONSTRUCTOR: return list_length(RECORD_PROCEDURE_SLOTS(proc));
+    case RECORD_PREDICATE:   return 1;
+    case RECORD_ACCESSOR:    return 1;
+    case RECORD_MODIFIER:    return 2;
+    }
+    return -1;
+}
+
+static int primitive_arity(SCM subr)
+{
+    switch (PRIMITIVE_TYPE(subr)) {
+    case PRIMITIVE_TYPE_EXPR_0: return 0;
+    case PRIMITIVE_TYPE_EXPR_1: return 1;
+    case PRIMITIVE_TYPE_EXPR_2: return 2;
+    case PRIMITIVE_TYPE_EXPR_3: return 3;
+    default:                    return -1;
+    }
+}
+
+static void compile_application(struct CompileContext *ctx, SCM sexp, int tail, char *result)
+{
+    char operands[SCMC_MAX_ARGUMENTS][OPERAND_SIZE];
+    char value[OPERAND_SIZE * (SCMC_MAX_ARGUMENTS + 2)];
+    char subr[OPERAND_SIZE];
+    SCM head = CAR(sexp);
+    int count = list_length(CDR(sexp));
+
+    if (count < 0 || count > SCMC_MAX_ARGUMENTS) {
+        /* left to the interpreter */
+        if (ctx->procedure != NULL) {
+            scheme_error("compile error: too many arguments");
+        }
+        snprintf(value, sizeof(value), "eval(scmc_const[%d], TOPLEVEL_ENVIRONMENT)",
+                 constant_index(sexp));
+        compile_value(ctx, value, tail, result);
+        return;
+    }
+
+    if (SYMBOL_P(head) && lexical_index(ctx, head) < 0) {
+        struct KnownProcedure *proc = known_procedure(head);
+        SCM global = SYMBOL_VCELL(head);
+        if (proc != NULL && proc->arity == count) {
+            compile_operands(ctx, CDR(sexp), operands);
+            compile_known_call(ctx, proc, operands, tail, result);
+            return;
+        }
+        if (proc == NULL && PRIMITIVE_P(global) && ! SPECIAL_FORM_P(global) &&
+            memq_count(head, ASSIGNED) == 0 &&
+            (LIST_EXPR_P(global) || primitive_arity(global) == count)) {
+            compile_operands(ctx, CDR(sexp), operands);
+            compile_primitive_call(ctx, global, head, operands, count, tail, result);
+            return;
+        }
+        if (proc == NULL && RECORD_PROCEDURE_P(global) && memq_count(head, ASSIGNED) == 0 &&
+            record_type_index(RECORD_PROCEDURE_DESCRIPTOR(global)) >= 0 &&
+            record_procedure_arity(global) == count) {
+            compile_operands(ctx, CDR(sexp), operands);
+            compile_record_call(ctx, global, operands, tail, result);
+            return;
+        }
+    }
+
+    compile_expression(ctx, head, FALSE, subr);
+    if (SYMBOL_P(head) && count > 0) {
+        char tmp[OPERAND_SIZE];
+        new_temporary(ctx, tmp);
+        emit(ctx, "SCM %s = %s;", tmp, subr);
+        strcpy(subr, tmp);
+    }
+    compile_operands(ctx, CDR(sexp), operands);
+    compile_unknown_call(ctx, subr, operands, count, tail, result);
+}
+
+static void compile_sequence(struct CompileContext *ctx, SCM body, int tail, char *result)
+{
+    char value[OPERAND_SIZE];
+    if (NULL_P(body)) {
+        compile_constant(ctx, SCM_UNDEFINED, tail, result);
+        return;
+    }
+    while (CONS_P(CDR(body))) {
+        compile_expression(ctx, CAR(body), FALSE, value);
+        emit(ctx, "(void) %s;", value); /* 値は捨てる */
+        body = CDR(body);
+    }
+    compile_expression(ctx, CAR(body), tail, result);
+}
+
+static void compile_expression(struct CompileContext *ctx, SCM sexp, int tail, char *result)
+{
+    SCM head;
+
+    if (SYMBOL_P(sexp)) {
+        compile_symbol(ctx, sexp, tail, result);
+        return;
+    }
+    if (! CONS_P(sexp)) {
+        compile_constant(ctx, sexp, tail, result);
+        return;
+    }
+
+    head = CAR(sexp);
+    if (SYMBOL_P(head) && lexical_index(ctx, head) < 0) {
+        if (global_p(ctx, head, symbol_quote)) {
+            compile_constant(ctx, CADR(sexp), tail, result);
+            return;
+        }
+        if (global_p(ctx, head, symbol_setq)) {
+            compile_setq(ctx, sexp, tail, result);
+            return;
+        }
+        if (global_p(ctx, head, symbol_cond)) {
+            compile_cond(ctx, CDR(sexp), tail, result);
+            return;
+        }
+        if (global_p(ctx, head, symbol_lambda)) {
+            compile_lambda(ctx, sexp, tail, result);
+            return;
+        }
+        if (global_p(ctx, head, symbol_begin)) {
+            compile_sequence(ctx, CDR(sexp), tail, result);
+            return;
+        }
+        if (global_p(ctx, head, symbol_if)) {
+            compile_if(ctx, CDR(sexp), tail, result);
+            return;
+        }
+        if (global_p(ctx, head, symbol_and) || global_p(ctx, head, symbol_or)) {
+            compile_logical(ctx, CDR(sexp), EQ_P(head, symbol_and), tail, result);
+            return;
+        }
+        if (global_p(ctx, head, symbol_define_record_type)) {
+            /* not on toplevel: left to the interpreter */
+            char value[OPERAND_SIZE];
+            interpreter_call_count++;
+            snprintf(value, sizeof(value), "eval(scmc_const[%d], TOPLEVEL_ENVIRONMENT)",
+                     constant_index(sexp));
+            compile_value(ctx, value, tail, result);
+            return;
+        }
+        if (PRIMITIVE_P(SYMBOL_VCELL(head)) && SPECIAL_FORM_P(SYMBOL_VCELL(head))) {
+            /* let, do, ...: compile the lambda form */
+            SCM derived = derived_syntax_expand(SYMBOL_VCELL(head), CDR(sexp));
+            if (derived != NULL) {
+                compile_expression(ctx, derived, tail, result);
+                return;
+            }
+        }
+        if (MACRO_P(SYMBOL_VCELL(head))) {
+            /* expand at compile time */
+            compile_expression(ctx, expand_macro(SYMBOL_VCELL(head), CDR(sexp)), tail, result);
+            return;
+        }
+    }
+    compile_application(ctx, sexp, tail, result);
+}
+
+/*==================================================
+  File Compiler
+==================================================*/
+static void compile_procedure(FILE *out, struct KnownProcedure *proc)
+{
+    struct CompileContext ctx = { out, proc, 0, 1 };
+    char params[OPERAND_SIZE * SCMC_MAX_ARGUMENTS];
+    char result[OPERAND_SIZE];
+    int index = proc - known_procedures;
+    int i;
+
+    params[0] = '\0';
+    for (i = 0; i < proc->arity; i++) {
+        char param[OPERAND_SIZE];
+        snprintf(param, OPERAND_SIZE, "%sSCM v%d", i > 0 ? ", " : "", i);
+        strcat(params, param);
+    }
+    fprintf(out, "/* %s */\n", SYMBOL_NAME(proc->name));
+    fprintf(out, "static SCM scmc_proc_%d(%s)\n{\n", index, proc->arity > 0 ? params : "void");
+    fprintf(out, " entry: __attribute__((unused));\n");
+    compile_sequence(&ctx, proc->body, TRUE, result);
+    fprintf(out, "}\n");
+
+    fprintf(out, "static SCM scmc_bounce_%d(SCM *a)\n{\n", index);
+    fprintf(out, "    return scmc_proc_%d(", index);
+    for (i = 0; i < proc->arity; i++) {
+        fprintf(out, "%sa[%d]", i > 0 ? ", " : "", i);
+    }
+    fprintf(out, ");\n}\n");
+
+    fprintf(out, "static SCM scmc_entry_%d(SCM args)\n{\n", index);
+    fprintf(out, "    SCM a[%d];\n", proc->arity > 0 ? proc->arity : 1);
+    fprintf(out, "    scmc_arguments(args, a, %d);\n", proc->arity);
+    fprintf(out, "    return scmc_trampoline(scmc_bounce_%d(a));\n}\n\n", index);
+}
+
+/* compile proc only to see whether it calls the interpreter */
+static int calls_interpreter_p(struct KnownProcedure *proc)
+{
+    SCM constants = CONSTANTS, primitives = PRIMITIVES;
+    int saved_constant_count = constant_count, saved_primitive_count = primitive_count;
+    char *code = NULL;
+    size_t code_size = 0;
+    FILE *out = open_memstream(&code, &code_size);
+
+    interpreter_call_count = 0;
+    compile_procedure(out, proc);
+    fclose(out);
+    free(code);
+    /* 表は本番のcompileで作り直す */
+    CONSTANTS = constants;
+    PRIMITIVES = primitives;
+    constant_count = saved_constant_count;
+    primitive_count = saved_primitive_count;
+    return interpreter_call_count > 0;
+}
+
+static void compile_toplevel_form(struct CompileContext *ctx, SCM form)
+{
+    char result[OPERAND_SIZE];
+
+    if (LIST_3_P(form) && EQ_P(CAR(form), symbol_setq) &&
+        known_procedure(CADR(form)) != NULL) {
+        /* bound in scmc_initialize */
+        return;
+    }
+    if (CONS_P(form) && (EQ_P(CAR(form), symbol_macro) || EQ_P(CAR(form), symbol_define_syntax))) {
+        /* defined at compile time by scan_macro, and again at run time */
+        emit(ctx, "eval(scmc_const[%d], TOPLEVEL_ENVIRONMENT);", constant_index(form));
+        return;
+    }
+    if (CONS_P(form) && EQ_P(CAR(form), symbol_define_record_type)) {
+        /* defined at compile time by scan_record_type */
+        emit(ctx, "eval(scmc_const[%d], TOPLEVEL_ENVIRONMENT);", constant_index(form));
+        emit(ctx, "scmc_record_type[%d] = scmc_global(scmc_const[%d]);",
+             record_type_defined++, constant_index(CADR(form)));
+        return;
+    }
+    if (LIST_3_P(form) && EQ_P(CAR(form), symbol_setq)) {
+        /* 値は表示しないので一時変数に取らない */
+        compile_expression(ctx, CADDR(form), FALSE, result);
+        emit(ctx, "SYMBOL_VCELL(scmc_const[%d]) = %s;", constant_index(CADR(form)), result);
+        return;
+    }
+    compile_expression(ctx, form, FALSE, result);
+    emit(ctx, "print(%s, stdout);", result);
+    emit(ctx, "putc('\\n', stdout);");
+}
+
+static void write_c_string(FILE *out, SCM datum)
+{
+    char *text = NULL;
+    size_t size = 0;
+    FILE *mem = open_memstream(&text, &size);
+    char *p;
+
+    print(datum, mem);
+    fclose(mem);
+    fputc('"', out);
+    for (p = text; *p; p++) {
+        if (*p == '"' || *p == '\\') fputc('\\', out);
+        if (*p == '\n') { fputs("\\n", out); continue; }
+        fputc(*p, out);
+    }
+    fputc('"', out);
+    free(text);
+}
+
+static void compiler_initialize(void)
+{
+    int i;
+    if (! compiler_roots_registered) {
+        scm_gc_register_roots(compiler_roots, COMPILER_ROOT_SIZE);
+        compiler_roots_registered = TRUE;
+    }
+    for (i = 0; i < COMPILER_ROOT_SIZE; i++) {
+        compiler_roots[i] = SCM_NULL;
+    }
+    free(known_procedures);
+    known_procedures = NULL;
+    known_procedure_count = 0;
+    constant_count = 0;
+    primitive_count = 0;
+    record_type_count = 0;
+    record_type_defined = 0;
+    alias_count = 0;
+
+    symbol_quote = SCM_SYMBOL_QUOTE;
+    symbol_setq = intern("set!");
+    symbol_cond = intern("cond");
+    symbol_lambda = intern("lambda");
+    symbol_macro = intern("macro");
+    symbol_define_syntax = intern("define-syntax");
+    symbol_begin = intern("begin");
+    symbol_if = intern("if");
+    symbol_and = intern("and");
+    symbol_or = intern("or");
+    symbol_define_record_type = intern("define-record-type");
+}
+
+/**
+ * inputをCのソースに変換してoutに出力する
+ */
+int compile_file(char *input, FILE *out, char *module_name)
+{
+    FILE *in = fopen(input, "r");
+    char *code = NULL;
+    size_t code_size = 0;
+    struct CompileContext toplevel = { NULL, NULL, 0, 1 };
+    SCM form, forms, constants, primitives;
+    int i, compiled_count = 0;
+
+    if (in == NULL) {
+        return FALSE;
+    }
+    compiler_initialize();
+
+    /* read all forms */
+    while (! EOF_P(form = Scheme_read(in))) {
+        FORMS = new_cons(form, FORMS);
+    }
+    fclose(in);
+    {
+        SCM r = SCM_NULL;
+        forms = FORMS;
+        while (CONS_P(forms)) {
+            r = new_cons(CAR(forms), r);
+            forms = CDR(forms);
+        }
+        FORMS = r;
+    }
+
+    /* analysis */
+    scan_assignments(FORMS);
+    forms = FORMS;
+    FOR_EACH(forms, form) {
+        scan_known_procedure(form);
+        scan_macro(form);
+        scan_record_type(form);
+    }
+    for (i = 0; i < known_procedure_count; i++) {
+        /* a macro can assign a captured parameter: check the expanded body too */
+        struct KnownProcedure *proc = &known_procedures[i];
+        if (proc->compilable) {
+            SCM lambda = new_cons(symbol_lambda, new_cons(proc->parameters, proc->body));
+            lambda = expand(tree_copy(lambda));
+            proc->compilable = compilable_p(CADR(lambda), CDDR(lambda));
+        }
+    }
+    if (occurs_p(intern("call/cc"), FORMS) ||
+        occurs_p(intern("call-with-current-continuation"), FORMS)) {
+        /* 呼び出し先が解釈実行に戻されると呼び出し元も調べ直す */
+        int changed = TRUE;
+        while (changed) {
+            changed = FALSE;
+            for (i = 0; i < known_procedure_count; i++) {
+                struct KnownProcedure *proc = &known_procedures[i];
+                if (proc->compilable && calls_interpreter_p(proc)) {
+                    proc->compilable = FALSE;
+                    changed = TRUE;
+                }
+            }
+        }
+    }
+
+    /* code */
+    toplevel.out = open_memstream(&code, &code_size);
+    for (i = 0; i < known_procedure_count; i++) {
+        if (known_procedures[i].compilable) {
+            struct CompileContext ctx = { toplevel.out, NULL, 0, 0 };
+            compiled_count++;
+            ctx.procedure = &known_procedures[i];
+            compile_procedure(toplevel.out, ctx.procedure);
+        }
+    }
+    fprintf(toplevel.out, "static SCM scmc_toplevel(SCM arg)\n{\n");
+    forms = FORMS;
+    FOR_EACH(forms, form) {
+        compile_toplevel_form(&toplevel, form);
+    }
+    fprintf(toplevel.out, "    return SCM_TRUE;\n}\n\n");
+    fclose(toplevel.out);
+
+    /* header */
+    fprintf(out, "/* generated by thesischeme -compile %s */\n", input);
+    fprintf(out, "#include \"scheme.h\"\n\n");
+    fprintf(out, "static SCM scmc_const[%d];\n", constant_count > 0 ? constant_count : 1);
+    if (primitive_count > 0)
+        fprintf(out, "static SCM (*scmc_primitive[%d])();\n", primitive_count);
+    if (record_type_count > 0)
+        fprintf(out, "static SCM scmc_record_type[%d];\n", record_type_count);
+    if (compiled_count > 0)
+        fprintf(out, "static struct _Cell scmc_cell[%d];\n", known_procedure_count);
+    fputc('\n', out);
+    for (i = 0; i < known_procedure_count; i++) {
+        struct KnownProcedure *proc = &known_procedures[i];
+        int j;
+        if (! proc->compilable) continue;
+        fprintf(out, "static SCM scmc_proc_%d(", i);
+        for (j = 0; j < proc->arity; j++) {
+            fprintf(out, "%sSCM", j > 0 ? ", " : "");
+        }
+        fprintf(out, "%s);\n", proc->arity > 0 ? "" : "void");
+        fprintf(out, "static SCM scmc_bounce_%d(SCM *a);\n", i);
+    }
+    fputc('\n', out);
+    fputs(code, out);
+    free(code);
+
+    /* initialize */
+    fprintf(out, "static void scmc_initialize(void)\n{\n");
+    fprintf(out, "    scm_gc_register_roots(scmc_const, %d);\n", constant_count);
+    constants = CONSTANTS;
+    for (i = constant_count - 1; CONS_P(constants); constants = CDR(constants), i--) {
+        fprintf(out, "    scmc_const[%d] = scmc_read_constant(", i);
+        write_c_string(out, CAR(constants));
+        fprintf(out, ");\n");
+    }
+    for (i = 0; i < record_type_count; i++) {
+        fprintf(out, "    scmc_record_type[%d] = SCM_FALSE;\n", i);
+    }
+    if (record_type_count > 0) {
+        fprintf(out, "    scm_gc_register_roots(scmc_record_type, %d);\n", record_type_count);
+    }
+    primitives = PRIMITIVES;
+    for (i = primitive_count - 1; CONS_P(primitives); primitives = CDR(primitives), i--) {
+        fprintf(out, "    scmc_primitive[%d] = PRIMITIVE_PROC(scmc_global(intern(\"%s\")));\n",
+                i, SYMBOL_NAME(CAR(primitives)));
+    }
+    for (i = 0; i < known_procedure_count; i++) {
+        if (! known_procedures[i].compilable) continue;
+        fprintf(out, "    scmc_define_procedure(&scmc_cell[%d], \"%s\", scmc_entry_%d, scmc_bounce_%d, %d);\n",
+                i, SYMBOL_NAME(known_procedures[i].name), i, i, known_procedures[i].arity);
+    }
+    fprintf(out, "}\n\n");
+
+    /* module entry */
+    fprintf(out, "SCM scheme_module_%s_initialize(void)\n{\n", module_name);
+    fprintf(out, "    SCM result;\n");
+    fprintf(out, "    scmc_initialize();\n");
+    fprintf(out, "    result = internal_catch(scmc_toplevel, SCM_NULL);\n");
+    fprintf(out, "    if (get_error_message() != NULL) {\n");
+    fprintf(out, "        fprintf(stderr, \"%%s \", get_error_message());\n");
+    fprintf(out, "        if (get_current_sexp() != NULL) print(get_current_sexp(), stderr);\n");
+    fprintf(out, "        putc('\\n', stderr);\n");
+    fprintf(out, "        return NULL;\n");
+    fprintf(out, "    }\n");
+    fprintf(out, "    return result;\n}\n\n");
+    fprintf(out, "#ifndef SCHEME_COMPILED_MODULE\n");
+    fprintf(out, "int main(int argc, char **argv)\n{\n");
+    fprintf(out, "    SCM result;\n");
+    fprintf(out, "    SCHEME_STACK_INITIALIZE;\n");
+    fprintf(out, "    scheme_initialize();\n");
+    fprintf(out, "    result = scheme_module_%s_initialize();\n", module_name);
+    fprintf(out, "    scheme_finalize();\n");
+    fprintf(out, "    return result == NULL ? EXIT_FAILURE : EXIT_SUCCESS;\n}\n");
+    fprintf(out, "#endif /* SCHEME_COMPILED_MODULE */\n");
+
+    compiler_initialize();
+    return TRUE;
+}
@@ -23,20 +23,25 @@ SCM extend_environment(SCM parameters, SCM arguments, SCM env)
     return new_cons(frame, env);
 }
 
+/**
+ * frameの中のvarの値の場所
+ * 残余引数(params . rest)は最後に辿った引数のcdrを指す
+ * (CDR_REFはCDR-coded listを分けるので、残余引数の時だけ取る)
+ */
 SCM* lookup_frame(SCM var, SCM frame)
 {
     SCM parameters;
-    SCM arguments;
-    for (parameters = CAR(frame), arguments = new_cons(SCM_NULL, CDR(frame));
-         CONS_P(parameters);
-         parameters = CDR(parameters), arguments = CDR(arguments) )
-    {
+    SCM last = frame;
+    SCM arguments = CDR(frame);
+    for (parameters = CAR(frame); CONS_P(parameters); parameters = CDR(parameters)) {
         if (EQ_P(CAR(parameters), var)) {
-            return CAR_REF(CDR(arguments));
+            return CAR_REF(arguments);
         }
+        last = arguments;
+        arguments = CDR(arguments);
     }
     if (EQ_P(parameters, var)) {
-        return CAR_REF(arguments);
+        return CDR_REF(last);
     }
     return NULL;
 }
@@ -66,7 +71,37 @@ SCM symbol_value(SCM var, SCM env)
         }
         return v;
     }
-    return *value;
+    return BOX_P(*value) ? BOX_VALUE(*value) : *value;
+}
+
+/**
+ * flat closureの環境。自由変数だけを持つ一つのframeをトップレベルに繋ぐ
+ * copiedは値をcopyする。boxedは代入される変数で、定義したframeの値を
+ * boxに入れ替えて共有する
+ */
+SCM flat_environment(SCM copied, SCM boxed, SCM env)
+{
+    SCM parameters = SCM_NULL, arguments = SCM_NULL;
+    SCM *ref;
+    for (; CONS_P(copied); copied = CDR(copied)) {
+        parameters = new_cons(CAR(copied), parameters);
+        arguments = new_cons(symbol_value(CAR(copied), env), arguments);
+    }
+    for (; CONS_P(boxed); boxed = CDR(boxed)) {
+        ref = lookup_environment(CAR(boxed), env);
+        if (ref == NULL) {
+            scheme_error("invalid reference");
+        }
+        if (! BOX_P(*ref)) {
+            *ref = new_box(*ref);
+        }
+        parameters = new_cons(CAR(boxed), parameters);
+        arguments = new_cons(*ref, arguments);
+    }
+    if (NULL_P(parameters)) {
+        return TOPLEVEL_ENVIRONMENT;
+    }
+    return extend_environment(parameters, arguments, TOPLEVEL_ENVIRONMENT);
 }
 
 /* debug print */
@@ -104,6 +139,169 @@ void dump_environment(SCM env)
     fflush(stdout);
 }
 
+/*==================================================
+  Env Stack
+==================================================*/
+/* escape analysisで環境が捕まらないと分かったclosureの環境 (frameと引数の
+ * list) はheapではなくenv stackに取る。呼び出しが戻る時に
+ * FRAME_TYPE_RELEASEで捨てる。
+ *
+ * env stack上のcellを指せるのはcontrol stackのframe, env stack上のcell,
+ * evaluatorのregisterだけ。lambda, macro, call/ccなどで環境が
+ * 捕まる時はenv_stack_promoteで生きているcellを全てheapに移す。
+ */
+struct _Cons *_env_stack = NULL;
+int _env_stack_top = 0;
+
+/* GCはenv_stack_markで辿る. gc_mark_objectはENV_STACK_Pで止まる */
+void env_stack_initialize(void)
+{
+    _env_stack = xmalloc(sizeof(struct _Cons) * ENV_STACK_SIZE);
+    _env_stack_top = 0;
+}
+
+void env_stack_finalize(void)
+{
+    free(_env_stack);
+    _env_stack = NULL;
+}
+
+/* env stackが一杯ならheapに取る */
+SCM env_stack_cons(SCM car, SCM cdr)
+{
+    SCM cell;
+    if (_env_stack_top == ENV_STACK_SIZE) {
+        return new_cons(car, cdr);
+    }
+    cell = ENV_STACK_CELL(_env_stack_top++);
+    CAR(cell) = car;
+    SET_CDR(cell, cdr);
+    return cell;
+}
+
+/* heapにcopyした引数のlist. heapにあるlistはそのまま */
+static SCM heap_arguments(SCM arguments)
+{
+    SCM copy = SCM_NULL;
+    SCM p;
+    if (! ENV_STACK_P(arguments)) {
+        return arguments;
+    }
+    for (p = arguments; CONS_P(p); p = CDR(p)) {
+        copy = new_cons(CAR(p), copy);
+    }
+    return list_reverse(copy);
+}
+
+/**
+ * env stackのbaseから先にclosureの引数のlistとframeを作る。
+ * base以降にある古い引数のcellは上書きしてよい(先頭から順に読むので
+ * 読む前に上書きされることはない)。
+ * 残余引数のlistは値として外に出うるのでheapに置く。
+ * arityは呼び出し側で確かめてあること。入りきらなければheapに作る。
+ */
+SCM env_stack_extend(SCM closure, SCM arguments, int base)
+{
+    SCM p, next, last = SCM_NULL;
+    SCM head = SCM_NULL;
+    int required = CLOSURE_REQUIRED(closure);
+    int i;
+
+    if (base + required + 2 > ENV_STACK_SIZE) {
+        /* overflow: env stack上の引数をheapに移す */
+        arguments = heap_arguments(arguments);
+        _env_stack_top = base;
+        return extend_environment(CLOSURE_ARGS(closure), arguments, CLOSURE_ENV(closure));
+    }
+    for (p = arguments, i = base; i < base + required; p = next, i++) {
+        SCM cell = ENV_STACK_CELL(i);
+        SCM value = CAR(p);
+        next = CDR(p);
+        CAR(cell) = value;
+        SET_CDR(cell, SCM_NULL);
+        if (NULL_P(head)) {
+            head = cell;
+        } else {
+            SET_CDR(last, cell);
+        }
+        last = cell;
+    }
+    if (CLOSURE_REST_P(closure)) {
+        /* env_stack_markが辿れるようにtopを延ばしてからheapに移す */
+        _env_stack_top = i > _env_stack_top ? i : _env_stack_top;
+        p = heap_arguments(p);
+        if (NULL_P(head)) {
+            head = p;
+        } else {
+            SET_CDR(last, p);
+        }
+    }
+    CAR(ENV_STACK_CELL(i)) = CLOSURE_ARGS(closure);
+    SET_CDR(ENV_STACK_CELL(i), head);
+    CAR(ENV_STACK_CELL(i + 1)) = ENV_STACK_CELL(i);
+    SET_CDR(ENV_STACK_CELL(i + 1), CLOSURE_ENV(closure));
+    _env_stack_top = i + 2;
+    return ENV_STACK_CELL(i + 1);
+}
+
+/* promote中: env stack上のcellはCARにheapのcopyを持つ */
+static SCM forward(SCM obj)
+{
+    return ENV_STACK_P(obj) ? CAR(obj) : obj;
+}
+
+static void forward_frame(struct Frame *frame)
+{
+    frame->env = forward(frame->env);
+    if (frame->type == FRAME_TYPE_RELEASE) {
+        frame->a = ENV_STACK_MARK_TO_SCM(0);
+    } else if (frame->type == FRAME_TYPE_ESCAPE) {
+        frame->c = ENV_STACK_MARK_TO_SCM(0);
+    } else {
+        frame->a = forward(frame->a);
+        frame->b = forward(frame->b);
+        frame->c = forward(frame->c);
+    }
+}
+
+/**
+ * env stack上の生きているcellを全てheapにcopyし、control stackの
+ * frameの参照を付け替えてenv stackを空にする。envの移動先を返す。
+ */
+SCM env_stack_promote(SCM env)
+{
+    int i;
+    int top = _env_stack_top;
+
+    if (top == 0) {
+        return env;
+    }
+    /* copyをCARに置いておく. 途中でGCが起きてもenv_stack_markから辿れる */
+    for (i = 0; i < top; i++) {
+        SCM cell = ENV_STACK_CELL(i);
+        CAR(cell) = new_cons(CAR(cell), CDR(cell));
+    }
+    for (i = 0; i < top; i++) {
+        SCM copy = CAR(ENV_STACK_CELL(i));
+        CAR(copy) = forward(CAR(copy));
+        SET_CDR(copy, forward(CDR(copy)));
+    }
+    control_stack_for_each_unsealed(forward_frame);
+    env = forward(env);
+    _env_stack_top = 0;
+    return env;
+}
+
+/* GC: 生きているcellの子をmarkする */
+void env_stack_mark(void)
+{
+    int i;
+    for (i = 0; i < _env_stack_top; i++) {
+        scm_gc_mark(CAR(ENV_STACK_CELL(i)));
+        scm_gc_mark(CDR(ENV_STACK_CELL(i)));
+    }
+}
+
 void symbols_of_env_initialize(void)
 {
 }
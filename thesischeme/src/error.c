@@ -15,6 +15,7 @@ struct Trap {
     struct Trap* owner;
     jmp_buf jmp;
     char *message;
+    struct ControlStackMark stack;
 };
 
 /*==================================================
@@ -42,9 +43,12 @@ SCM internal_catch(SCM (*func)(), SCM arg)
     trap.owner = traplist;
     traplist = &trap;
     error_message = NULL;
+    control_stack_save(&trap.stack);
 
     if (setjmp(trap.jmp) == 0) {
         value = func(arg);
+    } else {
+        control_stack_restore(&trap.stack);
     }
 
     traplist = trap.owner;
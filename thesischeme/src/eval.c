@@ -4,6 +4,7 @@
  * $Id$
 ===========================================================================*/
 #include <setjmp.h>
+#include <math.h>
 
 #include "scheme.h"
 
@@ -47,170 +48,186 @@ static SCM nreverse(SCM sexp)
     SCM result = SCM_NULL;
     while(CONS_P(curr)) {
         kdr = CDR(curr);
-        CDR(curr) = result;
+        SET_CDR(curr, result);
         result = curr;
         curr = kdr;
     }
     return result;
 }
-static SCM eval_list(SCM sexp, SCM env)
+static SCM apply_primitive(SCM subr, SCM args)
 {
-    SCM r = SCM_NULL;
-    SCM tmp;
-    while(!NULL_P(sexp)) {
-        tmp = new_cons(eval(CAR(sexp), env), r);
-        r = tmp;
-        sexp = CDR(sexp);
+    int argc = length(args);
+
+    switch(PRIMITIVE_TYPE(subr)) {
+    case PRIMITIVE_TYPE_SPECIAL_FORM:
+        scheme_error("can't apply/map a special form");
+        break;
+    case PRIMITIVE_TYPE_CONTROL:
+        /* executeの中でしか呼べない */
+        scheme_error("control primitive called outside the evaluator");
+        break;
+    case PRIMITIVE_TYPE_LIST_EXPR:
+        return PRIMITIVE_PROC(subr)(args);
+    case PRIMITIVE_TYPE_EXPR_0:
+        if (argc != 0)
+            goto ARG_ERROR;
+        return PRIMITIVE_PROC(subr)();
+    case PRIMITIVE_TYPE_EXPR_1:
+        if (argc != 1)
+            goto ARG_ERROR;
+        return PRIMITIVE_PROC(subr)(CAR(args));
+    case PRIMITIVE_TYPE_EXPR_2:
+        if (argc != 2)
+            goto ARG_ERROR;
+        return PRIMITIVE_PROC(subr)(CAR(args),
+                                    CADR(args));
+    case PRIMITIVE_TYPE_EXPR_3:
+        if (argc != 3)
+            goto ARG_ERROR;
+        return PRIMITIVE_PROC(subr)(CAR(  args),
+                                    CADR( args),
+                                    CADDR(args) );
+    case PRIMITIVE_TYPE_EXPR_4:
+        if (argc != 4)
+            goto ARG_ERROR;
+        return PRIMITIVE_PROC(subr)(CAR(args),
+                                    CADR(args),
+                                    CADDR(args),
+                                    CAR(CDDDR(args)));
+    case PRIMITIVE_TYPE_EXPR_5:
+        if (argc != 5)
+            goto ARG_ERROR;
+        return PRIMITIVE_PROC(subr)(CAR(args),
+                                    CADR(args),
+                                    CADDR(args),
+                                    CAR(CDDDR(args)),
+                                    CADR(CDDDR(args)));
     }
-    return nreverse(r);
+ ARG_ERROR:
+    scheme_error("eval unsupported :");
+    return SCM_NULL;
 }
 
-static SCM apply_primitive(SCM subr, SCM arg, struct EvalState *state, SCM need_argument_eval)
+/**
+ * 引数の数をclosureのarityと比べる
+ * 引数のlistは高々required + 1個しか辿らない
+ */
+static void check_arity(SCM closure, SCM args)
 {
-    if (SPECIAL_FORM_P(subr)) { 
-        if (FALSE_P(need_argument_eval)) {
-            scheme_error("can't apply/map a special form");
-        }
-        return PRIMITIVE_PROC(subr)(arg, state);
-    } else if (LIST_EXPR_P(subr)) {
-        SCM evaled_arg;
-        if (FALSE_P(need_argument_eval) ) {
-            evaled_arg = arg;
-        } else {
-            evaled_arg = eval_list(arg, state->env);
-        }
-        return PRIMITIVE_PROC(subr)(evaled_arg);
-    } else {
-        SCM result;
-        SCM evaled_arg;
-        if (FALSE_P(need_argument_eval) ) {
-            evaled_arg = arg;
-        } else {
-            evaled_arg = eval_list(arg, state->env);
-        }
-        switch(PRIMITIVE_TYPE(subr)) {
-        case PRIMITIVE_TYPE_EXPR_0:
-            if (length(arg) != 0)
-                goto ARG_ERROR;
-            result = PRIMITIVE_PROC(subr)();
-            break;
-        case PRIMITIVE_TYPE_EXPR_1:
-            if (length(arg) != 1)
-                goto ARG_ERROR;
-            result = PRIMITIVE_PROC(subr)(CAR(evaled_arg));
-            break;
-        case PRIMITIVE_TYPE_EXPR_2:
-            if (length(arg) != 2)
-                goto ARG_ERROR;
-            result = PRIMITIVE_PROC(subr)(CAR(evaled_arg),
-                                          CADR(evaled_arg));
-            break;
-        case PRIMITIVE_TYPE_EXPR_3:
-            if (length(arg) != 3)
-                goto ARG_ERROR;
-            result = PRIMITIVE_PROC(subr)(CAR(  evaled_arg),
-                                          CADR( evaled_arg),
-                                          CADDR(evaled_arg) );
-            break;
-        case PRIMITIVE_TYPE_EXPR_4:
-            if (length(arg) != 4)
-                goto ARG_ERROR;
-            result = PRIMITIVE_PROC(subr)(CAR(evaled_arg),
-                                          CADR(evaled_arg),
-                                          CADDR(evaled_arg),
-                                          CAR(CDDDR(evaled_arg)));
-        case PRIMITIVE_TYPE_EXPR_5:
-            if (length(arg) != 5)
-                goto ARG_ERROR;
-        default:
-            return SCM_NULL;
-        }
-        return result;
-    ARG_ERROR:
-        scheme_error("eval unsupported :");
+    char message[64];
+    int required = CLOSURE_REQUIRED(closure);
+    int argc;
+    for (argc = 0; argc < required && CONS_P(args); argc++) {
+        args = CDR(args);
     }
-    /* */
-    return SCM_NULL;
+    if (argc == required && (CLOSURE_REST_P(closure) || NULL_P(args))) {
+        return;
+    }
+    argc += length(args);
+    snprintf(message, sizeof(message), "wrong number of arguments (%s%d, got %d)",
+             CLOSURE_REST_P(closure) ? "at least " : "", required, argc);
+    scheme_error(message);
 }
-static SCM apply_closure(SCM closure, SCM arg, struct EvalState *state, SCM need_argument_eval)
+
+/**
+ * マクロ本体を実行して展開形を得る
+ * operandsは評価せずにマクロの引数に束縛する
+ */
+SCM expand_macro(SCM macro, SCM operands)
 {
-    SCM closure_env = NULL;
+    SCM closure = MACRO_CLOSURE(macro);
+    SCM closure_body;
+    SCM closure_env;
     SCM result = SCM_NULL;
-    SCM evaled_arg = SCM_NULL;
-    SCM body = CLOSURE_BODY(closure);
 
-    if (length(CLOSURE_ARGS(closure)) > length(arg)) {
-        scheme_error("argument error");
-    }
-    if (FALSE_P(need_argument_eval) ) {
-        evaled_arg = arg;
-    } else {
-        evaled_arg = eval_list(arg, state->env);
+    if (! NULL_P(MACRO_RULES(macro))) {
+        return syntax_rules_expand(MACRO_RULES(macro), operands);
     }
-    closure_env = extend_environment(CLOSURE_ARGS(closure), evaled_arg, CLOSURE_ENV(closure));
-#if DEBUG
-    printf("closure - env\n");
-    fflush(stdout);
-    dump_environment(closure_env);
-#endif
+    closure_body = CLOSURE_BODY(closure);
 
-    while (! NULL_P(body)) {
-        // need_argument_evalで末尾再帰の
-        if (LIST_1_P(body) && FALSE_P(need_argument_eval)) {
-            state->status = EVAL_STATUS_NEED_EVAL;
-            state->env=closure_env;
-            result = CAR(body);
-            break;
-        }
-        result = eval(CAR(body), closure_env);
-        body = CDR(body);
-    }
-    
-    return result;
-}
-static SCM apply_macro(SCM subr, SCM arg, struct EvalState *state)
-{
-    SCM closure = MACRO_CLOSURE(subr);
-    SCM closure_body = CLOSURE_BODY(closure);
-    SCM closure_arg = CLOSURE_ARGS(closure);
-    SCM closure_env = CLOSURE_ENV(closure);
-    SCM result = SCM_NULL;
-    state->env = extend_environment(closure_arg, arg, state->env);
+    check_arity(closure, operands);
+    closure_env = extend_environment(CLOSURE_ARGS(closure), operands, CLOSURE_ENV(closure));
 
     while(! NULL_P(closure_body)) {
-        result = eval(CAR(closure_body), state->env);
+        result = eval(CAR(closure_body), closure_env);
         closure_body = CDR(closure_body);
     }
-    state->status = EVAL_STATUS_NEED_EVAL;
-    state->env=closure_env;
-    print (result, stdout);
-    fflush(stdout);
     return result;
 }
-static SCM apply(SCM subr, SCM arg, struct EvalState *state, SCM need_argument_eval)
+
+/**
+ * 本体の評価. 最後の式は末尾位置なのでframeを積まずにevalに返す
+ */
+static SCM eval_sequence(SCM body, struct EvalState *state)
 {
-    if (PRIMITIVE_P(subr)) {
-        return apply_primitive(subr, arg, state, need_argument_eval);
-    } else if (CLOSURE_P(subr)) {
-        return apply_closure(subr, arg, state, need_argument_eval);
-    } else if (MACRO_P(subr)) {
-        if (FALSE_P(need_argument_eval)) {
-            scheme_error("can't apply/map a macro");
-        }
-        return apply_macro(subr, arg, state);
-    } else {
-        scheme_error("subroutine type error");
-        return NULL;
+    if (NULL_P(body)) {
+        return SCM_UNDEFINED;
+    }
+    if (! NULL_P(CDR(body))) {
+        control_stack_push(FRAME_TYPE_SEQUENCE, state->env, CDR(body), SCM_NULL, SCM_NULL);
     }
+    state->status = EVAL_STATUS_NEED_EVAL;
+    return CAR(body);
 }
 
-SCM eval(SCM sexp, SCM env)
+/* == Evaluator ==
+ *
+ * register machine. registers are sexp, env, subr, args and val.
+ * eval never calls itself; a pending computation is pushed to the
+ * control stack as a frame and resumed at eval_return.
+ *
+ *   eval_dispatch  : evaluate sexp in env
+ *   eval_combination : apply subr to the operands of sexp
+ *   apply_dispatch : apply subr to evaluated args
+ *   eval_return    : pass val to the top frame
+ *
+ * special forms receive the operands and an EvalState. They may push
+ * their own frame and return the next sexp with EVAL_STATUS_NEED_EVAL.
+ * control primitives (call/cc etc.) receive the evaluated arguments and
+ * may ask for a tail application with EVAL_STATUS_NEED_APPLY.
+ *
+ * each call of execute is an Activation. Its FRAME_TYPE_BASE frame
+ * records the activation id, so a continuation which returns into a
+ * frame of an outer execute longjmps to it. The frame of a toplevel
+ * execute which has already returned returns to the current toplevel.
+ * A nested one is an error: its C caller is gone.
+ */
+static void activation_resume(struct Activation *activation, enum ActivationResume how, SCM val)
 {
-    SCM kar = SCM_NULL;
-    SCM result = NULL;
-    struct EvalState state = { env, EVAL_STATUS_RETURN_VALUE};
+    _current_activation = activation;
+    activation->value = val;
+    longjmp(activation->jmp, how);
+}
+
+/* 変数と定数はframeを積まずにその場で評価できる */
+#define DIRECT_OPERAND_P(sexp) (SYMBOL_P(sexp) || ! CONS_P(sexp))
+#define DIRECT_OPERAND_VALUE(sexp, env) \
+  (SYMBOL_P(sexp) ? symbol_value((sexp), (env)) : (sexp))
 
- eval_loop:
+static SCM execute(SCM sexp, SCM env, SCM subr, SCM args)
+{
+    SCM val = SCM_UNDEFINED;
+    SCM body;
+    struct Frame *frame;
+    struct EvalState state;
+    struct Activation activation;
+
+    activation_enter(&activation);
+    control_stack_push(FRAME_TYPE_BASE, SCM_NULL, ACTIVATION_ID_TO_SCM(activation.id),
+                       C_TO_SCM_BOOLEAN(activation.owner == NULL), SCM_NULL);
+    switch (setjmp(activation.jmp)) {
+    case ACTIVATION_RESUME_START:
+        break;
+    case ACTIVATION_RESUME_RETURN:
+        activation_leave(&activation);
+        return activation.value;
+    case ACTIVATION_RESUME_CONTINUE:
+        val = activation.value;
+        goto eval_return;
+    }
+    if (subr != NULL) goto apply_dispatch;
+
+ eval_dispatch:
 #if DEBUG
     print(sexp, stdout);
     putchar('\n');
@@ -220,37 +237,402 @@ SCM eval(SCM sexp, SCM env)
     set_current_sexp(sexp);
 
     if (SYMBOL_P(sexp)) {
+        val = symbol_value(sexp, env);
+        goto eval_return;
+    }
+    if (! CONS_P(sexp)) {
+        val = sexp;
+        goto eval_return;
+    }
+    if (SYMBOL_P(CAR(sexp))) {
+        subr = symbol_value(CAR(sexp), env);
+    } else if (CALL_SITE_P(CAR(sexp))) {
+        /* optimizerが調べている呼び出し位置 */
+        SCM target = CALL_SITE_TARGET(CAR(sexp));
+        subr = SYMBOL_P(target) ? symbol_value(target, env) : target;
+        CALL_SITE_RECORD_CALLEE(CAR(sexp), subr);
+    } else if (CONS_P(CAR(sexp))) {
+        control_stack_push(FRAME_TYPE_OPERATOR, env, sexp, SCM_NULL, SCM_NULL);
+        sexp = CAR(sexp);
+        goto eval_dispatch;
+    } else {
+        subr = CAR(sexp);
+    }
+
+ eval_combination:
+    if (PRIMITIVE_P(subr) && SPECIAL_FORM_P(subr)) {
+        state.env = env;
+        state.status = EVAL_STATUS_RETURN_VALUE;
+        val = PRIMITIVE_PROC(subr)(CDR(sexp), &state);
+        if (state.status == EVAL_STATUS_NEED_EVAL) {
+            sexp = val;
+            env = state.env;
+            goto eval_dispatch;
+        }
+        goto eval_return;
+    }
+    if (MACRO_P(subr)) {
+        /* 名前で呼ばれたマクロは展開形で置き換えて一度しか展開しない */
+        body = expand_macro(subr, CDR(sexp));
+        if (SYMBOL_P(CAR(sexp))) {
+            displace_form(sexp, body);
+        } else {
+            sexp = body;
+        }
+        goto eval_dispatch;
+    }
+    if (NULL_P(CDR(sexp))) {
+        args = SCM_NULL;
+        goto apply_dispatch;
+    }
+    if (PRIMITIVE_P(subr) && EXPR_2_P(subr) && LIST_2_P(CDR(sexp)) &&
+        DIRECT_OPERAND_P(CADR(sexp)) && DIRECT_OPERAND_P(CADDR(sexp))) {
+        /* (+ i 1)など: 引数のlistを作らずに直接呼ぶ */
+        SCM x = DIRECT_OPERAND_VALUE(CADR(sexp), env);
+        SCM y = DIRECT_OPERAND_VALUE(CADDR(sexp), env);
+        if (CALL_SITE_P(CAR(sexp))) {
+            CALL_SITE_RECORD_OPERANDS(CAR(sexp), x, y);
+        }
+        val = PRIMITIVE_PROC(subr)(x, y);
+        goto eval_return;
+    }
+    if (PRIMITIVE_P(subr) && EXPR_1_P(subr) && LIST_1_P(CDR(sexp)) &&
+        DIRECT_OPERAND_P(CADR(sexp))) {
+        val = PRIMITIVE_PROC(subr)(DIRECT_OPERAND_VALUE(CADR(sexp), env));
+        goto eval_return;
+    }
+    if (RECORD_PROCEDURE_P(subr) && DIRECT_OPERAND_P(CADR(sexp))) {
+        /* (point-x p)など: 型を比べてslotを直接読み書きする */
+        SCM descriptor = RECORD_PROCEDURE_DESCRIPTOR(subr);
+        SCM x;
+        switch (RECORD_PROCEDURE_KIND(subr)) {
+        case RECORD_ACCESSOR:
+            if (! LIST_1_P(CDR(sexp))) break;
+            x = DIRECT_OPERAND_VALUE(CADR(sexp), env);
+            if (! RECORD_INSTANCE_P(x, descriptor))
+                record_type_error(RECORD_PROCEDURE_NAME(subr), descriptor);
+            val = RECORD_REF(x, RECORD_PROCEDURE_INDEX(subr));
+            goto eval_return;
+        case RECORD_PREDICATE:
+            if (! LIST_1_P(CDR(sexp))) break;
+            x = DIRECT_OPERAND_VALUE(CADR(sexp), env);
+            val = C_TO_SCM_BOOLEAN(RECORD_INSTANCE_P(x, descriptor));
+            goto eval_return;
+        case RECORD_MODIFIER:
+            if (! LIST_2_P(CDR(sexp)) || ! DIRECT_OPERAND_P(CADDR(sexp))) break;
+            x = DIRECT_OPERAND_VALUE(CADR(sexp), env);
+            if (! RECORD_INSTANCE_P(x, descriptor))
+                record_type_error(RECORD_PROCEDURE_NAME(subr), descriptor);
+            RECORD_REF(x, RECORD_PROCEDURE_INDEX(subr)) = DIRECT_OPERAND_VALUE(CADDR(sexp), env);
+            val = SCM_UNDEFINED;
+            goto eval_return;
+        case RECORD_CONSTRUCTOR:
+            break;
+        }
+    }
+    if (PRIMITIVE_P(subr) && CALL_SITE_P(CAR(sexp)) && LIST_2_P(CDR(sexp))) {
+        /* 二項版の呼び出し位置: 引数が揃ったら型を記録する */
+        subr = CAR(sexp);
+    }
+    frame = control_stack_push(FRAME_TYPE_OPERAND, env, subr, SCM_NULL, CDDR(sexp));
+    frame->form = sexp;
+    sexp = CADR(sexp);
+    goto eval_dispatch;
+
+ apply_dispatch:
+    if (PRIMITIVE_P(subr)) {
+        if (PRIMITIVE_TYPE_CONTROL_P(subr)) {
+            state.env = env;
+            state.status = EVAL_STATUS_RETURN_VALUE;
+            val = PRIMITIVE_PROC(subr)(args, &state);
+            if (state.status == EVAL_STATUS_NEED_APPLY) {
+                subr = state.subr;
+                args = state.args;
+                goto apply_dispatch;
+            }
+            if (state.status == EVAL_STATUS_NEED_EVAL) {
+                sexp = val;
+                env = state.env;
+                goto eval_dispatch;
+            }
+            goto eval_return;
+        }
+        val = apply_primitive(subr, args);
+        if (ENV_STACK_P(args)) {
+            /* OPERANDでenv stackに取った引数 */
+            ENV_STACK_RESET(ENV_STACK_INDEX(args));
+        }
+        goto eval_return;
+    }
+    if (RECORD_PROCEDURE_P(subr)) {
+        val = record_apply(subr, args);
+        if (ENV_STACK_P(args)) {
+            ENV_STACK_RESET(ENV_STACK_INDEX(args));
+        }
+        goto eval_return;
+    }
+    if (CLOSURE_P(subr)) {
+        check_arity(subr, args);
+        if (CLOSURE_STACK_FRAME_P(subr)) {
+            int base;
+            CONTROL_STACK_SETTLE();
+            frame = CONTROL_STACK_TOP();
+            if (frame->type == FRAME_TYPE_RELEASE) {
+                /* 末尾呼び出し: 呼び出し元の環境はもう使われない */
+                base = SCM_TO_ENV_STACK_MARK(frame->a);
+            } else {
+                /* env stack上の引数もこの呼び出しと一緒に捨てる */
+                base = ENV_STACK_P(args) ? ENV_STACK_INDEX(args) : ENV_STACK_TOP();
+                control_stack_push(FRAME_TYPE_RELEASE, SCM_NULL, ENV_STACK_MARK_TO_SCM(base),
+                                   SCM_NULL, SCM_NULL);
+            }
+            env = env_stack_extend(subr, args, base);
+        } else {
+            env = extend_environment(CLOSURE_ARGS(subr), args, CLOSURE_ENV(subr));
+        }
 #if DEBUG
-        print(symbol_value(sexp, state.env), stdout);
-        putchar('\n');
+        printf("closure - env\n");
         fflush(stdout);
+        dump_environment(env);
 #endif
-        return symbol_value(sexp, state.env);
+        body = CLOSURE_BODY(subr);
+        goto eval_body;
     }
-    if (! CONS_P(sexp)) {
-        return sexp;
+    if (CONTINUATION_P(subr)) {
+        val = NULL_P(args) ? SCM_UNDEFINED : CAR(args);
+        if (CONTINUATION_ESCAPE_P(subr)) {
+            int depth = CONTINUATION_DEPTH(subr);
+            struct Frame *escape = control_stack_frame(depth);
+            struct Activation *owner;
+            if (escape == NULL || escape->type != FRAME_TYPE_ESCAPE || ! EQ_P(escape->a, subr)) {
+                scheme_error("escape continuation is no longer valid");
+            }
+            owner = activation_lookup(SCM_TO_ACTIVATION_ID(escape->b));
+            ENV_STACK_RESET(SCM_TO_ENV_STACK_MARK(escape->c));
+            control_stack_cut(depth);
+            if (owner != NULL && owner != &activation) {
+                activation_resume(owner, ACTIVATION_RESUME_CONTINUE, val);
+            }
+            goto eval_return;
+        }
+        control_stack_reinstate(CONTINUATION_SEGMENT(subr));
+        /* continuationのframeはcapture時にpromote済み */
+        ENV_STACK_RESET(0);
+        goto eval_return;
+    }
+    if (MACRO_P(subr)) {
+        scheme_error("can't apply/map a macro");
     }
+    scheme_error("subroutine type error");
 
-    if (CONS_P(sexp)) {
-        SCM subr;
-        /* eval state init */
-        state.status = EVAL_STATUS_RETURN_VALUE;
+ eval_body:
+    state.env = env;
+    state.status = EVAL_STATUS_RETURN_VALUE;
+    val = eval_sequence(body, &state);
+    if (state.status == EVAL_STATUS_NEED_EVAL) {
+        sexp = val;
+        goto eval_dispatch;
+    }
 
-        kar = CAR(sexp);
-        if (SYMBOL_P(kar)) {
-            subr = symbol_value(kar, state.env);
-        } else if (CONS_P(kar)) {
-            subr = eval(kar, state.env);
+ eval_return:
+    CONTROL_STACK_SETTLE();
+    frame = CONTROL_STACK_TOP();
+    env = frame->env;
+    switch (frame->type) {
+    case FRAME_TYPE_BASE: {
+        struct Activation *owner = activation_lookup(SCM_TO_ACTIVATION_ID(frame->a));
+        if (owner == NULL) {
+            /* 既に戻ったexecute. toplevelならtoplevelに返せばよいが、
+               途中のCの呼び出し元(hash-table-update!等)には戻れない */
+            if (FALSE_P(frame->b))
+                scheme_error("continuation is not re-entrant across C frames");
+            owner = activation_outermost();
         }
-        result = apply(subr, CDR(sexp), &state, SCM_TRUE);
-        sexp = result;
-        if (state.status == EVAL_STATUS_NEED_EVAL) {
-            goto eval_loop;
+        CONTROL_STACK_POP();
+        if (owner != &activation) {
+            activation_resume(owner, ACTIVATION_RESUME_RETURN, val);
+        }
+        if (CONTROL_STACK_DEPTH() > activation.base) {
+            control_stack_cut(activation.base);
+        }
+        activation_leave(&activation);
+        return val;
+    }
+
+    case FRAME_TYPE_OPERATOR:
+        sexp = frame->a;
+        subr = val;
+        CONTROL_STACK_POP();
+        goto eval_combination;
+
+    case FRAME_TYPE_OPERAND:
+        subr = CALL_SITE_P(frame->a) ? CALL_SITE_TARGET(frame->a) : frame->a;
+        if (CLOSURE_STACK_FRAME_P(subr) || PRIMITIVE_TRANSIENT_ARGUMENTS_P(subr) ||
+            RECORD_PROCEDURE_P(subr)) {
+            frame->b = env_stack_cons(val, frame->b);
+        } else {
+            frame->b = new_cons(val, frame->b);
+        }
+        if (NULL_P(frame->c)) {
+            args = nreverse(frame->b);
+            /* errorには最後に評価した引数ではなく適用するformを出す */
+            set_current_sexp(frame->form);
+            if (CALL_SITE_P(frame->a)) {
+                CALL_SITE_RECORD_OPERANDS(frame->a, CAR(args), CADR(args));
+                subr = CALL_SITE_TARGET(frame->a);
+            }
+            CONTROL_STACK_POP();
+            goto apply_dispatch;
         }
-    } 
+        sexp = CAR(frame->c);
+        frame->c = CDR(frame->c);
+        goto eval_dispatch;
 
-    /* literal or result */
-    return sexp;
+    case FRAME_TYPE_RELEASE:
+        ENV_STACK_RESET(SCM_TO_ENV_STACK_MARK(frame->a));
+        CONTROL_STACK_POP();
+        goto eval_return;
+
+    case FRAME_TYPE_SEQUENCE:
+        body = frame->a;
+        if (NULL_P(CDR(body))) {
+            CONTROL_STACK_POP();
+        } else {
+            frame->a = CDR(body);
+        }
+        sexp = CAR(body);
+        goto eval_dispatch;
+
+    case FRAME_TYPE_SETQ: {
+        SCM *ref = lookup_environment(frame->a, env);
+        if (! (ref == NULL)) {
+            if (BOX_P(*ref)) {
+                BOX_VALUE(*ref) = val;
+            } else {
+                *ref = val;
+            }
+        } else {
+            optimize_invalidate(frame->a);
+            SYMBOL_VCELL(frame->a) = val;
+        }
+        CONTROL_STACK_POP();
+        goto eval_return;
+    }
+
+    case FRAME_TYPE_COND: {
+        SCM clauses = frame->a;
+        SCM clause;
+        if (! FALSE_P(val)) {
+            body = CDAR(clauses);
+            CONTROL_STACK_POP();
+            if (NULL_P(body)) {
+                /* (<test>) の値はtestの値 */
+                goto eval_return;
+            }
+            /* (<test> => <receiver>) */
+            if (EQ_P(CAR(body), SCM_SYMBOL_DOUBLE_ARROW) && LIST_2_P(body)) {
+                control_stack_push(FRAME_TYPE_COND_ARROW, env, val, SCM_NULL, SCM_NULL);
+                sexp = CADR(body);
+                goto eval_dispatch;
+            }
+            goto eval_body;
+        }
+        clauses = CDR(clauses);
+        if (NULL_P(clauses)) {
+            CONTROL_STACK_POP();
+            val = SCM_UNDEFINED;
+            goto eval_return;
+        }
+        clause = CAR(clauses);
+        if (EQ_P(CAR(clause), SCM_SYMBOL_ELSE)) {
+            if (! NULL_P(CDR(clauses))) {
+                scheme_error("syntax error");
+            }
+            CONTROL_STACK_POP();
+            body = CDR(clause);
+            goto eval_body;
+        }
+        frame->a = clauses;
+        sexp = CAR(clause);
+        goto eval_dispatch;
+    }
+
+    case FRAME_TYPE_COND_ARROW:
+        subr = val;
+        args = new_cons(frame->a, SCM_NULL);
+        CONTROL_STACK_POP();
+        goto apply_dispatch;
+
+    case FRAME_TYPE_IF: {
+        SCM branches = frame->a;
+        CONTROL_STACK_POP();
+        if (FALSE_P(val)) {
+            if (NULL_P(CDR(branches))) {
+                val = SCM_UNDEFINED;
+                goto eval_return;
+            }
+            sexp = CADR(branches);
+        } else {
+            sexp = CAR(branches);
+        }
+        goto eval_dispatch;
+    }
+
+    case FRAME_TYPE_AND:
+    case FRAME_TYPE_OR: {
+        SCM rest = frame->a;
+        if (FALSE_P(val) == (frame->type == FRAME_TYPE_AND)) {
+            /* andの#f, orの真の値で打ち切る */
+            CONTROL_STACK_POP();
+            goto eval_return;
+        }
+        if (NULL_P(CDR(rest))) {
+            CONTROL_STACK_POP();
+        } else {
+            frame->a = CDR(rest);
+        }
+        sexp = CAR(rest);
+        goto eval_dispatch;
+    }
+
+    case FRAME_TYPE_MAP:
+        /* continuationで戻り直すことがあるので結果のlistは書き換えない */
+        frame->b = new_cons(val, frame->b);
+        if (NULL_P(frame->c)) {
+            val = cdr_coded_reverse(frame->b);
+            CONTROL_STACK_POP();
+            goto eval_return;
+        }
+        subr = frame->a;
+        args = CAR(frame->c);
+        frame->c = CDR(frame->c);
+        goto apply_dispatch;
+
+    case FRAME_TYPE_ESCAPE:
+        CONTROL_STACK_POP();
+        goto eval_return;
+    }
+    scheme_error("broken control stack");
+    return SCM_NULL;
+}
+
+/**
+ * 評価済みの引数リストに手続きを適用する (C側からの呼び出し用)
+ */
+SCM apply_procedure(SCM subr, SCM args)
+{
+    if (PRIMITIVE_P(subr) && ! PRIMITIVE_TYPE_CONTROL_P(subr)) {
+        return apply_primitive(subr, args);
+    }
+    if (RECORD_PROCEDURE_P(subr)) {
+        return record_apply(subr, args);
+    }
+    return execute(NULL, TOPLEVEL_ENVIRONMENT, subr, args);
+}
+
+SCM eval(SCM sexp, SCM env)
+{
+    return execute(sexp, env, NULL, NULL);
 }
 
 /*************************************************** 
@@ -262,85 +644,94 @@ DEFINE_PRIMITIVE("quote", quote, (SCM sexp, struct EvalState *state), special_fo
 }
 DEFINE_PRIMITIVE("set!", setq, (SCM sexp, struct EvalState *state), special_form)
 {
-    SCM lvalue = CAR(sexp);
-    SCM rsexp = CADR(sexp);
-    SCM rvalue = SCM_NULL;
-    SCM *ref;
-    rvalue = eval(rsexp, state->env);
-    ref = lookup_environment(lvalue,state->env);
-    if (! (ref == NULL)) {
-        *ref =rvalue;
-    } else {
-        SYMBOL_VCELL(lvalue) = rvalue;
-    }
-    return rvalue;
+    control_stack_push(FRAME_TYPE_SETQ, state->env, CAR(sexp), SCM_NULL, SCM_NULL);
+    state->status = EVAL_STATUS_NEED_EVAL;
+    return CADR(sexp);
 }
 
 /* symtax cond
  *
  * (cond <clause> <clause> ...)
- * 
+ *
+ * 節の選択はFRAME_TYPE_CONDで行う
  */
 DEFINE_PRIMITIVE("cond", cond, (SCM sexp, struct EvalState *state), special_form)
 {
-    SCM clauses; /* (<clause> <clause> .. <clasue>) */
-    SCM clause;  /* (<condition> . <body>)          */
-    SCM condition;
-    SCM body;
-    SCM result = SCM_UNDEFINED;
-    int else_break = FALSE;
-
-    clauses = sexp;
+    SCM clauses = sexp; /* (<clause> <clause> .. <clasue>) */
+    SCM clause;         /* (<condition> . <body>)          */
 
-    /* conditionが#fでない節を探す */
-    while (! NULL_P(clauses)) {
-        clause = CAR(clauses);
-        condition = CAR(clause);
+    if (NULL_P(clauses)) {
+        return SCM_UNDEFINED;
+    }
+    clause = CAR(clauses);
 
-        /* conditionがelse */
-        if (EQ_P(condition, SCM_SYMBOL_ELSE)) {
-            if (LIST_1_P(clauses)) {
-                else_break = TRUE;
-                break;
-            } else {
-                scheme_error("syntax error");
-            }
-        }
-        condition = eval(condition, state->env);
-        if (! FALSE_P(condition)) {
-            break;
+    /* conditionがelse */
+    if (EQ_P(CAR(clause), SCM_SYMBOL_ELSE)) {
+        if (! LIST_1_P(clauses)) {
+            scheme_error("syntax error");
         }
-        clauses = CDR(clauses);
+        return eval_sequence(CDR(clause), state);
     }
-
-    /* 最後まで見付からなかった */
-    if (NULL_P(clauses)) return result;
-
-    body = CDR(clause);
-
-    /* (<condition> => <expr>) */
-    if (EQ_P(CAR(body),SCM_SYMBOL_DOUBLE_ARROW) &&
-        LIST_2_P(body)) {
-        if (else_break) scheme_error("syntax error");
-        return apply(eval(CADR(body), state->env), new_cons(condition, SCM_NULL), state, SCM_FALSE);
+    control_stack_push(FRAME_TYPE_COND, state->env, clauses, SCM_NULL, SCM_NULL);
+    state->status = EVAL_STATUS_NEED_EVAL;
+    return CAR(clause);
+}
+/* syntax if
+ *
+ * (if <test> <consequent>)
+ * (if <test> <consequent> <alternative>)
+ *
+ * 分岐はFRAME_TYPE_IFで選ぶ。frameを降ろしてから評価するので末尾位置
+ */
+DEFINE_PRIMITIVE("if", if, (SCM sexp, struct EvalState *state), special_form)
+{
+    if (! (LIST_2_P(sexp) || LIST_3_P(sexp))) {
+        scheme_error("if: syntax error");
     }
+    control_stack_push(FRAME_TYPE_IF, state->env, CDR(sexp), SCM_NULL, SCM_NULL);
+    state->status = EVAL_STATUS_NEED_EVAL;
+    return CAR(sexp);
+}
 
-    /* 節の評価 */
-    while(!NULL_P(body)) {
-        /* 単一の要素の場合は一旦evalに返す */
-        if (LIST_1_P(body)) {
-            state->status = EVAL_STATUS_NEED_EVAL;
-            result = CAR(body);
-            break;
-        }
-        result = eval(CAR(body), state->env);
-        body = CDR(body);
+/* syntax and, or
+ *
+ * 最後の式はframeを積まずに評価する
+ */
+static SCM logical_operation(SCM sexp, enum FrameType type, SCM unit, struct EvalState *state)
+{
+    if (NULL_P(sexp)) {
+        return unit;
+    }
+    if (! NULL_P(CDR(sexp))) {
+        control_stack_push(type, state->env, CDR(sexp), SCM_NULL, SCM_NULL);
     }
-    return result;    
+    state->status = EVAL_STATUS_NEED_EVAL;
+    return CAR(sexp);
 }
+DEFINE_PRIMITIVE("and", and, (SCM sexp, struct EvalState *state), special_form)
+{
+    return logical_operation(sexp, FRAME_TYPE_AND, SCM_TRUE, state);
+}
+DEFINE_PRIMITIVE("or", or, (SCM sexp, struct EvalState *state), special_form)
+{
+    return logical_operation(sexp, FRAME_TYPE_OR, SCM_FALSE, state);
+}
+
 DEFINE_PRIMITIVE("lambda", lambda, (SCM sexp, struct EvalState *state), special_form)
 {
-    return new_closure(sexp, state->env);
+    SCM closure;
+    /* env stack上の環境は捕まえる前にheapに移す */
+    if (ENV_STACK_P(state->env)) {
+        state->env = env_stack_promote(state->env);
+    }
+    closure = new_closure(sexp, state->env);
+    return closure;
+}
+/* (#<flat lambda> (params . body) copied . boxed) : optimizerが書き換えたlambda
+ * 環境全体ではなく自由変数の値だけを捕まえるので、env stackのままでよい */
+DEFINE_PRIMITIVE("lambda", flat_lambda, (SCM sexp, struct EvalState *state), special_form)
+{
+    return new_closure(CAR(sexp), flat_environment(CADR(sexp), CDDR(sexp), state->env));
 }
 /* (macro i (lambda ))
  */
@@ -348,13 +739,15 @@ DEFINE_PRIMITIVE("macro",  macro,  (SCM sexp, struct EvalState *state), special_
 {
     SCM identifier = CAR(sexp);
     SCM macro = SCM_NULL;
+    if (ENV_STACK_P(state->env)) {
+        state->env = env_stack_promote(state->env);
+    }
     if (CONS_P(identifier)) {
         /* (macor (idenfifer . arg) body) */
-        identifier = CAR(identifier);
         SCM arg = CDR(identifier);
         SCM body = CDR(sexp);
+        identifier = CAR(identifier);
         macro = new_macro(new_closure(new_cons(arg, body), state->env), state->env);
-        //(identifier, macro, env);
     } else {
         SCM body = CADR(sexp);
         SCM closure = SCM_NULL;
@@ -363,24 +756,15 @@ DEFINE_PRIMITIVE("macro",  macro,  (SCM sexp, struct EvalState *state), special_
         }
         closure = eval(CADR(sexp), state->env);
         macro = new_macro(closure, state->env);
-        //(identifier, macro, env);
     }
+    optimize_invalidate(identifier);
     SYMBOL_VCELL(identifier) = macro;
     
     return macro;
 }
 DEFINE_PRIMITIVE("begin", begin, (SCM sexp, struct EvalState *state), special_form)
 {
-    SCM result = SCM_UNDEFINED;
-    SCM kar;
-    print(sexp, stdout);
-    FOR_EACH(sexp, kar) {
-        result = eval(kar, state->env);
-        putchar('e');
-        print(kar,stdout );
-        putchar('\n');
-    }
-    return result;
+    return eval_sequence(sexp, state);
 }
 
 
@@ -389,8 +773,9 @@ DEFINE_PRIMITIVE("begin", begin, (SCM sexp, struct EvalState *state), special_fo
  */
 DEFINE_PRIMITIVE("exit", exit, (SCM l), expr1)
 {
+    int status = FIXNUM_P(l) ? (int) FIXNUM_VALUE(l) : 1;
     scheme_finalize();
-    exit(INTEGER_VALUE(l));
+    exit(status);
 }
 
 DEFINE_PRIMITIVE("car", car, (SCM l), expr1)
@@ -433,32 +818,31 @@ static SCM transposed(SCM lst)
             acc_kdrs = new_cons(CDAR(iter), acc_kdrs);
             iter = CDR(iter);
         }
-        kars = new_cons(nreverse(acc_kars), kars);
+        kars = new_cons(list_to_cdr_coded(nreverse(acc_kars)), kars);
         kdrs = nreverse(acc_kdrs);
     }
  END:
-    return nreverse(kars);    
+    return list_to_cdr_coded(nreverse(kars));
 }
 
-static SCM map(SCM subr, SCM lst)
-{
-    SCM r = SCM_NULL;
-    lst = transposed(lst);
-    SCM tmp;
-    struct EvalState state = { TOPLEVEL_ENVIRONMENT, EVAL_STATUS_NEED_EVAL };
-    while (!NULL_P(lst)) {
-        
-        tmp = new_cons(apply(subr,CAR(lst), &state, SCM_NULL), r);
-        r = tmp;
-        lst = CDR(lst);
-    }
-    return nreverse(r);
-}
-DEFINE_PRIMITIVE("map",  map,  (SCM l), list_expr)
+/* map
+ *
+ * 手続きはFRAME_TYPE_MAPの上でevaluatorが呼ぶ。Cのstackは伸びない。
+ */
+DEFINE_PRIMITIVE("map",  map,  (SCM args, struct EvalState *state), control)
 {
-    if (length(l) < 2)
+    SCM lst;
+    if (length(args) < 2)
         scheme_error("argument error :");
-    return map(CAR(l), CDR(l));
+    lst = transposed(CDR(args));
+    if (NULL_P(lst)) {
+        return SCM_NULL;
+    }
+    control_stack_push(FRAME_TYPE_MAP, state->env, CAR(args), SCM_NULL, CDR(lst));
+    state->subr = CAR(args);
+    state->args = CAR(lst);
+    state->status = EVAL_STATUS_NEED_APPLY;
+    return SCM_UNDEFINED;
 }
 
 DEFINE_PRIMITIVE("atom?", atom, (SCM o), expr1)
@@ -470,21 +854,148 @@ DEFINE_PRIMITIVE("eq?", eq, (SCM o1, SCM o2), expr2)
     return C_TO_SCM_BOOLEAN(EQ_P(o1,o2));
 }
 
+/* 数は正確さと値が同じなら等しい. flonumはbitで比べる (0.0と-0.0は別) */
+int eqv_p(SCM a, SCM b)
+{
+    union FlonumBits x, y;
+    if (EQ_P(a, b))
+        return TRUE;
+    if (BIGNUM_P(a) && BIGNUM_P(b))
+        return integer_compare(a, b) == 0;
+    if (FLONUM_P(a) && FLONUM_P(b)) {
+        x.value = FLONUM_VALUE(a);
+        y.value = FLONUM_VALUE(b);
+        return x.bits == y.bits;
+    }
+    return FALSE;
+}
+
+int equal_p(SCM a, SCM b)
+{
+    int i;
+ loop:
+    if (eqv_p(a, b))
+        return TRUE;
+    if (CONS_P(a) && CONS_P(b)) {
+        if (! equal_p(CAR(a), CAR(b)))
+            return FALSE;
+        a = CDR(a);
+        b = CDR(b);
+        goto loop;
+    }
+    if (STRING_P(a) && STRING_P(b))
+        return string_equal_p(a, b);
+    if (VECTOR_P(a) && VECTOR_P(b)) {
+        if (VECTOR_LENGTH(a) != VECTOR_LENGTH(b))
+            return FALSE;
+        for (i = 0; i < VECTOR_LENGTH(a); i++) {
+            if (! equal_p(VECTOR_REF(a, i), VECTOR_REF(b, i)))
+                return FALSE;
+        }
+        return TRUE;
+    }
+    if (UVECTOR_P(a) && UVECTOR_P(b)) {
+        return UVECTOR_TYPE(a) == UVECTOR_TYPE(b) && UVECTOR_LENGTH(a) == UVECTOR_LENGTH(b) &&
+            memcmp(UVECTOR_ELEMENTS(a), UVECTOR_ELEMENTS(b),
+                   UVECTOR_LENGTH(a) * UVECTOR_ELEMENT_SIZE(UVECTOR_TYPE(a))) == 0;
+    }
+    return FALSE;
+}
+
+DEFINE_PRIMITIVE("eqv?", eqv, (SCM o1, SCM o2), expr2)
+{
+    return C_TO_SCM_BOOLEAN(eqv_p(o1, o2));
+}
+
+DEFINE_PRIMITIVE("equal?", equal, (SCM o1, SCM o2), expr2)
+{
+    return C_TO_SCM_BOOLEAN(equal_p(o1, o2));
+}
+
+DEFINE_PRIMITIVE("write",   write,   (SCM o),     expr1)
+{
+    print(o, stdout);
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("display", display, (SCM o),     expr1)
+{
+    display(o, stdout);
+    return SCM_UNDEFINED;
+}
+
 DEFINE_PRIMITIVE("newline", newline, (),          expr0)
 {
     putchar('\n');
     return SCM_NULL;
 }
 
-DEFINE_PRIMITIVE("eval",   eval,   (SCM sexp),              expr1)
+/* evalとapplyは末尾位置で評価, 適用する.
+ * 展開と最適化はformを書き換えるので、渡されたdatumの複製を評価する */
+DEFINE_PRIMITIVE("eval",   eval,   (SCM args, struct EvalState *state), control)
+{
+    if (! LIST_1_P(args))
+        scheme_error("argument error :");
+    state->env = TOPLEVEL_ENVIRONMENT;
+    state->status = EVAL_STATUS_NEED_EVAL;
+    return optimize(expand(tree_copy(CAR(args))));
+}
+
+/* (apply proc arg1 ... args) */
+DEFINE_PRIMITIVE("apply",  apply,  (SCM args, struct EvalState *state), control)
+{
+    /* closureは引数のlistをそのまま環境にするので、呼び出し側のlistを共有しない */
+    SCM copy = SCM_NULL;
+    SCM p;
+    if (length(args) < 2)
+        scheme_error("argument error :");
+    for (p = CDR(args); CONS_P(CDR(p)); p = CDR(p)) {
+        copy = new_cons(CAR(p), copy);
+    }
+    for (p = CAR(p); CONS_P(p); p = CDR(p)) {
+        copy = new_cons(CAR(p), copy);
+    }
+    state->subr = CAR(args);
+    state->args = nreverse(copy);
+    state->status = EVAL_STATUS_NEED_APPLY;
+    return SCM_UNDEFINED;
+}
+
+/* call/cc
+ *
+ * 現在のstackをsealしてcontinuationにする。
+ * captureの費用は前回のcapture以降に積まれたsegmentの数に比例する。
+ */
+DEFINE_PRIMITIVE("call-with-current-continuation", call_cc, (SCM args, struct EvalState *state), control)
 {
-    return eval(sexp, TOPLEVEL_ENVIRONMENT);
+    if (! LIST_1_P(args))
+        scheme_error("argument error :");
+    state->subr = CAR(args);
+    /* captureされるframeがenv stackを指さないように */
+    env_stack_promote(state->env);
+    state->args = new_cons(new_continuation(control_stack_capture(), 0), SCM_NULL);
+    state->status = EVAL_STATUS_NEED_APPLY;
+    return SCM_UNDEFINED;
 }
 
-DEFINE_PRIMITIVE("apply",  apply,  (SCM subr, SCM arg), expr2)
+/* call/ec
+ *
+ * 脱出専用のcontinuation. stackはcopyせず、FRAME_TYPE_ESCAPEの深さだけ覚える。
+ * receiverから戻った後に呼ぶとエラー。
+ */
+DEFINE_PRIMITIVE("call-with-escape-continuation", call_ec, (SCM args, struct EvalState *state), control)
 {
-    struct EvalState state = { TOPLEVEL_ENVIRONMENT, EVAL_STATUS_NEED_EVAL };
-    return apply(subr, arg, &state, SCM_NULL);
+    SCM k;
+    if (! LIST_1_P(args))
+        scheme_error("argument error :");
+    k = new_continuation(NULL, CONTROL_STACK_DEPTH());
+    control_stack_push(FRAME_TYPE_ESCAPE, state->env, k,
+                       ACTIVATION_ID_TO_SCM(_current_activation->id),
+                       ENV_STACK_MARK_TO_SCM(ENV_STACK_TOP()));
+    state->subr = CAR(args);
+    state->args = new_cons(k, SCM_NULL);
+    state->status = EVAL_STATUS_NEED_APPLY;
+    return SCM_UNDEFINED;
 }
 
 DEFINE_PRIMITIVE("load",   load,   (SCM filename),          expr1)
@@ -497,7 +1008,7 @@ DEFINE_PRIMITIVE("load",   load,   (SCM filename),          expr1)
     }
     while(! EOF_P(sexp = Scheme_read(in))) {
         print(sexp, stdout);
-        eval(sexp, TOPLEVEL_ENVIRONMENT);
+        eval(optimize(expand(sexp)), TOPLEVEL_ENVIRONMENT);
     }
     fclose(in);
     return SCM_TRUE;
@@ -505,12 +1016,13 @@ DEFINE_PRIMITIVE("load",   load,   (SCM filename),          expr1)
 
 DEFINE_PRIMITIVE("intern", intern, (SCM str),               expr1)
 {
-    return SCM_UNDEFINED;
+    return string_to_symbol(str);
 }
 
+/* 名前は写さずに指す */
 DEFINE_PRIMITIVE("symbol->string", symbol2string, (SCM symbol), expr1)
 {
-    return new_string(SYMBOL_NAME(symbol));
+    return symbol_to_string(symbol);
 }
 
 DEFINE_PRIMITIVE("set-car!", set_carq, (SCM lvar, SCM rvar), expr2)
@@ -520,66 +1032,253 @@ DEFINE_PRIMITIVE("set-car!", set_carq, (SCM lvar, SCM rvar), expr2)
 }
 DEFINE_PRIMITIVE("set-cdr!", set_cdrq, (SCM lvar, SCM rvar), expr2)
 {
-    CDR(lvar) = rvar;
+    SET_CDR(lvar, rvar);
     return lvar;
 }
 
-DEFINE_PRIMITIVE("<", less_than, (SCM l), list_expr)
+/*************************************************** 
+ * Number
+ *
+ * 汎用の手続きは引数のlistを受け取る。optimizerは2引数の呼び出しを
+ * 引数を直接受け取る二項版 (fx_plusなど) に書き換える。二項版は両方が
+ * fixnumで結果もfixnumに収まる時だけ自分で計算し、それ以外は汎用の
+ * 手続きに任せる。汎用の手続きは溢れた結果をbignumにし (bignum.c)、
+ * flonumが混じればflonumで計算する (number.c)。
+ * 呼び出し位置でflonumしか来なければ、optimizerはflonumの二項版
+ * (fl_plusなど) に替える
+ */
+static SCM number_check(SCM o, char *name)
 {
-    int result = 1;
-    SCM kar = CAR(l);
-    SCM lst = CDR(l);
-    while (! NULL_P(lst)) {
-        result = INTEGER_VALUE(kar) < INTEGER_VALUE(CAR(lst));
-        kar = CAR(lst);
-        lst = CDR(lst);
+    char message[64];
+    if (! NUMBER_P(o)) {
+        snprintf(message, sizeof(message), "%s: number required", name);
+        scheme_error(message);
+    }
+    return o;
+}
+
+/* (< x1 x2 ...) : 引数は全て型を確かめる */
+static SCM compare_list(enum Comparison op, SCM l, char *name)
+{
+    int result = TRUE;
+    SCM x, y;
+    if (NULL_P(l))
+        scheme_error("argument error :");
+    x = number_check(CAR(l), name);
+    for (l = CDR(l); ! NULL_P(l); l = CDR(l)) {
+        y = number_check(CAR(l), name);
+        result = result && number_compare(op, x, y);
+        x = y;
     }
     return C_TO_SCM_BOOLEAN(result);
 }
+
+DEFINE_PRIMITIVE("=", num_eq, (SCM l), list_expr)
+{
+    return compare_list(COMPARISON_EQ, l, "=");
+}
+DEFINE_PRIMITIVE("<", less_than, (SCM l), list_expr)
+{
+    return compare_list(COMPARISON_LT, l, "<");
+}
+DEFINE_PRIMITIVE("<=", less_equal, (SCM l), list_expr)
+{
+    return compare_list(COMPARISON_LE, l, "<=");
+}
+DEFINE_PRIMITIVE(">", greater_than, (SCM l), list_expr)
+{
+    return compare_list(COMPARISON_GT, l, ">");
+}
+DEFINE_PRIMITIVE(">=", greater_equal, (SCM l), list_expr)
+{
+    return compare_list(COMPARISON_GE, l, ">=");
+}
 DEFINE_PRIMITIVE("+", num_plus,  (SCM l), list_expr)
 {
-    int sum = 0;
+    SCM sum = MAKE_FIXNUM(0);
     SCM lst = l;
     while (! NULL_P(lst)) {
-        sum += INTEGER_VALUE(CAR(lst));
+        sum = number_add(sum, number_check(CAR(lst), "+"));
         lst = CDR(lst);
     }
-    return new_integer(sum);
+    return sum;
 }
 DEFINE_PRIMITIVE("-", num_minus, (SCM l), list_expr)
 {
-    int sum = 0;
+    SCM sum;
     SCM lst = l;
-    sum -= INTEGER_VALUE(CAR(lst));
+    if (NULL_P(lst))
+        scheme_error("argument error :");
+    sum = number_check(CAR(lst), "-");
     lst = CDR(lst);
-    if (! NULL_P(lst)) { sum *= -1; }
+    if (NULL_P(lst)) {
+        sum = number_negate(sum);
+    }
     while (! NULL_P(lst)) {
-        sum -= INTEGER_VALUE(CAR(lst));
+        sum = number_sub(sum, number_check(CAR(lst), "-"));
         lst = CDR(lst);
     }
-    return new_integer(sum);
+    return sum;
 }
 DEFINE_PRIMITIVE("*", num_mul,   (SCM l), list_expr)
 {
-    int mul = 1;
+    SCM mul = MAKE_FIXNUM(1);
     SCM lst = l;
     while (! NULL_P(lst)) {
-        mul *= INTEGER_VALUE(CAR(lst));
+        mul = number_mul(mul, number_check(CAR(lst), "*"));
         lst = CDR(lst);
     }
-    return new_integer(mul);
+    return mul;
 }
 DEFINE_PRIMITIVE("/", num_div,   (SCM l), list_expr)
 {
-    int mul = 0;
+    SCM mul;
+    SCM divisor;
     SCM lst = l;
-    mul = INTEGER_VALUE(CAR(lst));
+    if (NULL_P(lst))
+        scheme_error("argument error :");
+    mul = number_check(CAR(lst), "/");
     lst = CDR(lst);
     while (! NULL_P(lst)) {
-        mul /= INTEGER_VALUE(CAR(lst));
+        divisor = number_check(CAR(lst), "/");
+        if (EQ_P(divisor, MAKE_FIXNUM(0)) && INTEGER_P(mul))
+            scheme_error("/: division by zero");
+        mul = number_div(mul, divisor);
         lst = CDR(lst);
     }
-    return new_integer(mul);
+    return mul;
+}
+
+/* 二項版: fixnumでない引数や溢れた結果は汎用の手続きに任せる */
+static SCM binary_fallback(SCM generic, SCM x, SCM y)
+{
+    return PRIMITIVE_PROC(generic)(new_cons(x, new_cons(y, SCM_NULL)));
+}
+
+DEFINE_PRIMITIVE("+", fx_plus,  (SCM x, SCM y), expr2)
+{
+    if (FIXNUM_P(x) && FIXNUM_P(y)) {
+        intptr_t r = FIXNUM_VALUE(x) + FIXNUM_VALUE(y);
+        if (FIXNUM_RANGE_P(r))
+            return MAKE_FIXNUM(r);
+    }
+    return binary_fallback(&Scheme_data_p_num_plus, x, y);
+}
+DEFINE_PRIMITIVE("-", fx_minus, (SCM x, SCM y), expr2)
+{
+    if (FIXNUM_P(x) && FIXNUM_P(y)) {
+        intptr_t r = FIXNUM_VALUE(x) - FIXNUM_VALUE(y);
+        if (FIXNUM_RANGE_P(r))
+            return MAKE_FIXNUM(r);
+    }
+    return binary_fallback(&Scheme_data_p_num_minus, x, y);
+}
+DEFINE_PRIMITIVE("*", fx_mul,   (SCM x, SCM y), expr2)
+{
+    intptr_t r;
+    if (FIXNUM_P(x) && FIXNUM_P(y) &&
+        ! __builtin_mul_overflow(FIXNUM_VALUE(x), FIXNUM_VALUE(y), &r) && FIXNUM_RANGE_P(r))
+        return MAKE_FIXNUM(r);
+    return binary_fallback(&Scheme_data_p_num_mul, x, y);
+}
+/* fixnumは即値なので大小は表現のまま比べられる */
+DEFINE_PRIMITIVE("=", fx_eq, (SCM x, SCM y), expr2)
+{
+    if (FIXNUM_P(x) && FIXNUM_P(y))
+        return C_TO_SCM_BOOLEAN(EQ_P(x, y));
+    return binary_fallback(&Scheme_data_p_num_eq, x, y);
+}
+DEFINE_PRIMITIVE("<", fx_less_than, (SCM x, SCM y), expr2)
+{
+    if (FIXNUM_P(x) && FIXNUM_P(y))
+        return C_TO_SCM_BOOLEAN((intptr_t) x < (intptr_t) y);
+    return binary_fallback(&Scheme_data_p_less_than, x, y);
+}
+DEFINE_PRIMITIVE("<=", fx_less_equal, (SCM x, SCM y), expr2)
+{
+    if (FIXNUM_P(x) && FIXNUM_P(y))
+        return C_TO_SCM_BOOLEAN((intptr_t) x <= (intptr_t) y);
+    return binary_fallback(&Scheme_data_p_less_equal, x, y);
+}
+DEFINE_PRIMITIVE(">", fx_greater_than, (SCM x, SCM y), expr2)
+{
+    if (FIXNUM_P(x) && FIXNUM_P(y))
+        return C_TO_SCM_BOOLEAN((intptr_t) x > (intptr_t) y);
+    return binary_fallback(&Scheme_data_p_greater_than, x, y);
+}
+DEFINE_PRIMITIVE(">=", fx_greater_equal, (SCM x, SCM y), expr2)
+{
+    if (FIXNUM_P(x) && FIXNUM_P(y))
+        return C_TO_SCM_BOOLEAN((intptr_t) x >= (intptr_t) y);
+    return binary_fallback(&Scheme_data_p_greater_equal, x, y);
+}
+
+/* flonumの二項版: 両方がflonumの時だけ自分で計算する */
+DEFINE_PRIMITIVE("+", fl_plus,  (SCM x, SCM y), expr2)
+{
+    if (FLONUM_P(x) && FLONUM_P(y))
+        return new_flonum(FLONUM_VALUE(x) + FLONUM_VALUE(y));
+    return binary_fallback(&Scheme_data_p_num_plus, x, y);
+}
+DEFINE_PRIMITIVE("-", fl_minus, (SCM x, SCM y), expr2)
+{
+    if (FLONUM_P(x) && FLONUM_P(y))
+        return new_flonum(FLONUM_VALUE(x) - FLONUM_VALUE(y));
+    return binary_fallback(&Scheme_data_p_num_minus, x, y);
+}
+DEFINE_PRIMITIVE("*", fl_mul,   (SCM x, SCM y), expr2)
+{
+    if (FLONUM_P(x) && FLONUM_P(y))
+        return new_flonum(FLONUM_VALUE(x) * FLONUM_VALUE(y));
+    return binary_fallback(&Scheme_data_p_num_mul, x, y);
+}
+DEFINE_PRIMITIVE("=", fl_eq, (SCM x, SCM y), expr2)
+{
+    if (FLONUM_P(x) && FLONUM_P(y))
+        return C_TO_SCM_BOOLEAN(FLONUM_VALUE(x) == FLONUM_VALUE(y));
+    return binary_fallback(&Scheme_data_p_num_eq, x, y);
+}
+DEFINE_PRIMITIVE("<", fl_less_than, (SCM x, SCM y), expr2)
+{
+    if (FLONUM_P(x) && FLONUM_P(y))
+        return C_TO_SCM_BOOLEAN(FLONUM_VALUE(x) < FLONUM_VALUE(y));
+    return binary_fallback(&Scheme_data_p_less_than, x, y);
+}
+DEFINE_PRIMITIVE("<=", fl_less_equal, (SCM x, SCM y), expr2)
+{
+    if (FLONUM_P(x) && FLONUM_P(y))
+        return C_TO_SCM_BOOLEAN(FLONUM_VALUE(x) <= FLONUM_VALUE(y));
+    return binary_fallback(&Scheme_data_p_less_equal, x, y);
+}
+DEFINE_PRIMITIVE(">", fl_greater_than, (SCM x, SCM y), expr2)
+{
+    if (FLONUM_P(x) && FLONUM_P(y))
+        return C_TO_SCM_BOOLEAN(FLONUM_VALUE(x) > FLONUM_VALUE(y));
+    return binary_fallback(&Scheme_data_p_greater_than, x, y);
+}
+DEFINE_PRIMITIVE(">=", fl_greater_equal, (SCM x, SCM y), expr2)
+{
+    if (FLONUM_P(x) && FLONUM_P(y))
+        return C_TO_SCM_BOOLEAN(FLONUM_VALUE(x) >= FLONUM_VALUE(y));
+    return binary_fallback(&Scheme_data_p_greater_equal, x, y);
+}
+
+DEFINE_PRIMITIVE("exact->inexact", exact2inexact, (SCM x), expr1)
+{
+    return new_flonum(number_to_double(number_check(x, "exact->inexact")));
+}
+/* 有理数はないので整数値のflonumだけを整数にする */
+DEFINE_PRIMITIVE("inexact->exact", inexact2exact, (SCM x), expr1)
+{
+    double value;
+    if (INTEGER_P(number_check(x, "inexact->exact")))
+        return x;
+    value = FLONUM_VALUE(x);
+    /* 2^53以上のdoubleは全て整数 */
+    if (isnan(value) || isinf(value) ||
+        (-9.0e15 < value && value < 9.0e15 && value != (double) (int64_t) value))
+        scheme_error("inexact->exact: integral number required");
+    return double_to_integer(value);
 }
 
 void symbols_of_eval_initialize(void)
@@ -590,8 +1289,12 @@ void symbols_of_eval_initialize(void)
     scm_gc_protect(_scm_symbol_double_arrow);
     ADD_PRIMITIVE("quote",  quote,  (SCM sexp, struct EvalState *state), SPECIAL_FORM);
     ADD_PRIMITIVE("set!",   setq,   (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+    ADD_PRIMITIVE("if",     if,     (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+    ADD_PRIMITIVE("and",    and,    (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+    ADD_PRIMITIVE("or",     or,     (SCM sexp, struct EvalState *state), SPECIAL_FORM);
     ADD_PRIMITIVE("cond",   cond,   (SCM sexp, struct EvalState *state), SPECIAL_FORM);
     ADD_PRIMITIVE("lambda", lambda, (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+    INITIALIZE_PRIMITIVE("lambda", flat_lambda, (SCM sexp, struct EvalState *state), SPECIAL_FORM);
     ADD_PRIMITIVE("macro",  macro,  (SCM sexp, struct EvalState *state), SPECIAL_FORM);
     ADD_PRIMITIVE("begin",  begin,  (SCM sexp, struct EvalState *state), SPECIAL_FORM);
     ADD_PRIMITIVE("exit", exit, (SCM l),              EXPR_1);
@@ -600,30 +1303,86 @@ void symbols_of_eval_initialize(void)
     ADD_PRIMITIVE("cdr",  cdr,  (SCM l),              EXPR_1);
     ADD_PRIMITIVE("cons", cons, (SCM o1, SCM o2), EXPR_2);
     ADD_PRIMITIVE("assq", assq, (SCM o,  SCM l),  EXPR_2);
-    ADD_PRIMITIVE("map",  map,  (SCM l),              LIST_EXPR);
+    ADD_PRIMITIVE("map",  map,  (SCM args, struct EvalState *state), CONTROL);
 
     ADD_PRIMITIVE("atom?", atom, (SCM o),              EXPR_1);
     ADD_PRIMITIVE("eq?",   eq,   (SCM o1, SCM o2), EXPR_2);
+    ADD_PRIMITIVE("eqv?",   eqv,   (SCM o1, SCM o2), EXPR_2);
+    ADD_PRIMITIVE("equal?", equal, (SCM o1, SCM o2), EXPR_2);
 
-/*     ADD_PRIMITIVE("write",   write,   (SCM o), expr1); */
-/*     ADD_PRIMITIVE("display", display, (SCM o), expr1); */
+    ADD_PRIMITIVE("write",   write,   (SCM o),     EXPR_1);
+    ADD_PRIMITIVE("display", display, (SCM o),     EXPR_1);
     ADD_PRIMITIVE("newline", newline, (),          EXPR_0);
 
-    ADD_PRIMITIVE("eval",   eval,   (SCM sexp),              EXPR_1);
-    ADD_PRIMITIVE("apply",  apply,  (SCM subr, SCM arg), EXPR_2);
+    ADD_PRIMITIVE("eval",   eval,   (SCM args, struct EvalState *state), CONTROL);
+    ADD_PRIMITIVE("apply",  apply,  (SCM args, struct EvalState *state), CONTROL);
     ADD_PRIMITIVE("load",   load,   (SCM filename),          EXPR_1);
 
+    ADD_PRIMITIVE("call-with-current-continuation", call_cc, (SCM args, struct EvalState *state), CONTROL);
+    ADD_PRIMITIVE("call-with-escape-continuation",  call_ec, (SCM args, struct EvalState *state), CONTROL);
+    SYMBOL_VCELL(intern("call/cc")) = &Scheme_data_p_call_cc;
+    SYMBOL_VCELL(intern("call/ec")) = &Scheme_data_p_call_ec;
+
     ADD_PRIMITIVE("intern", intern, (SCM str),               EXPR_1);
     ADD_PRIMITIVE("symbol->string", symbol2string, (SCM symbol), EXPR_1);
 
     ADD_PRIMITIVE("set-car!", set_carq, (SCM lvar, SCM rvar), EXPR_2);
     ADD_PRIMITIVE("set-cdr!", set_cdrq, (SCM lvar, SCM rvar), EXPR_2);
 
-    ADD_PRIMITIVE("<", less_than, (SCM l), LIST_EXPR);
+    ADD_PRIMITIVE("=",  num_eq,        (SCM l), LIST_EXPR);
+    ADD_PRIMITIVE("<",  less_than,     (SCM l), LIST_EXPR);
+    ADD_PRIMITIVE("<=", less_equal,    (SCM l), LIST_EXPR);
+    ADD_PRIMITIVE(">",  greater_than,  (SCM l), LIST_EXPR);
+    ADD_PRIMITIVE(">=", greater_equal, (SCM l), LIST_EXPR);
     ADD_PRIMITIVE("+", num_plus,  (SCM l), LIST_EXPR);
     ADD_PRIMITIVE("-", num_minus, (SCM l), LIST_EXPR);
     ADD_PRIMITIVE("*", num_mul,   (SCM l), LIST_EXPR);
     ADD_PRIMITIVE("/", num_div,   (SCM l), LIST_EXPR);
+    HEADER_FLAG(&Scheme_data_p_num_eq) = PRIMITIVE_FLAG_TRANSIENT;
+    HEADER_FLAG(&Scheme_data_p_less_than) = PRIMITIVE_FLAG_TRANSIENT;
+    HEADER_FLAG(&Scheme_data_p_less_equal) = PRIMITIVE_FLAG_TRANSIENT;
+    HEADER_FLAG(&Scheme_data_p_greater_than) = PRIMITIVE_FLAG_TRANSIENT;
+    HEADER_FLAG(&Scheme_data_p_greater_equal) = PRIMITIVE_FLAG_TRANSIENT;
+    HEADER_FLAG(&Scheme_data_p_num_plus) = PRIMITIVE_FLAG_TRANSIENT;
+    HEADER_FLAG(&Scheme_data_p_num_minus) = PRIMITIVE_FLAG_TRANSIENT;
+    HEADER_FLAG(&Scheme_data_p_num_mul) = PRIMITIVE_FLAG_TRANSIENT;
+    HEADER_FLAG(&Scheme_data_p_num_div) = PRIMITIVE_FLAG_TRANSIENT;
+    ADD_PRIMITIVE("exact->inexact", exact2inexact, (SCM x), EXPR_1);
+    ADD_PRIMITIVE("inexact->exact", inexact2exact, (SCM x), EXPR_1);
+
+    /* 二項版. optimizerが呼び出し位置に置く */
+    INITIALIZE_PRIMITIVE("+",  fx_plus,          (SCM x, SCM y), EXPR_2);
+    INITIALIZE_PRIMITIVE("-",  fx_minus,         (SCM x, SCM y), EXPR_2);
+    INITIALIZE_PRIMITIVE("*",  fx_mul,           (SCM x, SCM y), EXPR_2);
+    INITIALIZE_PRIMITIVE("=",  fx_eq,            (SCM x, SCM y), EXPR_2);
+    INITIALIZE_PRIMITIVE("<",  fx_less_than,     (SCM x, SCM y), EXPR_2);
+    INITIALIZE_PRIMITIVE("<=", fx_less_equal,    (SCM x, SCM y), EXPR_2);
+    INITIALIZE_PRIMITIVE(">",  fx_greater_than,  (SCM x, SCM y), EXPR_2);
+    INITIALIZE_PRIMITIVE(">=", fx_greater_equal, (SCM x, SCM y), EXPR_2);
+    HEADER_FLAG(&Scheme_data_p_fx_plus) = PRIMITIVE_FLAG_SPECIALIZED;
+    HEADER_FLAG(&Scheme_data_p_fx_minus) = PRIMITIVE_FLAG_SPECIALIZED;
+    HEADER_FLAG(&Scheme_data_p_fx_mul) = PRIMITIVE_FLAG_SPECIALIZED;
+    HEADER_FLAG(&Scheme_data_p_fx_eq) = PRIMITIVE_FLAG_SPECIALIZED;
+    HEADER_FLAG(&Scheme_data_p_fx_less_than) = PRIMITIVE_FLAG_SPECIALIZED;
+    HEADER_FLAG(&Scheme_data_p_fx_less_equal) = PRIMITIVE_FLAG_SPECIALIZED;
+    HEADER_FLAG(&Scheme_data_p_fx_greater_than) = PRIMITIVE_FLAG_SPECIALIZED;
+    HEADER_FLAG(&Scheme_data_p_fx_greater_equal) = PRIMITIVE_FLAG_SPECIALIZED;
+    INITIALIZE_PRIMITIVE("+",  fl_plus,          (SCM x, SCM y), EXPR_2);
+    INITIALIZE_PRIMITIVE("-",  fl_minus,         (SCM x, SCM y), EXPR_2);
+    INITIALIZE_PRIMITIVE("*",  fl_mul,           (SCM x, SCM y), EXPR_2);
+    INITIALIZE_PRIMITIVE("=",  fl_eq,            (SCM x, SCM y), EXPR_2);
+    INITIALIZE_PRIMITIVE("<",  fl_less_than,     (SCM x, SCM y), EXPR_2);
+    INITIALIZE_PRIMITIVE("<=", fl_less_equal,    (SCM x, SCM y), EXPR_2);
+    INITIALIZE_PRIMITIVE(">",  fl_greater_than,  (SCM x, SCM y), EXPR_2);
+    INITIALIZE_PRIMITIVE(">=", fl_greater_equal, (SCM x, SCM y), EXPR_2);
+    HEADER_FLAG(&Scheme_data_p_fl_plus) = PRIMITIVE_FLAG_SPECIALIZED;
+    HEADER_FLAG(&Scheme_data_p_fl_minus) = PRIMITIVE_FLAG_SPECIALIZED;
+    HEADER_FLAG(&Scheme_data_p_fl_mul) = PRIMITIVE_FLAG_SPECIALIZED;
+    HEADER_FLAG(&Scheme_data_p_fl_eq) = PRIMITIVE_FLAG_SPECIALIZED;
+    HEADER_FLAG(&Scheme_data_p_fl_less_than) = PRIMITIVE_FLAG_SPECIALIZED;
+    HEADER_FLAG(&Scheme_data_p_fl_less_equal) = PRIMITIVE_FLAG_SPECIALIZED;
+    HEADER_FLAG(&Scheme_data_p_fl_greater_than) = PRIMITIVE_FLAG_SPECIALIZED;
+    HEADER_FLAG(&Scheme_data_p_fl_greater_equal) = PRIMITIVE_FLAG_SPECIALIZED;
     return ;
 }
 
@@ -0,0 +1,116 @@
+/*===========================================================================
+ * expand.c - macro expander
+ *
+ * $Id$
+===========================================================================*/
+
+#include "scheme.h"
+
+/*==================================================
+  Displacement
+==================================================*/
+/**
+ * マクロ呼び出しのformを展開形で置き換える。
+ * 置き換えたformは次から普通の式として評価され、二度と展開されない。
+ * (マクロを定義し直しても置き換え済みのformには効かない)
+ */
+void displace_form(SCM form, SCM expansion)
+{
+    if (CONS_P(expansion)) {
+        CAR(form) = CAR(expansion);
+        SET_CDR(form, CDR(expansion));
+    } else {
+        /* (#<primitive begin> <expansion>) */
+        CAR(form) = &Scheme_data_p_begin;
+        SET_CDR(form, new_cons(expansion, SCM_NULL));
+    }
+}
+
+/*==================================================
+  Expander
+==================================================*/
+static SCM expand_form(SCM sexp, SCM bound);
+
+static int memq_p(SCM symbol, SCM lst)
+{
+    SCM kar;
+    FOR_EACH(lst, kar) {
+        if (EQ_P(kar, symbol))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/* lstの要素をそれぞれ展開する */
+static void expand_each(SCM lst, SCM bound)
+{
+    for (; CONS_P(lst); lst = CDR(lst)) {
+        CAR(lst) = expand_form(CAR(lst), bound);
+    }
+}
+
+/* (lambda <params> <body>) : paramsはマクロ名を隠す */
+static void expand_lambda(SCM sexp, SCM bound)
+{
+    SCM params = CADR(sexp);
+    for (; CONS_P(params); params = CDR(params)) {
+        bound = new_cons(CAR(params), bound);
+    }
+    if (SYMBOL_P(params)) {
+        bound = new_cons(params, bound);
+    }
+    expand_each(CDDR(sexp), bound);
+}
+
+/**
+ * sexpの中のマクロ呼び出しを展開して置き換える。
+ * boundはlambdaで束縛された変数の一覧。
+ */
+static SCM expand_form(SCM sexp, SCM bound)
+{
+    SCM head, value;
+ loop:
+    if (! CONS_P(sexp)) {
+        return sexp;
+    }
+    head = CAR(sexp);
+    if (SYMBOL_P(head) && ! memq_p(head, bound)) {
+        value = SYMBOL_VCELL(head);
+        if (MACRO_P(value)) {
+            displace_form(sexp, expand_macro(value, CDR(sexp)));
+            goto loop;
+        }
+        if (PRIMITIVE_P(value) && SPECIAL_FORM_P(value)) {
+            SCM derived = derived_syntax_expand(value, CDR(sexp));
+            if (derived != NULL) {
+                /* let, doなど: lambdaの式にして続けて展開する */
+                displace_form(sexp, derived);
+                goto loop;
+            }
+            if (EQ_P(value, &Scheme_data_p_lambda)) {
+                expand_lambda(sexp, bound);
+            } else if (EQ_P(value, &Scheme_data_p_cond)) {
+                SCM clauses = CDR(sexp);
+                for (; CONS_P(clauses); clauses = CDR(clauses)) {
+                    expand_each(CAR(clauses), bound);
+                }
+            } else if (EQ_P(value, &Scheme_data_p_setq) || EQ_P(value, &Scheme_data_p_begin) ||
+                       CONDITIONAL_FORM_P(value)) {
+                expand_each(CDR(sexp), bound);
+            }
+            /* quote, macroなどは中を見ない */
+            return sexp;
+        }
+    }
+    expand_each(sexp, bound);
+    return sexp;
+}
+
+/**
+ * 評価の前にformのマクロ呼び出しを全て展開する (load, REPL)
+ * ここで定義されていないマクロは評価時に展開される。
+ */
+SCM expand(SCM sexp)
+{
+    return expand_form(sexp, SCM_NULL);
+}
@@ -0,0 +1,599 @@
+/*===========================================================================
+ * hamt.c - persistent map and set (hash array mapped trie)
+ *
+ * $Id$
+===========================================================================*/
+
+#include "scheme.h"
+
+/* keyのhash (equal?) を5bitずつ使って32分岐する木。
+ * nodeは32bitのbitmapと、ある枝だけを詰めた key, value の配列を持つ.
+ * keyがSCM_UNBOUNDの所はvalueが下のnodeになっている.
+ * 更新は根からその枝までのnodeだけを写し、残りは元の木と共有する.
+ * hashを使い切っても同じなら衝突nodeに並べる.
+ *
+ * transientは自分の番号(edit)を持ち、同じ番号のnodeはその場で書き換える.
+ * persistent!すると番号を捨てるので、以後そのnodeが書き換えられることはない.
+ * symbol以外のcellのkeyはaddressでhashするので、cellを動かすGCになったら
+ * 木を作り直す必要がある (hashtable.cと同じ)
+ */
+
+#define HAMT_BITS 5
+#define HAMT_MASK 31
+#define HAMT_MAX_SHIFT 30       /* 32bitのhashの最後の段 */
+#define HAMT_SUBNODE SCM_UNBOUND
+
+#define HAMT_BIT(hash, shift)      (1U << (((hash) >> (shift)) & HAMT_MASK))
+#define HAMT_INDEX(bitmap, bit)    __builtin_popcount((bitmap) & ((bit) - 1))
+#define HAMT_KEY(node, i)          (HAMT_NODE_ENTRIES(node)[(i) * 2])
+#define HAMT_VALUE(node, i)        (HAMT_NODE_ENTRIES(node)[(i) * 2 + 1])
+
+static unsigned int hamt_edit_counter = 0;
+
+static unsigned int hamt_hash(SCM key)
+{
+    uint64_t h = equal_hash(key);
+    return (unsigned int) (h ^ (h >> 32));
+}
+
+static unsigned int hamt_new_edit(void)
+{
+    if (++hamt_edit_counter == 0)
+        hamt_edit_counter = 1;
+    return hamt_edit_counter;
+}
+
+/*==================================================
+  Node
+==================================================*/
+/* 同じtransientが作ったnodeはそのまま、他は写す */
+static SCM node_editable(SCM node, unsigned int edit)
+{
+    SCM copy;
+    if (edit != 0 && HAMT_NODE_EDIT(node) == edit)
+        return node;
+    copy = new_hamt_node(HEADER_FLAG(node), HAMT_NODE_BITMAP(node), HAMT_NODE_LENGTH(node), edit);
+    memcpy(HAMT_NODE_ENTRIES(copy), HAMT_NODE_ENTRIES(node),
+           sizeof(SCM) * 2 * HAMT_NODE_LENGTH(node));
+    return copy;
+}
+
+static SCM node_replace(SCM node, unsigned int edit, int i, SCM key, SCM value)
+{
+    node = node_editable(node, edit);
+    HAMT_KEY(node, i) = key;
+    HAMT_VALUE(node, i) = value;
+    return node;
+}
+
+/* i番目に組を入れる (delta = 1) か、i番目を除く (delta = -1).
+ * 長さが変わるので配列は取り直すが、transientのnodeはcellを使い回す */
+static SCM node_splice(SCM node, unsigned int edit, unsigned int bitmap, int i, int delta,
+                       SCM key, SCM value)
+{
+    int length = HAMT_NODE_LENGTH(node);
+    SCM *old = HAMT_NODE_ENTRIES(node);
+    SCM *entries;
+    SCM result;
+
+    if (edit != 0 && HAMT_NODE_EDIT(node) == edit) {
+        result = node;
+        entries = data_allocate(sizeof(SCM) * 2 * (length + delta));
+    } else {
+        result = new_hamt_node(HEADER_FLAG(node), bitmap, length + delta, edit);
+        entries = HAMT_NODE_ENTRIES(result);
+    }
+    memcpy(entries, old, sizeof(SCM) * 2 * i);
+    if (delta > 0) {
+        entries[i * 2] = key;
+        entries[i * 2 + 1] = value;
+        memcpy(entries + i * 2 + 2, old + i * 2, sizeof(SCM) * 2 * (length - i));
+    } else {
+        memcpy(entries + i * 2, old + i * 2 + 2, sizeof(SCM) * 2 * (length - i - 1));
+    }
+    HAMT_NODE_ENTRIES(result) = entries;
+    HAMT_NODE_BITMAP(result) = bitmap;
+    HAMT_NODE_LENGTH(result) = length + delta;
+    return result;
+}
+
+/* 別々のkeyの二組だけを持つ木 */
+static SCM node_merge(unsigned int edit, int shift,
+                      SCM key1, SCM value1, unsigned int hash1,
+                      SCM key2, SCM value2, unsigned int hash2)
+{
+    unsigned int bit1, bit2;
+    SCM node, child;
+
+    if (shift > HAMT_MAX_SHIFT) {
+        node = new_hamt_node(HAMT_NODE_FLAG_COLLISION, 0, 2, edit);
+        HAMT_KEY(node, 0) = key1; HAMT_VALUE(node, 0) = value1;
+        HAMT_KEY(node, 1) = key2; HAMT_VALUE(node, 1) = value2;
+        return node;
+    }
+    bit1 = HAMT_BIT(hash1, shift);
+    bit2 = HAMT_BIT(hash2, shift);
+    if (bit1 == bit2) {
+        child = node_merge(edit, shift + HAMT_BITS, key1, value1, hash1, key2, value2, hash2);
+        node = new_hamt_node(0, bit1, 1, edit);
+        HAMT_KEY(node, 0) = HAMT_SUBNODE;
+        HAMT_VALUE(node, 0) = child;
+        return node;
+    }
+    node = new_hamt_node(0, bit1 | bit2, 2, edit);
+    if (bit1 > bit2) {
+        HAMT_KEY(node, 0) = key2; HAMT_VALUE(node, 0) = value2;
+        HAMT_KEY(node, 1) = key1; HAMT_VALUE(node, 1) = value1;
+    } else {
+        HAMT_KEY(node, 0) = key1; HAMT_VALUE(node, 0) = value1;
+        HAMT_KEY(node, 1) = key2; HAMT_VALUE(node, 1) = value2;
+    }
+    return node;
+}
+
+/*==================================================
+  Trie
+==================================================*/
+static SCM hamt_lookup(SCM node, SCM key, unsigned int hash, SCM fallback)
+{
+    int shift, i;
+    unsigned int bit;
+    SCM k;
+
+    for (shift = 0; ! NULL_P(node); shift += HAMT_BITS) {
+        if (HAMT_NODE_COLLISION_P(node)) {
+            for (i = 0; i < HAMT_NODE_LENGTH(node); i++)
+                if (equal_p(HAMT_KEY(node, i), key))
+                    return HAMT_VALUE(node, i);
+            return fallback;
+        }
+        bit = HAMT_BIT(hash, shift);
+        if (! (HAMT_NODE_BITMAP(node) & bit))
+            return fallback;
+        i = HAMT_INDEX(HAMT_NODE_BITMAP(node), bit);
+        k = HAMT_KEY(node, i);
+        if (! UNBOUND_P(k))
+            return equal_p(k, key) ? HAMT_VALUE(node, i) : fallback;
+        node = HAMT_VALUE(node, i);
+    }
+    return fallback;
+}
+
+/* 変わらなければ同じnodeを返す. 組が増えたらaddedを立てる */
+static SCM hamt_assoc(SCM node, unsigned int edit, int shift,
+                      SCM key, unsigned int hash, SCM value, int *added)
+{
+    unsigned int bitmap, bit;
+    SCM k, v, child;
+    int i;
+
+    if (NULL_P(node)) {
+        *added = TRUE;
+        node = new_hamt_node(0, HAMT_BIT(hash, shift), 1, edit);
+        HAMT_KEY(node, 0) = key;
+        HAMT_VALUE(node, 0) = value;
+        return node;
+    }
+    if (HAMT_NODE_COLLISION_P(node)) {
+        for (i = 0; i < HAMT_NODE_LENGTH(node); i++) {
+            if (equal_p(HAMT_KEY(node, i), key)) {
+                if (EQ_P(HAMT_VALUE(node, i), value))
+                    return node;
+                return node_replace(node, edit, i, key, value);
+            }
+        }
+        *added = TRUE;
+        return node_splice(node, edit, 0, i, 1, key, value);
+    }
+    bitmap = HAMT_NODE_BITMAP(node);
+    bit = HAMT_BIT(hash, shift);
+    i = HAMT_INDEX(bitmap, bit);
+    if (! (bitmap & bit)) {
+        *added = TRUE;
+        return node_splice(node, edit, bitmap | bit, i, 1, key, value);
+    }
+    k = HAMT_KEY(node, i);
+    v = HAMT_VALUE(node, i);
+    if (UNBOUND_P(k)) {
+        child = hamt_assoc(v, edit, shift + HAMT_BITS, key, hash, value, added);
+        if (EQ_P(child, v))
+            return node;
+        return node_replace(node, edit, i, HAMT_SUBNODE, child);
+    }
+    if (equal_p(k, key)) {
+        if (EQ_P(v, value))
+            return node;
+        return node_replace(node, edit, i, key, value);
+    }
+    *added = TRUE;
+    child = node_merge(edit, shift + HAMT_BITS, k, v, hamt_hash(k), key, value, hash);
+    return node_replace(node, edit, i, HAMT_SUBNODE, child);
+}
+
+/* 空になったら()を返す. 一組だけ残った下のnodeは上に引き上げる */
+static SCM hamt_dissoc(SCM node, unsigned int edit, int shift,
+                       SCM key, unsigned int hash, int *removed)
+{
+    unsigned int bitmap, bit;
+    SCM k, v, child;
+    int i;
+
+    if (NULL_P(node))
+        return node;
+    if (HAMT_NODE_COLLISION_P(node)) {
+        for (i = 0; i < HAMT_NODE_LENGTH(node); i++) {
+            if (equal_p(HAMT_KEY(node, i), key)) {
+                *removed = TRUE;
+                if (HAMT_NODE_LENGTH(node) == 1)
+                    return SCM_NULL;
+                return node_splice(node, edit, 0, i, -1, SCM_NULL, SCM_NULL);
+            }
+        }
+        return node;
+    }
+    bitmap = HAMT_NODE_BITMAP(node);
+    bit = HAMT_BIT(hash, shift);
+    if (! (bitmap & bit))
+        return node;
+    i = HAMT_INDEX(bitmap, bit);
+    k = HAMT_KEY(node, i);
+    v = HAMT_VALUE(node, i);
+    if (UNBOUND_P(k)) {
+        child = hamt_dissoc(v, edit, shift + HAMT_BITS, key, hash, removed);
+        if (EQ_P(child, v))
+            return node;
+        if (! NULL_P(child)) {
+            if (HAMT_NODE_LENGTH(child) == 1 && ! UNBOUND_P(HAMT_KEY(child, 0)))
+                return node_replace(node, edit, i, HAMT_KEY(child, 0), HAMT_VALUE(child, 0));
+            return node_replace(node, edit, i, HAMT_SUBNODE, child);
+        }
+    } else if (! equal_p(k, key)) {
+        return node;
+    } else {
+        *removed = TRUE;
+    }
+    if (HAMT_NODE_LENGTH(node) == 1)
+        return SCM_NULL;
+    return node_splice(node, edit, bitmap & ~bit, i, -1, SCM_NULL, SCM_NULL);
+}
+
+/* 木の組をresultの前に積む. whatは0: key, 1: value, 2: (key . value) */
+static SCM hamt_fold(SCM node, int what, SCM result)
+{
+    int i;
+    SCM k;
+    if (NULL_P(node))
+        return result;
+    for (i = HAMT_NODE_LENGTH(node) - 1; i >= 0; i--) {
+        k = HAMT_KEY(node, i);
+        if (UNBOUND_P(k) && ! HAMT_NODE_COLLISION_P(node))
+            result = hamt_fold(HAMT_VALUE(node, i), what, result);
+        else
+            result = new_cons(what == 0 ? k :
+                              what == 1 ? HAMT_VALUE(node, i) :
+                              new_cons(k, HAMT_VALUE(node, i)),
+                              result);
+    }
+    return result;
+}
+
+void print_hamt(SCM hamt, FILE *file)
+{
+    fprintf(file, "#<%s%s %d>",
+            HAMT_TRANSIENT_P(hamt) ? "transient-" : "",
+            HAMT_SET_P(hamt) ? "pset" : "pmap", HAMT_COUNT(hamt));
+}
+
+/*==================================================
+  Map
+==================================================*/
+static SCM hamt_get(SCM hamt, SCM key, SCM fallback)
+{
+    return hamt_lookup(HAMT_ROOT(hamt), key, hamt_hash(key), fallback);
+}
+
+/* 変わらなければ同じmapを返す */
+static SCM hamt_put(SCM hamt, SCM key, SCM value)
+{
+    int added = FALSE;
+    SCM root = hamt_assoc(HAMT_ROOT(hamt), 0, 0, key, hamt_hash(key), value, &added);
+    if (EQ_P(root, HAMT_ROOT(hamt)))
+        return hamt;
+    return new_hamt(HEADER_FLAG(hamt), root, HAMT_COUNT(hamt) + (added ? 1 : 0), 0);
+}
+
+static SCM hamt_remove(SCM hamt, SCM key)
+{
+    int removed = FALSE;
+    SCM root = hamt_dissoc(HAMT_ROOT(hamt), 0, 0, key, hamt_hash(key), &removed);
+    if (! removed)
+        return hamt;
+    return new_hamt(HEADER_FLAG(hamt), root, HAMT_COUNT(hamt) - 1, 0);
+}
+
+static void hamt_put_transient(SCM hamt, SCM key, SCM value)
+{
+    int added = FALSE;
+    HAMT_ROOT(hamt) = hamt_assoc(HAMT_ROOT(hamt), HAMT_EDIT(hamt), 0, key, hamt_hash(key), value, &added);
+    if (added)
+        HAMT_COUNT(hamt)++;
+}
+
+static void hamt_remove_transient(SCM hamt, SCM key)
+{
+    int removed = FALSE;
+    HAMT_ROOT(hamt) = hamt_dissoc(HAMT_ROOT(hamt), HAMT_EDIT(hamt), 0, key, hamt_hash(key), &removed);
+    if (removed)
+        HAMT_COUNT(hamt)--;
+}
+
+/*==================================================
+  Check
+==================================================*/
+/* flagが合うか. TRANSIENTを要求するときは使い終えていないことも見る */
+static SCM hamt_check(SCM o, int flag, char *name)
+{
+    char message[64];
+    if (! HAMT_P(o) || (HEADER_FLAG(o) & HAMT_FLAG_SET) != (flag & HAMT_FLAG_SET)) {
+        snprintf(message, sizeof(message), "%s: %s required", name,
+                 (flag & HAMT_FLAG_SET) ? "pset" : "pmap");
+        scheme_error(message);
+    }
+    if ((HEADER_FLAG(o) & HAMT_FLAG_TRANSIENT) != (flag & HAMT_FLAG_TRANSIENT)) {
+        snprintf(message, sizeof(message), "%s: %s required", name,
+                 (flag & HAMT_FLAG_TRANSIENT) ? "transient" : "persistent");
+        scheme_error(message);
+    }
+    if ((flag & HAMT_FLAG_TRANSIENT) && HAMT_EDIT(o) == 0) {
+        snprintf(message, sizeof(message), "%s: transient used after persistent!", name);
+        scheme_error(message);
+    }
+    return o;
+}
+
+/* 読むだけの手続きはtransientも受け付ける */
+static SCM hamt_check_read(SCM o, int flag, char *name)
+{
+    return hamt_check(o, flag | (HAMT_P(o) ? HAMT_TRANSIENT_P(o) : 0), name);
+}
+
+static SCM hamt_transient(SCM hamt)
+{
+    return new_hamt(HEADER_FLAG(hamt) | HAMT_FLAG_TRANSIENT,
+                    HAMT_ROOT(hamt), HAMT_COUNT(hamt), hamt_new_edit());
+}
+
+static SCM hamt_persistent(SCM hamt)
+{
+    HAMT_EDIT(hamt) = 0;
+    return new_hamt(HEADER_FLAG(hamt) & ~HAMT_FLAG_TRANSIENT, HAMT_ROOT(hamt), HAMT_COUNT(hamt), 0);
+}
+
+/*==================================================
+  Primitive: pmap
+==================================================*/
+DEFINE_PRIMITIVE("make-pmap", make_pmap, (), expr0)
+{
+    return new_hamt(0, SCM_NULL, 0, 0);
+}
+
+/* (pmap key value ...). 途中はtransientで作る */
+DEFINE_PRIMITIVE("pmap", pmap, (SCM l), list_expr)
+{
+    SCM hamt = new_hamt(HAMT_FLAG_TRANSIENT, SCM_NULL, 0, hamt_new_edit());
+    for (; CONS_P(l); l = CDDR(l)) {
+        if (! CONS_P(CDR(l)))
+            scheme_error("pmap: odd number of arguments");
+        hamt_put_transient(hamt, CAR(l), CADR(l));
+    }
+    return hamt_persistent(hamt);
+}
+
+DEFINE_PRIMITIVE("pmap?", pmapp, (SCM o), expr1)
+{
+    return C_TO_SCM_BOOLEAN(HAMT_P(o) && ! HAMT_SET_P(o));
+}
+
+/* (pmap-ref map key [default]) */
+DEFINE_PRIMITIVE("pmap-ref", pmap_ref, (SCM l), list_expr)
+{
+    SCM value;
+    int argc = list_length(l);
+    if (argc != 2 && argc != 3)
+        scheme_error("pmap-ref: wrong number of arguments");
+    value = hamt_get(hamt_check_read(CAR(l), 0, "pmap-ref"), CADR(l), SCM_UNBOUND);
+    if (! UNBOUND_P(value))
+        return value;
+    if (argc == 2)
+        scheme_error("pmap-ref: key not found");
+    return CADDR(l);
+}
+
+DEFINE_PRIMITIVE("pmap-contains?", pmap_containsp, (SCM hamt, SCM key), expr2)
+{
+    return C_TO_SCM_BOOLEAN(! UNBOUND_P(hamt_get(hamt_check_read(hamt, 0, "pmap-contains?"),
+                                                 key, SCM_UNBOUND)));
+}
+
+DEFINE_PRIMITIVE("pmap-set", pmap_set, (SCM hamt, SCM key, SCM value), expr3)
+{
+    return hamt_put(hamt_check(hamt, 0, "pmap-set"), key, value);
+}
+
+DEFINE_PRIMITIVE("pmap-delete", pmap_delete, (SCM hamt, SCM key), expr2)
+{
+    return hamt_remove(hamt_check(hamt, 0, "pmap-delete"), key);
+}
+
+/* 値をprocに通して入れる. keyがなければdefaultを通す */
+DEFINE_PRIMITIVE("pmap-update", pmap_update, (SCM hamt, SCM key, SCM proc, SCM fallback), expr4)
+{
+    SCM value = hamt_get(hamt_check(hamt, 0, "pmap-update"), key, fallback);
+    value = apply_procedure(proc, new_cons(value, SCM_NULL));
+    return hamt_put(hamt, key, value);
+}
+
+DEFINE_PRIMITIVE("pmap-size", pmap_size, (SCM hamt), expr1)
+{
+    return MAKE_FIXNUM(HAMT_COUNT(hamt_check_read(hamt, 0, "pmap-size")));
+}
+
+DEFINE_PRIMITIVE("pmap-keys", pmap_keys, (SCM hamt), expr1)
+{
+    return hamt_fold(HAMT_ROOT(hamt_check_read(hamt, 0, "pmap-keys")), 0, SCM_NULL);
+}
+
+DEFINE_PRIMITIVE("pmap-values", pmap_values, (SCM hamt), expr1)
+{
+    return hamt_fold(HAMT_ROOT(hamt_check_read(hamt, 0, "pmap-values")), 1, SCM_NULL);
+}
+
+DEFINE_PRIMITIVE("pmap->alist", pmap2alist, (SCM hamt), expr1)
+{
+    return hamt_fold(HAMT_ROOT(hamt_check_read(hamt, 0, "pmap->alist")), 2, SCM_NULL);
+}
+
+/* 先にあるものを優先する */
+DEFINE_PRIMITIVE("alist->pmap", alist2pmap, (SCM alist), expr1)
+{
+    SCM hamt = new_hamt(HAMT_FLAG_TRANSIENT, SCM_NULL, 0, hamt_new_edit());
+    SCM entry;
+    for (; CONS_P(alist); alist = CDR(alist)) {
+        entry = CAR(alist);
+        if (! CONS_P(entry))
+            scheme_error("alist->pmap: pair required");
+        if (UNBOUND_P(hamt_get(hamt, CAR(entry), SCM_UNBOUND)))
+            hamt_put_transient(hamt, CAR(entry), CDR(entry));
+    }
+    return hamt_persistent(hamt);
+}
+
+DEFINE_PRIMITIVE("pmap-transient", pmap_transient, (SCM hamt), expr1)
+{
+    return hamt_transient(hamt_check(hamt, 0, "pmap-transient"));
+}
+
+DEFINE_PRIMITIVE("pmap-set!", pmap_setq, (SCM hamt, SCM key, SCM value), expr3)
+{
+    hamt_put_transient(hamt_check(hamt, HAMT_FLAG_TRANSIENT, "pmap-set!"), key, value);
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("pmap-delete!", pmap_deleteq, (SCM hamt, SCM key), expr2)
+{
+    hamt_remove_transient(hamt_check(hamt, HAMT_FLAG_TRANSIENT, "pmap-delete!"), key);
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("pmap-persistent!", pmap_persistentq, (SCM hamt), expr1)
+{
+    return hamt_persistent(hamt_check(hamt, HAMT_FLAG_TRANSIENT, "pmap-persistent!"));
+}
+
+/*==================================================
+  Primitive: pset
+==================================================*/
+DEFINE_PRIMITIVE("make-pset", make_pset, (), expr0)
+{
+    return new_hamt(HAMT_FLAG_SET, SCM_NULL, 0, 0);
+}
+
+DEFINE_PRIMITIVE("pset", pset, (SCM l), list_expr)
+{
+    SCM hamt = new_hamt(HAMT_FLAG_SET | HAMT_FLAG_TRANSIENT, SCM_NULL, 0, hamt_new_edit());
+    for (; CONS_P(l); l = CDR(l))
+        hamt_put_transient(hamt, CAR(l), SCM_TRUE);
+    return hamt_persistent(hamt);
+}
+
+DEFINE_PRIMITIVE("list->pset", list2pset, (SCM l), expr1)
+{
+    return Scheme_pset(l);
+}
+
+DEFINE_PRIMITIVE("pset?", psetp, (SCM o), expr1)
+{
+    return C_TO_SCM_BOOLEAN(HAMT_P(o) && HAMT_SET_P(o));
+}
+
+DEFINE_PRIMITIVE("pset-contains?", pset_containsp, (SCM hamt, SCM key), expr2)
+{
+    return C_TO_SCM_BOOLEAN(! UNBOUND_P(hamt_get(hamt_check_read(hamt, HAMT_FLAG_SET, "pset-contains?"),
+                                                 key, SCM_UNBOUND)));
+}
+
+DEFINE_PRIMITIVE("pset-add", pset_add, (SCM hamt, SCM key), expr2)
+{
+    return hamt_put(hamt_check(hamt, HAMT_FLAG_SET, "pset-add"), key, SCM_TRUE);
+}
+
+DEFINE_PRIMITIVE("pset-remove", pset_remove, (SCM hamt, SCM key), expr2)
+{
+    return hamt_remove(hamt_check(hamt, HAMT_FLAG_SET, "pset-remove"), key);
+}
+
+DEFINE_PRIMITIVE("pset-size", pset_size, (SCM hamt), expr1)
+{
+    return MAKE_FIXNUM(HAMT_COUNT(hamt_check_read(hamt, HAMT_FLAG_SET, "pset-size")));
+}
+
+DEFINE_PRIMITIVE("pset->list", pset2list, (SCM hamt), expr1)
+{
+    return hamt_fold(HAMT_ROOT(hamt_check_read(hamt, HAMT_FLAG_SET, "pset->list")), 0, SCM_NULL);
+}
+
+DEFINE_PRIMITIVE("pset-transient", pset_transient, (SCM hamt), expr1)
+{
+    return hamt_transient(hamt_check(hamt, HAMT_FLAG_SET, "pset-transient"));
+}
+
+DEFINE_PRIMITIVE("pset-add!", pset_addq, (SCM hamt, SCM key), expr2)
+{
+    hamt_put_transient(hamt_check(hamt, HAMT_FLAG_SET | HAMT_FLAG_TRANSIENT, "pset-add!"), key, SCM_TRUE);
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("pset-remove!", pset_removeq, (SCM hamt, SCM key), expr2)
+{
+    hamt_remove_transient(hamt_check(hamt, HAMT_FLAG_SET | HAMT_FLAG_TRANSIENT, "pset-remove!"), key);
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("pset-persistent!", pset_persistentq, (SCM hamt), expr1)
+{
+    return hamt_persistent(hamt_check(hamt, HAMT_FLAG_SET | HAMT_FLAG_TRANSIENT, "pset-persistent!"));
+}
+
+void symbols_of_hamt_initialize(void)
+{
+    ADD_PRIMITIVE("make-pmap",        make_pmap,        (),                       EXPR_0);
+    ADD_PRIMITIVE("pmap",             pmap,             (SCM l),                  LIST_EXPR);
+    ADD_PRIMITIVE("pmap?",            pmapp,            (SCM o),                  EXPR_1);
+    ADD_PRIMITIVE("pmap-ref",         pmap_ref,         (SCM l),                  LIST_EXPR);
+    ADD_PRIMITIVE("pmap-contains?",   pmap_containsp,   (SCM m, SCM k),           EXPR_2);
+    ADD_PRIMITIVE("pmap-set",         pmap_set,         (SCM m, SCM k, SCM v),    EXPR_3);
+    ADD_PRIMITIVE("pmap-delete",      pmap_delete,      (SCM m, SCM k),           EXPR_2);
+    ADD_PRIMITIVE("pmap-update",      pmap_update,      (SCM m, SCM k, SCM p, SCM d), EXPR_4);
+    ADD_PRIMITIVE("pmap-size",        pmap_size,        (SCM m),                  EXPR_1);
+    ADD_PRIMITIVE("pmap-keys",        pmap_keys,        (SCM m),                  EXPR_1);
+    ADD_PRIMITIVE("pmap-values",      pmap_values,      (SCM m),                  EXPR_1);
+    ADD_PRIMITIVE("pmap->alist",      pmap2alist,       (SCM m),                  EXPR_1);
+    ADD_PRIMITIVE("alist->pmap",      alist2pmap,       (SCM a),                  EXPR_1);
+    ADD_PRIMITIVE("pmap-transient",   pmap_transient,   (SCM m),                  EXPR_1);
+    ADD_PRIMITIVE("pmap-set!",        pmap_setq,        (SCM m, SCM k, SCM v),    EXPR_3);
+    ADD_PRIMITIVE("pmap-delete!",     pmap_deleteq,     (SCM m, SCM k),           EXPR_2);
+    ADD_PRIMITIVE("pmap-persistent!", pmap_persistentq, (SCM m),                  EXPR_1);
+    ADD_PRIMITIVE("make-pset",        make_pset,        (),                       EXPR_0);
+    ADD_PRIMITIVE("pset",             pset,             (SCM l),                  LIST_EXPR);
+    ADD_PRIMITIVE("list->pset",       list2pset,        (SCM l),                  EXPR_1);
+    ADD_PRIMITIVE("pset?",            psetp,            (SCM o),                  EXPR_1);
+    ADD_PRIMITIVE("pset-contains?",   pset_containsp,   (SCM s, SCM k),           EXPR_2);
+    ADD_PRIMITIVE("pset-add",         pset_add,         (SCM s, SCM k),           EXPR_2);
+    ADD_PRIMITIVE("pset-remove",      pset_remove,      (SCM s, SCM k),           EXPR_2);
+    ADD_PRIMITIVE("pset-size",        pset_size,        (SCM s),                  EXPR_1);
+    ADD_PRIMITIVE("pset->list",       pset2list,        (SCM s),                  EXPR_1);
+    ADD_PRIMITIVE("pset-transient",   pset_transient,   (SCM s),                  EXPR_1);
+    ADD_PRIMITIVE("pset-add!",        pset_addq,        (SCM s, SCM k),           EXPR_2);
+    ADD_PRIMITIVE("pset-remove!",     pset_removeq,     (SCM s, SCM k),           EXPR_2);
+    ADD_PRIMITIVE("pset-persistent!", pset_persistentq, (SCM s),                  EXPR_1);
+}
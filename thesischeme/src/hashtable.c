@@ -0,0 +1,500 @@
+/*===========================================================================
+ * hashtable.c - hash table (SRFI-69)
+ *
+ * $Id$
+===========================================================================*/
+
+#include <limits.h>
+
+#include "scheme.h"
+
+/* keyとvalueを交互に並べた配列を線形探査する開番地法の表。
+ * 削除した所はkeyをSCM_DELETEDにして探査を続けられるようにする。
+ * 比較はeq?, eqv?, equal?, string=? から選ぶ。
+ * symbolは名前のhashを使うので、addressでhashするのは他のcellだけ.
+ * そういうkeyがある表はcellを動かすGCの後で入れ直す (scm_gc_move_epoch)
+ */
+
+#define HASH_TABLE_INITIAL_CAPACITY 8
+#define HASH_TABLE_MAX_CAPACITY (INT_MAX / 4)
+#define HASH_EQUAL_DEPTH 4   /* equal?のhashで見る入れ子の深さ */
+#define HASH_EQUAL_WIDTH 8   /* 一段で見るlistとvectorの要素の数 */
+
+static char *hash_table_kind_names[] = { "eq", "eqv", "equal", "string" };
+
+/*==================================================
+  Hash Function
+==================================================*/
+static uintptr_t hash_mix(uintptr_t x)
+{
+    x ^= x >> 31;
+    x *= (uintptr_t) 0x9E3779B97F4A7C15ULL;
+    x ^= x >> 29;
+    return x;
+}
+
+/* symbol以外のcellはaddressでhashし、addressに印を付ける */
+static uintptr_t hash_eq(SCM obj, int *address)
+{
+    if (SYMBOL_P(obj))
+        return SYMBOL_HASH(obj);
+    if (CONS_P(obj) || SCM_POINTER_P(obj))
+        *address = TRUE;
+    return hash_mix(AS_UINT(obj));
+}
+
+static uintptr_t hash_eqv(SCM obj, int *address)
+{
+    union FlonumBits u;
+    uintptr_t h;
+    int i;
+
+    if (BIGNUM_P(obj)) {
+        h = BIGNUM_NEGATIVE_P(obj) ? 1 : 0;
+        for (i = 0; i < BIGNUM_LENGTH(obj); i++)
+            h = h * 31 + BIGNUM_DIGITS(obj)[i];
+        return hash_mix(h);
+    }
+    if (HEAP_FLONUM_P(obj)) {
+        u.value = HEAP_FLONUM_VALUE(obj);
+        return hash_mix((uintptr_t) u.bits);
+    }
+    return hash_eq(obj, address);
+}
+
+/* 長いlistや深い木は先の方だけ見る */
+static uintptr_t hash_equal(SCM obj, int depth, int *address)
+{
+    uintptr_t h;
+    unsigned char *p, *end;
+    int i;
+
+    if (STRING_P(obj))
+        return string_hash(obj);
+    if (CONS_P(obj)) {
+        h = 17;
+        if (depth <= 0)
+            return h;
+        for (i = 0; CONS_P(obj) && i < HASH_EQUAL_WIDTH; i++, obj = CDR(obj))
+            h = h * 31 + hash_equal(CAR(obj), depth - 1, address);
+        if (! CONS_P(obj))
+            h = h * 31 + hash_equal(obj, depth - 1, address);
+        return hash_mix(h);
+    }
+    if (VECTOR_P(obj)) {
+        h = VECTOR_LENGTH(obj);
+        if (depth <= 0)
+            return h;
+        for (i = 0; i < VECTOR_LENGTH(obj) && i < HASH_EQUAL_WIDTH; i++)
+            h = h * 31 + hash_equal(VECTOR_REF(obj, i), depth - 1, address);
+        return hash_mix(h);
+    }
+    if (UVECTOR_P(obj)) {
+        h = UVECTOR_TYPE(obj);
+        p = UVECTOR_ELEMENTS(obj);
+        end = p + UVECTOR_LENGTH(obj) * UVECTOR_ELEMENT_SIZE(UVECTOR_TYPE(obj));
+        for (; p < end; p++)
+            h = h * 31 + *p;
+        return hash_mix(h);
+    }
+    return hash_eqv(obj, address);
+}
+
+/* equal?で等しいものは同じ値になる (hamt.c) */
+uintptr_t equal_hash(SCM obj)
+{
+    int address = FALSE;
+    return hash_equal(obj, HASH_EQUAL_DEPTH, &address);
+}
+
+static uintptr_t hash_key(SCM table, SCM key, int *address)
+{
+    switch (HASH_TABLE_KIND(table)) {
+    case HASH_TABLE_EQ:     return hash_eq(key, address);
+    case HASH_TABLE_EQV:    return hash_eqv(key, address);
+    case HASH_TABLE_EQUAL:  return hash_equal(key, HASH_EQUAL_DEPTH, address);
+    case HASH_TABLE_STRING: return string_hash(key);
+    }
+    return 0;
+}
+
+static int same_key(SCM table, SCM a, SCM b)
+{
+    switch (HASH_TABLE_KIND(table)) {
+    case HASH_TABLE_EQ:     return EQ_P(a, b);
+    case HASH_TABLE_EQV:    return eqv_p(a, b);
+    case HASH_TABLE_EQUAL:  return equal_p(a, b);
+    case HASH_TABLE_STRING: return string_equal_p(a, b);
+    }
+    return FALSE;
+}
+
+/*==================================================
+  Table
+==================================================*/
+/* 新しい領域を取ってから入れ直す. 入れ直す間は領域を取らない */
+static void hash_table_rehash(SCM table, int capacity)
+{
+    SCM *entries = data_allocate(sizeof(SCM) * 2 * capacity);
+    SCM *old = HASH_TABLE_ENTRIES(table);
+    int mask = capacity - 1;
+    int address = FALSE;
+    int i, j;
+    SCM key;
+
+    for (i = 0; i < capacity * 2; i++)
+        entries[i] = SCM_UNBOUND;
+    for (i = 0; i < HASH_TABLE_CAPACITY(table); i++) {
+        key = old[i * 2];
+        if (UNBOUND_P(key) || EQ_P(key, SCM_DELETED))
+            continue;
+        for (j = hash_key(table, key, &address) & mask; ! UNBOUND_P(entries[j * 2]); j = (j + 1) & mask)
+            ;
+        entries[j * 2] = key;
+        entries[j * 2 + 1] = old[i * 2 + 1];
+    }
+    HASH_TABLE_ENTRIES(table) = entries;
+    HASH_TABLE_CAPACITY(table) = capacity;
+    HASH_TABLE_DELETED(table) = 0;
+    HASH_TABLE_EPOCH(table) = scm_gc_move_epoch();
+    HEADER_FLAG(table) = HASH_TABLE_KIND(table) | (address ? HASH_TABLE_FLAG_ADDRESS : 0);
+}
+
+/* keyのある位置. なければ -1 - (入れる位置) */
+static int hash_table_find(SCM table, SCM key, int *address)
+{
+    int mask, i, free_slot = -1;
+    SCM k;
+
+    if ((HEADER_FLAG(table) & HASH_TABLE_FLAG_ADDRESS) &&
+        HASH_TABLE_EPOCH(table) != scm_gc_move_epoch())
+        hash_table_rehash(table, HASH_TABLE_CAPACITY(table));
+    if (HASH_TABLE_KIND(table) == HASH_TABLE_STRING && ! STRING_P(key))
+        scheme_error("hash table: string key required");
+    mask = HASH_TABLE_CAPACITY(table) - 1;
+    for (i = hash_key(table, key, address) & mask; ; i = (i + 1) & mask) {
+        k = HASH_TABLE_KEY(table, i);
+        if (UNBOUND_P(k))
+            return -1 - (free_slot >= 0 ? free_slot : i);
+        if (EQ_P(k, SCM_DELETED)) {
+            if (free_slot < 0)
+                free_slot = i;
+        } else if (same_key(table, k, key)) {
+            return i;
+        }
+    }
+}
+
+static SCM hash_table_get(SCM table, SCM key, SCM fallback)
+{
+    int address = FALSE;
+    int i = hash_table_find(table, key, &address);
+    return i >= 0 ? HASH_TABLE_VALUE(table, i) : fallback;
+}
+
+/* 削除した所も数えて3/4を超えるなら入れ直す. 半分を超えていれば倍にする */
+static void hash_table_put(SCM table, SCM key, SCM value)
+{
+    int address = FALSE;
+    int i = hash_table_find(table, key, &address);
+    int capacity = HASH_TABLE_CAPACITY(table);
+
+    if (i >= 0) {
+        HASH_TABLE_VALUE(table, i) = value;
+        return ;
+    }
+    if ((HASH_TABLE_COUNT(table) + HASH_TABLE_DELETED(table) + 1) * 4 > capacity * 3) {
+        if ((HASH_TABLE_COUNT(table) + 1) * 2 > capacity) {
+            if (capacity >= HASH_TABLE_MAX_CAPACITY)
+                scheme_error("hash table: too many entries");
+            capacity *= 2;
+        }
+        hash_table_rehash(table, capacity);
+        i = hash_table_find(table, key, &address);
+    }
+    i = -1 - i;
+    if (EQ_P(HASH_TABLE_KEY(table, i), SCM_DELETED))
+        HASH_TABLE_DELETED(table)--;
+    HASH_TABLE_KEY(table, i) = key;
+    HASH_TABLE_VALUE(table, i) = value;
+    HASH_TABLE_COUNT(table)++;
+    if (address)
+        HEADER_FLAG(table) |= HASH_TABLE_FLAG_ADDRESS;
+}
+
+static void hash_table_remove(SCM table, SCM key)
+{
+    int address = FALSE;
+    int i = hash_table_find(table, key, &address);
+    if (i >= 0) {
+        HASH_TABLE_KEY(table, i) = SCM_DELETED;
+        HASH_TABLE_VALUE(table, i) = SCM_UNBOUND;
+        HASH_TABLE_COUNT(table)--;
+        HASH_TABLE_DELETED(table)++;
+    }
+}
+
+/* keys, values, alistを作る. whatは0: key, 1: value, 2: (key . value) */
+static SCM hash_table_fold(SCM table, int what)
+{
+    SCM result = SCM_NULL;
+    SCM key;
+    int i;
+    for (i = 0; i < HASH_TABLE_CAPACITY(table); i++) {
+        key = HASH_TABLE_KEY(table, i);
+        if (UNBOUND_P(key) || EQ_P(key, SCM_DELETED))
+            continue;
+        result = new_cons(what == 0 ? key :
+                          what == 1 ? HASH_TABLE_VALUE(table, i) :
+                          new_cons(key, HASH_TABLE_VALUE(table, i)),
+                          result);
+    }
+    return result;
+}
+
+void print_hash_table(SCM table, FILE *file)
+{
+    fprintf(file, "#<hash-table %s %d>",
+            hash_table_kind_names[HASH_TABLE_KIND(table)], HASH_TABLE_COUNT(table));
+}
+
+/*==================================================
+  Check
+==================================================*/
+static SCM hash_table_check(SCM o, char *name)
+{
+    char message[64];
+    if (! HASH_TABLE_P(o)) {
+        snprintf(message, sizeof(message), "%s: hash table required", name);
+        scheme_error(message);
+    }
+    return o;
+}
+
+/* 比較の手続きから表の種類を決める. hash関数は比較から決まる */
+static enum HashTableKind hash_table_kind(SCM equivalence, char *name)
+{
+    char message[64];
+    if (EQ_P(equivalence, &Scheme_data_p_eq))        return HASH_TABLE_EQ;
+    if (EQ_P(equivalence, &Scheme_data_p_eqv))       return HASH_TABLE_EQV;
+    if (EQ_P(equivalence, &Scheme_data_p_equal))     return HASH_TABLE_EQUAL;
+    if (EQ_P(equivalence, &Scheme_data_p_string_eq)) return HASH_TABLE_STRING;
+    snprintf(message, sizeof(message), "%s: unsupported equivalence procedure", name);
+    scheme_error(message);
+    return HASH_TABLE_EQUAL;
+}
+
+/* (hash obj [bound]) などの結果. fixnumに収める */
+static SCM hash_result(uintptr_t h, SCM l, char *name)
+{
+    char message[64];
+    h &= (uintptr_t) FIXNUM_MAX;
+    if (NULL_P(CDR(l)))
+        return MAKE_FIXNUM(h);
+    if (! FIXNUM_P(CADR(l)) || FIXNUM_VALUE(CADR(l)) <= 0) {
+        snprintf(message, sizeof(message), "%s: bad bound", name);
+        scheme_error(message);
+    }
+    return MAKE_FIXNUM(h % FIXNUM_VALUE(CADR(l)));
+}
+
+/*==================================================
+  Primitive
+==================================================*/
+/* (make-hash-table [equivalence [hash]]) */
+DEFINE_PRIMITIVE("make-hash-table", make_hash_table, (SCM l), list_expr)
+{
+    enum HashTableKind kind = HASH_TABLE_EQUAL;
+    if (CONS_P(l))
+        kind = hash_table_kind(CAR(l), "make-hash-table");
+    return new_hash_table(kind, HASH_TABLE_INITIAL_CAPACITY);
+}
+
+DEFINE_PRIMITIVE("hash-table?", hash_tablep, (SCM o), expr1)
+{
+    return C_TO_SCM_BOOLEAN(HASH_TABLE_P(o));
+}
+
+/* (hash-table-ref table key [thunk]) */
+DEFINE_PRIMITIVE("hash-table-ref", hash_table_ref, (SCM l), list_expr)
+{
+    SCM value;
+    int argc = list_length(l);
+    if (argc != 2 && argc != 3)
+        scheme_error("hash-table-ref: wrong number of arguments");
+    value = hash_table_get(hash_table_check(CAR(l), "hash-table-ref"), CADR(l), SCM_UNBOUND);
+    if (! UNBOUND_P(value))
+        return value;
+    if (argc == 2)
+        scheme_error("hash-table-ref: key not found");
+    return apply_procedure(CADDR(l), SCM_NULL);
+}
+
+DEFINE_PRIMITIVE("hash-table-ref/default", hash_table_ref_default, (SCM table, SCM key, SCM fallback), expr3)
+{
+    return hash_table_get(hash_table_check(table, "hash-table-ref/default"), key, fallback);
+}
+
+DEFINE_PRIMITIVE("hash-table-set!", hash_table_setq, (SCM table, SCM key, SCM value), expr3)
+{
+    hash_table_put(hash_table_check(table, "hash-table-set!"), key, value);
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("hash-table-delete!", hash_table_deleteq, (SCM table, SCM key), expr2)
+{
+    hash_table_remove(hash_table_check(table, "hash-table-delete!"), key);
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("hash-table-exists?", hash_table_existsp, (SCM table, SCM key), expr2)
+{
+    int address = FALSE;
+    return C_TO_SCM_BOOLEAN(hash_table_find(hash_table_check(table, "hash-table-exists?"), key, &address) >= 0);
+}
+
+/* (hash-table-update! table key proc [thunk]) */
+DEFINE_PRIMITIVE("hash-table-update!", hash_table_updateq, (SCM l), list_expr)
+{
+    SCM table, value;
+    int argc = list_length(l);
+    if (argc != 3 && argc != 4)
+        scheme_error("hash-table-update!: wrong number of arguments");
+    table = hash_table_check(CAR(l), "hash-table-update!");
+    value = hash_table_get(table, CADR(l), SCM_UNBOUND);
+    if (UNBOUND_P(value)) {
+        if (argc == 3)
+            scheme_error("hash-table-update!: key not found");
+        value = apply_procedure(CAR(CDDDR(l)), SCM_NULL);
+    }
+    value = apply_procedure(CADDR(l), new_cons(value, SCM_NULL));
+    hash_table_put(table, CADR(l), value);
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("hash-table-update!/default", hash_table_update_default,
+                 (SCM table, SCM key, SCM proc, SCM fallback), expr4)
+{
+    SCM value = hash_table_get(hash_table_check(table, "hash-table-update!/default"), key, fallback);
+    value = apply_procedure(proc, new_cons(value, SCM_NULL));
+    hash_table_put(table, key, value);
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("hash-table-size", hash_table_size, (SCM table), expr1)
+{
+    return MAKE_FIXNUM(HASH_TABLE_COUNT(hash_table_check(table, "hash-table-size")));
+}
+
+DEFINE_PRIMITIVE("hash-table-keys", hash_table_keys, (SCM table), expr1)
+{
+    return hash_table_fold(hash_table_check(table, "hash-table-keys"), 0);
+}
+
+DEFINE_PRIMITIVE("hash-table-values", hash_table_values, (SCM table), expr1)
+{
+    return hash_table_fold(hash_table_check(table, "hash-table-values"), 1);
+}
+
+DEFINE_PRIMITIVE("hash-table->alist", hash_table2alist, (SCM table), expr1)
+{
+    return hash_table_fold(hash_table_check(table, "hash-table->alist"), 2);
+}
+
+/* procの中で表を変えても壊れないよう毎回表から読む */
+DEFINE_PRIMITIVE("hash-table-walk", hash_table_walk, (SCM table, SCM proc), expr2)
+{
+    SCM key;
+    int i;
+    hash_table_check(table, "hash-table-walk");
+    for (i = 0; i < HASH_TABLE_CAPACITY(table); i++) {
+        key = HASH_TABLE_KEY(table, i);
+        if (UNBOUND_P(key) || EQ_P(key, SCM_DELETED))
+            continue;
+        apply_procedure(proc, new_cons(key, new_cons(HASH_TABLE_VALUE(table, i), SCM_NULL)));
+    }
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("hash-table-copy", hash_table_copy, (SCM table), expr1)
+{
+    SCM copy;
+    hash_table_check(table, "hash-table-copy");
+    copy = new_hash_table(HASH_TABLE_KIND(table), HASH_TABLE_CAPACITY(table));
+    memcpy(HASH_TABLE_ENTRIES(copy), HASH_TABLE_ENTRIES(table),
+           sizeof(SCM) * 2 * HASH_TABLE_CAPACITY(table));
+    HASH_TABLE_COUNT(copy) = HASH_TABLE_COUNT(table);
+    HASH_TABLE_DELETED(copy) = HASH_TABLE_DELETED(table);
+    HASH_TABLE_EPOCH(copy) = HASH_TABLE_EPOCH(table);
+    HEADER_FLAG(copy) = HEADER_FLAG(table);
+    return copy;
+}
+
+/* (alist->hash-table alist [equivalence]). 先にあるものを優先する */
+DEFINE_PRIMITIVE("alist->hash-table", alist2hash_table, (SCM l), list_expr)
+{
+    enum HashTableKind kind = HASH_TABLE_EQUAL;
+    SCM table, alist, entry;
+    if (! CONS_P(l))
+        scheme_error("alist->hash-table: wrong number of arguments");
+    if (CONS_P(CDR(l)))
+        kind = hash_table_kind(CADR(l), "alist->hash-table");
+    table = new_hash_table(kind, HASH_TABLE_INITIAL_CAPACITY);
+    for (alist = CAR(l); CONS_P(alist); alist = CDR(alist)) {
+        entry = CAR(alist);
+        if (! CONS_P(entry))
+            scheme_error("alist->hash-table: pair required");
+        if (UNBOUND_P(hash_table_get(table, CAR(entry), SCM_UNBOUND)))
+            hash_table_put(table, CAR(entry), CDR(entry));
+    }
+    return table;
+}
+
+/* (hash obj [bound]) */
+DEFINE_PRIMITIVE("hash", hash, (SCM l), list_expr)
+{
+    int address = FALSE;
+    if (! CONS_P(l))
+        scheme_error("hash: wrong number of arguments");
+    return hash_result(hash_equal(CAR(l), HASH_EQUAL_DEPTH, &address), l, "hash");
+}
+
+DEFINE_PRIMITIVE("string-hash", string_hash, (SCM l), list_expr)
+{
+    if (! CONS_P(l) || ! STRING_P(CAR(l)))
+        scheme_error("string-hash: string required");
+    return hash_result(string_hash(CAR(l)), l, "string-hash");
+}
+
+DEFINE_PRIMITIVE("hash-by-identity", hash_by_identity, (SCM l), list_expr)
+{
+    int address = FALSE;
+    if (! CONS_P(l))
+        scheme_error("hash-by-identity: wrong number of arguments");
+    return hash_result(hash_eq(CAR(l), &address), l, "hash-by-identity");
+}
+
+void symbols_of_hashtable_initialize(void)
+{
+    ADD_PRIMITIVE("make-hash-table",        make_hash_table,        (SCM l),                  LIST_EXPR);
+    ADD_PRIMITIVE("hash-table?",            hash_tablep,            (SCM o),                  EXPR_1);
+    ADD_PRIMITIVE("hash-table-ref",         hash_table_ref,         (SCM l),                  LIST_EXPR);
+    ADD_PRIMITIVE("hash-table-ref/default", hash_table_ref_default, (SCM t, SCM k, SCM d),    EXPR_3);
+    ADD_PRIMITIVE("hash-table-set!",        hash_table_setq,        (SCM t, SCM k, SCM v),    EXPR_3);
+    ADD_PRIMITIVE("hash-table-delete!",     hash_table_deleteq,     (SCM t, SCM k),           EXPR_2);
+    ADD_PRIMITIVE("hash-table-exists?",     hash_table_existsp,     (SCM t, SCM k),           EXPR_2);
+    ADD_PRIMITIVE("hash-table-update!",     hash_table_updateq,     (SCM l),                  LIST_EXPR);
+    ADD_PRIMITIVE("hash-table-update!/default", hash_table_update_default,
+                  (SCM t, SCM k, SCM p, SCM d), EXPR_4);
+    ADD_PRIMITIVE("hash-table-size",        hash_table_size,        (SCM t),                  EXPR_1);
+    ADD_PRIMITIVE("hash-table-keys",        hash_table_keys,        (SCM t),                  EXPR_1);
+    ADD_PRIMITIVE("hash-table-values",      hash_table_values,      (SCM t),                  EXPR_1);
+    ADD_PRIMITIVE("hash-table->alist",      hash_table2alist,       (SCM t),                  EXPR_1);
+    ADD_PRIMITIVE("hash-table-walk",        hash_table_walk,        (SCM t, SCM p),           EXPR_2);
+    ADD_PRIMITIVE("hash-table-copy",        hash_table_copy,        (SCM t),                  EXPR_1);
+    ADD_PRIMITIVE("alist->hash-table",      alist2hash_table,       (SCM l),                  LIST_EXPR);
+    ADD_PRIMITIVE("hash",                   hash,                   (SCM l),                  LIST_EXPR);
+    ADD_PRIMITIVE("string-hash",            string_hash,            (SCM l),                  LIST_EXPR);
+    ADD_PRIMITIVE("hash-by-identity",       hash_by_identity,       (SCM l),                  LIST_EXPR);
+    SYMBOL_VCELL(intern("hash-table-contains?")) = &Scheme_data_p_hash_table_existsp;
+}
@@ -5,3 +5,43 @@
  */
 
 #include "scheme.h"
+
+/**
+ * proper listの長さ. proper listでなければ-1
+ */
+int list_length(SCM lst)
+{
+    int len = 0;
+    while (CONS_P(lst)) {
+        len++;
+        lst = CDR(lst);
+    }
+    return NULL_P(lst) ? len : -1;
+}
+
+/* 新しいlistを作って逆順にする */
+SCM list_reverse(SCM lst)
+{
+    SCM result = SCM_NULL;
+    for (; CONS_P(lst); lst = CDR(lst)) {
+        result = new_cons(CAR(lst), result);
+    }
+    return result;
+}
+
+/* consを全て作り直す. 展開や最適化で書き換えても元のformは変わらない */
+SCM tree_copy(SCM obj)
+{
+    SCM head, tail, cell;
+    if (! CONS_P(obj)) {
+        return obj;
+    }
+    head = tail = new_cons(tree_copy(CAR(obj)), SCM_NULL);
+    for (obj = CDR(obj); CONS_P(obj); obj = CDR(obj)) {
+        cell = new_cons(tree_copy(CAR(obj)), SCM_NULL);
+        SET_CDR(tail, cell);
+        tail = cell;
+    }
+    SET_CDR(tail, obj);
+    return head;
+}
@@ -48,8 +48,8 @@ static SCM read_eval_print(void)
 #endif
     if (EOF_P(sexp)) { return NULL; }
 
-    /* eval */
-    result = eval(sexp, TOPLEVEL_ENVIRONMENT);
+    /* expand, optimize, eval */
+    result = eval(optimize(expand(sexp)), TOPLEVEL_ENVIRONMENT);
 
     /* print */
     print(result, stdout);
@@ -87,21 +87,95 @@ static SCM read_eval_print_loop(void)
 
 static void usage(char *program_name)
 {
-    printf("Usage %s [-help] filename\n", program_name);
+    printf("Usage %s [-help] [-optimize-debug] filename\n", program_name);
+    printf("      %s -compile filename.scm [output.c]\n", program_name);
     return;
 }
 
+/*==================================================
+  Compiler Driver
+==================================================*/
+static char *compile_input = NULL;
+static char *compile_output = NULL;
+
+/* basename without extension, usable as a C identifier */
+static char *module_name(char *filename)
+{
+    char *base = strrchr(filename, '/');
+    char *name = strdup(base ? base + 1 : filename);
+    char *p;
+    if ((p = strchr(name, '.')) != NULL) *p = '\0';
+    for (p = name; *p; p++) {
+        if (! isalnum(*p)) *p = '_';
+    }
+    return name;
+}
+
+static SCM compile_main(SCM arg)
+{
+    FILE *out = stdout;
+    char *name = module_name(compile_input);
+    int result;
+
+    if (compile_output != NULL) {
+        out = fopen(compile_output, "w");
+        if (out == NULL) {
+            fprintf(stderr, "can't open %s\n", compile_output);
+            free(name);
+            return SCM_FALSE;
+        }
+    }
+    result = compile_file(compile_input, out, name);
+    if (out != stdout) fclose(out);
+    free(name);
+    if (! result) {
+        fprintf(stderr, "can't open %s\n", compile_input);
+        return SCM_FALSE;
+    }
+    return SCM_TRUE;
+}
+
 int main(int argc, char **argv)
 {
     char *program_name = argv[0];
     char *filename = NULL;
 
+    if (argc > 1 && strcmp(argv[1], "-optimize-debug") == 0) {
+        scm_optimize_debug = TRUE;
+        argv++;
+        argc--;
+    }
     if (argc > 1) {
         if (strcmp(argv[1], "-help") == 0) {
             usage(program_name);
             return EXIT_SUCCESS;
         }
-        filename = argv[1];
+        if (strcmp(argv[1], "-compile") == 0) {
+            if (argc < 3) {
+                usage(program_name);
+                return EXIT_FAILURE;
+            }
+            compile_input = argv[2];
+            compile_output = argc > 3 ? argv[3] : NULL;
+        } else {
+            filename = argv[1];
+        }
+    }
+    if (compile_input != NULL) {
+        SCM result;
+        SCHEME_STACK_INITIALIZE;
+        scheme_initialize();
+        result = internal_catch(compile_main, SCM_NULL);
+        if (get_error_message() != NULL) {
+            fprintf(stderr, "%s ", get_error_message());
+            if (get_current_sexp() != NULL) {
+                print(get_current_sexp(), stderr);
+            }
+            putc('\n', stderr);
+            result = SCM_FALSE;
+        }
+        scheme_finalize();
+        exit(TRUE_P(result) ? EXIT_SUCCESS : EXIT_FAILURE);
     }
     {
         SCHEME_STACK_INITIALIZE;
@@ -0,0 +1,175 @@
+/*===========================================================================
+ * number.c - flonum and mixed number arithmetic
+ *
+ * $Id$
+===========================================================================*/
+
+#include <math.h>
+
+#include "scheme.h"
+
+/* 数は整数 (fixnum, bignum: bignum.c) かflonum (double).
+ * 整数同士の計算は整数のまま、一方でもflonumならdoubleで計算する。
+ * 整数同士の / は0に向かって丸めた商。
+ */
+
+/*==================================================
+  Flonum
+==================================================*/
+/* 0x3000000000000000 (2^-255) は回すと+0.0と同じになるのでheapに置く */
+#define IMMEDIATE_FLONUM_COLLISION 0x3000000000000000ULL
+
+SCM new_flonum(double value)
+{
+#if INTPTR_MAX == INT64_MAX
+    union FlonumBits u;
+    u.value = value;
+    if (((u.bits >> 60) & 7) - 3 <= 1 && u.bits != IMMEDIATE_FLONUM_COLLISION) {
+        return AS_SCM((FLONUM_ROTATE_LEFT(u.bits) & ~(uint64_t) 1) |
+                      SCM_INTERNAL_REPRESENTATION_TYPE_FLONUM);
+    }
+    if (u.bits == 0) {
+        return IMMEDIATE_FLONUM_ZERO;
+    }
+#endif
+    return new_heap_flonum(value);
+}
+
+double number_to_double(SCM x)
+{
+    return FLONUM_P(x) ? FLONUM_VALUE(x) : integer_to_double(x);
+}
+
+/*==================================================
+  Arithmetic
+==================================================*/
+SCM number_add(SCM x, SCM y)
+{
+    if (INTEGER_P(x) && INTEGER_P(y))
+        return integer_add(x, y);
+    return new_flonum(number_to_double(x) + number_to_double(y));
+}
+
+SCM number_sub(SCM x, SCM y)
+{
+    if (INTEGER_P(x) && INTEGER_P(y))
+        return integer_sub(x, y);
+    return new_flonum(number_to_double(x) - number_to_double(y));
+}
+
+/* (- x). flonumは0から引かずに符号を反転する: (- 0.0) => -0.0 */
+SCM number_negate(SCM x)
+{
+    if (INTEGER_P(x))
+        return integer_sub(MAKE_FIXNUM(0), x);
+    return new_flonum(- FLONUM_VALUE(x));
+}
+
+SCM number_mul(SCM x, SCM y)
+{
+    if (INTEGER_P(x) && INTEGER_P(y))
+        return integer_mul(x, y);
+    return new_flonum(number_to_double(x) * number_to_double(y));
+}
+
+/* 整数の0で割るのは呼び出し側で弾くこと. flonumの0ではinfかnanになる */
+SCM number_div(SCM x, SCM y)
+{
+    if (INTEGER_P(x) && INTEGER_P(y))
+        return integer_quotient(x, y);
+    return new_flonum(number_to_double(x) / number_to_double(y));
+}
+
+/* nanとの比較は全て偽 */
+int number_compare(enum Comparison op, SCM x, SCM y)
+{
+    double a, b;
+    if (INTEGER_P(x) && INTEGER_P(y)) {
+        int c = integer_compare(x, y);
+        switch (op) {
+        case COMPARISON_EQ: return c == 0;
+        case COMPARISON_LT: return c <  0;
+        case COMPARISON_LE: return c <= 0;
+        case COMPARISON_GT: return c >  0;
+        case COMPARISON_GE: return c >= 0;
+        }
+        return FALSE;
+    }
+    a = number_to_double(x);
+    b = number_to_double(y);
+    switch (op) {
+    case COMPARISON_EQ: return a == b;
+    case COMPARISON_LT: return a <  b;
+    case COMPARISON_LE: return a <= b;
+    case COMPARISON_GT: return a >  b;
+    case COMPARISON_GE: return a >= b;
+    }
+    return FALSE;
+}
+
+/*==================================================
+  Printer
+==================================================*/
+/* 仮数の桁数がこれ以下なら小数点の位置に0を補って書く */
+#define FLONUM_POSITIONAL_MAX 21
+#define FLONUM_POSITIONAL_MIN (-7)
+
+/**
+ * 読み戻すと同じdoubleになる最短の桁で表示する。
+ * %.*eで桁を増やしながら試し、仮数の数字と指数から組み立て直す
+ *   100.0  0.001  1.5e300  +inf.0  +nan.0
+ */
+void print_flonum(SCM x, FILE *file)
+{
+    print_double(FLONUM_VALUE(x), file);
+}
+
+void print_double(double value, FILE *file)
+{
+    char buf[40], digits[24];
+    char *p, *e;
+    int precision, exponent, length, i;
+
+    if (isnan(value)) {
+        fputs("+nan.0", file);
+        return;
+    }
+    if (isinf(value)) {
+        fputs(value > 0 ? "+inf.0" : "-inf.0", file);
+        return;
+    }
+    for (precision = 0; precision < 17; precision++) {
+        snprintf(buf, sizeof(buf), "%.*e", precision, value);
+        if (strtod(buf, NULL) == value)
+            break;
+    }
+    /* buf: [-]d[.ddd]e[+-]xx */
+    p = buf;
+    if (*p == '-') {
+        fputc('-', file);
+        p++;
+    }
+    e = strchr(p, 'e');
+    exponent = atoi(e + 1);
+    for (length = 0; p < e; p++) {
+        if (*p != '.')
+            digits[length++] = *p;
+    }
+    digits[length] = '\0';
+
+    if (FLONUM_POSITIONAL_MIN <= exponent && exponent < FLONUM_POSITIONAL_MAX) {
+        if (exponent < 0) {
+            fputs("0.", file);
+            for (i = -1; i > exponent; i--)
+                fputc('0', file);
+            fputs(digits, file);
+        } else {
+            for (i = 0; i <= exponent; i++)
+                fputc(i < length ? digits[i] : '0', file);
+            fputc('.', file);
+            fputs(length > exponent + 1 ? digits + exponent + 1 : "0", file);
+        }
+    } else {
+        fprintf(file, "%c.%se%d", digits[0], length > 1 ? digits + 1 : "0", exponent);
+    }
+}
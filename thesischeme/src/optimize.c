@@ -0,0 +1,1096 @@
+/*===========================================================================
+ * optimize.c - source level optimizer
+ *
+ * $Id$
+===========================================================================*/
+
+#include "scheme.h"
+
+/*
+ * expandの後、evalの前にformを書き換える。
+ *
+ *  - constant folding   : (+ 1 2) => 3, (car '(a b)) => 'a
+ *  - copy propagation   : ((lambda (x) (f x)) 5) => (f 5)
+ *                         代入されない変数に定数か代入されない変数を束縛した時
+ *  - dead branch        : 定数のtestを持つcondの節を取り除く
+ *  - inlining           : (first l) => (car l)
+ *                         小さな大域手続きの本体を呼び出し位置に埋め込む
+ *  - escape analysis    : 中にlambdaを持たないlambdaの環境はenv stackに取る
+ *  - closure conversion : 内側のlambdaは自由変数の値だけを捕まえる (flat closure)
+ *  - specialization     : (+ x 1) => (#<fx+> x 1)
+ *                         2引数の算術と比較は引数を直接受け取る二項版を呼ぶ
+ *  - type feedback      : lambdaの中の二項版と大域手続きの呼び出しは先頭を
+ *                         call siteにして、来た型と呼ばれた手続きを記録する。
+ *                         二項版に整数以外が来たら汎用の手続きに戻す
+ *
+ * 畳み込むのは大域変数が組み込み手続きを指している時だけ。
+ * 後から大域変数を書き換えても、畳み込み済みの式は元に戻らない。
+ *
+ * 埋め込んだ呼び出しは大域変数ごとに記録しておき、その変数が
+ * set!などで書き換えられたら元の呼び出しに戻す (deoptimize)。
+ */
+
+/*==================================================
+  Global
+==================================================*/
+/* -optimize-debug: report every rewrite */
+int scm_optimize_debug = FALSE;
+
+/*==================================================
+  File Local Variables
+==================================================*/
+/**
+ * 埋め込みの依存関係
+ * ((symbol (site . original) ...) ...)
+ * siteは埋め込んだ展開形で置き換えたform, originalは元の(f arg ...)
+ * siteへの参照は弱く、siteが回収されたら記録も消す (optimize_gc_prune)
+ */
+static SCM inline_dependencies = SCM_NULL;
+
+/*==================================================
+  Utility
+==================================================*/
+struct OptimizeScope {
+    SCM bound;      /* lexically bound variables                 */
+    SCM immutable;  /* bound variables never assigned in scope   */
+    SCM subst;      /* ((variable . replacement) ...)            */
+    int in_lambda;  /* inside a lambda body: may run more than once */
+};
+
+static SCM optimize_form(SCM sexp, struct OptimizeScope *scope);
+static int pure_p(SCM sexp, struct OptimizeScope *scope);
+static int mentions_p(SCM sexp, SCM symbols);
+static int occurrences(SCM symbol, SCM sexp, int strict, int *strict_count,
+                       struct OptimizeScope *scope);
+static SCM generic_primitive(SCM subr);
+static void profile_call(SCM sexp, SCM target);
+
+static int memq_p(SCM symbol, SCM lst)
+{
+    for (; CONS_P(lst); lst = CDR(lst)) {
+        if (EQ_P(CAR(lst), symbol))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static SCM assq_ref(SCM symbol, SCM alist)
+{
+    for (; CONS_P(alist); alist = CDR(alist)) {
+        if (EQ_P(CAAR(alist), symbol))
+            return CAR(alist);
+    }
+    return SCM_NULL;
+}
+
+static void report(char *what, SCM before, SCM after)
+{
+    if (! scm_optimize_debug)
+        return;
+    printf("; optimize: %s ", what);
+    print(before, stdout);
+    if (after != NULL) {
+        printf(" => ");
+        print(after, stdout);
+    }
+    putchar('\n');
+    fflush(stdout);
+}
+
+/* 大域変数として見たsymbolの値。局所的に束縛されていればNULL */
+static SCM global_value(SCM symbol, struct OptimizeScope *scope)
+{
+    if (! SYMBOL_P(symbol) || memq_p(symbol, scope->bound))
+        return NULL;
+    return SYMBOL_VCELL(symbol);
+}
+
+/* (set! symbol ...) が sexp の中にあるか. quoteの中は見ない */
+static int assigned_p(SCM symbol, SCM sexp)
+{
+    for (; CONS_P(sexp); sexp = CDR(sexp)) {
+        SCM kar = CAR(sexp);
+        if (EQ_P(kar, SCM_SYMBOL_QUOTE))
+            return FALSE;
+        if (EQ_P(kar, intern("set!")) && CONS_P(CDR(sexp)) && EQ_P(CADR(sexp), symbol))
+            return TRUE;
+        if (assigned_p(symbol, kar))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/*==================================================
+  Constant
+==================================================*/
+static int constant_p(SCM sexp, struct OptimizeScope *scope)
+{
+    if (NUMBER_P(sexp) || TRUE_P(sexp) || FALSE_P(sexp) || NULL_P(sexp))
+        return TRUE;
+    return LIST_2_P(sexp) && EQ_P(CAR(sexp), SCM_SYMBOL_QUOTE) &&
+        EQ_P(global_value(SCM_SYMBOL_QUOTE, scope), &Scheme_data_p_quote);
+}
+
+static SCM constant_value(SCM sexp)
+{
+    return CONS_P(sexp) ? CADR(sexp) : sexp;
+}
+
+static SCM make_constant(SCM value)
+{
+    if (NUMBER_P(value) || TRUE_P(value) || FALSE_P(value) || NULL_P(value))
+        return value;
+    return new_cons(SCM_SYMBOL_QUOTE, new_cons(value, SCM_NULL));
+}
+
+/*==================================================
+  Constant Folding
+==================================================*/
+#define FOLD_MAX_ARGUMENTS 8
+
+/**
+ * 組み込み手続きの引数が全て定数なら結果の定数を返す。畳み込めなければNULL
+ * 結果は実行時の手続きと同じになるようにする
+ */
+static SCM fold_primitive(SCM subr, SCM operands, struct OptimizeScope *scope)
+{
+    SCM args[FOLD_MAX_ARGUMENTS];
+    SCM p;
+    int argc = 0;
+
+    for (p = operands; CONS_P(p); p = CDR(p)) {
+        if (! constant_p(CAR(p), scope) || argc == FOLD_MAX_ARGUMENTS)
+            return NULL;
+        args[argc++] = constant_value(CAR(p));
+    }
+
+    subr = generic_primitive(subr);
+    if (EQ_P(subr, &Scheme_data_p_num_plus) || EQ_P(subr, &Scheme_data_p_num_minus) ||
+        EQ_P(subr, &Scheme_data_p_num_mul)) {
+        SCM value;
+        int i;
+        for (i = 0; i < argc; i++) {
+            if (! NUMBER_P(args[i]))
+                return NULL;
+        }
+        if (EQ_P(subr, &Scheme_data_p_num_plus)) {
+            for (value = MAKE_FIXNUM(0), i = 0; i < argc; i++)
+                value = number_add(value, args[i]);
+        } else if (EQ_P(subr, &Scheme_data_p_num_mul)) {
+            for (value = MAKE_FIXNUM(1), i = 0; i < argc; i++)
+                value = number_mul(value, args[i]);
+        } else {
+            if (argc == 0)
+                return NULL;
+            value = args[0];
+            if (argc == 1)
+                value = number_negate(value);
+            for (i = 1; i < argc; i++)
+                value = number_sub(value, args[i]);
+        }
+        return value;
+    }
+    if (EQ_P(subr, &Scheme_data_p_less_than) || EQ_P(subr, &Scheme_data_p_num_eq) ||
+        EQ_P(subr, &Scheme_data_p_less_equal) || EQ_P(subr, &Scheme_data_p_greater_than) ||
+        EQ_P(subr, &Scheme_data_p_greater_equal)) {
+        enum Comparison op;
+        if (argc != 2 || ! NUMBER_P(args[0]) || ! NUMBER_P(args[1]))
+            return NULL;
+        op = EQ_P(subr, &Scheme_data_p_less_than)    ? COMPARISON_LT :
+             EQ_P(subr, &Scheme_data_p_num_eq)       ? COMPARISON_EQ :
+             EQ_P(subr, &Scheme_data_p_less_equal)   ? COMPARISON_LE :
+             EQ_P(subr, &Scheme_data_p_greater_than) ? COMPARISON_GT : COMPARISON_GE;
+        return C_TO_SCM_BOOLEAN(number_compare(op, args[0], args[1]));
+    }
+    if (EQ_P(subr, &Scheme_data_p_eq)) {
+        if (argc != 2)
+            return NULL;
+        return C_TO_SCM_BOOLEAN(EQ_P(args[0], args[1]));
+    }
+    if (EQ_P(subr, &Scheme_data_p_atom)) {
+        if (argc != 1)
+            return NULL;
+        return C_TO_SCM_BOOLEAN(! CONS_P(args[0]));
+    }
+    if (EQ_P(subr, &Scheme_data_p_car) || EQ_P(subr, &Scheme_data_p_cdr)) {
+        if (argc != 1 || ! CONS_P(args[0]))
+            return NULL;
+        return make_constant(EQ_P(subr, &Scheme_data_p_car) ? CAR(args[0]) : CDR(args[0]));
+    }
+    return NULL;
+}
+
+/*==================================================
+  Closure Conversion
+==================================================*/
+struct FreeVariables {
+    SCM found;      /* 外側のlambdaで束縛された自由変数 */
+    int unknown;    /* 実行時にしか分からない式がある */
+};
+
+static void free_variables(SCM sexp, SCM shadowed, struct OptimizeScope *scope,
+                           struct FreeVariables *fv);
+
+static SCM bind_params(SCM params, SCM shadowed)
+{
+    for (; CONS_P(params); params = CDR(params)) {
+        shadowed = new_cons(CAR(params), shadowed);
+    }
+    if (SYMBOL_P(params))
+        shadowed = new_cons(params, shadowed);
+    return shadowed;
+}
+
+static void free_variables_each(SCM lst, SCM shadowed, struct OptimizeScope *scope,
+                                struct FreeVariables *fv)
+{
+    for (; CONS_P(lst); lst = CDR(lst)) {
+        free_variables(CAR(lst), shadowed, scope, fv);
+    }
+}
+
+/**
+ * sexpの中でshadowedに隠されていない、scopeで束縛された変数を集める
+ * 未定義の大域変数やマクロの呼び出しは実行時に展開されて
+ * 何を参照するか分からないのでunknownにする
+ */
+static void free_variables(SCM sexp, SCM shadowed, struct OptimizeScope *scope,
+                           struct FreeVariables *fv)
+{
+    SCM head, value;
+
+    if (SYMBOL_P(sexp)) {
+        if (memq_p(sexp, scope->bound) && ! memq_p(sexp, shadowed) && ! memq_p(sexp, fv->found))
+            fv->found = new_cons(sexp, fv->found);
+        return;
+    }
+    if (! CONS_P(sexp))
+        return;
+    head = CAR(sexp);
+    if (EQ_P(head, &Scheme_data_p_flat_lambda)) {
+        SCM code = CADR(sexp);
+        free_variables_each(CDR(code), bind_params(CAR(code), shadowed), scope, fv);
+        return;
+    }
+    if (SYMBOL_P(head) && ! memq_p(head, shadowed) && ! memq_p(head, scope->bound)) {
+        value = SYMBOL_VCELL(head);
+        if (UNBOUND_P(value) || MACRO_P(value) || EQ_P(value, &Scheme_data_p_macro) ||
+            EQ_P(value, &Scheme_data_p_define_syntax)) {
+            fv->unknown = TRUE;
+            return;
+        }
+        if (EQ_P(value, &Scheme_data_p_quote))
+            return;
+        if (EQ_P(value, &Scheme_data_p_lambda) && CONS_P(CDR(sexp))) {
+            free_variables_each(CDDR(sexp), bind_params(CADR(sexp), shadowed), scope, fv);
+            return;
+        }
+        if (EQ_P(value, &Scheme_data_p_cond)) {
+            SCM clauses;
+            for (clauses = CDR(sexp); CONS_P(clauses); clauses = CDR(clauses)) {
+                free_variables_each(CAR(clauses), shadowed, scope, fv);
+            }
+            return;
+        }
+    }
+    free_variables_each(sexp, shadowed, scope, fv);
+}
+
+/**
+ * (lambda <params> <body>) => (#<flat lambda> (<params> . <body>) copied . boxed)
+ * 代入されない自由変数はcopy, 代入される自由変数はboxで共有する
+ */
+static SCM closure_convert(SCM sexp, struct OptimizeScope *scope)
+{
+    struct FreeVariables fv;
+    SCM copied = SCM_NULL, boxed = SCM_NULL;
+    SCM p;
+
+    fv.found = SCM_NULL;
+    fv.unknown = FALSE;
+    free_variables_each(CDDR(sexp), bind_params(CADR(sexp), SCM_NULL), scope, &fv);
+    if (fv.unknown)
+        return sexp;
+    for (p = fv.found; CONS_P(p); p = CDR(p)) {
+        if (memq_p(CAR(p), scope->immutable)) {
+            copied = new_cons(CAR(p), copied);
+        } else {
+            boxed = new_cons(CAR(p), boxed);
+        }
+    }
+    report("flat closure", CADR(sexp), fv.found);
+    CAR(sexp) = &Scheme_data_p_flat_lambda;
+    SET_CDR(sexp, new_cons(CDR(sexp), new_cons(copied, boxed)));
+    return sexp;
+}
+
+/*==================================================
+  Special Forms
+==================================================*/
+static void optimize_each(SCM lst, struct OptimizeScope *scope)
+{
+    for (; CONS_P(lst); lst = CDR(lst)) {
+        CAR(lst) = optimize_form(CAR(lst), scope);
+    }
+}
+
+/* body ... を一つの式にする */
+static SCM make_sequence(SCM body)
+{
+    if (LIST_1_P(body))
+        return CAR(body);
+    return new_cons(&Scheme_data_p_begin, body);
+}
+
+/**
+ * lambdaの中のscope. substは外側の置き換えにextraを加えたもの
+ */
+static void enter_lambda(struct OptimizeScope *inner, struct OptimizeScope *outer,
+                         SCM params, SCM body, SCM extra)
+{
+    SCM p, s;
+    inner->bound = outer->bound;
+    inner->immutable = SCM_NULL;
+    inner->subst = extra;
+    inner->in_lambda = outer->in_lambda;
+    for (p = params; CONS_P(p); p = CDR(p)) {
+        inner->bound = new_cons(CAR(p), inner->bound);
+        if (! assigned_p(CAR(p), body))
+            inner->immutable = new_cons(CAR(p), inner->immutable);
+    }
+    if (SYMBOL_P(p))
+        inner->bound = new_cons(p, inner->bound);
+    /* 外側の変数のうち、paramsで隠されないもの */
+    for (s = outer->immutable; CONS_P(s); s = CDR(s)) {
+        if (! memq_p(CAR(s), params) && ! EQ_P(CAR(s), p))
+            inner->immutable = new_cons(CAR(s), inner->immutable);
+    }
+    for (s = outer->subst; CONS_P(s); s = CDR(s)) {
+        SCM key = CAAR(s), value = CDAR(s);
+        if (memq_p(key, params) || EQ_P(key, p))
+            continue;
+        if (SYMBOL_P(value) && (memq_p(value, params) || EQ_P(value, p)))
+            continue;
+        inner->subst = new_cons(CAR(s), inner->subst);
+    }
+}
+
+/**
+ * bodyの環境を捕まえうる式 (lambda, macro, define-syntax) があるか
+ * 実行時のマクロ展開やcall/ccで捕まる場合はevaluatorがheapに移す
+ */
+static int captures_environment_p(SCM sexp)
+{
+    if (SYMBOL_P(sexp)) {
+        return EQ_P(sexp, intern("lambda")) || EQ_P(sexp, intern("macro")) ||
+            EQ_P(sexp, intern("define-syntax"));
+    }
+    if (PRIMITIVE_P(sexp)) {
+        return EQ_P(sexp, &Scheme_data_p_lambda) || EQ_P(sexp, &Scheme_data_p_macro) ||
+            EQ_P(sexp, &Scheme_data_p_define_syntax);
+    }
+    if (! CONS_P(sexp) || EQ_P(CAR(sexp), SCM_SYMBOL_QUOTE)) {
+        return FALSE;
+    }
+    for (; CONS_P(sexp); sexp = CDR(sexp)) {
+        if (captures_environment_p(CAR(sexp)))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * (lambda <params> <body>)
+ * flatは外側のlambdaの中で値として作られるlambdaか
+ * (直接呼び出すlambdaは作ってすぐ捨てるので変換しない)
+ */
+static SCM optimize_lambda(SCM sexp, struct OptimizeScope *scope, int flat)
+{
+    struct OptimizeScope inner;
+    enter_lambda(&inner, scope, CADR(sexp), CDDR(sexp), SCM_NULL);
+    inner.in_lambda = TRUE;
+    optimize_each(CDDR(sexp), &inner);
+    if (! captures_environment_p(CDDR(sexp))) {
+        report("stack frame", CADR(sexp), NULL);
+        LAMBDA_STACK_FRAME_SET(CDR(sexp));
+    }
+    if (flat && ! NULL_P(scope->bound))
+        return closure_convert(sexp, scope);
+    return sexp;
+}
+
+/**
+ * 引数argを本体のparamの位置に直接埋め込めるか
+ * 埋め込んだ手続きの本体(inlined)は副作用を持たないので、変数と
+ * 一度だけ必ず評価される位置に現れる純粋な式も埋め込める
+ */
+static int substitutable_p(SCM param, SCM arg, SCM params, SCM body, int inlined,
+                           struct OptimizeScope *scope)
+{
+    int count = 0, strict = 0;
+    /* argの中の変数が残ったparamsに捕まらないように */
+    if (assigned_p(param, body) || mentions_p(arg, params))
+        return FALSE;
+    if (constant_p(arg, scope))
+        return TRUE;
+    if (SYMBOL_P(arg))
+        return inlined || memq_p(arg, scope->immutable);
+    if (! inlined || ! pure_p(arg, scope))
+        return FALSE;
+    for (; CONS_P(body); body = CDR(body)) {
+        count += occurrences(param, CAR(body), TRUE, &strict, scope);
+    }
+    return count == 1 && strict == 1;
+}
+
+/**
+ * ((lambda (x ...) body ...) arg ...)
+ * 代入されないxに定数か代入されない変数が渡されていれば本体に埋め込む
+ */
+static SCM optimize_direct_application(SCM sexp, struct OptimizeScope *scope, int inlined)
+{
+    struct OptimizeScope inner;
+    SCM lambda = CAR(sexp);
+    SCM params = CADR(lambda), body = CDDR(lambda);
+    SCM p, a;
+    SCM extra = SCM_NULL, kept_params = SCM_NULL, kept_args = SCM_NULL;
+    int substituted = FALSE;
+
+    optimize_each(CDR(sexp), scope);
+    if (list_length(params) < 0 || list_length(params) != list_length(CDR(sexp))) {
+        optimize_lambda(lambda, scope, FALSE);
+        return sexp;
+    }
+    for (p = params, a = CDR(sexp); CONS_P(p); p = CDR(p), a = CDR(a)) {
+        SCM arg = CAR(a);
+        if (substitutable_p(CAR(p), arg, params, body, inlined, scope)) {
+            report("propagate", new_cons(CAR(p), new_cons(arg, SCM_NULL)), NULL);
+            extra = new_cons(new_cons(CAR(p), arg), extra);
+            substituted = TRUE;
+        } else {
+            kept_params = new_cons(CAR(p), kept_params);
+            kept_args = new_cons(arg, kept_args);
+        }
+    }
+    if (! substituted) {
+        optimize_lambda(lambda, scope, FALSE);
+        return sexp;
+    }
+    enter_lambda(&inner, scope, params, body, extra);
+    optimize_each(body, &inner);
+    if (NULL_P(kept_params)) {
+        return make_sequence(body);
+    }
+    CADR(lambda) = list_reverse(kept_params);
+    SET_CDR(sexp, list_reverse(kept_args));
+    return sexp;
+}
+
+/* (cond <clause> ...) : testが定数の節を決めてしまう */
+static SCM optimize_cond(SCM sexp, struct OptimizeScope *scope)
+{
+    SCM clauses = SCM_NULL;
+    SCM p;
+
+    for (p = CDR(sexp); CONS_P(p); p = CDR(p)) {
+        SCM clause = CAR(p);
+        SCM test;
+        if (EQ_P(CAR(clause), SCM_SYMBOL_ELSE)) {
+            optimize_each(CDR(clause), scope);
+            clauses = new_cons(clause, clauses);
+            break;
+        }
+        test = CAR(clause) = optimize_form(CAR(clause), scope);
+        optimize_each(CDR(clause), scope);
+        if (! constant_p(test, scope)) {
+            clauses = new_cons(clause, clauses);
+            continue;
+        }
+        if (FALSE_P(constant_value(test))) {
+            report("remove clause", clause, NULL);
+            continue;
+        }
+        if (CONS_P(CDR(clause)) && EQ_P(CADR(clause), SCM_SYMBOL_DOUBLE_ARROW)) {
+            /* (<constant> => <receiver>) */
+            clauses = new_cons(clause, clauses);
+            break;
+        }
+        report(CONS_P(CDR(p)) ? "else, remove clauses after" : "else", clause, NULL);
+        /* (<constant>) の値はtestそのもの */
+        clauses = new_cons(new_cons(SCM_SYMBOL_ELSE,
+                                    NULL_P(CDR(clause)) ? new_cons(test, SCM_NULL) : CDR(clause)),
+                           clauses);
+        break;
+    }
+    clauses = list_reverse(clauses);
+    if (NULL_P(clauses) || EQ_P(CAAR(clauses), SCM_SYMBOL_ELSE)) {
+        SCM result = NULL_P(clauses) ? new_cons(&Scheme_data_p_begin, SCM_NULL)
+                                     : make_sequence(CDAR(clauses));
+        report("cond", sexp, result);
+        return result;
+    }
+    SET_CDR(sexp, clauses);
+    return sexp;
+}
+
+/* (if <test> <consequent> <alternative>) : testが定数なら分岐を選ぶ */
+static SCM optimize_if(SCM sexp, struct OptimizeScope *scope)
+{
+    SCM test;
+    optimize_each(CDR(sexp), scope);
+    if (! (LIST_3_P(CDR(sexp)) || LIST_2_P(CDR(sexp))))
+        return sexp;
+    test = CADR(sexp);
+    if (! constant_p(test, scope))
+        return sexp;
+    if (! FALSE_P(constant_value(test))) {
+        report("if", sexp, CADDR(sexp));
+        return CADDR(sexp);
+    }
+    if (NULL_P(CDDDR(sexp))) {
+        report("if", sexp, NULL);
+        return new_cons(&Scheme_data_p_begin, SCM_NULL);
+    }
+    report("if", sexp, CAR(CDDDR(sexp)));
+    return CAR(CDDDR(sexp));
+}
+
+/*==================================================
+  Inlining
+==================================================*/
+#define INLINE_MAX_SIZE 16
+
+/* 副作用の無い組み込み手続き */
+static int pure_primitive_p(SCM value)
+{
+    value = generic_primitive(value);
+    return EQ_P(value, &Scheme_data_p_car) || EQ_P(value, &Scheme_data_p_cdr) ||
+        EQ_P(value, &Scheme_data_p_cons) || EQ_P(value, &Scheme_data_p_atom) ||
+        EQ_P(value, &Scheme_data_p_eq) || EQ_P(value, &Scheme_data_p_assq) ||
+        EQ_P(value, &Scheme_data_p_less_than) || EQ_P(value, &Scheme_data_p_num_plus) ||
+        EQ_P(value, &Scheme_data_p_num_minus) || EQ_P(value, &Scheme_data_p_num_mul) ||
+        EQ_P(value, &Scheme_data_p_num_div) || EQ_P(value, &Scheme_data_p_num_eq) ||
+        EQ_P(value, &Scheme_data_p_less_equal) || EQ_P(value, &Scheme_data_p_greater_than) ||
+        EQ_P(value, &Scheme_data_p_greater_equal);
+}
+
+static SCM head_value(SCM head, struct OptimizeScope *scope)
+{
+    if (CALL_SITE_P(head))
+        head = CALL_SITE_TARGET(head);
+    return SYMBOL_P(head) ? global_value(head, scope) : head;
+}
+
+/* 定数, 変数, 純粋な組み込み手続きの呼び出しだけからなる式 */
+static int pure_p(SCM sexp, struct OptimizeScope *scope)
+{
+    SCM value, p;
+    if (! CONS_P(sexp) || constant_p(sexp, scope))
+        return TRUE;
+    value = head_value(CAR(sexp), scope);
+    if (value == NULL || ! (pure_primitive_p(value) || EQ_P(value, &Scheme_data_p_begin)))
+        return FALSE;
+    for (p = CDR(sexp); CONS_P(p); p = CDR(p)) {
+        if (! pure_p(CAR(p), scope))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* sexpの中にsymbolsのどれかが変数として現れるか */
+static int mentions_p(SCM sexp, SCM symbols)
+{
+    if (SYMBOL_P(sexp))
+        return memq_p(sexp, symbols);
+    if (! CONS_P(sexp) || EQ_P(CAR(sexp), SCM_SYMBOL_QUOTE))
+        return FALSE;
+    for (; CONS_P(sexp); sexp = CDR(sexp)) {
+        if (mentions_p(CAR(sexp), symbols))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * 埋め込む本体の中でsymbolが現れる回数
+ * 必ず評価される位置(condの最初のtest以外の節の中でない)の回数をstrictに足す
+ */
+static int occurrences(SCM symbol, SCM sexp, int strict, int *strict_count,
+                       struct OptimizeScope *scope)
+{
+    int count = 0;
+    SCM p;
+    if (EQ_P(sexp, symbol)) {
+        if (strict)
+            (*strict_count)++;
+        return 1;
+    }
+    if (! CONS_P(sexp) || EQ_P(CAR(sexp), SCM_SYMBOL_QUOTE))
+        return 0;
+    if (CONDITIONAL_FORM_P(head_value(CAR(sexp), scope))) {
+        /* if, and, or: 最初の式だけが必ず評価される */
+        for (p = CDR(sexp); CONS_P(p); p = CDR(p)) {
+            count += occurrences(symbol, CAR(p), strict && EQ_P(p, CDR(sexp)), strict_count, scope);
+        }
+        return count;
+    }
+    if (EQ_P(head_value(CAR(sexp), scope), &Scheme_data_p_cond)) {
+        for (p = CDR(sexp); CONS_P(p); p = CDR(p)) {
+            SCM e;
+            for (e = CAR(p); CONS_P(e); e = CDR(e)) {
+                int first_test = EQ_P(p, CDR(sexp)) && EQ_P(e, CAR(p));
+                count += occurrences(symbol, CAR(e), strict && first_test, strict_count, scope);
+            }
+        }
+        return count;
+    }
+    for (p = CDR(sexp); CONS_P(p); p = CDR(p)) {
+        count += occurrences(symbol, CAR(p), strict, strict_count, scope);
+    }
+    return count;
+}
+
+/**
+ * 手続きの本体を呼び出し位置に埋め込めるか
+ * 本体は小さく、組み込み手続きの呼び出しとquote, cond, if, and, or, beginだけからなり、
+ * 自由変数が呼び出し位置で局所変数に隠されていないこと
+ * (他の手続きを呼ばないので再帰もしない)
+ */
+static int inlinable_p(SCM sexp, SCM params, struct OptimizeScope *scope, int *size)
+{
+    SCM value, p;
+
+    if (SYMBOL_P(sexp))
+        return memq_p(sexp, params) || ! memq_p(sexp, scope->bound);
+    if (! CONS_P(sexp))
+        return TRUE;
+    if (++*size > INLINE_MAX_SIZE || list_length(sexp) < 0 || memq_p(CAR(sexp), params))
+        return FALSE;
+    value = head_value(CAR(sexp), scope);
+    if (value == NULL)
+        return FALSE;
+    if (EQ_P(value, &Scheme_data_p_quote))
+        return TRUE;
+    if (EQ_P(value, &Scheme_data_p_cond)) {
+        for (p = CDR(sexp); CONS_P(p); p = CDR(p)) {
+            SCM clause = CAR(p);
+            SCM e;
+            if (list_length(clause) < 1)
+                return FALSE;
+            for (e = clause; CONS_P(e); e = CDR(e)) {
+                if (EQ_P(e, clause) && EQ_P(CAR(e), SCM_SYMBOL_ELSE))
+                    continue;
+                if (EQ_P(CAR(e), SCM_SYMBOL_DOUBLE_ARROW) ||
+                    ! inlinable_p(CAR(e), params, scope, size))
+                    return FALSE;
+            }
+        }
+        return TRUE;
+    }
+    if (! pure_primitive_p(value) && ! EQ_P(value, &Scheme_data_p_begin) &&
+        ! CONDITIONAL_FORM_P(value))
+        return FALSE;
+    for (p = CDR(sexp); CONS_P(p); p = CDR(p)) {
+        if (! inlinable_p(CAR(p), params, scope, size))
+            return FALSE;
+    }
+    return TRUE;
+}
+
+/* 本体を書き換えるので埋め込む度にcopyする. quoteの中は共有してよい */
+static SCM copy_code(SCM sexp)
+{
+    if (! CONS_P(sexp) || EQ_P(CAR(sexp), SCM_SYMBOL_QUOTE))
+        return sexp;
+    return new_cons(copy_code(CAR(sexp)), copy_code(CDR(sexp)));
+}
+
+static int contains_p(SCM sexp, SCM site)
+{
+    for (; CONS_P(sexp); sexp = CDR(sexp)) {
+        if (EQ_P(sexp, site) || contains_p(CAR(sexp), site))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+/**
+ * sexpに既に埋め込まれている手続きの名前
+ * それを埋め込んだ先も同じ変数に依存する
+ */
+static SCM site_dependencies(SCM sexp)
+{
+    SCM symbols = SCM_NULL;
+    SCM d, s;
+    for (d = inline_dependencies; CONS_P(d); d = CDR(d)) {
+        for (s = CDAR(d); CONS_P(s); s = CDR(s)) {
+            if (contains_p(sexp, CAAR(s))) {
+                symbols = new_cons(CAAR(d), symbols);
+                break;
+            }
+        }
+    }
+    return symbols;
+}
+
+static void add_dependency(SCM symbol, SCM site, SCM original)
+{
+    SCM entry = assq_ref(symbol, inline_dependencies);
+    if (NULL_P(entry)) {
+        entry = new_cons(symbol, SCM_NULL);
+        inline_dependencies = new_cons(entry, inline_dependencies);
+    }
+    SET_CDR(entry, new_cons(new_cons(site, original), CDR(entry)));
+}
+
+/**
+ * (f arg ...) を ((lambda params body) arg ...) として最適化し、
+ * 結果でformを置き換える。埋め込めなければNULL
+ */
+static SCM inline_call(SCM sexp, SCM symbol, SCM closure, struct OptimizeScope *scope)
+{
+    SCM params = CLOSURE_ARGS(closure);
+    SCM body = CLOSURE_BODY(closure);
+    SCM symbol_lambda = intern("lambda");
+    SCM original, symbols, lambda, result, d;
+    int size = 0;
+
+    if (! TOPLEVEL_ENVIRONMENT_P(CLOSURE_ENV(closure)) || ! LIST_1_P(body) ||
+        list_length(params) < 0 || list_length(params) != list_length(CDR(sexp)) ||
+        ! EQ_P(global_value(symbol_lambda, scope), &Scheme_data_p_lambda) ||
+        ! inlinable_p(CAR(body), params, scope, &size)) {
+        return NULL;
+    }
+    original = new_cons(CAR(sexp), CDR(sexp));
+    symbols = new_cons(symbol, site_dependencies(CAR(body)));
+    lambda = new_cons(symbol_lambda, new_cons(params, new_cons(copy_code(CAR(body)), SCM_NULL)));
+    result = optimize_direct_application(new_cons(lambda, CDR(sexp)), scope, TRUE);
+    report("inline", original, result);
+    displace_form(sexp, result);
+    /* 一度しか評価されないトップレベルの式は記録しない */
+    if (scope->in_lambda) {
+        for (d = symbols; CONS_P(d); d = CDR(d)) {
+            add_dependency(CAR(d), sexp, original);
+        }
+    }
+    return sexp;
+}
+
+/**
+ * 大域変数symbolが書き換えられた。symbolを埋め込んだformを元に戻す
+ */
+void optimize_invalidate(SCM symbol)
+{
+    SCM *p;
+    for (p = &inline_dependencies; CONS_P(*p); p = CDR_REF(*p)) {
+        if (EQ_P(CAAR(*p), symbol)) {
+            SCM s;
+            report("deoptimize", symbol, NULL);
+            for (s = CDAR(*p); CONS_P(s); s = CDR(s)) {
+                SCM site = CAAR(s), original = CDAR(s);
+                CAR(site) = CAR(original);
+                SET_CDR(site, CDR(original));
+            }
+            *p = CDR(*p);
+            return;
+        }
+    }
+}
+
+/*==================================================
+  Specialization
+==================================================*/
+/* 汎用の手続きと、2引数の呼び出しで使う二項版 (fixnum, flonum) */
+static struct BinaryPrimitive {
+    SCM generic;
+    SCM binary;
+    SCM flonum;
+} binary_primitives[] = {
+    { &Scheme_data_p_num_plus,      &Scheme_data_p_fx_plus,          &Scheme_data_p_fl_plus },
+    { &Scheme_data_p_num_minus,     &Scheme_data_p_fx_minus,         &Scheme_data_p_fl_minus },
+    { &Scheme_data_p_num_mul,       &Scheme_data_p_fx_mul,           &Scheme_data_p_fl_mul },
+    { &Scheme_data_p_num_eq,        &Scheme_data_p_fx_eq,            &Scheme_data_p_fl_eq },
+    { &Scheme_data_p_less_than,     &Scheme_data_p_fx_less_than,     &Scheme_data_p_fl_less_than },
+    { &Scheme_data_p_less_equal,    &Scheme_data_p_fx_less_equal,    &Scheme_data_p_fl_less_equal },
+    { &Scheme_data_p_greater_than,  &Scheme_data_p_fx_greater_than,  &Scheme_data_p_fl_greater_than },
+    { &Scheme_data_p_greater_equal, &Scheme_data_p_fx_greater_equal, &Scheme_data_p_fl_greater_equal },
+};
+#define BINARY_PRIMITIVE_COUNT ((int) (sizeof(binary_primitives) / sizeof(binary_primitives[0])))
+
+/* 二項版なら元の汎用の手続き */
+static SCM generic_primitive(SCM subr)
+{
+    int i;
+    for (i = 0; i < BINARY_PRIMITIVE_COUNT; i++) {
+        if (EQ_P(subr, binary_primitives[i].binary) || EQ_P(subr, binary_primitives[i].flonum))
+            return binary_primitives[i].generic;
+    }
+    return subr;
+}
+
+/* fixnumの二項版ならflonumの二項版 */
+static SCM flonum_primitive(SCM subr)
+{
+    int i;
+    for (i = 0; i < BINARY_PRIMITIVE_COUNT; i++) {
+        if (EQ_P(subr, binary_primitives[i].binary))
+            return binary_primitives[i].flonum;
+    }
+    return subr;
+}
+
+/**
+ * (+ x y) の+を二項版で置き換える。大域変数の+が書き換えられたら
+ * 埋め込みと同じように元に戻す
+ */
+static SCM specialize_call(SCM sexp, SCM subr, struct OptimizeScope *scope)
+{
+    SCM original;
+    int i;
+    if (! LIST_2_P(CDR(sexp)))
+        return sexp;
+    for (i = 0; i < BINARY_PRIMITIVE_COUNT; i++) {
+        if (EQ_P(subr, binary_primitives[i].generic))
+            break;
+    }
+    if (i == BINARY_PRIMITIVE_COUNT)
+        return sexp;
+    original = new_cons(CAR(sexp), CDR(sexp));
+    report("specialize", original, NULL);
+    if (scope->in_lambda) {
+        profile_call(sexp, binary_primitives[i].binary);
+    } else {
+        CAR(sexp) = binary_primitives[i].binary;
+    }
+    if (scope->in_lambda && SYMBOL_P(CAR(original))) {
+        add_dependency(CAR(original), sexp, original);
+    }
+    return sexp;
+}
+
+/*==================================================
+  Type Feedback
+==================================================*/
+/* 先頭をcall siteにしたform. (type-feedback)で表示する. formへの参照は弱い */
+static SCM call_sites = SCM_NULL;
+
+static void profile_call(SCM sexp, SCM target)
+{
+    CAR(sexp) = new_call_site(target);
+    call_sites = new_cons(sexp, call_sites);
+}
+
+void call_site_record_callee(SCM site, SCM callee)
+{
+    if (UNBOUND_P(CALL_SITE_CALLEE(site))) {
+        CALL_SITE_CALLEE(site) = callee;
+    } else if (! EQ_P(CALL_SITE_CALLEE(site), callee)) {
+        HEADER_FLAG(site) |= CALL_SITE_FLAG_POLYMORPHIC;
+    }
+}
+
+/**
+ * 二項版の呼び出し位置に来た引数の型を記録する
+ * 最初からflonumしか来なければflonumの二項版に替え、
+ * 型が混じったら汎用の手続きに戻す
+ */
+void call_site_record_operands(SCM site, SCM x, SCM y)
+{
+    SCM target = CALL_SITE_TARGET(site);
+    int types;
+    CALL_SITE_TYPES(site)[0] |= TYPE_FEEDBACK_CLASS(x);
+    CALL_SITE_TYPES(site)[1] |= TYPE_FEEDBACK_CLASS(y);
+    types = CALL_SITE_TYPES(site)[0] | CALL_SITE_TYPES(site)[1];
+    if (types == TYPE_FEEDBACK_FLONUM && ! EQ_P(flonum_primitive(target), target)) {
+        report("specialize flonum", site, NULL);
+        CALL_SITE_TARGET(site) = flonum_primitive(target);
+    } else if (types != TYPE_FEEDBACK_FIXNUM && types != TYPE_FEEDBACK_FLONUM &&
+               ! EQ_P(generic_primitive(target), target)) {
+        report("deoptimize", site, NULL);
+        CALL_SITE_TARGET(site) = generic_primitive(target);
+        HEADER_FLAG(site) |= CALL_SITE_FLAG_DEOPTIMIZED;
+    }
+}
+
+static void print_type_feedback(int types)
+{
+    static const char *names[] = { "fixnum", "bignum", "flonum", "other" };
+    int i, first = TRUE;
+    if (types == 0) {
+        printf("-");
+        return;
+    }
+    for (i = 0; i < 4; i++) {
+        if (types & (1 << i)) {
+            printf("%s%s", first ? "" : "|", names[i]);
+            first = FALSE;
+        }
+    }
+}
+
+/* 記録した型と呼ばれた手続きを定義した順に表示する */
+DEFINE_PRIMITIVE("type-feedback", type_feedback, (), expr0)
+{
+    SCM p;
+    for (p = list_reverse(call_sites); CONS_P(p); p = CDR(p)) {
+        SCM form = CAR(p), site = CAR(form);
+        if (! CALL_SITE_P(site))
+            continue;   /* deoptimizeで元に戻したform */
+        printf("; ");
+        print(form, stdout);
+        printf(" : %u calls, ", CALL_SITE_CALLS(site));
+        if (PRIMITIVE_P(CALL_SITE_TARGET(site))) {
+            print_type_feedback(CALL_SITE_TYPES(site)[0]);
+            printf(" x ");
+            print_type_feedback(CALL_SITE_TYPES(site)[1]);
+            printf((HEADER_FLAG(site) & CALL_SITE_FLAG_DEOPTIMIZED) ? ", generic" : ", specialized");
+        } else if (UNBOUND_P(CALL_SITE_CALLEE(site))) {
+            printf("not called");
+        } else {
+            printf((HEADER_FLAG(site) & CALL_SITE_FLAG_POLYMORPHIC) ? "polymorphic" : "monomorphic");
+        }
+        putchar('\n');
+    }
+    fflush(stdout);
+    return SCM_UNDEFINED;
+}
+
+/*==================================================
+  Weak References
+==================================================*/
+/**
+ * GCのmarkの後に呼ばれる. 定義し直した手続きの本体など、回収される
+ * formの依存関係とcall siteを捨てて、残るものだけをmarkする.
+ * originalからしか辿れないformもあるので、増えなくなるまで繰り返す
+ */
+static void optimize_gc_prune(void)
+{
+    SCM *p, *q;
+    SCM d, s;
+    int marked;
+
+    do {
+        marked = FALSE;
+        for (d = inline_dependencies; CONS_P(d); d = CDR(d)) {
+            for (s = CDAR(d); CONS_P(s); s = CDR(s)) {
+                if (scm_gc_marked_p(CAAR(s)) && ! scm_gc_marked_p(CDAR(s))) {
+                    scm_gc_mark(CDAR(s));
+                    marked = TRUE;
+                }
+            }
+        }
+    } while (marked);
+
+    for (p = &inline_dependencies; CONS_P(*p); ) {
+        for (q = CDR_REF(CAR(*p)); CONS_P(*q); ) {
+            if (scm_gc_marked_p(CAAR(*q))) {
+                q = CDR_REF(*q);
+            } else {
+                *q = CDR(*q);
+            }
+        }
+        if (NULL_P(CDAR(*p))) {
+            *p = CDR(*p);
+        } else {
+            p = CDR_REF(*p);
+        }
+    }
+    for (p = &call_sites; CONS_P(*p); ) {
+        if (scm_gc_marked_p(CAR(*p))) {
+            p = CDR_REF(*p);
+        } else {
+            *p = CDR(*p);
+        }
+    }
+    scm_gc_mark(inline_dependencies);
+    scm_gc_mark(call_sites);
+}
+
+/*==================================================
+  Optimizer
+==================================================*/
+static SCM optimize_form(SCM sexp, struct OptimizeScope *scope)
+{
+    SCM head, value;
+
+    if (SYMBOL_P(sexp)) {
+        SCM pair = assq_ref(sexp, scope->subst);
+        return NULL_P(pair) ? sexp : CDR(pair);
+    }
+    if (! CONS_P(sexp)) {
+        return sexp;
+    }
+    head = CAR(sexp);
+    if (CALL_SITE_P(head)) {
+        /* 埋め込む本体のcopy: call siteは元のformのものなので選び直す */
+        head = CAR(sexp) = generic_primitive(CALL_SITE_TARGET(head));
+    }
+    if (CONS_P(head) && list_length(head) >= 2 &&
+        EQ_P(global_value(CAR(head), scope), &Scheme_data_p_lambda)) {
+        return optimize_direct_application(sexp, scope, FALSE);
+    }
+    value = SYMBOL_P(head) ? global_value(head, scope) : head;
+    if (SYMBOL_P(head) && value != NULL && CLOSURE_P(value) &&
+        NULL_P(assq_ref(head, scope->subst))) {
+        SCM inlined = inline_call(sexp, head, value, scope);
+        if (inlined != NULL) {
+            return inlined;
+        }
+        if (scope->in_lambda) {
+            profile_call(sexp, head);
+        }
+    } else if (SYMBOL_P(head) && value != NULL && UNBOUND_P(value) && scope->in_lambda) {
+        /* 再帰する手続きの本体など、後で定義される大域変数の呼び出し */
+        profile_call(sexp, head);
+    }
+    if (value != NULL && NULL_P(assq_ref(head, scope->subst)) && PRIMITIVE_P(value)) {
+        if (SPECIAL_FORM_P(value)) {
+            if (EQ_P(value, &Scheme_data_p_lambda)) {
+                return optimize_lambda(sexp, scope, TRUE);
+            }
+            if (EQ_P(value, &Scheme_data_p_cond)) {
+                return optimize_cond(sexp, scope);
+            }
+            if (EQ_P(value, &Scheme_data_p_if)) {
+                return optimize_if(sexp, scope);
+            }
+            if (EQ_P(value, &Scheme_data_p_setq)) {
+                optimize_each(CDDR(sexp), scope);
+            } else if (EQ_P(value, &Scheme_data_p_begin) || CONDITIONAL_FORM_P(value)) {
+                optimize_each(CDR(sexp), scope);
+            }
+            /* quote, macro, define-syntax はそのまま */
+            return sexp;
+        }
+        optimize_each(CDR(sexp), scope);
+        {
+            SCM folded = fold_primitive(value, CDR(sexp), scope);
+            if (folded != NULL) {
+                report("fold", sexp, folded);
+                return folded;
+            }
+        }
+        return specialize_call(sexp, value, scope);
+    }
+    optimize_each(sexp, scope);
+    return sexp;
+}
+
+/**
+ * トップレベルのformを最適化する
+ */
+SCM optimize(SCM sexp)
+{
+    struct OptimizeScope scope;
+    scope.bound = SCM_NULL;
+    scope.immutable = SCM_NULL;
+    scope.subst = SCM_NULL;
+    scope.in_lambda = FALSE;
+    return optimize_form(sexp, &scope);
+}
+
+void symbols_of_optimize_initialize(void)
+{
+    scm_gc_register_weak_hook(optimize_gc_prune);
+    ADD_PRIMITIVE("type-feedback", type_feedback, (), EXPR_0);
+}
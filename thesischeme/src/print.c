@@ -11,6 +11,21 @@ static SCM print_list(SCM sexp, FILE *file)
 {
     SCM lst = sexp;
     putc('(', file);
+    /* flat closureに変換したlambdaは元の形で表示する */
+    if (EQ_P(CAR(lst), &Scheme_data_p_flat_lambda)) {
+        fprintf(file, "lambda ");
+        lst = CADR(lst);
+    }
+    /* 呼び出し位置に置いた二項版などは名前で表示する */
+    if (PRIMITIVE_P(CAR(lst)) && (HEADER_FLAG(CAR(lst)) & PRIMITIVE_FLAG_SPECIALIZED)) {
+        fprintf(file, "%s", PRIMITIVE_NAME(CAR(lst)));
+        lst = CDR(lst);
+        if (NULL_P(lst)) {
+            putc(')', file);
+            return SCM_NULL;
+        }
+        putc(' ', file);
+    }
     for(;;) {
         print(CAR(lst), file);
         lst = CDR(lst);
@@ -24,6 +39,10 @@ static SCM print_list(SCM sexp, FILE *file)
 
 SCM print(SCM sexp, FILE *file)
 {
+    if (CHAR_P(sexp)) {
+        print_char(sexp, file);
+        return SCM_UNDEFINED;
+    }
     if (SCM_CONSTANT_P(sexp)) {
         switch(AS_UINT(sexp)) {
         case AS_UINT(SCM_NULL):       fprintf(file, "()"); break;
@@ -37,13 +56,25 @@ SCM print(SCM sexp, FILE *file)
         return SCM_UNDEFINED;
     }
     if (SYMBOL_P(sexp)) {
-        fprintf(file, "%s", SYMBOL_NAME(sexp));
+        fwrite(SYMBOL_NAME(sexp), 1, SYMBOL_LENGTH(sexp), file);
     } else if (INTEGER_P(sexp)) {
-        fprintf(file, "%d", INTEGER_VALUE(sexp));
+        print_integer(sexp, file);
+    } else if (FLONUM_P(sexp)) {
+        print_flonum(sexp, file);
     } else if (STRING_P(sexp)) {
-        fprintf(file, "\"%s\"", STRING_VALUE(sexp));
+        print_string(sexp, file);
     } else if (CONS_P(sexp)) {
         print_list(sexp, file);
+    } else if (VECTOR_P(sexp)) {
+        print_vector(sexp, file);
+    } else if (UVECTOR_P(sexp)) {
+        print_uvector(sexp, file);
+    } else if (HASH_TABLE_P(sexp)) {
+        print_hash_table(sexp, file);
+    } else if (HAMT_P(sexp)) {
+        print_hamt(sexp, file);
+    } else if (RECORD_P(sexp) || RECORD_TYPE_P(sexp) || RECORD_PROCEDURE_P(sexp)) {
+        print_record(sexp, file);
     } else if (PRIMITIVE_P(sexp)) {
         fprintf(file, "#<primitive %s>", PRIMITIVE_NAME(sexp));
     } else if (CLOSURE_P(sexp)) {
@@ -52,9 +83,38 @@ SCM print(SCM sexp, FILE *file)
         print(CLOSURE_BODY(sexp), file);
     } else if (MACRO_P(sexp)) {
         fprintf(file, "#<macro>");
-        print(MACRO_CLOSURE(sexp), file);
+        if (NULL_P(MACRO_RULES(sexp))) {
+            print(MACRO_CLOSURE(sexp), file);
+        } else {
+            fprintf(file, "syntax-rules");
+        }
+    } else if (CONTINUATION_P(sexp)) {
+        fprintf(file, "#<continuation>");
+    } else if (BOX_P(sexp)) {
+        fprintf(file, "#<box>");
+    } else if (CALL_SITE_P(sexp)) {
+        /* 呼び出し位置の先頭. 元の名前で表示する */
+        if (PRIMITIVE_P(CALL_SITE_TARGET(sexp))) {
+            fprintf(file, "%s", PRIMITIVE_NAME(CALL_SITE_TARGET(sexp)));
+        } else {
+            print(CALL_SITE_TARGET(sexp), file);
+        }
     } else {
         printf("print unsupported: %p", sexp);
     }
     return SCM_UNDEFINED;
 }
+
+/* 文字列と文字は中身をそのまま書く */
+SCM display(SCM sexp, FILE *file)
+{
+    char buf[4];
+    if (STRING_P(sexp)) {
+        display_string(sexp, file);
+    } else if (CHAR_P(sexp)) {
+        fwrite(buf, 1, utf8_encode(CHAR_VALUE(sexp), buf), file);
+    } else {
+        print(sexp, file);
+    }
+    return SCM_UNDEFINED;
+}
@@ -44,8 +44,8 @@ SCM _scm_symbol_quote;
  *
  *   <boolean>     ok
  *   <number>      ok (integer only)
- *   <character>   
- *   <string>      
+ *   <character>   ok (#\a #\space #\x41 UTF-8)
+ *   <string>      ok (escape: \a \b \t \n \r \" \\ \| \xHH; line continuation)
  *   <symbol>      ok
  *   <list>        ok
  *   <vector>      
@@ -57,7 +57,7 @@ SCM _scm_symbol_quote;
 static char scm_initial_characters[] =
 "ABCDEFGHIJKLMNOPQRSTUVWXYZ" /* upper case */
 "abcdefghijklmnopqrstuvwxyz" /* lower case */
-"!$%&*?:<=>?^_~"             /* special initial */
+"!$%&*/:<=>?^_~"             /* special initial */
 ;
 static char scm_special_subsequent[] = "+-.@";
 static char scm_delimiters[] = "()\";";
@@ -76,7 +76,6 @@ static char scm_delimiters[] = "()\";";
 ==================================================*/
 static int skip_comment_and_space(FILE *file);
 static char* read_word(FILE *file, int first_char);
-static SCM c_string_to_number(char *buf);
 
 static SCM read_simple_datum(FILE *file, int previous);
 static SCM read_symbol(FILE *file, int first_char);
@@ -87,6 +86,7 @@ static SCM read_character(FILE *file);
 
 static SCM read_list(FILE *file);
 static SCM read_vector(FILE *file);
+static SCM read_uvector_or_false(FILE *file, int first_char);
 
 SCM scm_proc_read(FILE *file);
 
@@ -154,30 +154,53 @@ static char* read_word(FILE *file, int first_char)
     }    
 }
 
-static SCM c_string_to_number(char *buf)
+/*
+ *   <integer> [+-]<digit>+
+ *   <flonum>  [+-]<digit>*[.<digit>*][e[+-]<digit>+]  (数字が一つ以上)
+ *             +inf.0 -inf.0 +nan.0
+ */
+SCM c_string_to_number(char *buf)
 {
-    int sign = 1;
     int offset = 0;
+    int digits = 0;
+    int integer_p = TRUE;
+    char *p;
+
+    if (strcmp(buf, "+inf.0") == 0)
+        return new_flonum(1.0 / 0.0);
+    if (strcmp(buf, "-inf.0") == 0)
+        return new_flonum(-1.0 / 0.0);
+    if (strcmp(buf, "+nan.0") == 0)
+        return new_flonum(0.0 / 0.0);
+
     switch (buf[offset]) {
     case '+':
-        offset++;
-        break;
     case '-':
         offset++;
-        sign *= -1;
         break;
     }
-    if ('\0' == buf[offset]) { return SCM_FALSE; }
-    {
-        int index = offset;
-        while (buf[index]) {
-            if (! isdigit(buf[index]) ) {
-                return SCM_FALSE;
-            }
-            index++;
-        }
+    for (p = buf + offset; isdigit(*p); p++)
+        digits++;
+    if ('.' == *p) {
+        integer_p = FALSE;
+        for (p++; isdigit(*p); p++)
+            digits++;
     }
-    return new_integer((int) strtol(buf, NULL,10));
+    if (0 == digits) { return SCM_FALSE; }
+    if ('e' == *p || 'E' == *p) {
+        integer_p = FALSE;
+        p++;
+        if ('+' == *p || '-' == *p)
+            p++;
+        if (! isdigit(*p))
+            return SCM_FALSE;
+        while (isdigit(*p))
+            p++;
+    }
+    if ('\0' != *p) { return SCM_FALSE; }
+    if (integer_p)
+        return c_string_to_integer(buf);
+    return new_flonum(strtod(buf, NULL));
 }
 
 
@@ -248,7 +271,10 @@ static SCM read_simple_datum(FILE *file, int previous)
             scheme_error("syntax error");
             /* <boolean> */
         case 't':    return SCM_TRUE;
-        case 'f':    return SCM_FALSE;
+        case 'f':
+        case 'u':
+        case 's':
+            return read_uvector_or_false(file, c);
 
             /* <character> */
         case '\\':
@@ -312,20 +338,132 @@ static SCM read_number_or_peculiar(FILE *file, int first_char)
     return number;
 }
 
+/* 文字列の \xHH; の16進数 */
+static int read_hex_scalar(FILE *file)
+{
+    int c, value = 0, digits = 0;
+    while (isxdigit(c = fgetc(file))) {
+        value = value * 16 + (isdigit(c) ? c - '0' : tolower(c) - 'a' + 10);
+        if (value > CHAR_MAX_VALUE)
+            scheme_error("syntax error: bad hex scalar value");
+        digits++;
+    }
+    if (digits == 0 || c != ';')
+        scheme_error("syntax error: bad hex scalar value");
+    return value;
+}
+
+/* 行末の \ の後の空白と改行、次の行の先頭の空白を読み飛ばす */
+static void skip_line_continuation(FILE *file, int c)
+{
+    while (c == ' ' || c == '\t')
+        c = fgetc(file);
+    if (c != '\n')
+        scheme_error("syntax error: bad escape in string");
+    do {
+        c = fgetc(file);
+    } while (c == ' ' || c == '\t');
+    ungetc(c, file);
+}
+
+/*
+ *   <string> -> " <string element>* "
+ *   中身はbyteのまま写す (UTF-8はそのまま)
+ */
 static SCM read_string(FILE *file)
 {
-    scheme_error("unsupport string");
-    return NULL;
+    int size = 64, length = 0;
+    char *buf = xmalloc(size);
+    int c;
+    SCM string;
+
+    for (;;) {
+        /* escapeで最大4 byte増える */
+        if (length + 4 >= size) {
+            size *= 2;
+            buf = xrealloc(buf, size);
+        }
+        c = fgetc(file);
+        if (EOF == c) {
+            free(buf);
+            scheme_error("syntax error: unterminated string");
+        }
+        if ('"' == c)
+            break;
+        if ('\\' != c) {
+            buf[length++] = c;
+            continue;
+        }
+        c = fgetc(file);
+        switch (c) {
+        case 'a':  buf[length++] = '\a'; break;
+        case 'b':  buf[length++] = '\b'; break;
+        case 't':  buf[length++] = '\t'; break;
+        case 'n':  buf[length++] = '\n'; break;
+        case 'r':  buf[length++] = '\r'; break;
+        case '"':
+        case '\\':
+        case '|':  buf[length++] = c; break;
+        case 'x':
+            length += utf8_encode(read_hex_scalar(file), buf + length);
+            break;
+        case ' ':
+        case '\t':
+        case '\n':
+            skip_line_continuation(file, c);
+            break;
+        default:
+            free(buf);
+            scheme_error("syntax error: bad escape in string");
+        }
+    }
+    string = new_string_bytes(buf, length, utf8_count(buf, length));
+    free(buf);
+    return string;
 }
 
+/*
+ *   <character> -> #\<any character> | #\<character name> | #\x<hex scalar value>
+ */
 static SCM read_character(FILE *file)
 {
-    scheme_error("unsupport character");
-    return NULL;
+    char bytes[4];
+    char *buf;
+    int c, n, i, value;
+
+    c = fgetc(file);
+    if (EOF == c)
+        scheme_error("syntax error: bad character");
+    if (c >= 0x80) {
+        /* UTF-8の先頭から長さを決めて残りを読む */
+        bytes[0] = c;
+        n = c >= 0xF0 ? 4 : c >= 0xE0 ? 3 : c >= 0xC0 ? 2 : 1;
+        for (i = 1; i < n; i++) {
+            if (EOF == (c = fgetc(file)))
+                scheme_error("syntax error: bad character");
+            bytes[i] = c;
+        }
+        utf8_decode(bytes, bytes + n, &value);
+        return MAKE_CHAR(value);
+    }
+    if (! isalpha(c))
+        return MAKE_CHAR(c);
+    buf = read_word(file, c);
+    if (strlen(buf) == 1) {
+        value = c;
+    } else if ('x' == buf[0] && strspn(buf + 1, "0123456789abcdefABCDEF") == strlen(buf) - 1) {
+        value = strtol(buf + 1, NULL, 16);
+        if (strlen(buf) > 7 || value > CHAR_MAX_VALUE)
+            value = -1;
+    } else {
+        value = char_name_value(buf);
+    }
+    free(buf);
+    if (value < 0)
+        scheme_error("syntax error: unknown character name");
+    return MAKE_CHAR(value);
 }
 
-/* <list> -> (<datum>*) | (<datum>+ . <datum>) | <abbreviation>
- */
 static SCM read_list(FILE *file)
 {
     int c;
@@ -341,26 +479,35 @@ static SCM read_list(FILE *file)
             break;
 
         case ')': /* end of list */
-            return lst;
+            return list_to_cdr_coded(lst);
 
-        case '.': /* dot pair */
+        case '.':
+            c = fgetc(file);
+            ungetc(c, file);
+            if (c != EOF && ! SCM_DELIMITER_P(c)) {
+                /* ... */
+                datum = read_number_or_peculiar(file, '.');
+                goto add_datum;
+            }
+            /* dot pair */
             if (NULL_P(last_pair)) /* ( . <datum>) is invalid */
                 goto syntax_error;
-            CDR(last_pair) = scm_proc_read(file);
+            SET_CDR(last_pair, scm_proc_read(file));
             c = skip_comment_and_space(file);
             if (c != ')') 
                 goto syntax_error;
-            return lst;
+            return list_to_cdr_coded(lst);
             break;
 
         default: /* read datum */
             ungetc(c, file);
             datum = scm_proc_read(file);
+        add_datum:
             if (NULL_P(lst)) { /* initialize list */
                 lst = new_cons(datum, SCM_NULL);
                 last_pair= lst;
             } else {
-                CDR(last_pair) = new_cons(datum, SCM_NULL);
+                SET_CDR(last_pair, new_cons(datum, SCM_NULL));
                 last_pair = CDR(last_pair);
             }
         }
@@ -375,7 +522,24 @@ static SCM read_list(FILE *file)
  */
 static SCM read_vector(FILE *file)
 {
-    scheme_error("unsupport vector");
-    return NULL;
+    return list_to_vector(read_list(file));
+}
+
+/* #f or <uvector> -> #u8(<number>*) | #s32(...) | #s64(...) | #f64(...)
+ */
+static SCM read_uvector_or_false(FILE *file, int first_char)
+{
+    char *buf = read_word(file, first_char);
+    int type = uvector_tag_type(buf);
+    int c;
+    if (strcmp(buf, "f") == 0) {
+        free(buf);
+        return SCM_FALSE;
+    }
+    free(buf);
+    if (type < 0 || (c = fgetc(file)) != '(') {
+        scheme_error("unsupport number prefix");
+    }
+    return list_to_uvector(type, read_list(file));
 }
 
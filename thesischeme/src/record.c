@@ -0,0 +1,210 @@
+/*===========================================================================
+ * record.c - record types (define-record-type)
+ *
+ * $Id$
+===========================================================================*/
+
+#include "scheme.h"
+
+/* recordはcellとslotの配列 (data space) で、slotの数は型が持つ.
+ * constructor, predicate, accessor, modifierは手続きの形をした専用のcellで、
+ * 型とslotの位置を持っている. evaluatorはこれらの呼び出しを型の比較と
+ * slotの読み書きだけで済ませ (eval.c)、compilerも同じCを出す (compile.c)
+ */
+
+static char *record_procedure_kind_names[] = {
+    "record-constructor", "record-predicate", "record-accessor", "record-modifier"
+};
+
+/* <point>なら両端の<>を除いた名前 */
+static int record_type_name(SCM descriptor, char **name)
+{
+    SCM symbol = RECORD_TYPE_NAME(descriptor);
+    int length = SYMBOL_LENGTH(symbol);
+    *name = SYMBOL_NAME(symbol);
+    if (length > 2 && (*name)[0] == '<' && (*name)[length - 1] == '>') {
+        (*name)++;
+        length -= 2;
+    }
+    return length;
+}
+
+void record_type_error(SCM name, SCM descriptor)
+{
+    char message[128];
+    char *type = "record";
+    int length = 6;
+    if (RECORD_TYPE_P(descriptor))
+        length = record_type_name(descriptor, &type);
+    snprintf(message, sizeof(message), "%.*s: %.*s required",
+             SYMBOL_LENGTH(name), SYMBOL_NAME(name), length, type);
+    scheme_error(message);
+}
+
+static void record_arity_error(SCM proc)
+{
+    char message[128];
+    SCM name = RECORD_PROCEDURE_NAME(proc);
+    snprintf(message, sizeof(message), "%.*s: wrong number of arguments",
+             SYMBOL_LENGTH(name), SYMBOL_NAME(name));
+    scheme_error(message);
+}
+
+/**
+ * 評価済みの引数にrecordの手続きを適用する.
+ * 引数のlistはenv stackにあることがあるので取っておかない
+ */
+SCM record_apply(SCM proc, SCM args)
+{
+    SCM descriptor = RECORD_PROCEDURE_DESCRIPTOR(proc);
+    SCM record, slots;
+
+    switch (RECORD_PROCEDURE_KIND(proc)) {
+    case RECORD_CONSTRUCTOR:
+        slots = RECORD_PROCEDURE_SLOTS(proc);
+        if (list_length(args) != list_length(slots))
+            record_arity_error(proc);
+        record = new_record(descriptor);
+        for (; CONS_P(slots); slots = CDR(slots), args = CDR(args)) {
+            RECORD_REF(record, FIXNUM_VALUE(CAR(slots))) = CAR(args);
+        }
+        return record;
+    case RECORD_PREDICATE:
+        if (! LIST_1_P(args))
+            record_arity_error(proc);
+        return C_TO_SCM_BOOLEAN(RECORD_INSTANCE_P(CAR(args), descriptor));
+    case RECORD_ACCESSOR:
+        if (! LIST_1_P(args))
+            record_arity_error(proc);
+        if (! RECORD_INSTANCE_P(CAR(args), descriptor))
+            record_type_error(RECORD_PROCEDURE_NAME(proc), descriptor);
+        return RECORD_REF(CAR(args), RECORD_PROCEDURE_INDEX(proc));
+    case RECORD_MODIFIER:
+        if (! LIST_2_P(args))
+            record_arity_error(proc);
+        if (! RECORD_INSTANCE_P(CAR(args), descriptor))
+            record_type_error(RECORD_PROCEDURE_NAME(proc), descriptor);
+        RECORD_REF(CAR(args), RECORD_PROCEDURE_INDEX(proc)) = CADR(args);
+        return SCM_UNDEFINED;
+    }
+    return SCM_UNDEFINED;
+}
+
+/* record, record type, recordの手続き */
+void print_record(SCM obj, FILE *file)
+{
+    char *name;
+    int length, i;
+
+    if (RECORD_TYPE_P(obj)) {
+        length = record_type_name(obj, &name);
+        fprintf(file, "#<record-type %.*s>", length, name);
+    } else if (RECORD_PROCEDURE_P(obj)) {
+        fprintf(file, "#<%s ", record_procedure_kind_names[RECORD_PROCEDURE_KIND(obj)]);
+        print(RECORD_PROCEDURE_NAME(obj), file);
+        fputc('>', file);
+    } else {
+        length = record_type_name(RECORD_DESCRIPTOR(obj), &name);
+        fprintf(file, "#<%.*s", length, name);
+        for (i = 0; i < RECORD_TYPE_COUNT(RECORD_DESCRIPTOR(obj)); i++) {
+            fputc(' ', file);
+            print(RECORD_REF(obj, i), file);
+        }
+        fputc('>', file);
+    }
+}
+
+/*==================================================
+  Definition
+==================================================*/
+static int field_index(SCM fields, SCM name)
+{
+    int index;
+    for (index = 0; CONS_P(fields); fields = CDR(fields), index++) {
+        if (EQ_P(CAR(fields), name))
+            return index;
+    }
+    scheme_error("define-record-type: unknown field in constructor");
+    return -1;
+}
+
+static void define_global(SCM symbol, SCM value)
+{
+    optimize_invalidate(symbol);
+    SYMBOL_VCELL(symbol) = value;
+}
+
+/* (define-record-type <type name>
+ *   (<constructor> <field> ...) <predicate>
+ *   (<field> <accessor> [<modifier>]) ...)
+ *
+ * 名前は全て大域変数に束縛する. constructorが名前だけなら全てのfieldを
+ * 順に取り、constructorやpredicateが#fなら作らない */
+DEFINE_PRIMITIVE("define-record-type", define_record_type, (SCM sexp, struct EvalState *state), special_form)
+{
+    SCM type_name, constructor, predicate, specs, spec, rest;
+    SCM fields = SCM_NULL;
+    SCM slots = SCM_NULL;
+    SCM descriptor;
+    int count = 0;
+    int index;
+
+    if (list_length(sexp) < 3 || ! SYMBOL_P(CAR(sexp)))
+        scheme_error("define-record-type: syntax error");
+    type_name = CAR(sexp);
+    constructor = CADR(sexp);
+    predicate = CADDR(sexp);
+    specs = CDR(CDDR(sexp));
+    for (rest = specs; CONS_P(rest); rest = CDR(rest)) {
+        spec = CAR(rest);
+        if (! (LIST_2_P(spec) || LIST_3_P(spec)) || ! SYMBOL_P(CAR(spec)) || ! SYMBOL_P(CADR(spec)) ||
+            (LIST_3_P(spec) && ! SYMBOL_P(CADDR(spec))))
+            scheme_error("define-record-type: bad field spec");
+        fields = new_cons(CAR(spec), fields);
+        count++;
+    }
+    if (count > RECORD_MAX_FIELDS)
+        scheme_error("define-record-type: too many fields");
+    fields = list_reverse(fields);
+    descriptor = new_record_type(type_name, fields, count);
+
+    if (SYMBOL_P(constructor)) {
+        for (index = count - 1; index >= 0; index--) {
+            slots = new_cons(MAKE_FIXNUM(index), slots);
+        }
+    } else if (CONS_P(constructor) && SYMBOL_P(CAR(constructor))) {
+        for (rest = CDR(constructor); CONS_P(rest); rest = CDR(rest)) {
+            slots = new_cons(MAKE_FIXNUM(field_index(fields, CAR(rest))), slots);
+        }
+        slots = list_reverse(slots);
+        constructor = CAR(constructor);
+    } else if (! FALSE_P(constructor)) {
+        scheme_error("define-record-type: bad constructor spec");
+    }
+    if (! SYMBOL_P(predicate) && ! FALSE_P(predicate))
+        scheme_error("define-record-type: bad predicate");
+
+    define_global(type_name, descriptor);
+    if (SYMBOL_P(constructor))
+        define_global(constructor, new_record_procedure(RECORD_CONSTRUCTOR, descriptor, constructor, 0, slots));
+    if (SYMBOL_P(predicate))
+        define_global(predicate, new_record_procedure(RECORD_PREDICATE, descriptor, predicate, 0, SCM_NULL));
+    for (rest = specs, index = 0; CONS_P(rest); rest = CDR(rest), index++) {
+        spec = CAR(rest);
+        define_global(CADR(spec), new_record_procedure(RECORD_ACCESSOR, descriptor, CADR(spec), index, SCM_NULL));
+        if (LIST_3_P(spec))
+            define_global(CADDR(spec), new_record_procedure(RECORD_MODIFIER, descriptor, CADDR(spec), index, SCM_NULL));
+    }
+    return type_name;
+}
+
+DEFINE_PRIMITIVE("record?", recordp, (SCM o), expr1)
+{
+    return C_TO_SCM_BOOLEAN(RECORD_P(o));
+}
+
+void symbols_of_record_initialize(void)
+{
+    ADD_PRIMITIVE("define-record-type", define_record_type, (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+    ADD_PRIMITIVE("record?",            recordp,            (SCM o),                             EXPR_1);
+}
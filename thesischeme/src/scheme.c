@@ -10,16 +10,28 @@
 void scheme_initialize(void)
 {
     allocator_initialize();
+    control_stack_initialize();
+    env_stack_initialize();
     symbol_table_initialize();
     symbols_of_symbol_initialize();
     symbols_of_env_initialize();
     symbols_of_read_initialize();
     symbols_of_eval_initialize();
+    symbols_of_syntax_initialize();
+    symbols_of_optimize_initialize();
+    symbols_of_vector_initialize();
+    symbols_of_uvector_initialize();
+    symbols_of_string_initialize();
+    symbols_of_hashtable_initialize();
+    symbols_of_hamt_initialize();
+    symbols_of_record_initialize();
 }
 
 void scheme_finalize(void)
 {
-    allocator_finalize();
+    allocator_finalize();  /* releases segments held by continuations */
+    control_stack_finalize();
+    env_stack_finalize();
     fflush(stdout);
     fflush(stderr);
 }
@@ -16,6 +16,7 @@
 #include <ctype.h>
 #include <error.h>
 #include <assert.h>
+#include <setjmp.h>
 
 /* test support */
 #ifdef GC
@@ -60,25 +61,71 @@ EXTERN_C_BEGIN
 /* scheme cell object interface */
 typedef struct _Cell* SCM;
 
+/* digit of bignum */
+typedef uint32_t BignumDigit;
+typedef uint64_t BignumDoubleDigit;
+#define BIGNUM_DIGIT_BITS 32
+
 /* Internal representation of SCM Object.
  *
- *   ........|00|       pointer on an object
+ *   .......|0|00|      pointer on a cell object
+ *   .......|1|00|      pointer on a cons (+4, alloc.c)
+ *   ........|01|       fixnum (small integer)
+ *   ........|10|       flonum (double, 64bit only)
  *   ........|11|       constant (#t #f '() ...)
+ *
+ * cellもconsも8 byte境界に置くので、pointerの3bit目でどちらか分かる
  */
 
 /* internal type */
 #define SCM_INTERNAL_REPRESENTATION_TYPE_POINTER     0 /* pointer  */
-/* reserved type                                     1             */
-/* reserved type                                     2             */
+#define SCM_INTERNAL_REPRESENTATION_TYPE_FIXNUM      1 /* fixnum   */
+#define SCM_INTERNAL_REPRESENTATION_TYPE_FLONUM      2 /* flonum   */
 #define SCM_INTERNAL_REPRESENTATION_TYPE_CONSTANT    3 /* constant */
 
 /* internal type mask */
 #define SCM_INTERNAL_REPRESENTATION_MASK 0x3
 
-/* pointer */
-#define SCM_POINTER_P(o) (                           \
+/* pointer: headerを持つcell. consは含まない */
+#define SCM_POINTER_P(o) ((AS_UINT(o) & 7) == SCM_INTERNAL_REPRESENTATION_TYPE_POINTER)
+
+/* cons */
+#define SCM_CONS_TAG 4
+#define SCM_CONS_P(o) ((AS_UINT(o) & 7) == SCM_CONS_TAG)
+
+/* fixnum: 値を2bit左にずらして持つ。範囲外の整数はbignumにする */
+#define FIXNUM_P(o) (                                \
   (AS_UINT(o) & SCM_INTERNAL_REPRESENTATION_MASK) == \
-   SCM_INTERNAL_REPRESENTATION_TYPE_POINTER)
+   SCM_INTERNAL_REPRESENTATION_TYPE_FIXNUM)
+#define FIXNUM_VALUE(o) (((intptr_t) AS_UINT(o)) >> 2)
+#define MAKE_FIXNUM(n)  (AS_SCM(((uintptr_t) (intptr_t) (n)) << 2 | \
+                                SCM_INTERNAL_REPRESENTATION_TYPE_FIXNUM))
+#define FIXNUM_MAX (INTPTR_MAX >> 2)
+#define FIXNUM_MIN (INTPTR_MIN >> 2)
+#define FIXNUM_RANGE_P(n) (FIXNUM_MIN <= (n) && (n) <= FIXNUM_MAX)
+
+/* flonum: 64bitでは指数の上位3bitが011か100のdouble (おおよそ
+ * 2^-255から2^256) を即値で持つ。bitを3つ左に回して符号と指数の上位
+ * 3bitを下位に移し、そのうち2bitをtagで潰す (残りの1bitから戻せる)。
+ * +0.0は特別な値にし、それ以外のdoubleはheapのcellに置く (new_flonum) */
+union FlonumBits {
+    double value;
+    uint64_t bits;
+};
+#if INTPTR_MAX == INT64_MAX
+#define IMMEDIATE_FLONUM_P(o) (                      \
+  (AS_UINT(o) & SCM_INTERNAL_REPRESENTATION_MASK) == \
+   SCM_INTERNAL_REPRESENTATION_TYPE_FLONUM)
+#else
+#define IMMEDIATE_FLONUM_P(o) FALSE
+#endif
+#define IMMEDIATE_FLONUM_ZERO AS_SCM(0x8000000000000002ULL)  /* +0.0 */
+#define IMMEDIATE_FLONUM_BITS(o)                                        \
+  (EQ_P((o), IMMEDIATE_FLONUM_ZERO) ? (uint64_t) 0 :                    \
+   FLONUM_ROTATE_RIGHT((2 - ((uint64_t) AS_UINT(o) >> 63)) |            \
+                       ((uint64_t) AS_UINT(o) & ~(uint64_t) 3)))
+#define FLONUM_ROTATE_LEFT(u)  (((u) << 3) | ((u) >> 61))
+#define FLONUM_ROTATE_RIGHT(u) (((u) >> 3) | ((u) << 61))
 
 /* constant */
 #define MAKE_SCM_CONSTANT(n) (AS_SCM(n << 2 | SCM_INTERNAL_REPRESENTATION_MASK))
@@ -96,6 +143,8 @@ typedef struct _Cell* SCM;
 #define SCM_EOF         MAKE_SCM_CONSTANT(3) /* eof-object   */
 #define SCM_UNDEFINED   MAKE_SCM_CONSTANT(4) /* #<undef>     */
 #define SCM_UNBOUND     MAKE_SCM_CONSTANT(5) /* internal use */
+#define SCM_TAIL_CALL   MAKE_SCM_CONSTANT(6) /* compiled code internal use */
+#define SCM_DELETED     MAKE_SCM_CONSTANT(7) /* hash table internal use */
 
 /* boolean converter */
 #define C_TO_SCM_BOOLEAN(condition) ((condition) ? SCM_TRUE : SCM_FALSE)
@@ -120,14 +169,41 @@ typedef struct _Cell* SCM;
 /* scheme cell object type */
 enum SchemeCellType {
     CELL_TYPE_FREE = 0,
-    CELL_TYPE_CONS,
-    CELL_TYPE_INTEGER,
+    CELL_TYPE_BIGNUM,
     CELL_TYPE_SYMBOL,
     CELL_TYPE_STRING,
     CELL_TYPE_PRIMITIVE,
     CELL_TYPE_CLOSURE,
     CELL_TYPE_MACRO,
     CELL_TYPE_PORT,
+    CELL_TYPE_CONTINUATION,
+    CELL_TYPE_BOX,
+    CELL_TYPE_CALL_SITE,
+    CELL_TYPE_FLONUM,
+    CELL_TYPE_VECTOR,
+    CELL_TYPE_UVECTOR,
+    CELL_TYPE_HASH_TABLE,
+    CELL_TYPE_HAMT,
+    CELL_TYPE_HAMT_NODE,
+    CELL_TYPE_RECORD_TYPE,
+    CELL_TYPE_RECORD,
+    CELL_TYPE_RECORD_PROCEDURE,
+};
+
+/* element type of homogeneous numeric vector (SRFI-4) */
+enum UvectorType {
+    UVECTOR_U8,
+    UVECTOR_S32,
+    UVECTOR_S64,
+    UVECTOR_F64,
+};
+
+/* equivalence of hash table keys (SRFI-69) */
+enum HashTableKind {
+    HASH_TABLE_EQ,
+    HASH_TABLE_EQV,
+    HASH_TABLE_EQUAL,
+    HASH_TABLE_STRING,
 };
 
 /* scheme cell gc flag */
@@ -148,6 +224,13 @@ enum PrimitiveType {
     PRIMITIVE_TYPE_EXPR_3,
     PRIMITIVE_TYPE_EXPR_4,
     PRIMITIVE_TYPE_EXPR_5,
+    PRIMITIVE_TYPE_CONTROL,   /* (SCM args, struct EvalState *state) */
+};
+
+/* consはheaderを持たない2 wordの組. cellとは別のpageに置く (alloc.c) */
+struct _Cons {
+    SCM car;
+    SCM cdr;
 };
 
 struct _Cell {
@@ -155,25 +238,73 @@ struct _Cell {
     struct _Header {
         enum SchemeCellType type;
         short gc_flag;
+        unsigned short flag;  /* type specific */
     } header;
 
     /* cell object */
     union {
-        struct _Cons {
-            SCM car;
-            SCM cdr;
-        } cons;
-        struct _Integer {
-            int value;
-        } integer;
+        struct _Cons cons;    /* free cellとpageの管理用 */
+        struct _Bignum {
+            BignumDigit *digits;  /* absolute value, least significant first */
+            int length;
+        } bignum;
+        struct _Flonum {
+            double value;
+        } flonum;
+        struct _Vector {
+            SCM *elements;        /* NULL if length is 0 */
+            int length;
+        } vector;
+        struct _Uvector {
+            void *elements;       /* raw array, not scanned by GC */
+            int length;
+        } uvector;
+        struct _HashTable {
+            SCM *entries;         /* key, value, key, value, ... */
+            int capacity;         /* power of 2 */
+            int count;
+            int deleted;          /* SCM_DELETED keys */
+            unsigned int epoch;   /* scm_gc_move_epoch at last rehash */
+        } hash_table;
+        struct _Hamt {
+            SCM root;             /* hamt node, or () if empty */
+            int count;
+            unsigned int edit;    /* transient: id of nodes it may mutate */
+        } hamt;
+        struct _HamtNode {
+            SCM *entries;         /* key, value, ... (key SCM_UNBOUND: value is a subnode) */
+            unsigned int bitmap;  /* slots present among 32 */
+            int length;           /* entries / 2 */
+            unsigned int edit;    /* id of the transient that created it, or 0 */
+        } hamt_node;
+        struct _RecordType {
+            SCM name;
+            SCM fields;           /* list of field names */
+            int count;
+        } record_type;
+        struct _Record {
+            SCM descriptor;       /* record type */
+            SCM *slots;           /* RECORD_TYPE_COUNT slots, NULL if none */
+        } record;
+        struct _RecordProcedure {
+            SCM descriptor;
+            SCM name;
+            SCM slots;            /* constructor: slot index of each argument */
+        } record_procedure;
         struct _Symbol {
             char *name;
             int length;
+            unsigned int hash;    /* symbol_hash of name */
             SCM value;
         } symbol;
         struct _String {
-            char *value;
-            char length;
+            char *value;          /* NULL while rope */
+            int length;           /* bytes */
+            int count;            /* characters (UTF-8) */
+            union {
+                void *payload;    /* data space block holding value */
+                SCM base;         /* rope: (left . right), symbol view: symbol */
+            } owner;
         } string;
         struct _Primitive {
             enum PrimitiveType type;
@@ -187,16 +318,31 @@ struct _Cell {
         } closure;
         struct _Macro {
             SCM closure;
+            SCM rules;    /* compiled syntax-rules, or () */
         } macro;
         struct _Port {
             FILE *file;
         } port;
+        struct _Continuation {
+            struct StackSegment *segment; /* NULL: escape only */
+            int depth;                    /* escape only       */
+        } continuation;
+        struct _Box {
+            SCM value;
+        } box;
+        struct _CallSite {
+            SCM target;               /* symbol or primitive */
+            SCM callee;               /* first procedure called */
+            unsigned int calls;
+            unsigned char types[2];   /* TYPE_FEEDBACK_* of the operands */
+        } call_site;
     } object;
-};
+} __attribute__((aligned(8)));
 
 /* accessor of cell header */
 #define HEADER_TYPE(obj) (((SCM) (obj))->header.type)
 #define HEADER_GC_FLAG(obj) (((SCM) (obj))->header.gc_flag)
+#define HEADER_FLAG(obj) (((SCM) (obj))->header.flag)
 
 /* accessor of gc header */
 #define GC_MARK(obj)           (HEADER_GC_FLAG(obj) = GC_FLAG_BLACK)
@@ -209,27 +355,181 @@ struct _Cell {
 #define FREE_CELL_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_FREE))
 
 /* accessor of cell object cons */
-#define CONS_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_CONS))
-#define CONS_CAR(obj) (((SCM) (obj))->object.cons.car)
-#define CONS_CDR(obj) (((SCM) (obj))->object.cons.cdr)
+#define CONS_P(obj) SCM_CONS_P(obj)
+#define SCM_TO_CONS(obj) ((struct _Cons *) ((char *) (obj) - SCM_CONS_TAG))
+#define CONS_TO_SCM(cons) ((SCM) ((char *) (cons) + SCM_CONS_TAG))
+#define CONS_CAR(obj) (SCM_TO_CONS(obj)->car)
+#define CONS_CDR(obj) \
+  (CDR_CODED_P(obj) ? CDR_CODED_CDR(obj) : SCM_TO_CONS(obj)->cdr)
 #define CONS_CAR_REF(obj) (&(CONS_CAR(obj)))
-#define CONS_CDR_REF(obj) (&(CONS_CDR(obj)))
-/* #define CONS_CAR_REF(obj) (&(((SCM) (obj))->object.cons.car)) */
-/* #define CONS_CDR_REF(obj) (&(((SCM) (obj))->object.cons.cdr)) */
-
-/* accessor of cell object integer */
-#define INTEGER_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_INTEGER))
-#define INTEGER_VALUE(obj) (((SCM) (obj))->object.integer.value)
+#define CONS_CDR_REF(obj) \
+  (CDR_CODED_P(obj) ? cdr_coded_cdr_ref(obj) : &(SCM_TO_CONS(obj)->cdr))
+/* CDRは値だけ. 書き換えはSET_CDRで (CDR-coded listを分けることがある) */
+#define CONS_SET_CDR(obj, value) (*CONS_CDR_REF(obj) = (value))
+
+/* CDR-coded list: 要素を連続したwordに並べたlist (alloc.c).
+ * consと同じtagで要素のwordを指し、CARはconsと同じ場所にある。
+ * CDRは次のwordを指すか、最後の要素なら次のwordの値 (consのcdrと同じ場所)
+ *
+ * CDRごとに範囲の比較が入るので、-DSCHEME_CDR_CODINGの時だけ使う。
+ * 領域は決まったaddressに予約し、比較を定数で済ませる */
+#define CDR_CODED_SPACE_START ((uintptr_t) 0x200000000000ULL)
+#define CDR_CODED_SPACE_SIZE ((uintptr_t) 128 * 1024 * 1024)
+/* 次のwordがcdrの要素のbitmap. 領域の直後に置く */
+#define CDR_CODED_NEXT_BITMAP ((uint64_t *) (CDR_CODED_SPACE_START + CDR_CODED_SPACE_SIZE))
+#define CDR_CODED_WORD_INDEX(obj) ((AS_UINT(obj) - CDR_CODED_SPACE_START) / sizeof(SCM))
+#define CDR_CODED_NEXT_P(obj) \
+  ((CDR_CODED_NEXT_BITMAP[CDR_CODED_WORD_INDEX(obj) / 64] >> (CDR_CODED_WORD_INDEX(obj) % 64)) & 1)
+#define CDR_CODED_CDR(obj) \
+  (CDR_CODED_NEXT_P(obj) ? AS_SCM(AS_UINT(obj) + sizeof(SCM)) : cdr_coded_cdr(obj))
+#ifdef SCHEME_CDR_CODING
+#define CDR_CODED_P(obj) (AS_UINT(obj) - CDR_CODED_SPACE_START < CDR_CODED_SPACE_SIZE)
+#else
+#define CDR_CODED_P(obj) FALSE
+#endif
+/* (lambda . <params and body>) の後半のconsに付ける印.
+ * 環境が捕まらないのでenv stackに取ってよい (optimize.c).
+ * consにはheaderが無いのでcons pageのbitmapに持つ */
+#define LAMBDA_STACK_FRAME_P(obj) cons_flag_p(obj)
+#define LAMBDA_STACK_FRAME_SET(obj) cons_set_flag(obj)
+
+/* accessor of cell object bignum: an integer out of the fixnum range */
+#define BIGNUM_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_BIGNUM))
+#define BIGNUM_DIGITS(obj) (((SCM) (obj))->object.bignum.digits)
+#define BIGNUM_LENGTH(obj) (((SCM) (obj))->object.bignum.length)
+/* header flag of bignum */
+#define BIGNUM_FLAG_NEGATIVE 1
+#define BIGNUM_NEGATIVE_P(obj) (HEADER_FLAG(obj) & BIGNUM_FLAG_NEGATIVE)
+
+/* exact integer: fixnum or bignum */
+#define INTEGER_P(obj) (FIXNUM_P(obj) || BIGNUM_P(obj))
+
+/* accessor of flonum: immediate or cell object */
+#define HEAP_FLONUM_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_FLONUM))
+#define FLONUM_P(obj) (IMMEDIATE_FLONUM_P(obj) || HEAP_FLONUM_P(obj))
+#define HEAP_FLONUM_VALUE(obj) (((SCM) (obj))->object.flonum.value)
+#define FLONUM_VALUE(obj)                                                    \
+  (IMMEDIATE_FLONUM_P(obj) ?                                                 \
+   ((union FlonumBits) { .bits = IMMEDIATE_FLONUM_BITS(obj) }).value :      \
+   HEAP_FLONUM_VALUE(obj))
+
+#define NUMBER_P(obj) (INTEGER_P(obj) || FLONUM_P(obj))
+
+/* accessor of cell object vector */
+#define VECTOR_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_VECTOR))
+#define VECTOR_ELEMENTS(obj) (((SCM) (obj))->object.vector.elements)
+#define VECTOR_LENGTH(obj)   (((SCM) (obj))->object.vector.length)
+#define VECTOR_REF(obj, i)   (VECTOR_ELEMENTS(obj)[(i)])
+
+/* accessor of cell object uvector: u8vector, s32vector, s64vector, f64vector.
+ * the element type is kept in the header flag */
+#define UVECTOR_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_UVECTOR))
+#define UVECTOR_TYPE(obj)     ((enum UvectorType) HEADER_FLAG(obj))
+#define UVECTOR_ELEMENTS(obj) (((SCM) (obj))->object.uvector.elements)
+#define UVECTOR_LENGTH(obj)   (((SCM) (obj))->object.uvector.length)
+#define UVECTOR_U8(obj)  ((uint8_t *) UVECTOR_ELEMENTS(obj))
+#define UVECTOR_S32(obj) ((int32_t *) UVECTOR_ELEMENTS(obj))
+#define UVECTOR_S64(obj) ((int64_t *) UVECTOR_ELEMENTS(obj))
+#define UVECTOR_F64(obj) ((double *)  UVECTOR_ELEMENTS(obj))
+#define UVECTOR_ELEMENT_SIZE(type) \
+  ((type) == UVECTOR_U8 ? 1 : (type) == UVECTOR_S32 ? 4 : 8)
+
+/* accessor of cell object hash table. 開番地法で、空きのkeyはSCM_UNBOUND */
+#define HASH_TABLE_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_HASH_TABLE))
+#define HASH_TABLE_ENTRIES(obj)  (((SCM) (obj))->object.hash_table.entries)
+#define HASH_TABLE_CAPACITY(obj) (((SCM) (obj))->object.hash_table.capacity)
+#define HASH_TABLE_COUNT(obj)    (((SCM) (obj))->object.hash_table.count)
+#define HASH_TABLE_DELETED(obj)  (((SCM) (obj))->object.hash_table.deleted)
+#define HASH_TABLE_EPOCH(obj)    (((SCM) (obj))->object.hash_table.epoch)
+#define HASH_TABLE_KEY(obj, i)   (HASH_TABLE_ENTRIES(obj)[(i) * 2])
+#define HASH_TABLE_VALUE(obj, i) (HASH_TABLE_ENTRIES(obj)[(i) * 2 + 1])
+#define HASH_TABLE_FLAG_ADDRESS 4   /* addressでhashしたkeyがある */
+#define HASH_TABLE_KIND(obj) ((enum HashTableKind) (HEADER_FLAG(obj) & 3))
+
+/* accessor of cell object hamt: persistent map and set (hamt.c) */
+#define HAMT_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_HAMT))
+#define HAMT_ROOT(obj)  (((SCM) (obj))->object.hamt.root)
+#define HAMT_COUNT(obj) (((SCM) (obj))->object.hamt.count)
+#define HAMT_EDIT(obj)  (((SCM) (obj))->object.hamt.edit)
+#define HAMT_FLAG_SET       1
+#define HAMT_FLAG_TRANSIENT 2
+#define HAMT_SET_P(obj)       (HEADER_FLAG(obj) & HAMT_FLAG_SET)
+#define HAMT_TRANSIENT_P(obj) (HEADER_FLAG(obj) & HAMT_FLAG_TRANSIENT)
+
+#define HAMT_NODE_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_HAMT_NODE))
+#define HAMT_NODE_ENTRIES(obj) (((SCM) (obj))->object.hamt_node.entries)
+#define HAMT_NODE_BITMAP(obj)  (((SCM) (obj))->object.hamt_node.bitmap)
+#define HAMT_NODE_LENGTH(obj)  (((SCM) (obj))->object.hamt_node.length)
+#define HAMT_NODE_EDIT(obj)    (((SCM) (obj))->object.hamt_node.edit)
+#define HAMT_NODE_FLAG_COLLISION 1  /* hashが全て同じkeyを並べただけのnode */
+#define HAMT_NODE_COLLISION_P(obj) (HEADER_FLAG(obj) & HAMT_NODE_FLAG_COLLISION)
+
+/* accessor of cell object record (define-record-type, record.c) */
+#define RECORD_TYPE_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_RECORD_TYPE))
+#define RECORD_TYPE_NAME(obj)   (((SCM) (obj))->object.record_type.name)
+#define RECORD_TYPE_FIELDS(obj) (((SCM) (obj))->object.record_type.fields)
+#define RECORD_TYPE_COUNT(obj)  (((SCM) (obj))->object.record_type.count)
+
+#define RECORD_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_RECORD))
+#define RECORD_DESCRIPTOR(obj) (((SCM) (obj))->object.record.descriptor)
+#define RECORD_SLOTS(obj)      (((SCM) (obj))->object.record.slots)
+#define RECORD_REF(obj, i)     (RECORD_SLOTS(obj)[(i)])
+#define RECORD_INSTANCE_P(obj, type) (RECORD_P(obj) && EQ_P(RECORD_DESCRIPTOR(obj), (type)))
+
+/* constructor, predicate, accessor, modifier. 種類とslotの位置はflagに持つ */
+enum RecordProcedureKind {
+    RECORD_CONSTRUCTOR,
+    RECORD_PREDICATE,
+    RECORD_ACCESSOR,
+    RECORD_MODIFIER,
+};
+#define RECORD_PROCEDURE_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_RECORD_PROCEDURE))
+#define RECORD_PROCEDURE_DESCRIPTOR(obj) (((SCM) (obj))->object.record_procedure.descriptor)
+#define RECORD_PROCEDURE_NAME(obj)       (((SCM) (obj))->object.record_procedure.name)
+#define RECORD_PROCEDURE_SLOTS(obj)      (((SCM) (obj))->object.record_procedure.slots)
+#define RECORD_PROCEDURE_KIND(obj)  ((enum RecordProcedureKind) (HEADER_FLAG(obj) & 3))
+#define RECORD_PROCEDURE_INDEX(obj) (HEADER_FLAG(obj) >> 2)
+#define RECORD_MAX_FIELDS (0xFFFF >> 2)
 
 /* accessor of cell object symbol */
 #define SYMBOL_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_SYMBOL))
 #define SYMBOL_NAME(obj)  (((SCM) (obj))->object.symbol.name)
+#define SYMBOL_LENGTH(obj) (((SCM) (obj))->object.symbol.length)
+#define SYMBOL_HASH(obj)  (((SCM) (obj))->object.symbol.hash)
 #define SYMBOL_VCELL(obj) (((SCM) (obj))->object.symbol.value)
 
-/* accessor of cell object string */
+/* accessor of cell object string.
+ * 中身はUTF-8のbyte列で、NULを含んでもよい. 種類はheaderのflagで表す
+ *   flat   : valueはpayloadの先頭. 末尾にNULを置く
+ *   rope   : string-appendの結果. 初めて中身が要る時にflatにする.
+ *            葉は引数と同じ中身を指す別のcellで、引数を書き換えても変わらない
+ *   view   : substringの結果. 元のpayloadの途中を指す (NUL終端ではない)
+ *   symbol : symbol->stringの結果. symbolの名前をそのまま指す
+ * 他の文字列から中身を参照されたらSHAREDを立て、書き換える前に写す
+ */
 #define STRING_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_STRING))
-#define STRING_VALUE(obj)  (((SCM) (obj))->object.string.value)
-#define STRING_LENGTH(obj) (((SCM) (obj))->object.string.length)
+#define STRING_VALUE(obj)   (((SCM) (obj))->object.string.value)
+#define STRING_LENGTH(obj)  (((SCM) (obj))->object.string.length)
+#define STRING_COUNT(obj)   (((SCM) (obj))->object.string.count)
+#define STRING_PAYLOAD(obj) (((SCM) (obj))->object.string.owner.payload)
+#define STRING_BASE(obj)    (((SCM) (obj))->object.string.owner.base)
+
+#define STRING_FLAG_ROPE   1
+#define STRING_FLAG_VIEW   2
+#define STRING_FLAG_SYMBOL 4
+#define STRING_FLAG_SHARED 8
+#define STRING_FLAG_DEPTH_SHIFT 4   /* ropeの深さ */
+#define STRING_ROPE_P(obj)   (HEADER_FLAG(obj) & STRING_FLAG_ROPE)
+#define STRING_VIEW_P(obj)   (HEADER_FLAG(obj) & STRING_FLAG_VIEW)
+#define STRING_SYMBOL_P(obj) (HEADER_FLAG(obj) & STRING_FLAG_SYMBOL)
+#define STRING_DEPTH(obj)    (HEADER_FLAG(obj) >> STRING_FLAG_DEPTH_SHIFT)
+#define STRING_ASCII_P(obj)  (STRING_COUNT(obj) == STRING_LENGTH(obj))
+
+/* character: 下位8bitが0xFFの定数. 上位にUnicodeのcode pointを置く */
+#define MAKE_CHAR(c)   MAKE_SCM_CONSTANT(((((uintptr_t) (c)) << 6) | 0x3F))
+#define CHAR_P(o)      ((AS_UINT(o) & 0xFF) == 0xFF)
+#define CHAR_VALUE(o)  ((int) (AS_UINT(o) >> 8))
+#define CHAR_MAX_VALUE 0x10FFFF
 
 /* accessor of cell object primitive*/
 #define PRIMITIVE_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_PRIMITIVE))
@@ -245,21 +545,89 @@ struct _Cell {
 #define PRIMITIVE_TYPE_EXPR_3_P(obj) (PRIMITIVE_TYPE(obj) == PRIMITIVE_TYPE_EXPR_3)
 #define PRIMITIVE_TYPE_EXPR_4_P(obj) (PRIMITIVE_TYPE(obj) == PRIMITIVE_TYPE_EXPR_4)
 #define PRIMITIVE_TYPE_EXPR_5_P(obj) (PRIMITIVE_TYPE(obj) == PRIMITIVE_TYPE_EXPR_5)
+#define PRIMITIVE_TYPE_CONTROL_P(obj) (PRIMITIVE_TYPE(obj) == PRIMITIVE_TYPE_CONTROL)
+/* header flag of list_expr primitive: the argument list is not kept after the call */
+#define PRIMITIVE_FLAG_TRANSIENT 1
+/* header flag of a specialised primitive the optimizer puts at a call site.
+ * it is printed by its name in code */
+#define PRIMITIVE_FLAG_SPECIALIZED 2
+/* the argument list may be built on the env stack and popped after the call */
+#define PRIMITIVE_TRANSIENT_ARGUMENTS_P(obj)                                    \
+  (PRIMITIVE_P(obj) &&                                                         \
+   ((PRIMITIVE_TYPE(obj) >= PRIMITIVE_TYPE_EXPR_0 &&                           \
+     PRIMITIVE_TYPE(obj) <= PRIMITIVE_TYPE_EXPR_5) ||                          \
+    (HEADER_FLAG(obj) & PRIMITIVE_FLAG_TRANSIENT)))
 
 /* accessor of cell object closure */
 #define CLOSURE_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_CLOSURE))
 #define CLOSURE_ARGS(obj) (((SCM) (obj))->object.closure.args)
 #define CLOSURE_BODY(obj) (((SCM) (obj))->object.closure.body)
 #define CLOSURE_ENV(obj)  (((SCM) (obj))->object.closure.env)
+/* header flag of closure: | required (14 bits) | rest | stack frame | */
+#define CLOSURE_FLAG_STACK_FRAME 1
+#define CLOSURE_FLAG_REST        2
+#define CLOSURE_ARITY_MAX 0x3FFF
+#define CLOSURE_FLAGS(required, rest, stack_frame)                       \
+  (((required) << 2) | ((rest) ? CLOSURE_FLAG_REST : 0) |               \
+   ((stack_frame) ? CLOSURE_FLAG_STACK_FRAME : 0))
+/* environment is allocated on the env stack (no inner lambda captures it) */
+#define CLOSURE_STACK_FRAME_P(obj) \
+  (CLOSURE_P(obj) && (HEADER_FLAG(obj) & CLOSURE_FLAG_STACK_FRAME))
+/* arity computed by new_closure. lambda lists have no optional parameters */
+#define CLOSURE_REQUIRED(obj) (HEADER_FLAG(obj) >> 2)
+#define CLOSURE_REST_P(obj)   (HEADER_FLAG(obj) & CLOSURE_FLAG_REST)
 
 /* accessor of cell object macro */
 #define MACRO_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_MACRO))
 #define MACRO_CLOSURE(obj)  (((SCM) (obj))->object.macro.closure)
+#define MACRO_RULES(obj)    (((SCM) (obj))->object.macro.rules)
 
 /* accessor of cell object port */
 #define PORT_P(obj)  (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_PORT))
 #define PORT_FILE(obj)  (((SCM) (obj))->object.port.file)
 
+/* accessor of cell object continuation */
+#define CONTINUATION_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_CONTINUATION))
+#define CONTINUATION_SEGMENT(obj) (((SCM) (obj))->object.continuation.segment)
+#define CONTINUATION_DEPTH(obj)   (((SCM) (obj))->object.continuation.depth)
+#define CONTINUATION_ESCAPE_P(obj) (CONTINUATION_SEGMENT(obj) == NULL)
+
+/* accessor of cell object box: a captured variable that is assigned */
+#define BOX_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_BOX))
+#define BOX_VALUE(obj) (((SCM) (obj))->object.box.value)
+
+/* accessor of cell object call site: the head of a combination the optimizer
+ * profiles. evaluated as the target (a global symbol or a primitive) */
+#define CALL_SITE_P(obj) (SCM_POINTER_P(obj) && (HEADER_TYPE(obj) == CELL_TYPE_CALL_SITE))
+#define CALL_SITE_TARGET(obj) (((SCM) (obj))->object.call_site.target)
+#define CALL_SITE_CALLEE(obj) (((SCM) (obj))->object.call_site.callee)
+#define CALL_SITE_CALLS(obj)  (((SCM) (obj))->object.call_site.calls)
+#define CALL_SITE_TYPES(obj)  (((SCM) (obj))->object.call_site.types)
+/* header flag of call site */
+#define CALL_SITE_FLAG_POLYMORPHIC 1   /* more than one procedure was called */
+#define CALL_SITE_FLAG_DEOPTIMIZED 2   /* specialised primitive was given up */
+
+/* type feedback: classes of values seen at a call site */
+#define TYPE_FEEDBACK_FIXNUM 1
+#define TYPE_FEEDBACK_BIGNUM 2
+#define TYPE_FEEDBACK_FLONUM 4
+#define TYPE_FEEDBACK_OTHER  8
+#define TYPE_FEEDBACK_CLASS(obj)                                        \
+  (FIXNUM_P(obj) ? TYPE_FEEDBACK_FIXNUM :                               \
+   BIGNUM_P(obj) ? TYPE_FEEDBACK_BIGNUM :                               \
+   FLONUM_P(obj) ? TYPE_FEEDBACK_FLONUM : TYPE_FEEDBACK_OTHER)
+/* evaluatorからの記録. 初めて見る手続きや型の時だけoptimize.cに回す */
+#define CALL_SITE_RECORD_CALLEE(site, callee) do {                      \
+        CALL_SITE_CALLS(site)++;                                        \
+        if (! EQ_P(CALL_SITE_CALLEE(site), (callee)))                   \
+            call_site_record_callee((site), (callee));                  \
+    } while (0)
+#define CALL_SITE_RECORD_OPERANDS(site, x, y) do {                      \
+        if ((TYPE_FEEDBACK_CLASS(x) & ~CALL_SITE_TYPES(site)[0]) |      \
+            (TYPE_FEEDBACK_CLASS(y) & ~CALL_SITE_TYPES(site)[1]))       \
+            call_site_record_operands((site), (x), (y));                \
+    } while (0)
+
 /*==================================================
   Scheme Global Object 
 ==================================================*/
@@ -289,12 +657,99 @@ enum ApplyStatus {
  */
 enum EvalStatus {
     EVAL_STATUS_NEED_EVAL,
+    EVAL_STATUS_NEED_APPLY,   /* control primitive: apply subr to args */
     EVAL_STATUS_RETURN_VALUE
 };
 
 struct EvalState {
     SCM env;
     enum EvalStatus status;
+    SCM subr;
+    SCM args;
+};
+
+/*==================================================
+  Control Stack
+==================================================*/
+/* evalの継続はCのスタックではなくcontrol stackのframeに積む。
+ *
+ * control stack is a list of segments.
+ *
+ *   current segment        previous segment
+ *  +-----------------+    +-----------------+
+ *  | frame | frame | |--->| frame | frame |.|---> NULL
+ *  +-----------------+    +-----------------+
+ *            ^ used
+ *
+ * env, a, b, c and form of a frame are SCM objects and marked by the GC.
+ *
+ * call/cc seals the segments and shares them with the continuation.
+ * A sealed segment is never written; returning into it copies it
+ * (only that segment) into a new current segment.
+ */
+enum FrameType {
+    FRAME_TYPE_BASE,       /* bottom of eval() called from C.
+                              a: activation id, b: #t at toplevel    */
+    FRAME_TYPE_OPERATOR,   /* a: combination                          */
+    FRAME_TYPE_OPERAND,    /* a: subr, b: evaluated args (reversed),
+                              c: rest operands, form: combination     */
+    FRAME_TYPE_SEQUENCE,   /* a: rest body                            */
+    FRAME_TYPE_SETQ,       /* a: variable                             */
+    FRAME_TYPE_COND,       /* a: clauses                              */
+    FRAME_TYPE_COND_ARROW, /* a: value of test                        */
+    FRAME_TYPE_IF,         /* a: (consequent alternative)             */
+    FRAME_TYPE_AND,        /* a: rest operands                        */
+    FRAME_TYPE_OR,         /* a: rest operands                        */
+    FRAME_TYPE_MAP,        /* a: procedure, b: results (reversed),
+                              c: rest argument lists                  */
+    FRAME_TYPE_ESCAPE,     /* a: escape continuation (call/ec),
+                              c: env stack mark                       */
+    FRAME_TYPE_RELEASE,    /* a: env stack mark to pop on return      */
+};
+
+struct Frame {
+    enum FrameType type;
+    SCM env;
+    SCM a;
+    SCM b;
+    SCM c;
+    SCM form;       /* 適用中のform. errorの表示に使う */
+};
+
+#define CONTROL_STACK_SEGMENT_SIZE 256
+
+struct StackSegment {
+    struct StackSegment *previous;
+    int base;       /* number of frames below this segment  */
+    int used;
+    int sealed;     /* shared with continuations            */
+    int reference;  /* newer segments, continuations, stack */
+    int gc_count;   /* last GC which marked this segment     */
+    struct Frame frames[CONTROL_STACK_SEGMENT_SIZE];
+};
+
+/* C level entry of the evaluator. FRAME_TYPE_BASE holds its id. */
+enum ActivationResume {
+    ACTIVATION_RESUME_START,
+    ACTIVATION_RESUME_RETURN,   /* return value from execute */
+    ACTIVATION_RESUME_CONTINUE  /* pass value to the top frame */
+};
+
+struct Activation {
+    struct Activation *owner;
+    jmp_buf jmp;
+    int id;
+    int base;       /* stack depth at entry */
+    SCM value;
+};
+#define ACTIVATION_ID_TO_SCM(id) MAKE_SCM_CONSTANT(id)
+#define SCM_TO_ACTIVATION_ID(o)  ((int) (AS_UINT(o) >> 2))
+
+/* saved stack position for error recovery */
+struct ControlStackMark {
+    int depth;
+    int env_stack_top;
+    struct Activation *activation;
 };
 
 /*==================================================
@@ -302,19 +757,24 @@ struct EvalState {
 ==================================================*/
 #define EXTERN_PRIMITIVE(_scheme_name, _c_name, _c_args, _type) \
   extern struct _Cell CPP_CONCAT(Scheme_data_p_, _c_name);      \
-  SCM CPP_CONCAT(Scheme_p_, _c_name) _c_args
+  SCM CPP_CONCAT(Scheme_, _c_name) _c_args
 
 #define DEFINE_PRIMITIVE(_scheme_name, _c_name, _c_args, _type) \
   struct _Cell CPP_CONCAT(Scheme_data_p_, _c_name);             \
   SCM CPP_CONCAT(Scheme_, _c_name) _c_args
 
-#define ADD_PRIMITIVE(_scheme_name, _c_name, _c_args, _type)                                  \
+#define INITIALIZE_PRIMITIVE(_scheme_name, _c_name, _c_args, _type)                           \
   do {                                                                                      \
     HEADER_TYPE(&CPP_CONCAT(Scheme_data_p_, _c_name)) = CELL_TYPE_PRIMITIVE;                  \
     HEADER_GC_FLAG(&CPP_CONCAT(Scheme_data_p_, _c_name)) = 0;                                 \
     PRIMITIVE_TYPE(&CPP_CONCAT(Scheme_data_p_, _c_name)) = CPP_CONCAT(PRIMITIVE_TYPE_, _type); \
     PRIMITIVE_NAME(&CPP_CONCAT(Scheme_data_p_, _c_name)) = _scheme_name;                        \
     PRIMITIVE_PROC(&CPP_CONCAT(Scheme_data_p_, _c_name)) = CPP_CONCAT(Scheme_, _c_name);        \
+  } while (0)
+
+#define ADD_PRIMITIVE(_scheme_name, _c_name, _c_args, _type)                                  \
+  do {                                                                                      \
+    INITIALIZE_PRIMITIVE(_scheme_name, _c_name, _c_args, _type);                            \
     SYMBOL_VCELL(intern(_scheme_name)) = &CPP_CONCAT(Scheme_data_p_, _c_name);                  \
   } while (0)
 
@@ -329,6 +789,7 @@ struct EvalState {
 /* short cut accessor of cell cons*/
 #define CAR CONS_CAR
 #define CDR CONS_CDR
+#define SET_CDR CONS_SET_CDR
 #define CAR_REF CONS_CAR_REF
 #define CDR_REF CONS_CDR_REF
 
@@ -377,11 +838,24 @@ struct EvalState {
 EXTERN_PRIMITIVE("quote",  quote,  (SCM sexp, struct EvalState *state), SPECIAL_FORM);
 EXTERN_PRIMITIVE("set!",   setq,   (SCM sexp, struct EvalState *state), SPECIAL_FORM);
 
-EXTERN_PRIMITIVE("if",     if,   (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+EXTERN_PRIMITIVE("if",     if,     (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+EXTERN_PRIMITIVE("and",    and,    (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+EXTERN_PRIMITIVE("or",     or,     (SCM sexp, struct EvalState *state), SPECIAL_FORM);
 EXTERN_PRIMITIVE("cond",   cond,   (SCM sexp, struct EvalState *state), SPECIAL_FORM);
 EXTERN_PRIMITIVE("lambda", lambda, (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+EXTERN_PRIMITIVE("lambda", flat_lambda, (SCM sexp, struct EvalState *state), SPECIAL_FORM);
 EXTERN_PRIMITIVE("macro",  macro,  (SCM sexp, struct EvalState *state), SPECIAL_FORM);
 EXTERN_PRIMITIVE("begin",  begin,   (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+EXTERN_PRIMITIVE("define-syntax", define_syntax, (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+EXTERN_PRIMITIVE("let",    let,      (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+EXTERN_PRIMITIVE("let*",   let_star, (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+EXTERN_PRIMITIVE("letrec", letrec,   (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+EXTERN_PRIMITIVE("do",     do,       (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+
+/* operandを全て式として持ち、最初の式だけが必ず評価されるspecial form */
+#define CONDITIONAL_FORM_P(obj) (EQ_P((obj), &Scheme_data_p_if) || \
+                                 EQ_P((obj), &Scheme_data_p_and) || \
+                                 EQ_P((obj), &Scheme_data_p_or))
 
 /* proc */
 EXTERN_PRIMITIVE("exit", exit, (SCM l),              EXPR_1);
@@ -390,30 +864,59 @@ EXTERN_PRIMITIVE("car",  car,  (SCM l),              EXPR_1);
 EXTERN_PRIMITIVE("cdr",  cdr,  (SCM l),              EXPR_1);
 EXTERN_PRIMITIVE("cons", cons, (SCM o1, SCM o2), EXPR_2);
 EXTERN_PRIMITIVE("assq", assq, (SCM o,  SCM l),  EXPR_2);
-EXTERN_PRIMITIVE("map",  map,  (SCM l),              LIST_EXPR);
+EXTERN_PRIMITIVE("map",  map,  (SCM args, struct EvalState *state), CONTROL);
 
 EXTERN_PRIMITIVE("atom?", atom, (SCM o),              EXPR_1);
 EXTERN_PRIMITIVE("eq?",   eq,   (SCM o1, SCM o2), EXPR_2);
+EXTERN_PRIMITIVE("eqv?",   eqv,   (SCM o1, SCM o2), EXPR_2);
+EXTERN_PRIMITIVE("equal?", equal, (SCM o1, SCM o2), EXPR_2);
 
 EXTERN_PRIMITIVE("write",   write,   (SCM o), EXPR_1);
 EXTERN_PRIMITIVE("display", display, (SCM o), EXPR_1);
 EXTERN_PRIMITIVE("newline", newline, (),          EXPR_0);
 
-EXTERN_PRIMITIVE("eval",   eval,   (SCM sexp),              EXPR_1);
-EXTERN_PRIMITIVE("apply",  apply,  (SCM subr, SCM arg), EXPR_2);
+EXTERN_PRIMITIVE("eval",   eval,   (SCM args, struct EvalState *state), CONTROL);
+EXTERN_PRIMITIVE("apply",  apply,  (SCM args, struct EvalState *state), CONTROL);
 EXTERN_PRIMITIVE("load",   load,   (SCM filename),          EXPR_1);
 
+EXTERN_PRIMITIVE("call-with-current-continuation", call_cc, (SCM args, struct EvalState *state), CONTROL);
+EXTERN_PRIMITIVE("call-with-escape-continuation",  call_ec, (SCM args, struct EvalState *state), CONTROL);
+
 EXTERN_PRIMITIVE("intern",         intern,        (SCM string), EXPR_1);
 EXTERN_PRIMITIVE("symbol->string", symbol2string, (SCM symbol), EXPR_1);
 
 EXTERN_PRIMITIVE("set-car!", set_carq, (SCM lvar, SCM rvar), EXPR_2);
 EXTERN_PRIMITIVE("set-cdr!", set_cdrq, (SCM lvar, SCM rvar), EXPR_2);
 
+EXTERN_PRIMITIVE("=",  num_eq,        (SCM l), LIST_EXPR);
 EXTERN_PRIMITIVE("<", less_than, (SCM l), LIST_EXPR);
+EXTERN_PRIMITIVE("<=", less_equal,    (SCM l), LIST_EXPR);
+EXTERN_PRIMITIVE(">",  greater_than,  (SCM l), LIST_EXPR);
+EXTERN_PRIMITIVE(">=", greater_equal, (SCM l), LIST_EXPR);
 EXTERN_PRIMITIVE("+", num_plus,  (SCM l), LIST_EXPR);
 EXTERN_PRIMITIVE("-", num_minus, (SCM l), LIST_EXPR);
 EXTERN_PRIMITIVE("*", num_mul,   (SCM l), LIST_EXPR);
 EXTERN_PRIMITIVE("/", num_div,   (SCM l), LIST_EXPR);
+/* binary versions put at call sites by the optimizer (not bound to symbols) */
+EXTERN_PRIMITIVE("+",  fx_plus,          (SCM x, SCM y), EXPR_2);
+EXTERN_PRIMITIVE("-",  fx_minus,         (SCM x, SCM y), EXPR_2);
+EXTERN_PRIMITIVE("*",  fx_mul,           (SCM x, SCM y), EXPR_2);
+EXTERN_PRIMITIVE("=",  fx_eq,            (SCM x, SCM y), EXPR_2);
+EXTERN_PRIMITIVE("<",  fx_less_than,     (SCM x, SCM y), EXPR_2);
+EXTERN_PRIMITIVE("<=", fx_less_equal,    (SCM x, SCM y), EXPR_2);
+EXTERN_PRIMITIVE(">",  fx_greater_than,  (SCM x, SCM y), EXPR_2);
+EXTERN_PRIMITIVE(">=", fx_greater_equal, (SCM x, SCM y), EXPR_2);
+EXTERN_PRIMITIVE("+",  fl_plus,          (SCM x, SCM y), EXPR_2);
+EXTERN_PRIMITIVE("-",  fl_minus,         (SCM x, SCM y), EXPR_2);
+EXTERN_PRIMITIVE("*",  fl_mul,           (SCM x, SCM y), EXPR_2);
+EXTERN_PRIMITIVE("=",  fl_eq,            (SCM x, SCM y), EXPR_2);
+EXTERN_PRIMITIVE("<",  fl_less_than,     (SCM x, SCM y), EXPR_2);
+EXTERN_PRIMITIVE("<=", fl_less_equal,    (SCM x, SCM y), EXPR_2);
+EXTERN_PRIMITIVE(">",  fl_greater_than,  (SCM x, SCM y), EXPR_2);
+EXTERN_PRIMITIVE(">=", fl_greater_equal, (SCM x, SCM y), EXPR_2);
+
+/* optimize.c */
+EXTERN_PRIMITIVE("type-feedback", type_feedback, (), EXPR_0);
 
 
 /*======================================================================
@@ -436,21 +939,108 @@ void stack_initialize(void *start);
 void *xmalloc(size_t size);
 void *xrealloc(void *ptr, size_t size);
 #define SCHEME_MALLOC(size) xmalloc((size))
+void *data_allocate(size_t size);
 void allocator_initialize(void);
 void allocator_finalize(void);
 void scm_gc_protect(SCM obj);
+void scm_gc_register_roots(SCM *start, int count);
+void scm_gc_mark(SCM obj);
+int scm_gc_marked_p(SCM obj);
+void scm_gc_register_weak_hook(void (*hook)(void));
+int scm_gc_count(void);
+unsigned int scm_gc_move_epoch(void);
 SCM new_cons(SCM car, SCM cdr);
-SCM new_integer(int i);
+int cons_flag_p(SCM cons);
+void cons_set_flag(SCM cons);
+SCM cdr_coded_cdr(SCM obj);
+SCM *cdr_coded_cdr_ref(SCM obj);
+SCM list_to_cdr_coded(SCM lst);
+SCM cdr_coded_reverse(SCM lst);
+SCM new_bignum(BignumDigit *digits, int length, int negative);
+SCM new_heap_flonum(double value);
+SCM new_vector(int length, SCM fill);
+SCM new_uvector(enum UvectorType type, int length);
+SCM new_hash_table(enum HashTableKind kind, int capacity);
+SCM new_hamt(int flag, SCM root, int count, unsigned int edit);
+SCM new_hamt_node(int flag, unsigned int bitmap, int length, unsigned int edit);
+SCM new_record_type(SCM name, SCM fields, int count);
+SCM new_record(SCM descriptor);
+SCM new_record_procedure(enum RecordProcedureKind kind, SCM descriptor, SCM name, int index, SCM slots);
 SCM new_symbol(char *pname, SCM value);
+SCM new_symbol_bytes(char *name, int length, SCM value);
 SCM new_string(char *string);
+SCM new_string_bytes(char *bytes, int length, int count);
+SCM new_rope_string(SCM left, SCM right, int depth);
+SCM new_string_view(char *value, int length, int count, void *payload);
+SCM new_symbol_string(SCM symbol, int count);
 SCM new_closure(SCM sexp, SCM env);
 SCM new_macro(SCM sexp, SCM env);
+SCM new_continuation(struct StackSegment *segment, int depth);
+SCM new_box(SCM value);
+SCM new_call_site(SCM target);
+
+/*======================================================================
+ * stack.c
+ */
+extern struct StackSegment *_control_stack;
+extern struct Activation *_current_activation;
+#define CONTROL_STACK_TOP() (&_control_stack->frames[_control_stack->used - 1])
+#define CONTROL_STACK_DEPTH() (_control_stack->base + _control_stack->used)
+#define CONTROL_STACK_POP() (_control_stack->used--)
+/* top segment may be empty after pop; refill it before reading the top */
+#define CONTROL_STACK_SETTLE()                                   \
+  do {                                                           \
+    if (_control_stack->used == 0) control_stack_underflow();    \
+  } while (0)
+
+void control_stack_initialize(void);
+void control_stack_finalize(void);
+struct Frame *control_stack_push(enum FrameType type, SCM env, SCM a, SCM b, SCM c);
+void control_stack_underflow(void);
+struct Frame *control_stack_frame(int depth);
+void control_stack_cut(int depth);
+struct StackSegment *control_stack_capture(void);
+void control_stack_reinstate(struct StackSegment *segment);
+void control_stack_release(struct StackSegment *segment);
+void control_stack_save(struct ControlStackMark *mark);
+void control_stack_restore(struct ControlStackMark *mark);
+void control_stack_mark(void);
+void control_stack_mark_segment(struct StackSegment *segment);
+void control_stack_for_each_unsealed(void (*func)(struct Frame *frame));
+
+void activation_enter(struct Activation *activation);
+void activation_leave(struct Activation *activation);
+struct Activation *activation_lookup(int id);
+struct Activation *activation_of_depth(int depth);
+struct Activation *activation_outermost(void);
 
 /*======================================================================
  * env.c
  */
 SCM extend_environment(SCM parameters, SCM arguments, SCM env);
 SCM* lookup_frame(SCM var, SCM frame);
+SCM flat_environment(SCM copied, SCM boxed, SCM env);
+
+/* env stack: environment frames of CLOSURE_STACK_FRAME_P closures */
+#define ENV_STACK_SIZE (64 * 1024)
+extern struct _Cons *_env_stack;
+extern int _env_stack_top;
+#define ENV_STACK_P(obj)                                      \
+  (CONS_P(obj) && SCM_TO_CONS(obj) >= _env_stack &&           \
+   SCM_TO_CONS(obj) < _env_stack + ENV_STACK_SIZE)
+#define ENV_STACK_INDEX(obj) ((int) (SCM_TO_CONS(obj) - _env_stack))
+#define ENV_STACK_CELL(i) CONS_TO_SCM(&_env_stack[i])
+#define ENV_STACK_TOP() (_env_stack_top)
+#define ENV_STACK_RESET(mark) (_env_stack_top = (mark))
+#define ENV_STACK_MARK_TO_SCM(mark) MAKE_SCM_CONSTANT(mark)
+#define SCM_TO_ENV_STACK_MARK(o)    ((int) (AS_UINT(o) >> 2))
+void env_stack_initialize(void);
+void env_stack_finalize(void);
+SCM env_stack_cons(SCM car, SCM cdr);
+SCM env_stack_extend(SCM closure, SCM arguments, int base);
+SCM env_stack_promote(SCM env);
+void env_stack_mark(void);
+
 SCM* lookup_environment(SCM var, SCM env);
 SCM symbol_value(SCM var, SCM env);
 void symbols_of_env_initialize(void);
@@ -461,19 +1051,184 @@ void dump_environment(SCM env);
  * read.c
  */
 SCM Scheme_read(FILE *file);
+SCM c_string_to_number(char *buf);
 void symbols_of_read_initialize(void);
 
 /*======================================================================
  * print.c
  */
 SCM print(SCM sexp, FILE *file);
+SCM display(SCM sexp, FILE *file);
 
 /*======================================================================
  * eval.c
  */
 SCM eval(SCM sexp, SCM env);
+SCM apply_procedure(SCM subr, SCM args);
+SCM expand_macro(SCM macro, SCM operands);
+int eqv_p(SCM a, SCM b);
+int equal_p(SCM a, SCM b);
 void symbols_of_eval_initialize(void);
 
+/*======================================================================
+ * expand.c
+ */
+SCM expand(SCM sexp);
+void displace_form(SCM form, SCM expansion);
+
+/*======================================================================
+ * syntax.c
+ */
+extern SCM _scm_symbol_syntax_rules;
+#define SCM_SYMBOL_SYNTAX_RULES (_scm_symbol_syntax_rules)
+SCM compile_syntax_rules(SCM spec);
+SCM syntax_rules_expand(SCM rules, SCM operands);
+SCM derived_syntax_expand(SCM syntax, SCM operands);
+void symbols_of_syntax_initialize(void);
+
+/*======================================================================
+ * optimize.c
+ */
+extern int scm_optimize_debug;
+SCM optimize(SCM sexp);
+void optimize_invalidate(SCM symbol);
+void call_site_record_callee(SCM site, SCM callee);
+void call_site_record_operands(SCM site, SCM x, SCM y);
+void symbols_of_optimize_initialize(void);
+
+/*======================================================================
+ * list.c
+ */
+int list_length(SCM lst);
+SCM list_reverse(SCM lst);
+SCM tree_copy(SCM obj);
+
+/*======================================================================
+ * bignum.c
+ */
+SCM new_integer(intptr_t value);
+SCM integer_add(SCM x, SCM y);
+SCM integer_sub(SCM x, SCM y);
+SCM integer_mul(SCM x, SCM y);
+SCM integer_quotient(SCM x, SCM y);
+int integer_compare(SCM x, SCM y);
+SCM c_string_to_integer(char *str);
+void print_integer(SCM x, FILE *file);
+int integer_to_int64(SCM x, int64_t *value);
+double integer_to_double(SCM x);
+SCM double_to_integer(double value);
+
+/*======================================================================
+ * number.c
+ */
+enum Comparison {
+    COMPARISON_EQ,
+    COMPARISON_LT,
+    COMPARISON_LE,
+    COMPARISON_GT,
+    COMPARISON_GE
+};
+
+SCM new_flonum(double value);
+double number_to_double(SCM x);
+SCM number_add(SCM x, SCM y);
+SCM number_sub(SCM x, SCM y);
+SCM number_negate(SCM x);
+SCM number_mul(SCM x, SCM y);
+SCM number_div(SCM x, SCM y);
+int number_compare(enum Comparison op, SCM x, SCM y);
+void print_flonum(SCM x, FILE *file);
+void print_double(double value, FILE *file);
+
+/*======================================================================
+ * vector.c
+ */
+SCM list_to_vector(SCM lst);
+void print_vector(SCM vector, FILE *file);
+void symbols_of_vector_initialize(void);
+
+/*======================================================================
+ * uvector.c
+ */
+int uvector_tag_type(char *tag);
+SCM list_to_uvector(enum UvectorType type, SCM lst);
+void print_uvector(SCM uvector, FILE *file);
+void symbols_of_uvector_initialize(void);
+
+/*======================================================================
+ * string.c
+ */
+#define UTF8_CONTINUATION_P(b) ((((unsigned char) (b)) & 0xC0) == 0x80)
+
+int utf8_count(char *bytes, int length);
+int utf8_encode(int c, char *buf);
+int utf8_decode(char *p, char *end, int *c);
+char *string_bytes(SCM string);
+SCM string_to_symbol(SCM string);
+SCM symbol_to_string(SCM symbol);
+int string_equal_p(SCM a, SCM b);
+unsigned int string_hash(SCM string);
+int char_name_value(char *name);
+void print_string(SCM string, FILE *file);
+void print_char(SCM c, FILE *file);
+void display_string(SCM string, FILE *file);
+void symbols_of_string_initialize(void);
+EXTERN_PRIMITIVE("string=?", string_eq, (SCM a, SCM b), EXPR_2);
+
+/*======================================================================
+ * hashtable.c
+ */
+uintptr_t equal_hash(SCM obj);
+void print_hash_table(SCM table, FILE *file);
+void symbols_of_hashtable_initialize(void);
+
+/*======================================================================
+ * hamt.c
+ */
+void print_hamt(SCM hamt, FILE *file);
+void symbols_of_hamt_initialize(void);
+
+/*======================================================================
+ * record.c
+ */
+void record_type_error(SCM name, SCM descriptor);
+SCM record_apply(SCM proc, SCM args);
+void print_record(SCM obj, FILE *file);
+void symbols_of_record_initialize(void);
+EXTERN_PRIMITIVE("define-record-type", define_record_type, (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+
+/*======================================================================
+ * simd.c
+ */
+enum SimdLevel {
+    SIMD_NONE,
+    SIMD_SSE2,
+    SIMD_AVX2
+};
+
+void simd_initialize(void);
+const char *simd_level_name(void);
+void simd_f64_add(double *dst, const double *a, const double *b, int n);
+void simd_f64_mul(double *dst, const double *a, const double *b, int n);
+void simd_s64_add(int64_t *dst, const int64_t *a, const int64_t *b, int n);
+void simd_s64_mul(int64_t *dst, const int64_t *a, const int64_t *b, int n);
+void simd_s32_add(int32_t *dst, const int32_t *a, const int32_t *b, int n);
+void simd_s32_mul(int32_t *dst, const int32_t *a, const int32_t *b, int n);
+void simd_u8_add(uint8_t *dst, const uint8_t *a, const uint8_t *b, int n);
+void simd_u8_mul(uint8_t *dst, const uint8_t *a, const uint8_t *b, int n);
+double simd_f64_sum(const double *a, int n);
+double simd_f64_dot(const double *a, const double *b, int n);
+uint64_t simd_u8_sum(const uint8_t *a, int n);
+int64_t simd_s32_sum(const int32_t *a, int n);
+double simd_f64_min(const double *a, int n);
+double simd_f64_max(const double *a, int n);
+int64_t simd_s64_min(const int64_t *a, int n);
+int64_t simd_s64_max(const int64_t *a, int n);
+int32_t simd_s32_min(const int32_t *a, int n);
+int32_t simd_s32_max(const int32_t *a, int n);
+uint8_t simd_u8_min(const uint8_t *a, int n);
+uint8_t simd_u8_max(const uint8_t *a, int n);
+
 /*======================================================================
  * error.c
  */
@@ -491,10 +1246,35 @@ void set_current_sexp(SCM sexp);
 extern SCM _symbol_table[SYMBOL_TABLE_SIZE];
 #define SYMBOL_TABLE _symbol_table
 
+unsigned int symbol_hash(char *name, int length);
 SCM intern(char *name);
+SCM intern_bytes(char *name, int length);
 void symbol_table_initialize(void);
 void symbols_of_symbol_initialize(void);
 
+/*======================================================================
+ * compile.c
+ */
+/* runtime support of compiled code (scmc = scheme compiled) */
+#define SCMC_MAX_ARGUMENTS 16
+typedef SCM (*scmc_bounce_proc)(SCM *args);
+extern scmc_bounce_proc scmc_bounce;
+extern SCM scmc_bounce_arguments[SCMC_MAX_ARGUMENTS];
+
+SCM scmc_trampoline(SCM result);
+SCM scmc_apply(SCM subr, SCM args);
+SCM scmc_bounce_apply(SCM *a);
+SCM scmc_list(int count, ...);
+SCM scmc_global(SCM symbol);
+void scmc_arguments(SCM args, SCM *vector, int count);
+SCM scmc_read_constant(char *text);
+SCM scmc_new_record(SCM descriptor, SCM name);
+void scmc_define_procedure(struct _Cell *cell, char *name, SCM (*entry)(SCM),
+                           scmc_bounce_proc bounce, int arity);
+
+/* compiler */
+int compile_file(char *input, FILE *out, char *module_name);
+
 
 EXTERN_C_END
 
@@ -0,0 +1,357 @@
+/*===========================================================================
+ * simd.c - vectorised kernels for homogeneous numeric vectors
+ *
+ * $Id$
+===========================================================================*/
+
+#include "scheme.h"
+
+/* uvector.cの一括演算の中身.
+ *
+ * 各演算にscalar版と、あればSSE2版とAVX2版を置き、simd_initializeで
+ * 調べたCPUに合わせて選ぶ。x86-64ならSSE2は必ずある。
+ * 命令がない組み合わせ (SSE2の32bit積, 64bit積など) はscalar版を使う。
+ * -DSCHEME_NO_SIMDでscalar版だけになる。
+ *
+ * 整数の和と積は2の補数で回る。flonumの総和と内積は足す順序が
+ * 変わるので、scalar版とは最後の桁が違うことがある。
+ * nanを含む時のmin/maxは決めない。
+ */
+
+#if defined(__x86_64__) && defined(__GNUC__) && ! defined(SCHEME_NO_SIMD)
+#define SIMD_X86 1
+#include <immintrin.h>
+#define AVX2_TARGET __attribute__((target("avx2")))
+#endif
+
+static enum SimdLevel simd_level = SIMD_NONE;
+
+#if SIMD_X86
+#define SIMD_SELECT(avx2, sse2, scalar)                                 \
+  (simd_level >= SIMD_AVX2 ? (avx2) : simd_level >= SIMD_SSE2 ? (sse2) : (scalar))
+#else
+#define SIMD_SELECT(avx2, sse2, scalar) (scalar)
+#endif
+
+void simd_initialize(void)
+{
+#if SIMD_X86
+    __builtin_cpu_init();
+    simd_level = __builtin_cpu_supports("avx2") ? SIMD_AVX2 : SIMD_SSE2;
+#endif
+}
+
+const char *simd_level_name(void)
+{
+    switch (simd_level) {
+    case SIMD_AVX2: return "avx2";
+    case SIMD_SSE2: return "sse2";
+    case SIMD_NONE: break;
+    }
+    return "none";
+}
+
+/*==================================================
+  Elementwise: dst[i] = a[i] op b[i]
+==================================================*/
+/* dstはaかbと同じでもよい */
+#define SCALAR_ELEMENTWISE(name, type, utype, op)                       \
+static void name(type *dst, const type *a, const type *b, int n)       \
+{                                                                       \
+    int i;                                                              \
+    for (i = 0; i < n; i++)                                             \
+        dst[i] = (type) ((utype) a[i] op (utype) b[i]);                 \
+}
+
+#define SIMD_ELEMENTWISE(name, attr, type, width, load, store, vop, scalar) \
+static attr void name(type *dst, const type *a, const type *b, int n)  \
+{                                                                       \
+    int i;                                                              \
+    for (i = 0; i + (width) <= n; i += (width))                         \
+        store((void *) (dst + i),                                       \
+              vop(load((const void *) (a + i)), load((const void *) (b + i)))); \
+    scalar(dst + i, a + i, b + i, n - i);                               \
+}
+
+SCALAR_ELEMENTWISE(f64_add_scalar, double,  double,   +)
+SCALAR_ELEMENTWISE(f64_mul_scalar, double,  double,   *)
+SCALAR_ELEMENTWISE(s64_add_scalar, int64_t, uint64_t, +)
+SCALAR_ELEMENTWISE(s64_mul_scalar, int64_t, uint64_t, *)
+SCALAR_ELEMENTWISE(s32_add_scalar, int32_t, uint32_t, +)
+SCALAR_ELEMENTWISE(s32_mul_scalar, int32_t, uint32_t, *)
+SCALAR_ELEMENTWISE(u8_add_scalar,  uint8_t, unsigned, +)
+SCALAR_ELEMENTWISE(u8_mul_scalar,  uint8_t, unsigned, *)
+
+#if SIMD_X86
+SIMD_ELEMENTWISE(f64_add_sse2, , double,  2,  _mm_loadu_pd,    _mm_storeu_pd,    _mm_add_pd,    f64_add_scalar)
+SIMD_ELEMENTWISE(f64_mul_sse2, , double,  2,  _mm_loadu_pd,    _mm_storeu_pd,    _mm_mul_pd,    f64_mul_scalar)
+SIMD_ELEMENTWISE(s64_add_sse2, , int64_t, 2,  _mm_loadu_si128, _mm_storeu_si128, _mm_add_epi64, s64_add_scalar)
+SIMD_ELEMENTWISE(s32_add_sse2, , int32_t, 4,  _mm_loadu_si128, _mm_storeu_si128, _mm_add_epi32, s32_add_scalar)
+SIMD_ELEMENTWISE(u8_add_sse2,  , uint8_t, 16, _mm_loadu_si128, _mm_storeu_si128, _mm_add_epi8,  u8_add_scalar)
+
+SIMD_ELEMENTWISE(f64_add_avx2, AVX2_TARGET, double,  4,  _mm256_loadu_pd,    _mm256_storeu_pd,    _mm256_add_pd,      f64_add_scalar)
+SIMD_ELEMENTWISE(f64_mul_avx2, AVX2_TARGET, double,  4,  _mm256_loadu_pd,    _mm256_storeu_pd,    _mm256_mul_pd,      f64_mul_scalar)
+SIMD_ELEMENTWISE(s64_add_avx2, AVX2_TARGET, int64_t, 4,  _mm256_loadu_si256, _mm256_storeu_si256, _mm256_add_epi64,   s64_add_scalar)
+SIMD_ELEMENTWISE(s32_add_avx2, AVX2_TARGET, int32_t, 8,  _mm256_loadu_si256, _mm256_storeu_si256, _mm256_add_epi32,   s32_add_scalar)
+SIMD_ELEMENTWISE(s32_mul_avx2, AVX2_TARGET, int32_t, 8,  _mm256_loadu_si256, _mm256_storeu_si256, _mm256_mullo_epi32, s32_mul_scalar)
+SIMD_ELEMENTWISE(u8_add_avx2,  AVX2_TARGET, uint8_t, 32, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_add_epi8,    u8_add_scalar)
+#endif
+
+void simd_f64_add(double *dst, const double *a, const double *b, int n)
+{
+    SIMD_SELECT(f64_add_avx2, f64_add_sse2, f64_add_scalar)(dst, a, b, n);
+}
+void simd_f64_mul(double *dst, const double *a, const double *b, int n)
+{
+    SIMD_SELECT(f64_mul_avx2, f64_mul_sse2, f64_mul_scalar)(dst, a, b, n);
+}
+void simd_s64_add(int64_t *dst, const int64_t *a, const int64_t *b, int n)
+{
+    SIMD_SELECT(s64_add_avx2, s64_add_sse2, s64_add_scalar)(dst, a, b, n);
+}
+void simd_s64_mul(int64_t *dst, const int64_t *a, const int64_t *b, int n)
+{
+    s64_mul_scalar(dst, a, b, n);
+}
+void simd_s32_add(int32_t *dst, const int32_t *a, const int32_t *b, int n)
+{
+    SIMD_SELECT(s32_add_avx2, s32_add_sse2, s32_add_scalar)(dst, a, b, n);
+}
+void simd_s32_mul(int32_t *dst, const int32_t *a, const int32_t *b, int n)
+{
+    SIMD_SELECT(s32_mul_avx2, s32_mul_scalar, s32_mul_scalar)(dst, a, b, n);
+}
+void simd_u8_add(uint8_t *dst, const uint8_t *a, const uint8_t *b, int n)
+{
+    SIMD_SELECT(u8_add_avx2, u8_add_sse2, u8_add_scalar)(dst, a, b, n);
+}
+void simd_u8_mul(uint8_t *dst, const uint8_t *a, const uint8_t *b, int n)
+{
+    u8_mul_scalar(dst, a, b, n);
+}
+
+/*==================================================
+  Sum and Dot Product
+==================================================*/
+static double f64_sum_scalar(const double *a, int n)
+{
+    double sum = 0.0;
+    int i;
+    for (i = 0; i < n; i++)
+        sum += a[i];
+    return sum;
+}
+
+static double f64_dot_scalar(const double *a, const double *b, int n)
+{
+    double sum = 0.0;
+    int i;
+    for (i = 0; i < n; i++)
+        sum += a[i] * b[i];
+    return sum;
+}
+
+static uint64_t u8_sum_scalar(const uint8_t *a, int n)
+{
+    uint64_t sum = 0;
+    int i;
+    for (i = 0; i < n; i++)
+        sum += a[i];
+    return sum;
+}
+
+/* nはintなので64bitで溢れない */
+static int64_t s32_sum_scalar(const int32_t *a, int n)
+{
+    int64_t sum = 0;
+    int i;
+    for (i = 0; i < n; i++)
+        sum += a[i];
+    return sum;
+}
+
+#if SIMD_X86
+static double f64_sum_sse2(const double *a, int n)
+{
+    __m128d acc = _mm_setzero_pd();
+    double lanes[2];
+    int i;
+    for (i = 0; i + 2 <= n; i += 2)
+        acc = _mm_add_pd(acc, _mm_loadu_pd(a + i));
+    _mm_storeu_pd(lanes, acc);
+    return lanes[0] + lanes[1] + f64_sum_scalar(a + i, n - i);
+}
+
+static AVX2_TARGET double f64_sum_avx2(const double *a, int n)
+{
+    __m256d acc = _mm256_setzero_pd();
+    double lanes[4];
+    int i;
+    for (i = 0; i + 4 <= n; i += 4)
+        acc = _mm256_add_pd(acc, _mm256_loadu_pd(a + i));
+    _mm256_storeu_pd(lanes, acc);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + f64_sum_scalar(a + i, n - i);
+}
+
+static double f64_dot_sse2(const double *a, const double *b, int n)
+{
+    __m128d acc = _mm_setzero_pd();
+    double lanes[2];
+    int i;
+    for (i = 0; i + 2 <= n; i += 2)
+        acc = _mm_add_pd(acc, _mm_mul_pd(_mm_loadu_pd(a + i), _mm_loadu_pd(b + i)));
+    _mm_storeu_pd(lanes, acc);
+    return lanes[0] + lanes[1] + f64_dot_scalar(a + i, b + i, n - i);
+}
+
+static AVX2_TARGET double f64_dot_avx2(const double *a, const double *b, int n)
+{
+    __m256d acc = _mm256_setzero_pd();
+    double lanes[4];
+    int i;
+    for (i = 0; i + 4 <= n; i += 4)
+        acc = _mm256_add_pd(acc, _mm256_mul_pd(_mm256_loadu_pd(a + i), _mm256_loadu_pd(b + i)));
+    _mm256_storeu_pd(lanes, acc);
+    return (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]) + f64_dot_scalar(a + i, b + i, n - i);
+}
+
+/* psadbwで16byteずつ0との差の和 (= 和) を取る */
+static uint64_t u8_sum_sse2(const uint8_t *a, int n)
+{
+    __m128i acc = _mm_setzero_si128(), zero = _mm_setzero_si128();
+    uint64_t lanes[2];
+    int i;
+    for (i = 0; i + 16 <= n; i += 16)
+        acc = _mm_add_epi64(acc, _mm_sad_epu8(_mm_loadu_si128((const void *) (a + i)), zero));
+    _mm_storeu_si128((void *) lanes, acc);
+    return lanes[0] + lanes[1] + u8_sum_scalar(a + i, n - i);
+}
+
+static AVX2_TARGET uint64_t u8_sum_avx2(const uint8_t *a, int n)
+{
+    __m256i acc = _mm256_setzero_si256(), zero = _mm256_setzero_si256();
+    uint64_t lanes[4];
+    int i;
+    for (i = 0; i + 32 <= n; i += 32)
+        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(_mm256_loadu_si256((const void *) (a + i)), zero));
+    _mm256_storeu_si256((void *) lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + u8_sum_scalar(a + i, n - i);
+}
+
+/* 64bitに広げてから足す */
+static AVX2_TARGET int64_t s32_sum_avx2(const int32_t *a, int n)
+{
+    __m256i acc = _mm256_setzero_si256();
+    int64_t lanes[4];
+    int i;
+    for (i = 0; i + 4 <= n; i += 4)
+        acc = _mm256_add_epi64(acc, _mm256_cvtepi32_epi64(_mm_loadu_si128((const void *) (a + i))));
+    _mm256_storeu_si256((void *) lanes, acc);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + s32_sum_scalar(a + i, n - i);
+}
+#endif
+
+double simd_f64_sum(const double *a, int n)
+{
+    return SIMD_SELECT(f64_sum_avx2, f64_sum_sse2, f64_sum_scalar)(a, n);
+}
+double simd_f64_dot(const double *a, const double *b, int n)
+{
+    return SIMD_SELECT(f64_dot_avx2, f64_dot_sse2, f64_dot_scalar)(a, b, n);
+}
+uint64_t simd_u8_sum(const uint8_t *a, int n)
+{
+    return SIMD_SELECT(u8_sum_avx2, u8_sum_sse2, u8_sum_scalar)(a, n);
+}
+int64_t simd_s32_sum(const int32_t *a, int n)
+{
+    return SIMD_SELECT(s32_sum_avx2, s32_sum_scalar, s32_sum_scalar)(a, n);
+}
+
+/*==================================================
+  Minimum and Maximum (n > 0)
+==================================================*/
+#define SCALAR_EXTREMUM(name, type, op)                                 \
+static type name(const type *a, int n)                                  \
+{                                                                       \
+    type m = a[0];                                                      \
+    int i;                                                              \
+    for (i = 1; i < n; i++)                                             \
+        if (a[i] op m) m = a[i];                                        \
+    return m;                                                           \
+}
+
+/* 一列分を並べて比べ、残った列と端をscalarで比べる */
+#define SIMD_EXTREMUM(name, attr, type, vtype, width, load, store, vop, scalar, op) \
+static attr type name(const type *a, int n)                             \
+{                                                                       \
+    vtype acc;                                                          \
+    type lanes[(width)], m;                                             \
+    int i;                                                              \
+    if (n < (width))                                                    \
+        return scalar(a, n);                                            \
+    acc = load((const void *) a);                                       \
+    for (i = (width); i + (width) <= n; i += (width))                   \
+        acc = vop(acc, load((const void *) (a + i)));                   \
+    store((void *) lanes, acc);                                         \
+    m = scalar(lanes, (width));                                         \
+    for (; i < n; i++)                                                  \
+        if (a[i] op m) m = a[i];                                        \
+    return m;                                                           \
+}
+
+SCALAR_EXTREMUM(f64_min_scalar, double,  <)
+SCALAR_EXTREMUM(f64_max_scalar, double,  >)
+SCALAR_EXTREMUM(s64_min_scalar, int64_t, <)
+SCALAR_EXTREMUM(s64_max_scalar, int64_t, >)
+SCALAR_EXTREMUM(s32_min_scalar, int32_t, <)
+SCALAR_EXTREMUM(s32_max_scalar, int32_t, >)
+SCALAR_EXTREMUM(u8_min_scalar,  uint8_t, <)
+SCALAR_EXTREMUM(u8_max_scalar,  uint8_t, >)
+
+#if SIMD_X86
+SIMD_EXTREMUM(f64_min_sse2, , double,  __m128d, 2,  _mm_loadu_pd,    _mm_storeu_pd,    _mm_min_pd,   f64_min_scalar, <)
+SIMD_EXTREMUM(f64_max_sse2, , double,  __m128d, 2,  _mm_loadu_pd,    _mm_storeu_pd,    _mm_max_pd,   f64_max_scalar, >)
+SIMD_EXTREMUM(u8_min_sse2,  , uint8_t, __m128i, 16, _mm_loadu_si128, _mm_storeu_si128, _mm_min_epu8, u8_min_scalar,  <)
+SIMD_EXTREMUM(u8_max_sse2,  , uint8_t, __m128i, 16, _mm_loadu_si128, _mm_storeu_si128, _mm_max_epu8, u8_max_scalar,  >)
+
+SIMD_EXTREMUM(f64_min_avx2, AVX2_TARGET, double,  __m256d, 4,  _mm256_loadu_pd,    _mm256_storeu_pd,    _mm256_min_pd,    f64_min_scalar, <)
+SIMD_EXTREMUM(f64_max_avx2, AVX2_TARGET, double,  __m256d, 4,  _mm256_loadu_pd,    _mm256_storeu_pd,    _mm256_max_pd,    f64_max_scalar, >)
+SIMD_EXTREMUM(s32_min_avx2, AVX2_TARGET, int32_t, __m256i, 8,  _mm256_loadu_si256, _mm256_storeu_si256, _mm256_min_epi32, s32_min_scalar, <)
+SIMD_EXTREMUM(s32_max_avx2, AVX2_TARGET, int32_t, __m256i, 8,  _mm256_loadu_si256, _mm256_storeu_si256, _mm256_max_epi32, s32_max_scalar, >)
+SIMD_EXTREMUM(u8_min_avx2,  AVX2_TARGET, uint8_t, __m256i, 32, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_min_epu8,  u8_min_scalar,  <)
+SIMD_EXTREMUM(u8_max_avx2,  AVX2_TARGET, uint8_t, __m256i, 32, _mm256_loadu_si256, _mm256_storeu_si256, _mm256_max_epu8,  u8_max_scalar,  >)
+#endif
+
+double simd_f64_min(const double *a, int n)
+{
+    return SIMD_SELECT(f64_min_avx2, f64_min_sse2, f64_min_scalar)(a, n);
+}
+double simd_f64_max(const double *a, int n)
+{
+    return SIMD_SELECT(f64_max_avx2, f64_max_sse2, f64_max_scalar)(a, n);
+}
+int64_t simd_s64_min(const int64_t *a, int n)
+{
+    return s64_min_scalar(a, n);
+}
+int64_t simd_s64_max(const int64_t *a, int n)
+{
+    return s64_max_scalar(a, n);
+}
+int32_t simd_s32_min(const int32_t *a, int n)
+{
+    return SIMD_SELECT(s32_min_avx2, s32_min_scalar, s32_min_scalar)(a, n);
+}
+int32_t simd_s32_max(const int32_t *a, int n)
+{
+    return SIMD_SELECT(s32_max_avx2, s32_max_scalar, s32_max_scalar)(a, n);
+}
+uint8_t simd_u8_min(const uint8_t *a, int n)
+{
+    return SIMD_SELECT(u8_min_avx2, u8_min_sse2, u8_min_scalar)(a, n);
+}
+uint8_t simd_u8_max(const uint8_t *a, int n)
+{
+    return SIMD_SELECT(u8_max_avx2, u8_max_sse2, u8_max_scalar)(a, n);
+}
@@ -0,0 +1,341 @@
+/*===========================================================================
+ * stack.c - control stack of the evaluator
+ *
+ * $Id$
+===========================================================================*/
+
+#include "scheme.h"
+
+/*==================================================
+  Global
+==================================================*/
+/* current (top) segment. never sealed. */
+struct StackSegment *_control_stack = NULL;
+
+/* innermost C level entry of the evaluator */
+struct Activation *_current_activation = NULL;
+
+/*==================================================
+  File Local Variables
+==================================================*/
+/* a few free segments are kept to avoid malloc/free at a segment boundary */
+#define SPARE_SEGMENT_MAX 8
+static struct StackSegment *spare_segments[SPARE_SEGMENT_MAX];
+static int spare_segment_count = 0;
+
+static int activation_count = 0;
+
+/*==================================================
+  Segment
+==================================================*/
+/**
+ * 新しいsegmentを作る。previousへの参照は呼び出し側から引き継ぐ。
+ */
+static struct StackSegment *new_segment(struct StackSegment *previous)
+{
+    struct StackSegment *segment;
+    if (spare_segment_count > 0) {
+        segment = spare_segments[--spare_segment_count];
+    } else {
+        segment = xmalloc(sizeof(struct StackSegment));
+    }
+    segment->previous = previous;
+    segment->base = (previous == NULL) ? 0 : previous->base + previous->used;
+    segment->used = 0;
+    segment->sealed = FALSE;
+    segment->reference = 1;
+    segment->gc_count = -1;
+    return segment;
+}
+
+static void free_segment(struct StackSegment *segment)
+{
+    if (spare_segment_count < SPARE_SEGMENT_MAX) {
+        spare_segments[spare_segment_count++] = segment;
+    } else {
+        free(segment);
+    }
+}
+
+void control_stack_release(struct StackSegment *segment)
+{
+    while (segment != NULL && --segment->reference == 0) {
+        struct StackSegment *previous = segment->previous;
+        free_segment(segment);
+        segment = previous;
+    }
+}
+
+/**
+ * sealedなsegmentをtopにする時はcopyする。
+ * 誰とも共有されていなければそのまま使う。
+ */
+static struct StackSegment *unshare_segment(struct StackSegment *segment, int used)
+{
+    struct StackSegment *copy;
+    if (! segment->sealed) {
+        segment->used = used;
+        return segment;
+    }
+    if (segment->reference == 1) {
+        segment->sealed = FALSE;
+        segment->used = used;
+        return segment;
+    }
+    copy = new_segment(segment->previous);
+    if (segment->previous != NULL)
+        segment->previous->reference++;
+    copy->base = segment->base;
+    copy->used = used;
+    memcpy(copy->frames, segment->frames, sizeof(struct Frame) * used);
+    control_stack_release(segment);
+    return copy;
+}
+
+void control_stack_initialize(void)
+{
+    _control_stack = new_segment(NULL);
+    _current_activation = NULL;
+}
+
+void control_stack_finalize(void)
+{
+    control_stack_release(_control_stack);
+    _control_stack = NULL;
+    while (spare_segment_count > 0)
+        free(spare_segments[--spare_segment_count]);
+}
+
+/*==================================================
+  Push / Pop
+==================================================*/
+struct Frame *control_stack_push(enum FrameType type, SCM env, SCM a, SCM b, SCM c)
+{
+    struct Frame *frame;
+    if (_control_stack->used == CONTROL_STACK_SEGMENT_SIZE) {
+        /* overflow */
+        _control_stack = new_segment(_control_stack);
+    }
+    frame = &_control_stack->frames[_control_stack->used++];
+    frame->type = type;
+    frame->env = env;
+    frame->a = a;
+    frame->b = b;
+    frame->c = c;
+    frame->form = SCM_NULL;
+    return frame;
+}
+
+/**
+ * OPERAND frameの評価済み引数のlistは適用の時にその場で逆順にされる。
+ * 共有しているsegmentのframeから壊されないようにcopyする
+ */
+static void copy_operands(struct StackSegment *segment)
+{
+    int i;
+    for (i = 0; i < segment->used; i++) {
+        struct Frame *frame = &segment->frames[i];
+        if (frame->type == FRAME_TYPE_OPERAND) {
+            frame->b = list_reverse(list_reverse(frame->b));
+        }
+    }
+}
+
+/**
+ * topのsegmentが空になったら一つ前のsegmentに戻る。
+ * popは使用数を減らすだけなので、topを読む前にCONTROL_STACK_SETTLEで呼ばれる。
+ */
+void control_stack_underflow(void)
+{
+    struct StackSegment *empty = _control_stack;
+    struct StackSegment *previous = empty->previous;
+
+    assert(previous != NULL);
+    if (previous->sealed && previous->reference > 1) {
+        /* copy the shared segment into the empty one */
+        empty->previous = previous->previous;
+        if (empty->previous != NULL)
+            empty->previous->reference++;
+        empty->base = previous->base;
+        empty->used = previous->used;
+        memcpy(empty->frames, previous->frames, sizeof(struct Frame) * previous->used);
+        copy_operands(empty);
+        control_stack_release(previous);
+        return;
+    }
+    /* the empty segment's reference to previous moves to _control_stack */
+    previous->sealed = FALSE;
+    _control_stack = previous;
+    free_segment(empty);
+}
+
+/*==================================================
+  Depth
+==================================================*/
+/**
+ * 底から数えてdepth番目のframe。無ければNULL。
+ */
+struct Frame *control_stack_frame(int depth)
+{
+    struct StackSegment *segment;
+    for (segment = _control_stack; segment != NULL; segment = segment->previous) {
+        if (segment->base <= depth) {
+            if (depth < segment->base + segment->used)
+                return &segment->frames[depth - segment->base];
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+/**
+ * depth個のframeを残して捨てる
+ */
+void control_stack_cut(int depth)
+{
+    assert(depth <= CONTROL_STACK_DEPTH());
+    while (_control_stack->base > depth) {
+        struct StackSegment *top = _control_stack;
+        _control_stack = top->previous;
+        top->previous = NULL;
+        control_stack_release(top);
+    }
+    _control_stack = unshare_segment(_control_stack, depth - _control_stack->base);
+}
+
+/*==================================================
+  Continuation
+==================================================*/
+/**
+ * 現在のstackをsealしてcontinuationと共有する。
+ * sealするのは前回のcapture以降に積まれたsegmentだけ。
+ */
+struct StackSegment *control_stack_capture(void)
+{
+    struct StackSegment *captured, *segment;
+    if (_control_stack->used == 0 && _control_stack->previous != NULL) {
+        captured = _control_stack->previous;
+    } else {
+        captured = _control_stack;
+        _control_stack = new_segment(captured);
+    }
+    for (segment = captured; segment != NULL && ! segment->sealed; segment = segment->previous)
+        segment->sealed = TRUE;
+    captured->reference++;
+    return captured;
+}
+
+/**
+ * continuationのstackに切り替える。copyは戻った時に一段ずつ行う。
+ */
+void control_stack_reinstate(struct StackSegment *segment)
+{
+    struct StackSegment *old = _control_stack;
+    segment->reference++;
+    _control_stack = new_segment(segment);
+    control_stack_release(old);
+}
+
+/*==================================================
+  Error Recovery
+==================================================*/
+void control_stack_save(struct ControlStackMark *mark)
+{
+    mark->depth = CONTROL_STACK_DEPTH();
+    mark->env_stack_top = ENV_STACK_TOP();
+    mark->activation = _current_activation;
+}
+
+/**
+ * scheme_errorで抜けた時にmarkの位置までframeを捨てる
+ */
+void control_stack_restore(struct ControlStackMark *mark)
+{
+    /* continuationで浅いstackに入れ替わっていればそのまま */
+    if (mark->depth < CONTROL_STACK_DEPTH())
+        control_stack_cut(mark->depth);
+    if (mark->env_stack_top < ENV_STACK_TOP())
+        ENV_STACK_RESET(mark->env_stack_top);
+    _current_activation = mark->activation;
+}
+
+/*==================================================
+  Activation
+==================================================*/
+void activation_enter(struct Activation *activation)
+{
+    activation->owner = _current_activation;
+    activation->id = ++activation_count;
+    activation->base = CONTROL_STACK_DEPTH();
+    _current_activation = activation;
+}
+
+void activation_leave(struct Activation *activation)
+{
+    _current_activation = activation->owner;
+}
+
+/**
+ * idのactivationがまだC stack上にあれば返す
+ */
+struct Activation *activation_lookup(int id)
+{
+    struct Activation *activation;
+    for (activation = _current_activation; activation != NULL; activation = activation->owner)
+        if (activation->id == id)
+            return activation;
+    return NULL;
+}
+
+struct Activation *activation_outermost(void)
+{
+    struct Activation *activation = _current_activation;
+    while (activation != NULL && activation->owner != NULL)
+        activation = activation->owner;
+    return activation;
+}
+
+/*==================================================
+  GC
+==================================================*/
+/**
+ * segmentとそれより古いsegmentのframeをmarkする。
+ * continuation間で共有されたsegmentは一度のGCで一回だけ辿る。
+ */
+void control_stack_mark_segment(struct StackSegment *segment)
+{
+    int count = scm_gc_count();
+    int i;
+    for (; segment != NULL && segment->gc_count != count; segment = segment->previous) {
+        segment->gc_count = count;
+        for (i = 0; i < segment->used; i++) {
+            struct Frame *frame = &segment->frames[i];
+            scm_gc_mark(frame->env);
+            scm_gc_mark(frame->a);
+            scm_gc_mark(frame->b);
+            scm_gc_mark(frame->c);
+            scm_gc_mark(frame->form);
+        }
+    }
+}
+
+/**
+ * sealされていないsegmentのframeにfuncを適用する。
+ * sealされたsegmentは書き換えない (env_stack_promote)
+ */
+void control_stack_for_each_unsealed(void (*func)(struct Frame *frame))
+{
+    struct StackSegment *segment;
+    int i;
+    for (segment = _control_stack; segment != NULL && ! segment->sealed; segment = segment->previous) {
+        for (i = 0; i < segment->used; i++) {
+            func(&segment->frames[i]);
+        }
+    }
+}
+
+/* control stack is scanned precisely */
+void control_stack_mark(void)
+{
+    control_stack_mark_segment(_control_stack);
+}
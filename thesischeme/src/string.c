@@ -0,0 +1,683 @@
+/*===========================================================================
+ * string.c - string and character
+ *
+ * $Id$
+===========================================================================*/
+
+#include <limits.h>
+
+#include "scheme.h"
+
+/* 文字列は長さを持つUTF-8のbyte列で、NULを含んでもよい。
+ * string-lengthやstring-refは文字単位で、ASCIIだけの文字列ならstring-refはO(1).
+ * string-appendはropeを、substringは元の中身を指すviewを作る。
+ * 短いものは写した方が速いので閾値以下ならflatな文字列にする
+ */
+
+/*==================================================
+  UTF-8
+==================================================*/
+/* 不正な列は1 byteを1文字 (値はそのbyte) として扱う. 冗長な符号化は検査しない */
+int utf8_decode(char *p, char *end, int *c)
+{
+    unsigned char *s = (unsigned char *) p;
+    int n, i, value;
+
+    if (s[0] < 0x80) {
+        *c = s[0];
+        return 1;
+    }
+    if (0xC2 <= s[0] && s[0] <= 0xDF) {
+        n = 2; value = s[0] & 0x1F;
+    } else if (0xE0 <= s[0] && s[0] <= 0xEF) {
+        n = 3; value = s[0] & 0x0F;
+    } else if (0xF0 <= s[0] && s[0] <= 0xF4) {
+        n = 4; value = s[0] & 0x07;
+    } else {
+        *c = s[0];
+        return 1;
+    }
+    if (p + n > end) {
+        *c = s[0];
+        return 1;
+    }
+    for (i = 1; i < n; i++) {
+        if (! UTF8_CONTINUATION_P(s[i])) {
+            *c = s[0];
+            return 1;
+        }
+        value = (value << 6) | (s[i] & 0x3F);
+    }
+    *c = value;
+    return n;
+}
+
+/* bufには4 byte置ければよい */
+int utf8_encode(int c, char *buf)
+{
+    if (c < 0x80) {
+        buf[0] = c;
+        return 1;
+    }
+    if (c < 0x800) {
+        buf[0] = 0xC0 | (c >> 6);
+        buf[1] = 0x80 | (c & 0x3F);
+        return 2;
+    }
+    if (c < 0x10000) {
+        buf[0] = 0xE0 | (c >> 12);
+        buf[1] = 0x80 | ((c >> 6) & 0x3F);
+        buf[2] = 0x80 | (c & 0x3F);
+        return 3;
+    }
+    buf[0] = 0xF0 | (c >> 18);
+    buf[1] = 0x80 | ((c >> 12) & 0x3F);
+    buf[2] = 0x80 | ((c >> 6) & 0x3F);
+    buf[3] = 0x80 | (c & 0x3F);
+    return 4;
+}
+
+int utf8_count(char *bytes, int length)
+{
+    char *p = bytes, *end = bytes + length;
+    int count = 0, c;
+    while (p < end) {
+        p += (unsigned char) *p < 0x80 ? 1 : utf8_decode(p, end, &c);
+        count++;
+    }
+    return count;
+}
+
+/*==================================================
+  Representation
+==================================================*/
+#define STRING_ROPE_THRESHOLD 128   /* これ以下の長さになる連結は写す */
+#define STRING_VIEW_THRESHOLD 32    /* これ以下の長さのsubstringは写す */
+#define STRING_ROPE_DEPTH_MAX 32    /* これより深くなる側はflatにしてから繋ぐ */
+
+#define STRING_ROPE_LEFT(obj)  CAR(STRING_BASE(obj))
+#define STRING_ROPE_RIGHT(obj) CDR(STRING_BASE(obj))
+
+/* 深さはSTRING_ROPE_DEPTH_MAXまでなので再帰でよい */
+static void string_copy_bytes(SCM s, char *dst)
+{
+    while (STRING_ROPE_P(s)) {
+        SCM left = STRING_ROPE_LEFT(s);
+        string_copy_bytes(left, dst);
+        dst += STRING_LENGTH(left);
+        s = STRING_ROPE_RIGHT(s);
+    }
+    memcpy(dst, STRING_VALUE(s), STRING_LENGTH(s));
+}
+
+/* 中身を新しいpayloadに写してflatにする. 先に領域を取ってから辿る */
+static void string_realize(SCM s)
+{
+    char *buf = data_allocate(STRING_LENGTH(s) + 1);
+    string_copy_bytes(s, buf);
+    buf[STRING_LENGTH(s)] = '\0';
+    if (STRING_ROPE_P(s)) {
+        /* 不正な列を繋いだropeは数え直すと変わることがある */
+        STRING_COUNT(s) = utf8_count(buf, STRING_LENGTH(s));
+    }
+    STRING_VALUE(s) = buf;
+    STRING_PAYLOAD(s) = buf;
+}
+
+/* 読むだけなら共有したままでよい. ropeだけ潰す */
+char *string_bytes(SCM s)
+{
+    if (STRING_ROPE_P(s)) {
+        string_realize(s);
+        HEADER_FLAG(s) &= STRING_FLAG_SHARED;
+    }
+    return STRING_VALUE(s);
+}
+
+/* 書き換える前に呼ぶ. 他と中身を共有していれば写す */
+static void string_unshare(SCM s)
+{
+    if (HEADER_FLAG(s) != 0) {
+        string_realize(s);
+        HEADER_FLAG(s) = 0;
+    }
+}
+
+/* viewが指すdata spaceの領域の先頭 */
+static void *string_payload(SCM s)
+{
+    return STRING_SYMBOL_P(s) ? SYMBOL_NAME(STRING_BASE(s)) : STRING_PAYLOAD(s);
+}
+
+/* k文字目のbyte位置 */
+static int string_offset(SCM s, int k)
+{
+    char *p, *end;
+    int c;
+    if (STRING_ASCII_P(s))
+        return k;
+    p = STRING_VALUE(s);
+    end = p + STRING_LENGTH(s);
+    while (k-- > 0)
+        p += utf8_decode(p, end, &c);
+    return p - STRING_VALUE(s);
+}
+
+/**
+ * ropeの葉にする複製. 元の文字列をstring-set!しても変わらないように、
+ * 別のcellで同じ中身を指し、元にはSHAREDを立てて書き換え時に写させる
+ */
+static SCM string_snapshot(SCM s)
+{
+    SCM copy;
+    if (STRING_ROPE_P(s)) {
+        /* 子は既に葉の複製なので、節だけ作り直せばよい */
+        return new_rope_string(STRING_ROPE_LEFT(s), STRING_ROPE_RIGHT(s), STRING_DEPTH(s));
+    }
+    if (STRING_SYMBOL_P(s))
+        return new_symbol_string(STRING_BASE(s), STRING_COUNT(s));
+    copy = new_string_view(NULL, STRING_LENGTH(s), STRING_COUNT(s), NULL);
+    STRING_VALUE(copy) = STRING_VALUE(s);
+    STRING_PAYLOAD(copy) = STRING_PAYLOAD(s);
+    HEADER_FLAG(s) |= STRING_FLAG_SHARED;
+    return copy;
+}
+
+static SCM string_append2(SCM a, SCM b)
+{
+    int length, depth;
+    SCM s;
+
+    if (STRING_LENGTH(a) > INT_MAX - 1 - STRING_LENGTH(b))
+        scheme_error("string-append: string too long");
+    length = STRING_LENGTH(a) + STRING_LENGTH(b);
+    if (length <= STRING_ROPE_THRESHOLD) {
+        s = new_string_bytes(NULL, length, STRING_COUNT(a) + STRING_COUNT(b));
+        string_copy_bytes(a, STRING_VALUE(s));
+        string_copy_bytes(b, STRING_VALUE(s) + STRING_LENGTH(a));
+        return s;
+    }
+    if (STRING_DEPTH(a) >= STRING_ROPE_DEPTH_MAX)
+        string_bytes(a);
+    if (STRING_DEPTH(b) >= STRING_ROPE_DEPTH_MAX)
+        string_bytes(b);
+    depth = (STRING_DEPTH(a) > STRING_DEPTH(b) ? STRING_DEPTH(a) : STRING_DEPTH(b)) + 1;
+    a = string_snapshot(a);
+    b = string_snapshot(b);
+    return new_rope_string(a, b, depth);
+}
+
+static SCM string_copy(SCM s)
+{
+    SCM copy = new_string_bytes(NULL, STRING_LENGTH(s), STRING_COUNT(s));
+    string_copy_bytes(s, STRING_VALUE(copy));
+    return copy;
+}
+
+int string_equal_p(SCM a, SCM b)
+{
+    return STRING_LENGTH(a) == STRING_LENGTH(b) &&
+        memcmp(string_bytes(a), string_bytes(b), STRING_LENGTH(a)) == 0;
+}
+
+/* 中身のFNV-1a. ropeは潰さずに辿るので領域を取らない */
+static unsigned int string_hash_bytes(SCM s, unsigned int h)
+{
+    unsigned char *p, *end;
+    while (STRING_ROPE_P(s)) {
+        h = string_hash_bytes(STRING_ROPE_LEFT(s), h);
+        s = STRING_ROPE_RIGHT(s);
+    }
+    p = (unsigned char *) STRING_VALUE(s);
+    for (end = p + STRING_LENGTH(s); p < end; p++) {
+        h ^= *p;
+        h *= 16777619U;
+    }
+    return h;
+}
+
+unsigned int string_hash(SCM s)
+{
+    return string_hash_bytes(s, 2166136261U);
+}
+
+static int string_compare(SCM a, SCM b)
+{
+    int la = STRING_LENGTH(a), lb = STRING_LENGTH(b);
+    int c = memcmp(string_bytes(a), string_bytes(b), la < lb ? la : lb);
+    return c != 0 ? c : la - lb;
+}
+
+/*==================================================
+  Check
+==================================================*/
+static SCM string_check(SCM o, char *name)
+{
+    char message[64];
+    if (! STRING_P(o)) {
+        snprintf(message, sizeof(message), "%s: string required", name);
+        scheme_error(message);
+    }
+    return o;
+}
+
+static int char_check(SCM o, char *name)
+{
+    char message[64];
+    if (! CHAR_P(o)) {
+        snprintf(message, sizeof(message), "%s: character required", name);
+        scheme_error(message);
+    }
+    return CHAR_VALUE(o);
+}
+
+/* 0 <= k < limit (inclusiveなら <= limit) の文字位置 */
+static int index_check(SCM k, int limit, int inclusive, char *name)
+{
+    char message[64];
+    if (! FIXNUM_P(k) || FIXNUM_VALUE(k) < 0 ||
+        FIXNUM_VALUE(k) > limit || (! inclusive && FIXNUM_VALUE(k) == limit)) {
+        snprintf(message, sizeof(message), "%s: index out of range", name);
+        scheme_error(message);
+    }
+    return (int) FIXNUM_VALUE(k);
+}
+
+/*==================================================
+  Conversion
+==================================================*/
+static SCM list_to_string(SCM lst, char *name)
+{
+    char buf[4];
+    int length = 0, count = 0;
+    SCM p, s;
+    char *dst;
+
+    for (p = lst; CONS_P(p); p = CDR(p)) {
+        length += utf8_encode(char_check(CAR(p), name), buf);
+        count++;
+    }
+    s = new_string_bytes(NULL, length, count);
+    dst = STRING_VALUE(s);
+    for (p = lst; CONS_P(p); p = CDR(p))
+        dst += utf8_encode(CHAR_VALUE(CAR(p)), dst);
+    return s;
+}
+
+/* symbolの名前を指す文字列ならそのsymbolを返す */
+SCM string_to_symbol(SCM s)
+{
+    char small[256];
+    char *name;
+    SCM symbol;
+
+    string_check(s, "string->symbol");
+    if (STRING_SYMBOL_P(s))
+        return STRING_BASE(s);
+    /* internの途中のGCで中身が回収されないよう写してから引く */
+    name = STRING_LENGTH(s) <= (int) sizeof(small) ? small : xmalloc(STRING_LENGTH(s));
+    memcpy(name, string_bytes(s), STRING_LENGTH(s));
+    symbol = intern_bytes(name, STRING_LENGTH(s));
+    if (name != small)
+        free(name);
+    return symbol;
+}
+
+SCM symbol_to_string(SCM symbol)
+{
+    if (! SYMBOL_P(symbol))
+        scheme_error("symbol->string: symbol required");
+    return new_symbol_string(symbol, utf8_count(SYMBOL_NAME(symbol), SYMBOL_LENGTH(symbol)));
+}
+
+/*==================================================
+  Printer
+==================================================*/
+static char *char_names[] = {
+    "nul", "alarm", "backspace", "tab", "newline", "return", "escape", "space", "delete",
+};
+static int char_name_values[] = {
+    0x00, 0x07, 0x08, 0x09, 0x0A, 0x0D, 0x1B, 0x20, 0x7F,
+};
+#define CHAR_NAME_COUNT ((int) (sizeof(char_names) / sizeof(char_names[0])))
+
+/* 名前のある文字の値. 知らない名前なら-1 */
+int char_name_value(char *name)
+{
+    int i;
+    for (i = 0; i < CHAR_NAME_COUNT; i++) {
+        if (strcmp(name, char_names[i]) == 0)
+            return char_name_values[i];
+    }
+    return strcmp(name, "null") == 0 ? 0 : -1;
+}
+
+/* readで読み戻せるように書く. 制御文字は\xHH; にする */
+void print_string(SCM s, FILE *file)
+{
+    unsigned char *p = (unsigned char *) string_bytes(s);
+    unsigned char *end = p + STRING_LENGTH(s);
+
+    putc('"', file);
+    for (; p < end; p++) {
+        switch (*p) {
+        case '"':  fputs("\\\"", file); break;
+        case '\\': fputs("\\\\", file); break;
+        case '\n': fputs("\\n", file); break;
+        case '\t': fputs("\\t", file); break;
+        case '\r': fputs("\\r", file); break;
+        default:
+            if (*p < 0x20 || *p == 0x7F)
+                fprintf(file, "\\x%X;", *p);
+            else
+                putc(*p, file);
+        }
+    }
+    putc('"', file);
+}
+
+void print_char(SCM c, FILE *file)
+{
+    char buf[4];
+    int value = CHAR_VALUE(c);
+    int i;
+
+    for (i = 0; i < CHAR_NAME_COUNT; i++) {
+        if (char_name_values[i] == value) {
+            fprintf(file, "#\\%s", char_names[i]);
+            return ;
+        }
+    }
+    if (value < 0x20) {
+        fprintf(file, "#\\x%X", value);
+        return ;
+    }
+    fputs("#\\", file);
+    fwrite(buf, 1, utf8_encode(value, buf), file);
+}
+
+void display_string(SCM s, FILE *file)
+{
+    fwrite(string_bytes(s), 1, STRING_LENGTH(s), file);
+}
+
+/*==================================================
+  Primitive
+==================================================*/
+DEFINE_PRIMITIVE("string?", stringp, (SCM o), expr1)
+{
+    return C_TO_SCM_BOOLEAN(STRING_P(o));
+}
+
+/* (make-string k [char]) */
+DEFINE_PRIMITIVE("make-string", make_string, (SCM l), list_expr)
+{
+    int argc = list_length(l);
+    char buf[4];
+    int k, width, i;
+    SCM s;
+
+    if (argc != 1 && argc != 2)
+        scheme_error("make-string: wrong number of arguments");
+    width = utf8_encode(argc == 2 ? char_check(CADR(l), "make-string") : ' ', buf);
+    if (! FIXNUM_P(CAR(l)) || FIXNUM_VALUE(CAR(l)) < 0 ||
+        FIXNUM_VALUE(CAR(l)) > (INT_MAX - 1) / width)
+        scheme_error("make-string: bad length");
+    k = (int) FIXNUM_VALUE(CAR(l));
+    s = new_string_bytes(NULL, k * width, k);
+    if (width == 1) {
+        memset(STRING_VALUE(s), buf[0], k);
+    } else {
+        for (i = 0; i < k; i++)
+            memcpy(STRING_VALUE(s) + i * width, buf, width);
+    }
+    return s;
+}
+
+DEFINE_PRIMITIVE("string", string, (SCM l), list_expr)
+{
+    return list_to_string(l, "string");
+}
+
+DEFINE_PRIMITIVE("string-length", string_length, (SCM s), expr1)
+{
+    return MAKE_FIXNUM(STRING_COUNT(string_check(s, "string-length")));
+}
+
+DEFINE_PRIMITIVE("string-ref", string_ref, (SCM s, SCM k), expr2)
+{
+    int i = index_check(k, STRING_COUNT(string_check(s, "string-ref")), FALSE, "string-ref");
+    char *bytes = string_bytes(s);
+    int c;
+    if (STRING_ASCII_P(s))
+        return MAKE_CHAR((unsigned char) bytes[i]);
+    i = string_offset(s, i);
+    utf8_decode(bytes + i, bytes + STRING_LENGTH(s), &c);
+    return MAKE_CHAR(c);
+}
+
+/* 幅の変わる文字を置く時は作り直す */
+DEFINE_PRIMITIVE("string-set!", string_setq, (SCM s, SCM k, SCM ch), expr3)
+{
+    int i = index_check(k, STRING_COUNT(string_check(s, "string-set!")), FALSE, "string-set!");
+    int c = char_check(ch, "string-set!");
+    char buf[4];
+    char *old, *value;
+    int width, old_width, old_c;
+
+    string_unshare(s);
+    if (STRING_ASCII_P(s) && c < 0x80) {
+        STRING_VALUE(s)[i] = c;
+        return SCM_UNDEFINED;
+    }
+    i = string_offset(s, i);
+    old_width = utf8_decode(STRING_VALUE(s) + i, STRING_VALUE(s) + STRING_LENGTH(s), &old_c);
+    width = utf8_encode(c, buf);
+    if (width == old_width) {
+        memcpy(STRING_VALUE(s) + i, buf, width);
+    } else {
+        if (STRING_LENGTH(s) > INT_MAX - 1 - width)
+            scheme_error("string-set!: string too long");
+        value = data_allocate(STRING_LENGTH(s) - old_width + width + 1);
+        old = STRING_VALUE(s);
+        memcpy(value, old, i);
+        memcpy(value + i, buf, width);
+        memcpy(value + i + width, old + i + old_width, STRING_LENGTH(s) - i - old_width);
+        STRING_LENGTH(s) += width - old_width;
+        value[STRING_LENGTH(s)] = '\0';
+        STRING_VALUE(s) = STRING_PAYLOAD(s) = value;
+    }
+    STRING_COUNT(s) = utf8_count(STRING_VALUE(s), STRING_LENGTH(s));
+    return SCM_UNDEFINED;
+}
+
+/* (substring s start [end]) */
+DEFINE_PRIMITIVE("substring", substring, (SCM l), list_expr)
+{
+    int argc = list_length(l);
+    int start, end, from, to;
+    SCM s, sub;
+
+    if (argc != 2 && argc != 3)
+        scheme_error("substring: wrong number of arguments");
+    s = string_check(CAR(l), "substring");
+    end = argc == 3 ? index_check(CADDR(l), STRING_COUNT(s), TRUE, "substring") : STRING_COUNT(s);
+    start = index_check(CADR(l), end, TRUE, "substring");
+    string_bytes(s);
+    from = string_offset(s, start);
+    to = string_offset(s, end);
+    if (to - from <= STRING_VIEW_THRESHOLD) {
+        sub = new_string_bytes(NULL, to - from, end - start);
+        memcpy(STRING_VALUE(sub), STRING_VALUE(s) + from, to - from);
+        return sub;
+    }
+    sub = new_string_view(NULL, to - from, end - start, NULL);
+    STRING_VALUE(sub) = STRING_VALUE(s) + from;
+    STRING_PAYLOAD(sub) = string_payload(s);
+    HEADER_FLAG(s) |= STRING_FLAG_SHARED;
+    return sub;
+}
+
+DEFINE_PRIMITIVE("string-append", string_append, (SCM l), list_expr)
+{
+    SCM result, s;
+
+    if (NULL_P(l))
+        return new_string_bytes(NULL, 0, 0);
+    result = string_check(CAR(l), "string-append");
+    if (NULL_P(CDR(l)))
+        return string_copy(result);
+    for (l = CDR(l); CONS_P(l); l = CDR(l)) {
+        s = string_check(CAR(l), "string-append");
+        result = string_append2(result, s);
+    }
+    return result;
+}
+
+DEFINE_PRIMITIVE("string-copy", string_copy, (SCM s), expr1)
+{
+    return string_copy(string_check(s, "string-copy"));
+}
+
+DEFINE_PRIMITIVE("string->list", string2list, (SCM s), expr1)
+{
+    SCM head = SCM_NULL, tail = SCM_NULL, cell;
+    char *p, *end;
+    int c;
+
+    p = string_bytes(string_check(s, "string->list"));
+    end = p + STRING_LENGTH(s);
+    while (p < end) {
+        p += utf8_decode(p, end, &c);
+        cell = new_cons(MAKE_CHAR(c), SCM_NULL);
+        if (NULL_P(head))
+            head = cell;
+        else
+            SET_CDR(tail, cell);
+        tail = cell;
+    }
+    return head;
+}
+
+DEFINE_PRIMITIVE("list->string", list2string, (SCM l), expr1)
+{
+    return list_to_string(l, "list->string");
+}
+
+DEFINE_PRIMITIVE("string->symbol", string2symbol, (SCM s), expr1)
+{
+    return string_to_symbol(s);
+}
+
+DEFINE_PRIMITIVE("string->number", string2number, (SCM s), expr1)
+{
+    char *buf;
+    SCM number;
+
+    string_check(s, "string->number");
+    if (memchr(string_bytes(s), '\0', STRING_LENGTH(s)) != NULL)
+        return SCM_FALSE;
+    buf = xmalloc(STRING_LENGTH(s) + 1);
+    memcpy(buf, STRING_VALUE(s), STRING_LENGTH(s));
+    buf[STRING_LENGTH(s)] = '\0';
+    number = c_string_to_number(buf);
+    free(buf);
+    return number;
+}
+
+DEFINE_PRIMITIVE("number->string", number2string, (SCM x), expr1)
+{
+    char *buf = NULL;
+    size_t size = 0;
+    FILE *out;
+    SCM s;
+
+    if (! NUMBER_P(x))
+        scheme_error("number->string: number required");
+    out = open_memstream(&buf, &size);
+    print(x, out);
+    fclose(out);
+    s = new_string_bytes(buf, (int) size, (int) size);
+    free(buf);
+    return s;
+}
+
+DEFINE_PRIMITIVE("string=?", string_eq, (SCM a, SCM b), expr2)
+{
+    string_check(a, "string=?");
+    string_check(b, "string=?");
+    return C_TO_SCM_BOOLEAN(string_equal_p(a, b));
+}
+
+/* UTF-8はbyte順に比べるとcode point順になる */
+DEFINE_PRIMITIVE("string<?", string_less_than, (SCM a, SCM b), expr2)
+{
+    string_check(a, "string<?");
+    string_check(b, "string<?");
+    return C_TO_SCM_BOOLEAN(string_compare(a, b) < 0);
+}
+
+DEFINE_PRIMITIVE("string>?", string_greater_than, (SCM a, SCM b), expr2)
+{
+    string_check(a, "string>?");
+    string_check(b, "string>?");
+    return C_TO_SCM_BOOLEAN(string_compare(a, b) > 0);
+}
+
+DEFINE_PRIMITIVE("char?", charp, (SCM o), expr1)
+{
+    return C_TO_SCM_BOOLEAN(CHAR_P(o));
+}
+
+DEFINE_PRIMITIVE("char->integer", char2integer, (SCM c), expr1)
+{
+    return MAKE_FIXNUM(char_check(c, "char->integer"));
+}
+
+DEFINE_PRIMITIVE("integer->char", integer2char, (SCM n), expr1)
+{
+    if (! FIXNUM_P(n) || FIXNUM_VALUE(n) < 0 || FIXNUM_VALUE(n) > CHAR_MAX_VALUE)
+        scheme_error("integer->char: bad code point");
+    return MAKE_CHAR(FIXNUM_VALUE(n));
+}
+
+DEFINE_PRIMITIVE("char=?", char_eq, (SCM a, SCM b), expr2)
+{
+    return C_TO_SCM_BOOLEAN(char_check(a, "char=?") == char_check(b, "char=?"));
+}
+
+DEFINE_PRIMITIVE("char<?", char_less_than, (SCM a, SCM b), expr2)
+{
+    return C_TO_SCM_BOOLEAN(char_check(a, "char<?") < char_check(b, "char<?"));
+}
+
+void symbols_of_string_initialize(void)
+{
+    ADD_PRIMITIVE("string?",        stringp,             (SCM o),               EXPR_1);
+    ADD_PRIMITIVE("make-string",    make_string,         (SCM l),               LIST_EXPR);
+    ADD_PRIMITIVE("string",         string,              (SCM l),               LIST_EXPR);
+    ADD_PRIMITIVE("string-length",  string_length,       (SCM s),               EXPR_1);
+    ADD_PRIMITIVE("string-ref",     string_ref,          (SCM s, SCM k),        EXPR_2);
+    ADD_PRIMITIVE("string-set!",    string_setq,         (SCM s, SCM k, SCM c), EXPR_3);
+    ADD_PRIMITIVE("substring",      substring,           (SCM l),               LIST_EXPR);
+    ADD_PRIMITIVE("string-append",  string_append,       (SCM l),               LIST_EXPR);
+    ADD_PRIMITIVE("string-copy",    string_copy,         (SCM s),               EXPR_1);
+    ADD_PRIMITIVE("string->list",   string2list,         (SCM s),               EXPR_1);
+    ADD_PRIMITIVE("list->string",   list2string,         (SCM l),               EXPR_1);
+    ADD_PRIMITIVE("string->symbol", string2symbol,       (SCM s),               EXPR_1);
+    ADD_PRIMITIVE("string->number", string2number,       (SCM s),               EXPR_1);
+    ADD_PRIMITIVE("number->string", number2string,       (SCM x),               EXPR_1);
+    ADD_PRIMITIVE("string=?",       string_eq,           (SCM a, SCM b),        EXPR_2);
+    ADD_PRIMITIVE("string<?",       string_less_than,    (SCM a, SCM b),        EXPR_2);
+    ADD_PRIMITIVE("string>?",       string_greater_than, (SCM a, SCM b),        EXPR_2);
+    ADD_PRIMITIVE("char?",          charp,               (SCM o),               EXPR_1);
+    ADD_PRIMITIVE("char->integer",  char2integer,        (SCM c),               EXPR_1);
+    ADD_PRIMITIVE("integer->char",  integer2char,        (SCM n),               EXPR_1);
+    ADD_PRIMITIVE("char=?",         char_eq,             (SCM a, SCM b),        EXPR_2);
+    ADD_PRIMITIVE("char<?",         char_less_than,      (SCM a, SCM b),        EXPR_2);
+    /* 引数のlistは呼び出しの後に残らない */
+    HEADER_FLAG(&Scheme_data_p_make_string) = PRIMITIVE_FLAG_TRANSIENT;
+    HEADER_FLAG(&Scheme_data_p_string) = PRIMITIVE_FLAG_TRANSIENT;
+    HEADER_FLAG(&Scheme_data_p_substring) = PRIMITIVE_FLAG_TRANSIENT;
+    HEADER_FLAG(&Scheme_data_p_string_append) = PRIMITIVE_FLAG_TRANSIENT;
+}
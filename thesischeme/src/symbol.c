@@ -32,31 +32,27 @@ SCM _symbol_table[SYMBOL_TABLE_SIZE];
   GLOBAL SCHEME CONSTANT OBJECTS
 ===========================================================================*/
 
-static long hash_string(char *name)
+/* FNV-1a. 名前はNULを含んでもよいので長さで回す */
+unsigned int symbol_hash(char *name, int length)
 {
-#if 0
-    char *p;
-    unsigned h = 0, g;
-    for(p = name; *p; p++) {
-        h = (h << 4) +(*p);
-        if (g = h &0xf0000000) {
-            h = h ^ (g >> 24);
-            h = h ^ g;
-        }
+    unsigned int h = 2166136261U;
+    int i;
+    for (i = 0; i < length; i++) {
+        h ^= (unsigned char) name[i];
+        h *= 16777619U;
     }
-    return h % SYMBOL_TABLE_SIZE;
-#endif 
-    return 0;
+    return h;
 }
 
-static SCM symbol_lookup(char *name)
+static SCM symbol_lookup(char *name, int length, unsigned int hash)
 {
-    SCM list = SYMBOL_TABLE[hash_string(name)];
+    SCM list = SYMBOL_TABLE[hash % SYMBOL_TABLE_SIZE];
     SCM symbol;
 
     FOR_EACH(list, symbol) {
         assert(! FREE_CELL_P(symbol));
-        if (strcmp(SYMBOL_NAME(symbol), name) == 0) {
+        if (SYMBOL_HASH(symbol) == hash && SYMBOL_LENGTH(symbol) == length &&
+            memcmp(SYMBOL_NAME(symbol), name, length) == 0) {
             return symbol;
         }
     }
@@ -65,16 +61,21 @@ static SCM symbol_lookup(char *name)
 
 static SCM symbol_insert(SCM symbol)
 {
-    int h = hash_string(SYMBOL_NAME(symbol));
+    int h = SYMBOL_HASH(symbol) % SYMBOL_TABLE_SIZE;
     SYMBOL_TABLE[h] = new_cons(symbol, SYMBOL_TABLE[h]);
     return symbol;
 }
 
 SCM intern(char *name)
 {
-    SCM symbol = symbol_lookup(name);
+    return intern_bytes(name, strlen(name));
+}
+
+SCM intern_bytes(char *name, int length)
+{
+    SCM symbol = symbol_lookup(name, length, symbol_hash(name, length));
     if (symbol == NULL) {
-        symbol = symbol_insert(new_symbol(name, SCM_UNBOUND));
+        symbol = symbol_insert(new_symbol_bytes(name, length, SCM_UNBOUND));
     }
     return symbol;
 }
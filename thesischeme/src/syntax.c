@@ -56,3 +56,801 @@ SCM scm_syntax_begin(SCM sexp, struct EvalState *state)
     }
     return result;
 }
+
+/*==================================================
+  syntax-rules
+==================================================*/
+/*
+ * (define-syntax <keyword> (syntax-rules (<literal> ...) (<pattern> <template>) ...))
+ *
+ * パターンとテンプレートはdefine-syntaxの時に一度だけ下のnodeに変換し、
+ * 展開時はnodeを辿るだけにする。パターン変数は番号(slot)で参照する。
+ * テンプレートが束縛する変数は展開の度に新しいsymbolにする (Hygiene)。
+ * それ以外のsymbolはそのまま挿入される。
+ *
+ *  rules    : (<dispatch> . <variadic rules>)
+ *             dispatchのn番目は引数がn個の時に試すruleのlist
+ *  rule     : (<matcher> . <template>)
+ *  matcher  : (ANY . slot) | (LITERAL . symbol) | (DATUM . datum)
+ *           | (LIST <heads> <ellipsis> <ellipsis slots> <tails> <rest>)
+ *  template : (DATUM . datum) | (REF . slot) | (CONS <car> . <cdr>)
+ *           | (ELLIPSIS <sub> <slots> . <rest>) | (RENAME . placeholder)
+ */
+#define SYNTAX_RULES_MAX_VARIABLES 64
+
+enum SyntaxNodeType {
+    SYNTAX_NODE_ANY,
+    SYNTAX_NODE_LITERAL,
+    SYNTAX_NODE_DATUM,
+    SYNTAX_NODE_LIST,
+    SYNTAX_NODE_REF,
+    SYNTAX_NODE_CONS,
+    SYNTAX_NODE_ELLIPSIS,
+    SYNTAX_NODE_RENAME,
+};
+#define SYNTAX_NODE(type, body) new_cons(MAKE_FIXNUM(type), (body))
+#define SYNTAX_NODE_TYPE(node)  FIXNUM_VALUE(CAR(node))
+#define SYNTAX_NODE_BODY(node)  CDR(node)
+
+/* FOR_EACHと違ってlstそのものは進めない */
+#define SYNTAX_FOR_EACH(lst, p) for ((p) = (lst); CONS_P(p); (p) = CDR(p))
+
+struct PatternVariable {
+    SCM symbol;
+    int depth;    /* number of ellipses around the variable */
+};
+
+struct SyntaxRulesCompiler {
+    SCM literals;
+    struct PatternVariable variables[SYNTAX_RULES_MAX_VARIABLES];
+    int count;
+    SCM renames;  /* placeholders of the variables bound by the template */
+};
+
+static SCM symbol_ellipsis, symbol_underscore;
+static SCM symbol_lambda, symbol_setq, symbol_cond, symbol_let, symbol_let_star, symbol_letrec, symbol_do;
+SCM _scm_symbol_syntax_rules;
+
+static int syntax_memq_p(SCM symbol, SCM lst)
+{
+    SCM kar;
+    FOR_EACH(lst, kar) {
+        if (EQ_P(kar, symbol))
+            return TRUE;
+    }
+    return FALSE;
+}
+
+static int ellipsis_follows_p(SCM lst)
+{
+    return CONS_P(CDR(lst)) && EQ_P(CADR(lst), symbol_ellipsis);
+}
+
+static struct PatternVariable *pattern_variable(struct SyntaxRulesCompiler *c, SCM symbol, int *slot)
+{
+    int i;
+    for (i = 0; i < c->count; i++) {
+        if (EQ_P(c->variables[i].symbol, symbol)) {
+            *slot = i;
+            return &c->variables[i];
+        }
+    }
+    return NULL;
+}
+
+/* (n1 n2 ...) に node を追加した list を返す */
+static SCM append_node(SCM lst, SCM node)
+{
+    SCM last = new_cons(node, SCM_NULL);
+    SCM p;
+    if (NULL_P(lst))
+        return last;
+    for (p = lst; CONS_P(CDR(p)); p = CDR(p))
+        ;
+    SET_CDR(p, last);
+    return lst;
+}
+
+/* == Pattern == */
+static SCM compile_pattern(struct SyntaxRulesCompiler *c, SCM pattern, int depth);
+
+static SCM compile_list_pattern(struct SyntaxRulesCompiler *c, SCM pattern, int depth)
+{
+    SCM heads = SCM_NULL, tails = SCM_NULL;
+    SCM ellipsis = SCM_FALSE, slots = SCM_NULL;
+    SCM rest = SCM_NULL;
+    SCM p = pattern;
+    int i, first;
+
+    while (CONS_P(p)) {
+        if (ellipsis_follows_p(p)) {
+            if (! FALSE_P(ellipsis))
+                scheme_error("syntax-rules: two ellipses in a list pattern");
+            first = c->count;
+            ellipsis = compile_pattern(c, CAR(p), depth + 1);
+            for (i = c->count - 1; i >= first; i--)
+                slots = new_cons(MAKE_FIXNUM(i), slots);
+            p = CDDR(p);
+            continue;
+        }
+        if (FALSE_P(ellipsis)) {
+            heads = append_node(heads, compile_pattern(c, CAR(p), depth));
+        } else {
+            tails = append_node(tails, compile_pattern(c, CAR(p), depth));
+        }
+        p = CDR(p);
+    }
+    if (! NULL_P(p))
+        rest = compile_pattern(c, p, depth);
+    return SYNTAX_NODE(SYNTAX_NODE_LIST,
+                       new_cons(heads,
+                                new_cons(ellipsis,
+                                         new_cons(slots,
+                                                  new_cons(tails,
+                                                           new_cons(rest, SCM_NULL))))));
+}
+
+static SCM compile_pattern(struct SyntaxRulesCompiler *c, SCM pattern, int depth)
+{
+    int slot;
+    if (SYMBOL_P(pattern)) {
+        if (EQ_P(pattern, symbol_ellipsis))
+            scheme_error("syntax-rules: misplaced ellipsis");
+        if (EQ_P(pattern, symbol_underscore))
+            return SYNTAX_NODE(SYNTAX_NODE_ANY, MAKE_FIXNUM(-1));
+        if (syntax_memq_p(pattern, c->literals))
+            return SYNTAX_NODE(SYNTAX_NODE_LITERAL, pattern);
+        if (pattern_variable(c, pattern, &slot) != NULL)
+            scheme_error("syntax-rules: duplicate pattern variable");
+        if (c->count == SYNTAX_RULES_MAX_VARIABLES)
+            scheme_error("syntax-rules: too many pattern variables");
+        c->variables[c->count].symbol = pattern;
+        c->variables[c->count].depth = depth;
+        return SYNTAX_NODE(SYNTAX_NODE_ANY, MAKE_FIXNUM(c->count++));
+    }
+    if (CONS_P(pattern))
+        return compile_list_pattern(c, pattern, depth);
+    return SYNTAX_NODE(SYNTAX_NODE_DATUM, pattern);
+}
+
+/* == Hygiene == */
+/*
+ * テンプレートのlambda, let, let*, letrec, named let, doが束縛する変数は
+ * (パターン変数でなければ) その有効範囲の中でplaceholderのsymbolに置き換え、
+ * 展開の度に新しいsymbolにする。
+ *   (let ((tmp a)) (set! a b) (set! b tmp))  ; tmpは利用者のtmpとぶつからない
+ */
+static SCM hygiene_rename(struct SyntaxRulesCompiler *c, SCM template, SCM env);
+
+static SCM hygiene_lookup(SCM symbol, SCM env)
+{
+    for (; CONS_P(env); env = CDR(env)) {
+        if (EQ_P(CAAR(env), symbol))
+            return CDAR(env);
+    }
+    return NULL;
+}
+
+/* テンプレートが持ち込んだsymbolがkeywordを指しているか */
+static int hygiene_keyword_p(struct SyntaxRulesCompiler *c, SCM head, SCM env, SCM keyword)
+{
+    int slot;
+    return EQ_P(head, keyword) && pattern_variable(c, head, &slot) == NULL &&
+        hygiene_lookup(head, env) == NULL;
+}
+
+/* 束縛する変数をplaceholderにして*envに加える */
+static SCM hygiene_bind(struct SyntaxRulesCompiler *c, SCM symbol, SCM *env)
+{
+    SCM placeholder;
+    int slot;
+    if (! SYMBOL_P(symbol) || EQ_P(symbol, symbol_ellipsis) ||
+        pattern_variable(c, symbol, &slot) != NULL)
+        return symbol;
+    placeholder = new_symbol_bytes(SYMBOL_NAME(symbol), SYMBOL_LENGTH(symbol), SCM_UNBOUND);
+    c->renames = new_cons(placeholder, c->renames);
+    *env = new_cons(new_cons(symbol, placeholder), *env);
+    return placeholder;
+}
+
+/* lambdaの(v ... . rest) */
+static SCM hygiene_bind_list(struct SyntaxRulesCompiler *c, SCM vars, SCM *env)
+{
+    SCM var;
+    if (! CONS_P(vars))
+        return hygiene_bind(c, vars, env);
+    var = hygiene_bind(c, CAR(vars), env);
+    return new_cons(var, hygiene_bind_list(c, CDR(vars), env));
+}
+
+static SCM hygiene_map(struct SyntaxRulesCompiler *c, SCM lst, SCM env)
+{
+    SCM kar;
+    if (! CONS_P(lst))
+        return hygiene_rename(c, lst, env);
+    kar = hygiene_rename(c, CAR(lst), env);
+    return new_cons(kar, hygiene_map(c, CDR(lst), env));
+}
+
+/**
+ * let, let*, letrec, doの((v init [step]) ...)
+ * 変数は*innerに加える. initはletrecなら*inner、let*ならそれまでの変数、
+ * 他は外側のenvで見る. doのstepは*innerで見る
+ */
+static SCM hygiene_bindings(struct SyntaxRulesCompiler *c, SCM keyword, SCM bindings,
+                            SCM env, SCM *inner)
+{
+    SCM result = SCM_NULL;
+    SCM p, binding, init;
+    int sequential = EQ_P(keyword, symbol_let_star);
+
+    if (! sequential) {
+        SYNTAX_FOR_EACH(bindings, p) {
+            if (CONS_P(CAR(p)))
+                hygiene_bind(c, CAAR(p), inner);
+        }
+    }
+    SYNTAX_FOR_EACH(bindings, p) {
+        binding = CAR(p);
+        if (! CONS_P(binding) || ! CONS_P(CDR(binding))) {
+            result = new_cons(hygiene_rename(c, binding, *inner), result);
+            continue;
+        }
+        if (sequential) {
+            init = hygiene_rename(c, CADR(binding), *inner);
+            hygiene_bind(c, CAR(binding), inner);
+        } else {
+            init = hygiene_rename(c, CADR(binding), EQ_P(keyword, symbol_letrec) ? *inner : env);
+        }
+        result = new_cons(new_cons(hygiene_rename(c, CAR(binding), *inner),
+                                   new_cons(init, hygiene_map(c, CDDR(binding), *inner))),
+                          result);
+    }
+    return list_reverse(result);
+}
+
+/* envは(symbol . placeholder)のalist */
+static SCM hygiene_rename(struct SyntaxRulesCompiler *c, SCM template, SCM env)
+{
+    SCM head, rest, bindings, name;
+    SCM inner = env;
+
+    if (SYMBOL_P(template)) {
+        SCM placeholder = hygiene_lookup(template, env);
+        return placeholder != NULL ? placeholder : template;
+    }
+    if (! CONS_P(template))
+        return template;
+    head = CAR(template);
+    rest = CDR(template);
+    if (hygiene_keyword_p(c, head, env, SCM_SYMBOL_QUOTE))
+        return template;
+    if (hygiene_keyword_p(c, head, env, symbol_lambda) && CONS_P(rest)) {
+        bindings = hygiene_bind_list(c, CAR(rest), &inner);
+        return new_cons(head, new_cons(bindings, hygiene_map(c, CDR(rest), inner)));
+    }
+    if (hygiene_keyword_p(c, head, env, symbol_let) && CONS_P(rest) &&
+        SYMBOL_P(CAR(rest)) && CONS_P(CDR(rest)) && list_length(CADR(rest)) >= 0) {
+        /* named let: 名前はbodyの中だけ */
+        bindings = hygiene_bindings(c, head, CADR(rest), env, &inner);
+        name = hygiene_bind(c, CAR(rest), &inner);
+        return new_cons(head, new_cons(name, new_cons(bindings, hygiene_map(c, CDDR(rest), inner))));
+    }
+    if ((hygiene_keyword_p(c, head, env, symbol_let) ||
+         hygiene_keyword_p(c, head, env, symbol_let_star) ||
+         hygiene_keyword_p(c, head, env, symbol_letrec) ||
+         hygiene_keyword_p(c, head, env, symbol_do)) &&
+        CONS_P(rest) && list_length(CAR(rest)) >= 0) {
+        bindings = hygiene_bindings(c, head, CAR(rest), env, &inner);
+        return new_cons(head, new_cons(bindings, hygiene_map(c, CDR(rest), inner)));
+    }
+    return hygiene_map(c, template, env);
+}
+
+/* == Template == */
+/* templateの中でdepthより深いellipsisを持つ変数のslot */
+static SCM ellipsis_slots(struct SyntaxRulesCompiler *c, SCM template, int depth, SCM slots)
+{
+    struct PatternVariable *variable;
+    SCM p;
+    int slot;
+    while (CONS_P(template)) {
+        slots = ellipsis_slots(c, CAR(template), depth, slots);
+        template = CDR(template);
+    }
+    if (SYMBOL_P(template) &&
+        (variable = pattern_variable(c, template, &slot)) != NULL &&
+        variable->depth > depth) {
+        SYNTAX_FOR_EACH(slots, p) {
+            if (FIXNUM_VALUE(CAR(p)) == slot)
+                return slots;
+        }
+        slots = new_cons(MAKE_FIXNUM(slot), slots);
+    }
+    return slots;
+}
+
+static SCM compile_template(struct SyntaxRulesCompiler *c, SCM template, int depth)
+{
+    struct PatternVariable *variable;
+    int slot;
+
+    if (SYMBOL_P(template)) {
+        if (syntax_memq_p(template, c->renames))
+            return SYNTAX_NODE(SYNTAX_NODE_RENAME, template);
+        if ((variable = pattern_variable(c, template, &slot)) == NULL)
+            return SYNTAX_NODE(SYNTAX_NODE_DATUM, template);
+        if (variable->depth > depth)
+            scheme_error("syntax-rules: pattern variable used without ellipsis");
+        return SYNTAX_NODE(SYNTAX_NODE_REF, MAKE_FIXNUM(slot));
+    }
+    if (! CONS_P(template))
+        return SYNTAX_NODE(SYNTAX_NODE_DATUM, template);
+
+    if (ellipsis_follows_p(template)) {
+        SCM slots = ellipsis_slots(c, CAR(template), depth, SCM_NULL);
+        SCM sub, rest;
+        if (NULL_P(slots))
+            scheme_error("syntax-rules: no pattern variable before ellipsis");
+        if (ellipsis_follows_p(CDR(template)))
+            scheme_error("syntax-rules: consecutive ellipses are not supported");
+        sub = compile_template(c, CAR(template), depth + 1);
+        rest = compile_template(c, CDDR(template), depth);
+        return SYNTAX_NODE(SYNTAX_NODE_ELLIPSIS, new_cons(sub, new_cons(slots, rest)));
+    }
+    return SYNTAX_NODE(SYNTAX_NODE_CONS,
+                       new_cons(compile_template(c, CAR(template), depth),
+                                compile_template(c, CDR(template), depth)));
+}
+
+/* == Rules == */
+static int list_count(SCM lst)
+{
+    int count = 0;
+    for (; CONS_P(lst); lst = CDR(lst))
+        count++;
+    return count;
+}
+
+/* 引数の数: fixed個ちょうど、variadicならfixed個以上 */
+static void matcher_shape(SCM matcher, int *fixed, int *variadic)
+{
+    SCM body = SYNTAX_NODE_BODY(matcher);
+    *fixed = 0;
+    *variadic = FALSE;
+    switch (SYNTAX_NODE_TYPE(matcher)) {
+    case SYNTAX_NODE_ANY:
+        *variadic = TRUE;
+        return;
+    case SYNTAX_NODE_LIST:
+        *fixed = list_count(CAR(body)) + list_count(CAR(CDDDR(body)));
+        *variadic = ! FALSE_P(CADR(body)) || ! NULL_P(CADR(CDDDR(body)));
+        return;
+    default:
+        /* () */
+        return;
+    }
+}
+
+/**
+ * syntax-rulesの(<literals> <rule> ...)をrulesに変換する
+ */
+SCM compile_syntax_rules(SCM spec)
+{
+    struct SyntaxRulesCompiler c;
+    SCM compiled = SCM_NULL;
+    SCM dispatch = SCM_NULL, variadic_rules = SCM_NULL;
+    SCM p;
+    int max_fixed = -1, fixed, variadic, n;
+
+    if (! CONS_P(spec))
+        scheme_error("syntax-rules: syntax error");
+    c.literals = CAR(spec);
+    SYNTAX_FOR_EACH(CDR(spec), p) {
+        SCM rule = CAR(p);
+        SCM matcher, template;
+        if (! LIST_2_P(rule) || ! CONS_P(CAR(rule)))
+            scheme_error("syntax-rules: syntax error");
+        /* the keyword position of the pattern is ignored */
+        c.count = 0;
+        c.renames = SCM_NULL;
+        matcher = compile_pattern(&c, CDAR(rule), 0);
+        template = hygiene_rename(&c, CADR(rule), SCM_NULL);
+        compiled = append_node(compiled, new_cons(matcher, compile_template(&c, template, 0)));
+        matcher_shape(matcher, &fixed, &variadic);
+        if (fixed > max_fixed)
+            max_fixed = fixed;
+    }
+
+    /* decision on the number of operands */
+    for (n = max_fixed; n >= 0; n--) {
+        SCM candidates = SCM_NULL;
+        SYNTAX_FOR_EACH(compiled, p) {
+            matcher_shape(CAAR(p), &fixed, &variadic);
+            if (fixed == n || (variadic && fixed <= n))
+                candidates = append_node(candidates, CAR(p));
+        }
+        dispatch = new_cons(candidates, dispatch);
+    }
+    SYNTAX_FOR_EACH(compiled, p) {
+        matcher_shape(CAAR(p), &fixed, &variadic);
+        if (variadic)
+            variadic_rules = append_node(variadic_rules, CAR(p));
+    }
+    return new_cons(dispatch, variadic_rules);
+}
+
+/* == Match == */
+static int datum_equal_p(SCM a, SCM b)
+{
+    if (EQ_P(a, b))
+        return TRUE;
+    if (FLONUM_P(a) && FLONUM_P(b))
+        return FLONUM_VALUE(a) == FLONUM_VALUE(b);
+    return INTEGER_P(a) && INTEGER_P(b) && integer_compare(a, b) == 0;
+}
+
+static int match_pattern(SCM matcher, SCM input, SCM *slots)
+{
+    SCM body = SYNTAX_NODE_BODY(matcher);
+    switch (SYNTAX_NODE_TYPE(matcher)) {
+    case SYNTAX_NODE_ANY:
+        if (FIXNUM_VALUE(body) >= 0)
+            slots[FIXNUM_VALUE(body)] = input;
+        return TRUE;
+    case SYNTAX_NODE_LITERAL:
+        return EQ_P(input, body);
+    case SYNTAX_NODE_DATUM:
+        return datum_equal_p(input, body);
+    case SYNTAX_NODE_LIST: {
+        SCM heads = CAR(body), ellipsis = CADR(body), ellipsis_slots = CADDR(body);
+        SCM tails = CAR(CDDDR(body)), rest = CADR(CDDDR(body));
+        SCM p, q;
+        SYNTAX_FOR_EACH(heads, p) {
+            if (! CONS_P(input) || ! match_pattern(CAR(p), CAR(input), slots))
+                return FALSE;
+            input = CDR(input);
+        }
+        if (! FALSE_P(ellipsis)) {
+            SCM acc[SYNTAX_RULES_MAX_VARIABLES];
+            int count = list_count(input) - list_count(tails);
+            if (count < 0)
+                return FALSE;
+            SYNTAX_FOR_EACH(ellipsis_slots, p) {
+                acc[FIXNUM_VALUE(CAR(p))] = SCM_NULL;
+            }
+            for (; count > 0; count--) {
+                if (! match_pattern(ellipsis, CAR(input), slots))
+                    return FALSE;
+                SYNTAX_FOR_EACH(ellipsis_slots, p) {
+                    int slot = FIXNUM_VALUE(CAR(p));
+                    acc[slot] = new_cons(slots[slot], acc[slot]);
+                }
+                input = CDR(input);
+            }
+            SYNTAX_FOR_EACH(ellipsis_slots, p) {
+                int slot = FIXNUM_VALUE(CAR(p));
+                SCM reversed = SCM_NULL;
+                SYNTAX_FOR_EACH(acc[slot], q) {
+                    reversed = new_cons(CAR(q), reversed);
+                }
+                slots[slot] = reversed;
+            }
+        }
+        SYNTAX_FOR_EACH(tails, p) {
+            if (! CONS_P(input) || ! match_pattern(CAR(p), CAR(input), slots))
+                return FALSE;
+            input = CDR(input);
+        }
+        if (NULL_P(rest))
+            return NULL_P(input);
+        return match_pattern(rest, input, slots);
+    }
+    }
+    return FALSE;
+}
+
+/* == Instantiate == */
+/* renamesはこの展開で作ったsymbolの(placeholder . symbol) */
+static SCM instantiate_template(SCM template, SCM *slots, SCM *renames)
+{
+    SCM body = SYNTAX_NODE_BODY(template);
+    switch (SYNTAX_NODE_TYPE(template)) {
+    case SYNTAX_NODE_DATUM:
+        return body;
+    case SYNTAX_NODE_REF:
+        return slots[FIXNUM_VALUE(body)];
+    case SYNTAX_NODE_RENAME: {
+        SCM symbol = hygiene_lookup(body, *renames);
+        if (symbol == NULL) {
+            symbol = new_symbol_bytes(SYMBOL_NAME(body), SYMBOL_LENGTH(body), SCM_UNBOUND);
+            *renames = new_cons(new_cons(body, symbol), *renames);
+        }
+        return symbol;
+    }
+    case SYNTAX_NODE_CONS:
+        return new_cons(instantiate_template(CAR(body), slots, renames),
+                        instantiate_template(CDR(body), slots, renames));
+    case SYNTAX_NODE_ELLIPSIS: {
+        SCM sub = CAR(body), ellipsis_slots = CADR(body), rest = CDDR(body);
+        SCM saved[SYNTAX_RULES_MAX_VARIABLES];
+        SCM iter[SYNTAX_RULES_MAX_VARIABLES];
+        SCM result = SCM_NULL, last = SCM_NULL;
+        SCM p;
+        int count = -1;
+        SYNTAX_FOR_EACH(ellipsis_slots, p) {
+            int slot = FIXNUM_VALUE(CAR(p));
+            int length = list_count(slots[slot]);
+            if (count >= 0 && count != length)
+                scheme_error("syntax-rules: ellipsis length mismatch");
+            count = length;
+            saved[slot] = iter[slot] = slots[slot];
+        }
+        for (; count > 0; count--) {
+            SCM cell;
+            SYNTAX_FOR_EACH(ellipsis_slots, p) {
+                int slot = FIXNUM_VALUE(CAR(p));
+                slots[slot] = CAR(iter[slot]);
+                iter[slot] = CDR(iter[slot]);
+            }
+            cell = new_cons(instantiate_template(sub, slots, renames), SCM_NULL);
+            if (NULL_P(result)) {
+                result = cell;
+            } else {
+                SET_CDR(last, cell);
+            }
+            last = cell;
+        }
+        SYNTAX_FOR_EACH(ellipsis_slots, p) {
+            int slot = FIXNUM_VALUE(CAR(p));
+            slots[slot] = saved[slot];
+        }
+        rest = instantiate_template(rest, slots, renames);
+        if (NULL_P(result))
+            return rest;
+        SET_CDR(last, rest);
+        return result;
+    }
+    }
+    scheme_error("syntax-rules: broken template");
+    return SCM_NULL;
+}
+
+/**
+ * operandsに一致する最初のruleのテンプレートを展開する
+ */
+SCM syntax_rules_expand(SCM rules, SCM operands)
+{
+    SCM slots[SYNTAX_RULES_MAX_VARIABLES];
+    SCM candidates = CDR(rules);
+    SCM renames = SCM_NULL;
+    SCM dispatch, p;
+    int count = list_count(operands);
+
+    for (dispatch = CAR(rules); CONS_P(dispatch); dispatch = CDR(dispatch), count--) {
+        if (count == 0) {
+            candidates = CAR(dispatch);
+            break;
+        }
+    }
+    SYNTAX_FOR_EACH(candidates, p) {
+        if (match_pattern(CAAR(p), operands, slots))
+            return instantiate_template(CDAR(p), slots, &renames);
+    }
+    scheme_error("no matching syntax rule");
+    return SCM_NULL;
+}
+
+/* (define-syntax <keyword> (syntax-rules ...)) */
+DEFINE_PRIMITIVE("define-syntax", define_syntax, (SCM sexp, struct EvalState *state), special_form)
+{
+    SCM keyword = CAR(sexp);
+    SCM spec;
+    SCM macro;
+    if (! SYMBOL_P(keyword) || ! LIST_2_P(sexp))
+        scheme_error("syntax error");
+    spec = CADR(sexp);
+    if (! CONS_P(spec) || ! EQ_P(CAR(spec), SCM_SYMBOL_SYNTAX_RULES))
+        scheme_error("define-syntax: syntax-rules expected");
+    if (ENV_STACK_P(state->env)) {
+        state->env = env_stack_promote(state->env);
+    }
+    macro = new_macro(SCM_NULL, state->env);
+    MACRO_RULES(macro) = compile_syntax_rules(CDR(spec));
+    optimize_invalidate(keyword);
+    SYMBOL_VCELL(keyword) = macro;
+    return macro;
+}
+
+/*==================================================
+  Derived Expressions
+==================================================*/
+/*
+ * let, let*, letrec, named let, doはlambdaとcondの式に書き換える。
+ * expandが評価の前に置き換えるので、optimizerはlambdaとして最適化する
+ * (escape analysisで環境はenv stackに取られ、末尾の自己呼び出しは
+ * 同じ場所にframeを作り直すだけになる)。
+ * 評価時に現れた式(実行時のマクロ展開など)は評価の度に書き換える。
+ */
+#define DERIVED_LIST2(a, b)    new_cons((a), new_cons((b), SCM_NULL))
+#define DERIVED_LIST3(a, b, c) new_cons((a), DERIVED_LIST2((b), (c)))
+
+/* revを逆順にしてtailの前に繋ぐ */
+static SCM append_reverse(SCM rev, SCM tail)
+{
+    for (; CONS_P(rev); rev = CDR(rev)) {
+        tail = new_cons(CAR(rev), tail);
+    }
+    return tail;
+}
+
+/* ((v e) ...) の変数とinitのlistを作る. stepsがNULLでなければdoの(v e step) */
+static void split_bindings(char *name, SCM bindings, SCM *vars, SCM *inits, SCM *steps)
+{
+    SCM v = SCM_NULL, e = SCM_NULL, s = SCM_NULL;
+    SCM p;
+    for (p = bindings; CONS_P(p); p = CDR(p)) {
+        SCM binding = CAR(p);
+        if (! CONS_P(binding) || ! SYMBOL_P(CAR(binding)) ||
+            ! (LIST_2_P(binding) || (steps != NULL && LIST_3_P(binding)))) {
+            char message[64];
+            snprintf(message, sizeof(message), "%s: bad binding", name);
+            scheme_error(message);
+        }
+        v = new_cons(CAR(binding), v);
+        e = new_cons(CADR(binding), e);
+        if (steps != NULL) {
+            s = new_cons(LIST_3_P(binding) ? CADDR(binding) : CAR(binding), s);
+        }
+    }
+    *vars = list_reverse(v);
+    *inits = list_reverse(e);
+    if (steps != NULL) {
+        *steps = list_reverse(s);
+    }
+}
+
+/* (letrec ((v e) ...) body ...) => ((lambda (v ...) (set! v e) ... body ...) #undefined ...) */
+static SCM expand_letrec(SCM sexp)
+{
+    SCM vars, inits, v, e;
+    SCM body = SCM_NULL, undefined = SCM_NULL;
+    if (! CONS_P(sexp))
+        scheme_error("letrec: syntax error");
+    split_bindings("letrec", CAR(sexp), &vars, &inits, NULL);
+    for (v = vars, e = inits; CONS_P(v); v = CDR(v), e = CDR(e)) {
+        body = new_cons(DERIVED_LIST3(symbol_setq, CAR(v), CAR(e)), body);
+        undefined = new_cons(SCM_UNDEFINED, undefined);
+    }
+    body = append_reverse(body, CDR(sexp));
+    return new_cons(new_cons(symbol_lambda, new_cons(vars, body)), undefined);
+}
+
+/**
+ * (let ((v e) ...) body ...)      => ((lambda (v ...) body ...) e ...)
+ * (let name ((v e) ...) body ...) => ((letrec ((name (lambda (v ...) body ...))) name) e ...)
+ */
+static SCM expand_let(SCM sexp)
+{
+    SCM vars, inits;
+    if (! CONS_P(sexp))
+        scheme_error("let: syntax error");
+    if (SYMBOL_P(CAR(sexp))) {
+        SCM name = CAR(sexp);
+        SCM lambda;
+        if (! CONS_P(CDR(sexp)))
+            scheme_error("let: syntax error");
+        split_bindings("let", CADR(sexp), &vars, &inits, NULL);
+        lambda = new_cons(symbol_lambda, new_cons(vars, CDDR(sexp)));
+        return new_cons(DERIVED_LIST3(symbol_letrec,
+                                      new_cons(DERIVED_LIST2(name, lambda), SCM_NULL),
+                                      name),
+                        inits);
+    }
+    split_bindings("let", CAR(sexp), &vars, &inits, NULL);
+    return new_cons(new_cons(symbol_lambda, new_cons(vars, CDR(sexp))), inits);
+}
+
+/* (let* (b1 b2 ...) body ...) => (let (b1) (let* (b2 ...) body ...)) */
+static SCM expand_let_star(SCM sexp)
+{
+    SCM bindings;
+    if (! CONS_P(sexp))
+        scheme_error("let*: syntax error");
+    bindings = CAR(sexp);
+    if (! CONS_P(bindings) || NULL_P(CDR(bindings)))
+        return new_cons(symbol_let, sexp);
+    return DERIVED_LIST3(symbol_let, new_cons(CAR(bindings), SCM_NULL),
+                         new_cons(symbol_let_star, new_cons(CDR(bindings), CDR(sexp))));
+}
+
+/**
+ * (do ((v init step) ...) (test expr ...) command ...)
+ * => (let <loop> ((v init) ...)
+ *      (cond (test expr ...) (else command ... (<loop> step ...))))
+ * <loop>はinternしないsymbolなので利用者の変数とぶつからない
+ */
+static SCM expand_do(SCM sexp)
+{
+    SCM vars, inits, steps, v, e;
+    SCM loop, bindings = SCM_NULL, body;
+    if (list_length(sexp) < 2 || ! CONS_P(CADR(sexp)))
+        scheme_error("do: syntax error");
+    split_bindings("do", CAR(sexp), &vars, &inits, &steps);
+    for (v = vars, e = inits; CONS_P(v); v = CDR(v), e = CDR(e)) {
+        bindings = new_cons(DERIVED_LIST2(CAR(v), CAR(e)), bindings);
+    }
+    loop = new_symbol("do-loop", SCM_UNBOUND);
+    body = append_reverse(list_reverse(CDDR(sexp)),
+                         new_cons(new_cons(loop, steps), SCM_NULL));
+    body = DERIVED_LIST3(symbol_cond, CADR(sexp), new_cons(SCM_SYMBOL_ELSE, body));
+    return new_cons(symbol_let, DERIVED_LIST3(loop, list_reverse(bindings), body));
+}
+
+/**
+ * syntaxがderived expressionのspecial formならoperandsを書き換えた式を返す
+ * そうでなければNULL
+ */
+SCM derived_syntax_expand(SCM syntax, SCM operands)
+{
+    if (EQ_P(syntax, &Scheme_data_p_let))
+        return expand_let(operands);
+    if (EQ_P(syntax, &Scheme_data_p_let_star))
+        return expand_let_star(operands);
+    if (EQ_P(syntax, &Scheme_data_p_letrec))
+        return expand_letrec(operands);
+    if (EQ_P(syntax, &Scheme_data_p_do))
+        return expand_do(operands);
+    return NULL;
+}
+
+DEFINE_PRIMITIVE("let", let, (SCM sexp, struct EvalState *state), special_form)
+{
+    state->status = EVAL_STATUS_NEED_EVAL;
+    return expand_let(sexp);
+}
+DEFINE_PRIMITIVE("let*", let_star, (SCM sexp, struct EvalState *state), special_form)
+{
+    state->status = EVAL_STATUS_NEED_EVAL;
+    return expand_let_star(sexp);
+}
+DEFINE_PRIMITIVE("letrec", letrec, (SCM sexp, struct EvalState *state), special_form)
+{
+    state->status = EVAL_STATUS_NEED_EVAL;
+    return expand_letrec(sexp);
+}
+DEFINE_PRIMITIVE("do", do, (SCM sexp, struct EvalState *state), special_form)
+{
+    state->status = EVAL_STATUS_NEED_EVAL;
+    return expand_do(sexp);
+}
+
+void symbols_of_syntax_initialize(void)
+{
+    symbol_ellipsis = intern("...");
+    symbol_underscore = intern("_");
+    _scm_symbol_syntax_rules = intern("syntax-rules");
+    scm_gc_protect(symbol_ellipsis);
+    scm_gc_protect(symbol_underscore);
+    scm_gc_protect(_scm_symbol_syntax_rules);
+    ADD_PRIMITIVE("define-syntax", define_syntax, (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+
+    symbol_lambda = intern("lambda");
+    symbol_setq = intern("set!");
+    symbol_cond = intern("cond");
+    symbol_let = intern("let");
+    symbol_let_star = intern("let*");
+    symbol_letrec = intern("letrec");
+    symbol_do = intern("do");
+    scm_gc_protect(symbol_lambda);
+    scm_gc_protect(symbol_setq);
+    scm_gc_protect(symbol_cond);
+    scm_gc_protect(symbol_let);
+    scm_gc_protect(symbol_let_star);
+    scm_gc_protect(symbol_letrec);
+    scm_gc_protect(symbol_do);
+    ADD_PRIMITIVE("let",    let,      (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+    ADD_PRIMITIVE("let*",   let_star, (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+    ADD_PRIMITIVE("letrec", letrec,   (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+    ADD_PRIMITIVE("do",     do,       (SCM sexp, struct EvalState *state), SPECIAL_FORM);
+}
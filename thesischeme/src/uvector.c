@@ -0,0 +1,464 @@
+/*===========================================================================
+ * uvector.c - homogeneous numeric vector (SRFI-4)
+ *
+ * $Id$
+===========================================================================*/
+
+#include <limits.h>
+
+#include "scheme.h"
+
+/* u8vector, s32vector, s64vector, f64vector.
+ * 要素は数のcellではなくCの配列に置き、GCは中を見ない。
+ * 一括演算 (uvector-add, uvector-dot など) はsimd.cのkernelで回す
+ */
+
+/*==================================================
+  Element
+==================================================*/
+static char *uvector_tags[] = { "u8", "s32", "s64", "f64" };
+#define UVECTOR_TYPE_COUNT ((int) (sizeof(uvector_tags) / sizeof(uvector_tags[0])))
+
+/* "u8"などの型の名前. 知らない名前なら-1 */
+int uvector_tag_type(char *tag)
+{
+    int i;
+    for (i = 0; i < UVECTOR_TYPE_COUNT; i++) {
+        if (strcmp(tag, uvector_tags[i]) == 0)
+            return i;
+    }
+    return -1;
+}
+
+static SCM uvector_check(SCM o, enum UvectorType type, char *name)
+{
+    char message[64];
+    if (! UVECTOR_P(o) || UVECTOR_TYPE(o) != type) {
+        snprintf(message, sizeof(message), "%s: %svector required", name, uvector_tags[type]);
+        scheme_error(message);
+    }
+    return o;
+}
+
+static SCM any_uvector_check(SCM o, char *name)
+{
+    char message[64];
+    if (! UVECTOR_P(o)) {
+        snprintf(message, sizeof(message), "%s: uvector required", name);
+        scheme_error(message);
+    }
+    return o;
+}
+
+static int index_check(SCM uvector, SCM k, char *name)
+{
+    char message[64];
+    if (! FIXNUM_P(k) || FIXNUM_VALUE(k) < 0 ||
+        FIXNUM_VALUE(k) >= UVECTOR_LENGTH(uvector)) {
+        snprintf(message, sizeof(message), "%s: index out of range", name);
+        scheme_error(message);
+    }
+    return (int) FIXNUM_VALUE(k);
+}
+
+static SCM uvector_ref(SCM uvector, int i)
+{
+    switch (UVECTOR_TYPE(uvector)) {
+    case UVECTOR_U8:  return MAKE_FIXNUM(UVECTOR_U8(uvector)[i]);
+    case UVECTOR_S32: return MAKE_FIXNUM(UVECTOR_S32(uvector)[i]);
+    case UVECTOR_S64: return new_integer((intptr_t) UVECTOR_S64(uvector)[i]);
+    case UVECTOR_F64: return new_flonum(UVECTOR_F64(uvector)[i]);
+    }
+    return SCM_UNDEFINED;
+}
+
+/* 要素の型に収まる数か調べて置く */
+static void uvector_set(SCM uvector, int i, SCM o, char *name)
+{
+    char message[64];
+    int64_t value;
+    switch (UVECTOR_TYPE(uvector)) {
+    case UVECTOR_U8:
+        if (! FIXNUM_P(o) || FIXNUM_VALUE(o) < 0 || FIXNUM_VALUE(o) > UINT8_MAX)
+            break;
+        UVECTOR_U8(uvector)[i] = (uint8_t) FIXNUM_VALUE(o);
+        return;
+    case UVECTOR_S32:
+        if (! FIXNUM_P(o) || FIXNUM_VALUE(o) < INT32_MIN || FIXNUM_VALUE(o) > INT32_MAX)
+            break;
+        UVECTOR_S32(uvector)[i] = (int32_t) FIXNUM_VALUE(o);
+        return;
+    case UVECTOR_S64:
+        if (! INTEGER_P(o) || ! integer_to_int64(o, &value))
+            break;
+        UVECTOR_S64(uvector)[i] = value;
+        return;
+    case UVECTOR_F64:
+        if (! NUMBER_P(o))
+            break;
+        UVECTOR_F64(uvector)[i] = number_to_double(o);
+        return;
+    }
+    snprintf(message, sizeof(message), "%s: bad %svector element",
+             name, uvector_tags[UVECTOR_TYPE(uvector)]);
+    scheme_error(message);
+}
+
+static int64_t uvector_int64_ref(SCM uvector, int i)
+{
+    switch (UVECTOR_TYPE(uvector)) {
+    case UVECTOR_U8:  return UVECTOR_U8(uvector)[i];
+    case UVECTOR_S32: return UVECTOR_S32(uvector)[i];
+    case UVECTOR_S64: return UVECTOR_S64(uvector)[i];
+    case UVECTOR_F64: break;
+    }
+    return 0;
+}
+
+SCM list_to_uvector(enum UvectorType type, SCM lst)
+{
+    SCM uvector;
+    int i, length = list_length(lst);
+    if (length < 0)
+        scheme_error("list->uvector: proper list required");
+    uvector = new_uvector(type, length);
+    for (i = 0; i < length; i++, lst = CDR(lst)) {
+        uvector_set(uvector, i, CAR(lst), "list->uvector");
+    }
+    return uvector;
+}
+
+/* #u8(1 2 3)  #f64(0.5 1.0) */
+void print_uvector(SCM uvector, FILE *file)
+{
+    int i;
+    fprintf(file, "#%s(", uvector_tags[UVECTOR_TYPE(uvector)]);
+    for (i = 0; i < UVECTOR_LENGTH(uvector); i++) {
+        if (i > 0) putc(' ', file);
+        switch (UVECTOR_TYPE(uvector)) {
+        case UVECTOR_U8:  fprintf(file, "%u", UVECTOR_U8(uvector)[i]); break;
+        case UVECTOR_S32: fprintf(file, "%d", UVECTOR_S32(uvector)[i]); break;
+        case UVECTOR_S64: fprintf(file, "%lld", (long long) UVECTOR_S64(uvector)[i]); break;
+        case UVECTOR_F64: print_double(UVECTOR_F64(uvector)[i], file); break;
+        }
+    }
+    putc(')', file);
+}
+
+/*==================================================
+  Constructor and Accessor
+==================================================*/
+/* (make-u8vector k [fill]) */
+static SCM make_uvector(enum UvectorType type, SCM l, char *name)
+{
+    char message[64];
+    SCM uvector, k;
+    int i, argc = list_length(l);
+    if (argc != 1 && argc != 2) {
+        snprintf(message, sizeof(message), "%s: wrong number of arguments", name);
+        scheme_error(message);
+    }
+    k = CAR(l);
+    if (! FIXNUM_P(k) || FIXNUM_VALUE(k) < 0 || FIXNUM_VALUE(k) > INT_MAX / 8) {
+        snprintf(message, sizeof(message), "%s: bad length", name);
+        scheme_error(message);
+    }
+    uvector = new_uvector(type, (int) FIXNUM_VALUE(k));
+    if (argc == 2) {
+        for (i = 0; i < UVECTOR_LENGTH(uvector); i++) {
+            uvector_set(uvector, i, CADR(l), name);
+        }
+    }
+    return uvector;
+}
+
+static SCM uvector_to_list(SCM uvector)
+{
+    SCM lst = SCM_NULL;
+    int i;
+    for (i = UVECTOR_LENGTH(uvector) - 1; i >= 0; i--) {
+        lst = new_cons(uvector_ref(uvector, i), lst);
+    }
+    return lst;
+}
+
+/* 型ごとの手続き: u8vector?, make-u8vector, u8vector, u8vector-length,
+ * u8vector-ref, u8vector-set!, u8vector->list, list->u8vector */
+#define DEFINE_UVECTOR_PRIMITIVES(tag, type)                                    \
+DEFINE_PRIMITIVE(#tag "vector?", tag ## vectorp, (SCM o), expr1)                \
+{                                                                               \
+    return C_TO_SCM_BOOLEAN(UVECTOR_P(o) && UVECTOR_TYPE(o) == type);           \
+}                                                                               \
+DEFINE_PRIMITIVE("make-" #tag "vector", make_ ## tag ## vector, (SCM l), list_expr) \
+{                                                                               \
+    return make_uvector(type, l, "make-" #tag "vector");                        \
+}                                                                               \
+DEFINE_PRIMITIVE(#tag "vector", tag ## vector, (SCM l), list_expr)              \
+{                                                                               \
+    return list_to_uvector(type, l);                                            \
+}                                                                               \
+DEFINE_PRIMITIVE(#tag "vector-length", tag ## vector_length, (SCM v), expr1)    \
+{                                                                               \
+    return MAKE_FIXNUM(UVECTOR_LENGTH(uvector_check(v, type, #tag "vector-length"))); \
+}                                                                               \
+DEFINE_PRIMITIVE(#tag "vector-ref", tag ## vector_ref, (SCM v, SCM k), expr2)   \
+{                                                                               \
+    uvector_check(v, type, #tag "vector-ref");                                  \
+    return uvector_ref(v, index_check(v, k, #tag "vector-ref"));                \
+}                                                                               \
+DEFINE_PRIMITIVE(#tag "vector-set!", tag ## vector_setq, (SCM v, SCM k, SCM o), expr3) \
+{                                                                               \
+    uvector_check(v, type, #tag "vector-set!");                                 \
+    uvector_set(v, index_check(v, k, #tag "vector-set!"), o, #tag "vector-set!"); \
+    return SCM_UNDEFINED;                                                       \
+}                                                                               \
+DEFINE_PRIMITIVE(#tag "vector->list", tag ## vector2list, (SCM v), expr1)       \
+{                                                                               \
+    return uvector_to_list(uvector_check(v, type, #tag "vector->list"));        \
+}                                                                               \
+DEFINE_PRIMITIVE("list->" #tag "vector", list2 ## tag ## vector, (SCM l), expr1) \
+{                                                                               \
+    return list_to_uvector(type, l);                                            \
+}
+
+DEFINE_UVECTOR_PRIMITIVES(u8,  UVECTOR_U8)
+DEFINE_UVECTOR_PRIMITIVES(s32, UVECTOR_S32)
+DEFINE_UVECTOR_PRIMITIVES(s64, UVECTOR_S64)
+DEFINE_UVECTOR_PRIMITIVES(f64, UVECTOR_F64)
+
+/*==================================================
+  Bulk Operations
+==================================================*/
+/* 二項の一括演算は同じ型で同じ長さのuvectorに限る */
+static void same_shape_check(SCM a, SCM b, char *name)
+{
+    char message[80];
+    any_uvector_check(a, name);
+    any_uvector_check(b, name);
+    if (UVECTOR_TYPE(a) != UVECTOR_TYPE(b) || UVECTOR_LENGTH(a) != UVECTOR_LENGTH(b)) {
+        snprintf(message, sizeof(message), "%s: uvectors of the same type and length required", name);
+        scheme_error(message);
+    }
+}
+
+/* dst = a + b (mul: a * b). dstはaでもよい */
+static void elementwise(SCM dst, SCM a, SCM b, int mul)
+{
+    int n = UVECTOR_LENGTH(a);
+    switch (UVECTOR_TYPE(a)) {
+    case UVECTOR_U8:
+        (mul ? simd_u8_mul : simd_u8_add)(UVECTOR_U8(dst), UVECTOR_U8(a), UVECTOR_U8(b), n);
+        break;
+    case UVECTOR_S32:
+        (mul ? simd_s32_mul : simd_s32_add)(UVECTOR_S32(dst), UVECTOR_S32(a), UVECTOR_S32(b), n);
+        break;
+    case UVECTOR_S64:
+        (mul ? simd_s64_mul : simd_s64_add)(UVECTOR_S64(dst), UVECTOR_S64(a), UVECTOR_S64(b), n);
+        break;
+    case UVECTOR_F64:
+        (mul ? simd_f64_mul : simd_f64_add)(UVECTOR_F64(dst), UVECTOR_F64(a), UVECTOR_F64(b), n);
+        break;
+    }
+}
+
+/**
+ * 整数の要素の積の和 (bがNULLなら和). 64bitで足していき、
+ * 溢れた分は整数 (bignum) で足すので結果は正確
+ */
+static SCM exact_dot(SCM a, SCM b)
+{
+    SCM total = MAKE_FIXNUM(0);
+    int64_t sum = 0, x, y, product, t;
+    int i;
+    for (i = 0; i < UVECTOR_LENGTH(a); i++) {
+        x = uvector_int64_ref(a, i);
+        y = b == NULL ? 1 : uvector_int64_ref(b, i);
+        if (__builtin_mul_overflow(x, y, &product)) {
+            total = integer_add(total, integer_mul(new_integer((intptr_t) x), new_integer((intptr_t) y)));
+        } else if (__builtin_add_overflow(sum, product, &t)) {
+            total = integer_add(total, new_integer((intptr_t) sum));
+            sum = product;
+        } else {
+            sum = t;
+        }
+    }
+    return integer_add(total, new_integer((intptr_t) sum));
+}
+
+DEFINE_PRIMITIVE("uvector-add", uvector_add, (SCM a, SCM b), expr2)
+{
+    SCM dst;
+    same_shape_check(a, b, "uvector-add");
+    dst = new_uvector(UVECTOR_TYPE(a), UVECTOR_LENGTH(a));
+    elementwise(dst, a, b, FALSE);
+    return dst;
+}
+
+DEFINE_PRIMITIVE("uvector-mul", uvector_mul, (SCM a, SCM b), expr2)
+{
+    SCM dst;
+    same_shape_check(a, b, "uvector-mul");
+    dst = new_uvector(UVECTOR_TYPE(a), UVECTOR_LENGTH(a));
+    elementwise(dst, a, b, TRUE);
+    return dst;
+}
+
+/* (uvector-add! a b): a += b */
+DEFINE_PRIMITIVE("uvector-add!", uvector_addq, (SCM a, SCM b), expr2)
+{
+    same_shape_check(a, b, "uvector-add!");
+    elementwise(a, a, b, FALSE);
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("uvector-mul!", uvector_mulq, (SCM a, SCM b), expr2)
+{
+    same_shape_check(a, b, "uvector-mul!");
+    elementwise(a, a, b, TRUE);
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("uvector-dot", uvector_dot, (SCM a, SCM b), expr2)
+{
+    same_shape_check(a, b, "uvector-dot");
+    if (UVECTOR_TYPE(a) == UVECTOR_F64)
+        return new_flonum(simd_f64_dot(UVECTOR_F64(a), UVECTOR_F64(b), UVECTOR_LENGTH(a)));
+    return exact_dot(a, b);
+}
+
+DEFINE_PRIMITIVE("uvector-sum", uvector_sum, (SCM a), expr1)
+{
+    int n = UVECTOR_LENGTH(any_uvector_check(a, "uvector-sum"));
+    switch (UVECTOR_TYPE(a)) {
+    case UVECTOR_U8:  return new_integer((intptr_t) simd_u8_sum(UVECTOR_U8(a), n));
+    case UVECTOR_S32: return new_integer((intptr_t) simd_s32_sum(UVECTOR_S32(a), n));
+    case UVECTOR_S64: return exact_dot(a, NULL);
+    case UVECTOR_F64: return new_flonum(simd_f64_sum(UVECTOR_F64(a), n));
+    }
+    return SCM_UNDEFINED;
+}
+
+static SCM extremum(SCM a, int max, char *name)
+{
+    char message[64];
+    int n = UVECTOR_LENGTH(any_uvector_check(a, name));
+    if (n == 0) {
+        snprintf(message, sizeof(message), "%s: empty uvector", name);
+        scheme_error(message);
+    }
+    switch (UVECTOR_TYPE(a)) {
+    case UVECTOR_U8:
+        return MAKE_FIXNUM((max ? simd_u8_max : simd_u8_min)(UVECTOR_U8(a), n));
+    case UVECTOR_S32:
+        return MAKE_FIXNUM((max ? simd_s32_max : simd_s32_min)(UVECTOR_S32(a), n));
+    case UVECTOR_S64:
+        return new_integer((intptr_t) (max ? simd_s64_max : simd_s64_min)(UVECTOR_S64(a), n));
+    case UVECTOR_F64:
+        return new_flonum((max ? simd_f64_max : simd_f64_min)(UVECTOR_F64(a), n));
+    }
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("uvector-min", uvector_min, (SCM a), expr1)
+{
+    return extremum(a, FALSE, "uvector-min");
+}
+
+DEFINE_PRIMITIVE("uvector-max", uvector_max, (SCM a), expr1)
+{
+    return extremum(a, TRUE, "uvector-max");
+}
+
+/* 最初の要素に置いた値を残りに写す */
+DEFINE_PRIMITIVE("uvector-fill!", uvector_fillq, (SCM a, SCM o), expr2)
+{
+    int i, n = UVECTOR_LENGTH(any_uvector_check(a, "uvector-fill!"));
+    if (n == 0)
+        return SCM_UNDEFINED;
+    uvector_set(a, 0, o, "uvector-fill!");
+    switch (UVECTOR_TYPE(a)) {
+    case UVECTOR_U8:
+        memset(UVECTOR_U8(a), UVECTOR_U8(a)[0], n);
+        break;
+    case UVECTOR_S32:
+        for (i = 1; i < n; i++) UVECTOR_S32(a)[i] = UVECTOR_S32(a)[0];
+        break;
+    case UVECTOR_S64:
+        for (i = 1; i < n; i++) UVECTOR_S64(a)[i] = UVECTOR_S64(a)[0];
+        break;
+    case UVECTOR_F64:
+        for (i = 1; i < n; i++) UVECTOR_F64(a)[i] = UVECTOR_F64(a)[0];
+        break;
+    }
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("uvector-copy", uvector_copy, (SCM a), expr1)
+{
+    SCM copy = new_uvector(UVECTOR_TYPE(any_uvector_check(a, "uvector-copy")), UVECTOR_LENGTH(a));
+    if (UVECTOR_LENGTH(a) > 0) {
+        memcpy(UVECTOR_ELEMENTS(copy), UVECTOR_ELEMENTS(a),
+               (size_t) UVECTOR_ELEMENT_SIZE(UVECTOR_TYPE(a)) * UVECTOR_LENGTH(a));
+    }
+    return copy;
+}
+
+/* (uvector-copy! dst src): srcの要素をdstの先頭に写す */
+DEFINE_PRIMITIVE("uvector-copy!", uvector_copyq, (SCM dst, SCM src), expr2)
+{
+    any_uvector_check(dst, "uvector-copy!");
+    any_uvector_check(src, "uvector-copy!");
+    if (UVECTOR_TYPE(dst) != UVECTOR_TYPE(src) || UVECTOR_LENGTH(dst) < UVECTOR_LENGTH(src))
+        scheme_error("uvector-copy!: destination too short or of another type");
+    if (UVECTOR_LENGTH(src) > 0) {
+        memmove(UVECTOR_ELEMENTS(dst), UVECTOR_ELEMENTS(src),
+                (size_t) UVECTOR_ELEMENT_SIZE(UVECTOR_TYPE(src)) * UVECTOR_LENGTH(src));
+    }
+    return SCM_UNDEFINED;
+}
+
+/* 使っているkernel: avx2, sse2, none */
+DEFINE_PRIMITIVE("simd-level", simd_level, (), expr0)
+{
+    return intern((char *) simd_level_name());
+}
+
+/*==================================================
+  Initialize
+==================================================*/
+#define ADD_UVECTOR_PRIMITIVES(tag)                                                          \
+  do {                                                                                      \
+    ADD_PRIMITIVE(#tag "vector?",        tag ## vectorp,        (SCM o),               EXPR_1);    \
+    ADD_PRIMITIVE("make-" #tag "vector", make_ ## tag ## vector, (SCM l),              LIST_EXPR); \
+    ADD_PRIMITIVE(#tag "vector",         tag ## vector,         (SCM l),               LIST_EXPR); \
+    ADD_PRIMITIVE(#tag "vector-length",  tag ## vector_length,  (SCM v),               EXPR_1);    \
+    ADD_PRIMITIVE(#tag "vector-ref",     tag ## vector_ref,     (SCM v, SCM k),        EXPR_2);    \
+    ADD_PRIMITIVE(#tag "vector-set!",    tag ## vector_setq,    (SCM v, SCM k, SCM o), EXPR_3);    \
+    ADD_PRIMITIVE(#tag "vector->list",   tag ## vector2list,    (SCM v),               EXPR_1);    \
+    ADD_PRIMITIVE("list->" #tag "vector", list2 ## tag ## vector, (SCM l),             EXPR_1);    \
+    HEADER_FLAG(&Scheme_data_p_make_ ## tag ## vector) = PRIMITIVE_FLAG_TRANSIENT;          \
+    HEADER_FLAG(&Scheme_data_p_ ## tag ## vector) = PRIMITIVE_FLAG_TRANSIENT;               \
+  } while (0)
+
+void symbols_of_uvector_initialize(void)
+{
+    simd_initialize();
+
+    ADD_UVECTOR_PRIMITIVES(u8);
+    ADD_UVECTOR_PRIMITIVES(s32);
+    ADD_UVECTOR_PRIMITIVES(s64);
+    ADD_UVECTOR_PRIMITIVES(f64);
+
+    ADD_PRIMITIVE("uvector-add",   uvector_add,   (SCM a, SCM b),     EXPR_2);
+    ADD_PRIMITIVE("uvector-mul",   uvector_mul,   (SCM a, SCM b),     EXPR_2);
+    ADD_PRIMITIVE("uvector-add!",  uvector_addq,  (SCM a, SCM b),     EXPR_2);
+    ADD_PRIMITIVE("uvector-mul!",  uvector_mulq,  (SCM a, SCM b),     EXPR_2);
+    ADD_PRIMITIVE("uvector-dot",   uvector_dot,   (SCM a, SCM b),     EXPR_2);
+    ADD_PRIMITIVE("uvector-sum",   uvector_sum,   (SCM a),            EXPR_1);
+    ADD_PRIMITIVE("uvector-min",   uvector_min,   (SCM a),            EXPR_1);
+    ADD_PRIMITIVE("uvector-max",   uvector_max,   (SCM a),            EXPR_1);
+    ADD_PRIMITIVE("uvector-fill!", uvector_fillq, (SCM a, SCM o),     EXPR_2);
+    ADD_PRIMITIVE("uvector-copy",  uvector_copy,  (SCM a),            EXPR_1);
+    ADD_PRIMITIVE("uvector-copy!", uvector_copyq, (SCM dst, SCM src), EXPR_2);
+    ADD_PRIMITIVE("simd-level",    simd_level,    (),                 EXPR_0);
+}
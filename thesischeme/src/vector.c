@@ -0,0 +1,147 @@
+/*===========================================================================
+ * vector.c - vector
+ *
+ * $Id$
+===========================================================================*/
+
+#include <limits.h>
+
+#include "scheme.h"
+
+/* vectorの要素は連続した領域に置く (new_vector). 添字で直接引ける */
+
+static SCM vector_check(SCM o, char *name)
+{
+    char message[64];
+    if (! VECTOR_P(o)) {
+        snprintf(message, sizeof(message), "%s: vector required", name);
+        scheme_error(message);
+    }
+    return o;
+}
+
+/* 整数でなければ型のerror. 0 <= k < lengthか調べてCの値を返す */
+static int index_check(SCM vector, SCM k, char *name)
+{
+    char message[64];
+    if (! INTEGER_P(k)) {
+        snprintf(message, sizeof(message), "%s: integer required", name);
+        scheme_error(message);
+    }
+    /* bignumは必ず範囲外 */
+    if (! FIXNUM_P(k) || FIXNUM_VALUE(k) < 0 || FIXNUM_VALUE(k) >= VECTOR_LENGTH(vector)) {
+        snprintf(message, sizeof(message), "%s: index out of range", name);
+        scheme_error(message);
+    }
+    return (int) FIXNUM_VALUE(k);
+}
+
+SCM list_to_vector(SCM lst)
+{
+    SCM vector;
+    int i, length = list_length(lst);
+    if (length < 0)
+        scheme_error("list->vector: proper list required");
+    vector = new_vector(length, SCM_UNDEFINED);
+    for (i = 0; i < length; i++, lst = CDR(lst)) {
+        VECTOR_REF(vector, i) = CAR(lst);
+    }
+    return vector;
+}
+
+void print_vector(SCM vector, FILE *file)
+{
+    int i;
+    fputs("#(", file);
+    for (i = 0; i < VECTOR_LENGTH(vector); i++) {
+        if (i > 0) putc(' ', file);
+        print(VECTOR_REF(vector, i), file);
+    }
+    putc(')', file);
+}
+
+/*==================================================
+  Primitives
+==================================================*/
+DEFINE_PRIMITIVE("vector?", vectorp, (SCM o), expr1)
+{
+    return C_TO_SCM_BOOLEAN(VECTOR_P(o));
+}
+
+/* (make-vector k [fill]) */
+DEFINE_PRIMITIVE("make-vector", make_vector, (SCM l), list_expr)
+{
+    int argc = list_length(l);
+    SCM k;
+    if (argc != 1 && argc != 2)
+        scheme_error("make-vector: wrong number of arguments");
+    k = CAR(l);
+    if (! FIXNUM_P(k) || FIXNUM_VALUE(k) < 0 || FIXNUM_VALUE(k) > INT_MAX / (int) sizeof(SCM))
+        scheme_error("make-vector: bad length");
+    return new_vector((int) FIXNUM_VALUE(k), argc == 2 ? CADR(l) : SCM_UNDEFINED);
+}
+
+DEFINE_PRIMITIVE("vector", vector, (SCM l), list_expr)
+{
+    return list_to_vector(l);
+}
+
+DEFINE_PRIMITIVE("vector-length", vector_length, (SCM v), expr1)
+{
+    return MAKE_FIXNUM(VECTOR_LENGTH(vector_check(v, "vector-length")));
+}
+
+DEFINE_PRIMITIVE("vector-ref", vector_ref, (SCM v, SCM k), expr2)
+{
+    vector_check(v, "vector-ref");
+    return VECTOR_REF(v, index_check(v, k, "vector-ref"));
+}
+
+DEFINE_PRIMITIVE("vector-set!", vector_setq, (SCM v, SCM k, SCM o), expr3)
+{
+    vector_check(v, "vector-set!");
+    VECTOR_REF(v, index_check(v, k, "vector-set!")) = o;
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("vector-fill!", vector_fillq, (SCM v, SCM o), expr2)
+{
+    int i;
+    vector_check(v, "vector-fill!");
+    for (i = 0; i < VECTOR_LENGTH(v); i++) {
+        VECTOR_REF(v, i) = o;
+    }
+    return SCM_UNDEFINED;
+}
+
+DEFINE_PRIMITIVE("vector->list", vector2list, (SCM v), expr1)
+{
+    SCM lst = SCM_NULL;
+    int i;
+    vector_check(v, "vector->list");
+    for (i = VECTOR_LENGTH(v) - 1; i >= 0; i--) {
+        lst = new_cons(VECTOR_REF(v, i), lst);
+    }
+    return lst;
+}
+
+DEFINE_PRIMITIVE("list->vector", list2vector, (SCM l), expr1)
+{
+    return list_to_vector(l);
+}
+
+void symbols_of_vector_initialize(void)
+{
+    ADD_PRIMITIVE("vector?",       vectorp,       (SCM o),               EXPR_1);
+    ADD_PRIMITIVE("make-vector",   make_vector,   (SCM l),               LIST_EXPR);
+    ADD_PRIMITIVE("vector",        vector,        (SCM l),               LIST_EXPR);
+    ADD_PRIMITIVE("vector-length", vector_length, (SCM v),               EXPR_1);
+    ADD_PRIMITIVE("vector-ref",    vector_ref,    (SCM v, SCM k),        EXPR_2);
+    ADD_PRIMITIVE("vector-set!",   vector_setq,   (SCM v, SCM k, SCM o), EXPR_3);
+    ADD_PRIMITIVE("vector-fill!",  vector_fillq,  (SCM v, SCM o),        EXPR_2);
+    ADD_PRIMITIVE("vector->list",  vector2list,   (SCM v),               EXPR_1);
+    ADD_PRIMITIVE("list->vector",  list2vector,   (SCM l),               EXPR_1);
+    /* 引数のlistは呼び出しの後に残らない */
+    HEADER_FLAG(&Scheme_data_p_make_vector) = PRIMITIVE_FLAG_TRANSIENT;
+    HEADER_FLAG(&Scheme_data_p_vector) = PRIMITIVE_FLAG_TRANSIENT;
+}